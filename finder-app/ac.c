@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+#include "ac.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE UINT32_MAX
+
+struct ac {
+    uint32_t nstates;
+    uint32_t first_out;     // states numbered >= first_out have outputs
+    bool dense;
+    int skip;               // first byte shared by every pattern, or -1
+
+    // dense form: delta holds row offsets (state * nclasses) of the targets
+    uint8_t cls[256];
+    uint32_t nclasses;
+    uint32_t *delta;
+
+    // compressed form: sorted trie edges per state plus failure links
+    uint32_t root[256];
+    uint32_t *fail;
+    uint32_t *eoff;
+    uint8_t *ebyte;
+    uint32_t *etgt;
+
+    // outputs: pattern ids ending at each state, and the next state on the
+    // failure chain that has outputs of its own
+    uint32_t *ooff;
+    uint32_t *oids;
+    uint32_t *dict;
+};
+
+// Trie used while building. Every node but the root has exactly one
+// incoming edge, so edges are stored on their child node.
+struct trie {
+    uint32_t *first;        // first child
+    uint32_t *sib;          // next sibling
+    uint8_t *byte;          // label of the edge into this node
+    uint32_t *plist;        // first pattern ending here
+    uint32_t *pnext;        // next pattern ending at the same node
+    uint32_t nodes;
+};
+
+static uint32_t trie_goto(const struct trie *t, uint32_t u, uint8_t b)
+{
+    for (uint32_t c = t->first[u]; c != NONE; c = t->sib[c]) {
+        if (t->byte[c] == b)
+            return c;
+    }
+    return NONE;
+}
+
+static void trie_free(struct trie *t)
+{
+    free(t->first);
+    free(t->sib);
+    free(t->byte);
+    free(t->plist);
+    free(t->pnext);
+}
+
+static int trie_build(struct trie *t, const char *const *pats,
+                      const size_t *lens, size_t n)
+{
+    size_t total = 1;
+    for (size_t i = 0; i < n; i++) {
+        total += lens[i];
+        if (total >= NONE)
+            return -1;
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->first = malloc(total * sizeof(uint32_t));
+    t->sib = malloc(total * sizeof(uint32_t));
+    t->byte = malloc(total);
+    t->plist = malloc(total * sizeof(uint32_t));
+    t->pnext = malloc(n * sizeof(uint32_t));
+    if (!t->first || !t->sib || !t->byte || !t->plist || (n && !t->pnext)) {
+        trie_free(t);
+        return -1;
+    }
+
+    t->nodes = 1;
+    t->first[0] = NONE;
+    t->plist[0] = NONE;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t u = 0;
+        for (size_t k = 0; k < lens[i]; k++) {
+            uint8_t b = (uint8_t)pats[i][k];
+            uint32_t c = trie_goto(t, u, b);
+            if (c == NONE) {
+                c = t->nodes++;
+                t->first[c] = NONE;
+                t->plist[c] = NONE;
+                t->byte[c] = b;
+                t->sib[c] = t->first[u];
+                t->first[u] = c;
+            }
+            u = c;
+        }
+        t->pnext[i] = t->plist[u];
+        t->plist[u] = (uint32_t)i;
+    }
+    return 0;
+}
+
+static int cmp_edge(const void *a, const void *b)
+{
+    return (int)((const uint8_t *)a)[0] - (int)((const uint8_t *)b)[0];
+}
+
+struct ac *ac_build(const char *const *pats, const size_t *lens,
+                    const uint32_t *ids, size_t n)
+{
+    struct trie t;
+    if (trie_build(&t, pats, lens, n) != 0)
+        return NULL;
+
+    uint32_t ns = t.nodes;
+    struct ac *ac = calloc(1, sizeof(*ac));
+    uint32_t *order = malloc(ns * sizeof(uint32_t));
+    uint32_t *fail = malloc(ns * sizeof(uint32_t));
+    uint32_t *dict = malloc(ns * sizeof(uint32_t));
+    uint32_t *newid = malloc(ns * sizeof(uint32_t));
+    if (!ac || !order || !fail || !dict || !newid)
+        goto fail;
+
+    // Breadth-first order guarantees a state's failure target is finished
+    // before the state itself.
+    uint32_t head = 0, tail = 1;
+    order[0] = 0;
+    fail[0] = 0;
+    dict[0] = NONE;
+    while (head < tail) {
+        uint32_t u = order[head++];
+        for (uint32_t c = t.first[u]; c != NONE; c = t.sib[c]) {
+            uint32_t g = NONE;
+            if (u != 0) {
+                uint32_t f = fail[u];
+                for (;;) {
+                    g = trie_goto(&t, f, t.byte[c]);
+                    if (g != NONE || f == 0)
+                        break;
+                    f = fail[f];
+                }
+            }
+            fail[c] = g == NONE ? 0 : g;
+            dict[c] = t.plist[fail[c]] != NONE ? fail[c] : dict[fail[c]];
+            order[tail++] = c;
+        }
+    }
+
+    // Renumber so every state with an output sorts after those without;
+    // the scan loop then needs a single compare per byte.
+    uint32_t next = 0;
+    for (uint32_t k = 0; k < ns; k++) {
+        uint32_t u = order[k];
+        if (t.plist[u] == NONE && dict[u] == NONE)
+            newid[u] = next++;
+    }
+    ac->first_out = next;
+    for (uint32_t k = 0; k < ns; k++) {
+        uint32_t u = order[k];
+        if (t.plist[u] != NONE || dict[u] != NONE)
+            newid[u] = next++;
+    }
+    ac->nstates = ns;
+
+    // Outputs
+    ac->ooff = calloc((size_t)ns + 1, sizeof(uint32_t));
+    ac->dict = malloc(ns * sizeof(uint32_t));
+    ac->oids = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (!ac->ooff || !ac->dict || !ac->oids)
+        goto fail;
+    for (uint32_t u = 0; u < ns; u++) {
+        for (uint32_t p = t.plist[u]; p != NONE; p = t.pnext[p])
+            ac->ooff[newid[u] + 1]++;
+        ac->dict[newid[u]] = dict[u] == NONE ? NONE : newid[dict[u]];
+    }
+    for (uint32_t s = 0; s < ns; s++)
+        ac->ooff[s + 1] += ac->ooff[s];
+    for (uint32_t u = 0; u < ns; u++) {
+        uint32_t k = ac->ooff[newid[u]];
+        for (uint32_t p = t.plist[u]; p != NONE; p = t.pnext[p])
+            ac->oids[k++] = ids[p];
+    }
+
+    // Byte classes: every byte used by a pattern gets its own class, all
+    // other bytes (including '\n') share class 0 and lead back to the root.
+    bool used[256] = { false };
+    int first_bytes = 0;
+    ac->skip = -1;
+    for (uint32_t c = t.first[0]; c != NONE; c = t.sib[c]) {
+        first_bytes++;
+        ac->skip = t.byte[c];
+    }
+    if (first_bytes != 1)
+        ac->skip = -1;
+    for (uint32_t c = 1; c < ns; c++)
+        used[t.byte[c]] = true;
+    ac->nclasses = 1;
+    for (int b = 0; b < 256; b++)
+        ac->cls[b] = used[b] ? (uint8_t)ac->nclasses++ : 0;
+
+    uint32_t nc = ac->nclasses;
+    if ((uint64_t)ns * nc * sizeof(uint32_t) <= AC_DENSE_MAX) {
+        ac->dense = true;
+        ac->delta = malloc((size_t)ns * nc * sizeof(uint32_t));
+        if (!ac->delta)
+            goto fail;
+        for (uint32_t k = 0; k < ns; k++) {
+            uint32_t u = order[k];
+            uint32_t *row = ac->delta + (size_t)newid[u] * nc;
+            if (u == 0)
+                memset(row, 0, nc * sizeof(uint32_t));
+            else
+                memcpy(row, ac->delta + (size_t)newid[fail[u]] * nc,
+                       nc * sizeof(uint32_t));
+            for (uint32_t c = t.first[u]; c != NONE; c = t.sib[c])
+                row[ac->cls[t.byte[c]]] = newid[c] * nc;
+        }
+    } else {
+        ac->fail = malloc(ns * sizeof(uint32_t));
+        ac->eoff = calloc((size_t)ns + 1, sizeof(uint32_t));
+        ac->ebyte = malloc(ns);
+        ac->etgt = malloc(ns * sizeof(uint32_t));
+        if (!ac->fail || !ac->eoff || !ac->ebyte || !ac->etgt)
+            goto fail;
+        for (uint32_t u = 0; u < ns; u++) {
+            ac->fail[newid[u]] = newid[fail[u]];
+            for (uint32_t c = t.first[u]; c != NONE; c = t.sib[c])
+                ac->eoff[newid[u] + 1]++;
+        }
+        for (uint32_t s = 0; s < ns; s++)
+            ac->eoff[s + 1] += ac->eoff[s];
+        struct { uint8_t byte; uint32_t tgt; } edges[256];
+        for (uint32_t u = 0; u < ns; u++) {
+            int m = 0;
+            for (uint32_t c = t.first[u]; c != NONE; c = t.sib[c]) {
+                edges[m].byte = t.byte[c];
+                edges[m].tgt = newid[c];
+                m++;
+            }
+            qsort(edges, m, sizeof(edges[0]), cmp_edge);
+            uint32_t k = ac->eoff[newid[u]];
+            for (int e = 0; e < m; e++, k++) {
+                ac->ebyte[k] = edges[e].byte;
+                ac->etgt[k] = edges[e].tgt;
+            }
+        }
+        memset(ac->root, 0, sizeof(ac->root));
+        for (uint32_t c = t.first[0]; c != NONE; c = t.sib[c])
+            ac->root[t.byte[c]] = newid[c];
+    }
+
+    free(order);
+    free(fail);
+    free(dict);
+    free(newid);
+    trie_free(&t);
+    return ac;
+
+fail:
+    free(order);
+    free(fail);
+    free(dict);
+    free(newid);
+    trie_free(&t);
+    ac_free(ac);
+    return NULL;
+}
+
+void ac_free(struct ac *ac)
+{
+    if (!ac)
+        return;
+    free(ac->delta);
+    free(ac->fail);
+    free(ac->eoff);
+    free(ac->ebyte);
+    free(ac->etgt);
+    free(ac->ooff);
+    free(ac->oids);
+    free(ac->dict);
+    free(ac);
+}
+
+size_t ac_mem(const struct ac *ac)
+{
+    // Output offsets, ids and dictionary links, then one of the two forms
+    size_t ns = ac->nstates;
+    size_t n = sizeof(*ac) + (2 * ns + 1 + ac->ooff[ns]) * sizeof(uint32_t);
+    if (ac->dense)
+        n += ns * ac->nclasses * sizeof(uint32_t);
+    else
+        n += (3 * ns + 1) * sizeof(uint32_t) + ns;
+    return n;
+}
+
+void ac_reset(struct ac_state *st)
+{
+    st->state = 0;
+    st->line = st->pos + 1;
+}
+
+// Newlines are only located when a pattern matches, by searching back from
+// the match to the last position already searched.
+struct line_track {
+    const unsigned char *buf;
+    uint64_t base;          // stream offset of buf[0]
+    size_t nl;              // buf[0..nl) has been searched for newlines
+    uint64_t line;
+};
+
+static void track_to(struct line_track *lt, size_t i)
+{
+    if (i > lt->nl) {
+        const unsigned char *q = memrchr(lt->buf + lt->nl, '\n', i - lt->nl);
+        if (q)
+            lt->line = lt->base + (uint64_t)(q - lt->buf) + 2;
+        lt->nl = i;
+    }
+}
+
+static void ac_hit(const struct ac *ac, struct line_track *lt, uint32_t s,
+                   size_t i, uint64_t *seen, uint64_t *counts)
+{
+    track_to(lt, i);
+    if (ac->ooff[s] == ac->ooff[s + 1])
+        s = ac->dict[s];
+    for (; s != NONE; s = ac->dict[s]) {
+        for (uint32_t k = ac->ooff[s]; k < ac->ooff[s + 1]; k++) {
+            uint32_t id = ac->oids[k];
+            if (seen[id] != lt->line) {
+                seen[id] = lt->line;
+                counts[id]++;
+            }
+        }
+    }
+}
+
+static uint32_t sparse_step(const struct ac *ac, uint32_t s, uint8_t b)
+{
+    while (s != 0) {
+        uint32_t lo = ac->eoff[s], hi = ac->eoff[s + 1];
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (ac->ebyte[mid] < b)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < ac->eoff[s + 1] && ac->ebyte[lo] == b)
+            return ac->etgt[lo];
+        s = ac->fail[s];
+    }
+    return ac->root[b];
+}
+
+void ac_feed(const struct ac *ac, struct ac_state *st,
+             const unsigned char *buf, size_t len,
+             uint64_t *seen, uint64_t *counts)
+{
+    struct line_track lt = { buf, st->pos, 0, st->line };
+    int skip = ac->skip;
+
+    if (ac->dense) {
+        const uint32_t *delta = ac->delta;
+        const uint8_t *cls = ac->cls;
+        uint32_t nc = ac->nclasses;
+        uint32_t out_row = ac->first_out * nc;
+        uint32_t s = st->state * nc;
+        for (size_t i = 0; i < len; i++) {
+            if (s == 0 && skip >= 0) {
+                const unsigned char *q = memchr(buf + i, skip, len - i);
+                if (!q)
+                    break;
+                i = (size_t)(q - buf);
+            }
+            s = delta[s + cls[buf[i]]];
+            if (s >= out_row)
+                ac_hit(ac, &lt, s / nc, i, seen, counts);
+        }
+        st->state = s / nc;
+    } else {
+        uint32_t s = st->state;
+        for (size_t i = 0; i < len; i++) {
+            if (s == 0 && skip >= 0) {
+                const unsigned char *q = memchr(buf + i, skip, len - i);
+                if (!q)
+                    break;
+                i = (size_t)(q - buf);
+            }
+            s = sparse_step(ac, s, buf[i]);
+            if (s >= ac->first_out)
+                ac_hit(ac, &lt, s, i, seen, counts);
+        }
+        st->state = s;
+    }
+
+    track_to(&lt, len);
+    st->line = lt.line;
+    st->pos += len;
+}
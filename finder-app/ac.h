@@ -0,0 +1,54 @@
+#ifndef AC_H
+#define AC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Aho-Corasick automaton over a set of literal patterns.
+ *
+ * Small pattern sets are compiled to a dense transition table indexed by
+ * byte class, so each input byte costs one table load. When the dense table
+ * would exceed AC_DENSE_MAX bytes the automaton keeps the trie edges in
+ * sorted CSR form plus failure links instead, with a full table only for
+ * the root state where most of the time is spent.
+ */
+#define AC_DENSE_MAX (4u * 1024 * 1024)
+
+struct ac;
+
+// Scan position carried across ac_feed() calls so input can be streamed
+struct ac_state {
+    uint32_t state;     // automaton state after the last byte fed
+    uint64_t pos;       // absolute stream offset of the next byte
+    uint64_t line;      // id of the current line: its start offset plus one
+};
+
+/**
+ * @param pats the literal patterns, none of which may be empty or contain '\n'
+ * @param lens the length of each pattern
+ * @param ids the id reported for each pattern, used to index seen and counts
+ * @param n the number of patterns
+ * @return the automaton, or NULL if memory could not be allocated
+ */
+struct ac *ac_build(const char *const *pats, const size_t *lens,
+                    const uint32_t *ids, size_t n);
+
+void ac_free(struct ac *ac);
+
+// Bytes the automaton's tables hold
+size_t ac_mem(const struct ac *ac);
+
+// Start a new file: drop any partial match and begin a new line
+void ac_reset(struct ac_state *st);
+
+/**
+ * Feed the next len bytes of the stream. Each line containing pattern id
+ * increments counts[id] once; seen[id] holds the id of the last line that
+ * was counted for the pattern and must start out zero.
+ */
+void ac_feed(const struct ac *ac, struct ac_state *st,
+             const unsigned char *buf, size_t len,
+             uint64_t *seen, uint64_t *counts);
+
+#endif
@@ -0,0 +1,175 @@
+#include "budget.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void budget_init(struct budget *b, size_t limit)
+{
+    memset(b, 0, sizeof(*b));
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->freed, NULL);
+    b->limit = limit;
+}
+
+void budget_destroy(struct budget *b)
+{
+    pthread_cond_destroy(&b->freed);
+    pthread_mutex_destroy(&b->lock);
+}
+
+static void take(struct budget *b, size_t n)
+{
+    b->used += n;
+    if (b->used > b->peak)
+        b->peak = b->used;
+}
+
+void budget_acquire(struct budget *b, size_t n)
+{
+    pthread_mutex_lock(&b->lock);
+    while (b->used + n > b->limit)
+        pthread_cond_wait(&b->freed, &b->lock);
+    take(b, n);
+    pthread_mutex_unlock(&b->lock);
+}
+
+bool budget_try(struct budget *b, size_t n)
+{
+    pthread_mutex_lock(&b->lock);
+    bool ok = b->used + n <= b->limit;
+    if (ok)
+        take(b, n);
+    pthread_mutex_unlock(&b->lock);
+    return ok;
+}
+
+void budget_release(struct budget *b, size_t n)
+{
+    pthread_mutex_lock(&b->lock);
+    b->used -= n;
+    pthread_cond_broadcast(&b->freed);
+    pthread_mutex_unlock(&b->lock);
+}
+
+// A limit read from a cgroup file, ULLONG_MAX for none or "max"
+static unsigned long long read_limit(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return ULLONG_MAX;
+    char line[64], *end;
+    unsigned long long max = ULLONG_MAX;
+    if (fgets(line, sizeof(line), fp) && strncmp(line, "max", 3) != 0) {
+        unsigned long long n = strtoull(line, &end, 10);
+        if (end != line)
+            max = n;
+    }
+    fclose(fp);
+    return max;
+}
+
+// True if the comma-separated list holds item
+static bool has_item(const char *list, const char *item)
+{
+    size_t len = strlen(item);
+    for (const char *p = list;; p++) {
+        if (strncmp(p, item, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+            return true;
+        if (!(p = strchr(p, ',')))
+            return false;
+    }
+}
+
+/**
+ * Find where the process's group of a cgroup hierarchy is mounted, from
+ * /proc/self/cgroup and /proc/self/mountinfo.
+ * @param v2 the unified hierarchy, else the v1 one with the memory
+ *   controller
+ * @param dir receives the group's directory
+ * @return the length of the mount point's path in dir, 0 if not found
+ */
+static size_t cgroup_dir(bool v2, char *dir, size_t len)
+{
+    char line[PATH_MAX + 256], group[PATH_MAX] = "";
+    FILE *fp = fopen("/proc/self/cgroup", "r");
+    if (!fp)
+        return 0;
+    while (fgets(line, sizeof(line), fp)) {
+        // hierarchy-id:controllers:path, with no controllers for v2
+        char *ctl = strchr(line, ':'), *path = ctl ? strchr(ctl + 1, ':') : NULL;
+        if (!path)
+            continue;
+        *path++ = '\0';
+        if (v2 ? strcmp(line, "0") == 0 && ctl[1] == '\0' : has_item(ctl + 1, "memory")) {
+            path[strcspn(path, "\n")] = '\0';
+            snprintf(group, sizeof(group), "%s", path);
+            break;
+        }
+    }
+    fclose(fp);
+    if (!group[0] || !(fp = fopen("/proc/self/mountinfo", "r")))
+        return 0;
+
+    size_t top = 0;
+    while (!top && fgets(line, sizeof(line), fp)) {
+        // id parent dev root mount-point options... - type source super-options
+        char root[PATH_MAX], mnt[PATH_MAX], type[64], opts[256];
+        const char *sep = strstr(line, " - ");
+        if (!sep || sscanf(line, "%*s %*s %*s %4095s %4095s", root, mnt) != 2 ||
+            sscanf(sep + 3, "%63s %*s %255s", type, opts) != 2)
+            continue;
+        if (v2 ? strcmp(type, "cgroup2") != 0
+               : strcmp(type, "cgroup") != 0 || !has_item(opts, "memory"))
+            continue;
+        // The group's path is relative to the root of its namespace, which
+        // the mount may show only part of
+        size_t rlen = strcmp(root, "/") == 0 ? 0 : strlen(root);
+        const char *rest = strncmp(group, root, rlen) == 0 ? group + rlen : "";
+        if ((size_t)snprintf(dir, len, "%s%s", mnt, rest) < len)
+            top = strlen(mnt);
+    }
+    fclose(fp);
+    return top;
+}
+
+/**
+ * The smallest limit file sets on the group in dir and those above it, up
+ * to the mount point top bytes into dir, which dir is left holding.
+ */
+static unsigned long long group_limit(char *dir, size_t top, const char *file)
+{
+    unsigned long long min = ULLONG_MAX;
+    size_t len = strlen(dir);
+    for (;;) {
+        char path[PATH_MAX + 32];
+        snprintf(path, sizeof(path), "%s/%s", dir, file);
+        unsigned long long max = read_limit(path);
+        if (max < min)
+            min = max;
+        while (len > top && dir[len - 1] != '/')
+            len--;
+        if (len <= top)
+            break;
+        dir[--len] = '\0';
+    }
+    return min;
+}
+
+size_t budget_default(void)
+{
+    // A group's usage counts against every group above it, so the
+    // tightest limit on the way up is the one that applies. v1 keeps the
+    // limit in memory.limit_in_bytes, "unlimited" as a huge number.
+    char dir[PATH_MAX];
+    unsigned long long max = ULLONG_MAX, v1 = ULLONG_MAX;
+    size_t top = cgroup_dir(true, dir, sizeof(dir));
+    if (top)
+        max = group_limit(dir, top, "memory.max");
+    if ((top = cgroup_dir(false, dir, sizeof(dir))) != 0)
+        v1 = group_limit(dir, top, "memory.limit_in_bytes");
+    if (v1 < max)
+        max = v1;
+    return max / 4 < BUDGET_DEFAULT ? (size_t)(max / 4) : BUDGET_DEFAULT;
+}
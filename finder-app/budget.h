@@ -0,0 +1,42 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A byte budget shared by the threads of a scan. Read buffers are taken
+ * from it before reading, so readers wait for matchers to give memory
+ * back rather than grow past the limit.
+ */
+struct budget {
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+    size_t limit;
+    size_t used;
+    size_t peak;
+};
+
+void budget_init(struct budget *b, size_t limit);
+
+void budget_destroy(struct budget *b);
+
+// Take n bytes, waiting until they are free; n must not exceed the limit
+void budget_acquire(struct budget *b, size_t n);
+
+// Take n bytes if they are free now
+bool budget_try(struct budget *b, size_t n);
+
+void budget_release(struct budget *b, size_t n);
+
+/**
+ * The default limit: a quarter of the memory limit of the process's
+ * cgroup, v2 or v1, or of a group above it when that is lower; at most
+ * BUDGET_DEFAULT.
+ */
+size_t budget_default(void);
+
+#define BUDGET_DEFAULT ((size_t)256 << 20)
+
+#endif
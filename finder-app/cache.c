@@ -0,0 +1,264 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct table {
+    void *map;
+    size_t size;
+    const struct cache_header *hdr;
+    const struct cache_entry *slots;
+};
+
+struct cache {
+    char *file;
+    struct table snap;          // the table as it was when the run started
+    struct cache_entry *pending;    // entries this run used or produced
+    size_t npending;
+    size_t cap;
+    size_t nnew;                    // pending entries not in the snapshot
+};
+
+static size_t slot_of(const struct cache_entry *e, uint32_t nslots)
+{
+    uint64_t h = e->qhash;
+    h ^= e->dev * 0x9E3779B97F4A7C15ull;
+    h ^= e->ino * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 29;
+    return (size_t)(h & (nslots - 1));
+}
+
+static bool same_key(const struct cache_entry *a, const struct cache_entry *b)
+{
+    return a->qhash == b->qhash && a->dev == b->dev && a->ino == b->ino;
+}
+
+// Map file if it holds a valid table; a missing or invalid file is empty
+static void table_map(struct table *t, const char *file)
+{
+    memset(t, 0, sizeof(*t));
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct cache_header)) {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return;
+
+    const struct cache_header *h = map;
+    if (memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->size != (uint64_t)st.st_size || h->nslots == 0 ||
+        (h->nslots & (h->nslots - 1)) != 0 || h->nused >= h->nslots ||
+        sizeof(*h) + (uint64_t)h->nslots * sizeof(struct cache_entry) != h->size) {
+        fprintf(stderr, "finder: %s: not a finder cache, it will be replaced\n", file);
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+    t->map = map;
+    t->size = (size_t)st.st_size;
+    t->hdr = h;
+    t->slots = (const struct cache_entry *)(h + 1);
+}
+
+static void table_unmap(struct table *t)
+{
+    if (t->map)
+        munmap(t->map, t->size);
+    memset(t, 0, sizeof(*t));
+}
+
+struct cache *cache_open(const char *file)
+{
+    struct cache *c = calloc(1, sizeof(*c));
+    if (!c || !(c->file = strdup(file))) {
+        fprintf(stderr, "finder: out of memory\n");
+        free(c);
+        return NULL;
+    }
+    table_map(&c->snap, file);
+    return c;
+}
+
+void cache_close(struct cache *c)
+{
+    if (!c)
+        return;
+    table_unmap(&c->snap);
+    free(c->pending);
+    free(c->file);
+    free(c);
+}
+
+bool cache_lookup(const struct cache *c, const struct cache_entry *key,
+                  uint64_t *lines)
+{
+    const struct table *t = &c->snap;
+    if (!t->map)
+        return false;
+
+    // The header's count is not trusted to leave an empty slot: a corrupt
+    // table with every slot used is probed once around, not forever
+    uint32_t mask = t->hdr->nslots - 1;
+    size_t s = slot_of(key, t->hdr->nslots);
+    for (uint32_t n = 0; n < t->hdr->nslots; n++, s = (s + 1) & mask) {
+        const struct cache_entry *e = &t->slots[s];
+        if (e->qhash == 0)
+            return false;
+        if (same_key(e, key)) {
+            if (e->size != key->size || e->mtime_ns != key->mtime_ns)
+                return false;
+            *lines = e->lines;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int pending_add(struct cache *c, const struct cache_entry *e)
+{
+    if (c->npending == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 1024;
+        struct cache_entry *pending = realloc(c->pending, cap * sizeof(*pending));
+        if (!pending)
+            return -1;
+        c->pending = pending;
+        c->cap = cap;
+    }
+    c->pending[c->npending++] = *e;
+    return 0;
+}
+
+int cache_put(struct cache *c, const struct cache_entry *e)
+{
+    if (pending_add(c, e) != 0)
+        return -1;
+    c->nnew++;
+    return 0;
+}
+
+int cache_touch(struct cache *c, const struct cache_entry *e)
+{
+    return pending_add(c, e);
+}
+
+// Insert e, replacing an older entry for the same file and pattern
+static void table_insert(struct cache_entry *slots, uint32_t nslots,
+                         uint32_t *nused, const struct cache_entry *e)
+{
+    for (size_t s = slot_of(e, nslots);; s = (s + 1) & (nslots - 1)) {
+        if (slots[s].qhash == 0) {
+            slots[s] = *e;
+            (*nused)++;
+            return;
+        }
+        if (same_key(&slots[s], e)) {
+            slots[s] = *e;
+            return;
+        }
+    }
+}
+
+static int write_table(const char *file, const struct cache_header *h,
+                       const struct cache_entry *slots)
+{
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", file, (int)getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        perror(tmp);
+        return -1;
+    }
+    int rc = 0;
+    if (fwrite(h, sizeof(*h), 1, fp) != 1 ||
+        fwrite(slots, sizeof(*slots), h->nslots, fp) != h->nslots ||
+        fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", tmp, strerror(errno));
+        rc = -1;
+    }
+    fclose(fp);
+    if (rc == 0 && rename(tmp, file) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", file, strerror(errno));
+        rc = -1;
+    }
+    if (rc != 0)
+        unlink(tmp);
+    return rc;
+}
+
+int cache_commit(struct cache *c)
+{
+    if (c->nnew == 0)
+        return 0;
+
+    char lock[PATH_MAX];
+    snprintf(lock, sizeof(lock), "%s.lock", c->file);
+    int lockfd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lockfd < 0 || flock(lockfd, LOCK_EX) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", lock, strerror(errno));
+        if (lockfd >= 0)
+            close(lockfd);
+        return -1;
+    }
+
+    // Merge into whatever the file holds now, which other runs may have
+    // updated since this one mapped it
+    struct table cur;
+    table_map(&cur, c->file);
+    // A table whose header miscounts its entries is corrupt and rebuilt
+    // from this run's results; its entries could overfill the new table
+    uint64_t used = 0;
+    for (uint32_t i = 0; cur.map && i < cur.hdr->nslots; i++)
+        used += cur.slots[i].qhash != 0;
+    if (cur.map && used != cur.hdr->nused) {
+        fprintf(stderr, "finder: %s: not a finder cache, it will be replaced\n", c->file);
+        table_unmap(&cur);
+    }
+    uint64_t want = c->npending;
+    if (cur.map && used + want <= CACHE_MAX_ENTRIES)
+        want += used;
+    else
+        table_unmap(&cur);
+    uint32_t nslots = 1024;
+    while ((uint64_t)nslots * 3 < want * 4)
+        nslots *= 2;
+
+    int rc = -1;
+    struct cache_entry *slots = calloc(nslots, sizeof(*slots));
+    if (!slots) {
+        fprintf(stderr, "finder: out of memory writing %s\n", c->file);
+    } else {
+        struct cache_header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+        h.nslots = nslots;
+        h.size = sizeof(h) + (uint64_t)nslots * sizeof(*slots);
+        for (uint32_t i = 0; cur.map && i < cur.hdr->nslots; i++) {
+            if (cur.slots[i].qhash)
+                table_insert(slots, nslots, &h.nused, &cur.slots[i]);
+        }
+        for (size_t i = 0; i < c->npending; i++)
+            table_insert(slots, nslots, &h.nused, &c->pending[i]);
+        rc = write_table(c->file, &h, slots);
+    }
+
+    free(slots);
+    table_unmap(&cur);
+    flock(lockfd, LOCK_UN);
+    close(lockfd);
+    if (rc == 0)
+        c->npending = c->nnew = 0;
+    return rc;
+}
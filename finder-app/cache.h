@@ -0,0 +1,77 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Per-file result cache shared between finder runs.
+ *
+ * The file is an open-addressed hash table of fixed-size entries in host
+ * byte order, mapped read-only for lookups:
+ *
+ *   struct cache_header
+ *   struct cache_entry[nslots]       empty slots have qhash 0
+ *
+ * Results found during a run are kept in memory and merged into the file
+ * by cache_commit() under an exclusive flock() on "<file>.lock". The merge
+ * is written to a temporary file and renamed into place, so concurrent
+ * runs never see a half-written table and runs still holding the previous
+ * table mapped keep a consistent snapshot.
+ */
+#define CACHE_MAGIC "FNDRCAC1"
+
+// Past this many entries a merge keeps only the entries used by the run
+#define CACHE_MAX_ENTRIES (1u << 22)
+
+struct cache_header {
+    char magic[8];
+    uint32_t nslots;            // power of two
+    uint32_t nused;             // below nslots, so probes find an empty slot
+    uint64_t size;              // total file size
+};
+
+// A file is identified by device and inode and considered unchanged while
+// its size and mtime are; qhash identifies the pattern and options
+struct cache_entry {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t qhash;
+    uint64_t lines;
+};
+
+struct cache;
+
+/**
+ * @param file the cache file, which need not exist yet
+ * @return the cache, or NULL after printing the reason to stderr. A file
+ *   that is not a valid cache is ignored and replaced on commit.
+ */
+struct cache *cache_open(const char *file);
+
+void cache_close(struct cache *c);
+
+/**
+ * @param key the file's identity and the pattern hash; lines is ignored
+ * @return true and the cached count in *lines if key is present
+ */
+bool cache_lookup(const struct cache *c, const struct cache_entry *key,
+                  uint64_t *lines);
+
+// Record a new result to be written by cache_commit()
+int cache_put(struct cache *c, const struct cache_entry *e);
+
+// Note that a cached result was used, so it survives a merge that drops
+// everything else once the cache holds CACHE_MAX_ENTRIES
+int cache_touch(struct cache *c, const struct cache_entry *e);
+
+/**
+ * Merge the recorded results into the cache file. Nothing is written if
+ * every result came from the cache.
+ * @return 0 on success, -1 after printing the reason to stderr
+ */
+int cache_commit(struct cache *c);
+
+#endif
@@ -0,0 +1,142 @@
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t done_words(size_t nfiles)
+{
+    return (nfiles + 63) / 64;
+}
+
+int checkpoint_write(const char *file, const struct checkpoint *c)
+{
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", file, (int)getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        perror(tmp);
+        return -1;
+    }
+
+    struct checkpoint_header h = {
+        .key = c->key,
+        .nfiles = c->nfiles,
+        .npatterns = c->npatterns,
+        .ndirs = c->ndirs,
+        .ntop = c->ntop,
+    };
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    int rc = 0;
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+        fwrite(c->lines, sizeof(uint64_t), c->npatterns, fp) != c->npatterns ||
+        fwrite(c->dir_lines, sizeof(uint64_t), c->ndirs, fp) != c->ndirs)
+        rc = -1;
+    for (size_t i = 0; rc == 0 && i < c->ntop; i++) {
+        uint32_t len = (uint32_t)strlen(c->top[i].path);
+        if (fwrite(&c->top[i].lines, sizeof(uint64_t), 1, fp) != 1 ||
+            fwrite(&len, sizeof(len), 1, fp) != 1 ||
+            fwrite(c->top[i].path, 1, len, fp) != len)
+            rc = -1;
+    }
+    size_t nwords = done_words(c->nfiles);
+    if (rc == 0 && fwrite(c->done, sizeof(uint64_t), nwords, fp) != nwords)
+        rc = -1;
+    if (rc == 0 && (fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+        rc = -1;
+    if (rc != 0)
+        fprintf(stderr, "finder: %s: %s\n", tmp, strerror(errno));
+    if (fclose(fp) != 0 && rc == 0) {
+        fprintf(stderr, "finder: %s: %s\n", tmp, strerror(errno));
+        rc = -1;
+    }
+    if (rc == 0 && rename(tmp, file) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", file, strerror(errno));
+        rc = -1;
+    }
+    if (rc != 0)
+        unlink(tmp);
+    return rc;
+}
+
+int checkpoint_read(const char *file, struct checkpoint *c)
+{
+    memset(c, 0, sizeof(*c));
+    FILE *fp = fopen(file, "rb");
+    if (!fp) {
+        if (errno == ENOENT)
+            return 0;
+        perror(file);
+        return -1;
+    }
+
+    struct stat st;
+    struct checkpoint_header h;
+    if (fstat(fileno(fp), &st) != 0 || fread(&h, sizeof(h), 1, fp) != 1 ||
+        memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0)
+        goto bad;
+    // Every count takes at least its eight bytes, so a header claiming more
+    // than the file holds is not believed
+    uint64_t size = (uint64_t)st.st_size;
+    if (h.npatterns > size / 8 || h.ndirs > size / 8 || h.ntop > size / 12 ||
+        h.nfiles / 64 > size / 8)
+        goto bad;
+
+    c->key = h.key;
+    c->nfiles = (size_t)h.nfiles;
+    c->npatterns = (size_t)h.npatterns;
+    c->ndirs = (size_t)h.ndirs;
+    size_t nwords = done_words(c->nfiles);
+    c->lines = calloc(c->npatterns ? c->npatterns : 1, sizeof(uint64_t));
+    c->dir_lines = calloc(c->ndirs ? c->ndirs : 1, sizeof(uint64_t));
+    c->top = calloc(h.ntop ? h.ntop : 1, sizeof(*c->top));
+    c->done = calloc(nwords ? nwords : 1, sizeof(uint64_t));
+    if (!c->lines || !c->dir_lines || !c->top || !c->done) {
+        fprintf(stderr, "finder: out of memory\n");
+        fclose(fp);
+        checkpoint_free(c);
+        return -1;
+    }
+
+    if (fread(c->lines, sizeof(uint64_t), c->npatterns, fp) != c->npatterns ||
+        fread(c->dir_lines, sizeof(uint64_t), c->ndirs, fp) != c->ndirs)
+        goto bad;
+    for (; c->ntop < h.ntop; c->ntop++) {
+        uint32_t len;
+        if (fread(&c->top[c->ntop].lines, sizeof(uint64_t), 1, fp) != 1 ||
+            fread(&len, sizeof(len), 1, fp) != 1 || len >= PATH_MAX)
+            goto bad;
+        char *path = malloc(len + 1);
+        if (!path || fread(path, 1, len, fp) != len) {
+            free(path);
+            goto bad;
+        }
+        path[len] = '\0';
+        c->top[c->ntop].path = path;
+    }
+    if (fread(c->done, sizeof(uint64_t), nwords, fp) != nwords)
+        goto bad;
+    fclose(fp);
+    return 1;
+
+bad:
+    fprintf(stderr, "finder: %s: not a finder checkpoint or truncated\n", file);
+    fclose(fp);
+    checkpoint_free(c);
+    return -1;
+}
+
+void checkpoint_free(struct checkpoint *c)
+{
+    for (size_t i = 0; i < c->ntop; i++)
+        free(c->top[i].path);
+    free(c->top);
+    free(c->lines);
+    free(c->dir_lines);
+    free(c->done);
+    memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,69 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "topk.h"
+
+/*
+ * Progress of a search saved so an interrupted run can be resumed.
+ *
+ * A search walks the whole tree before it reads any file, and the walk
+ * of an unchanged tree lists the same files in the same order, so the
+ * progress is which listed files have been matched and what they added
+ * up to. Counts from a result cache are found again by the walk and are
+ * not saved. The file is in host byte order:
+ *
+ *   struct checkpoint_header
+ *   uint64_t lines[npatterns]        over the matched files
+ *   uint64_t dir_lines[ndirs]        likewise, per directory node
+ *   ntop times: uint64_t lines, uint32_t length, the path's bytes
+ *   uint64_t done[(nfiles + 63) / 64]    bit i set once file i is matched
+ *
+ * It is written to a temporary file and renamed into place, so a run
+ * killed while writing leaves the previous checkpoint.
+ */
+#define CHECKPOINT_MAGIC "FNDRCKP1"
+
+// How often a search saves its progress unless told otherwise
+#define CHECKPOINT_INTERVAL_NS (10ull * 1000000000)
+
+struct checkpoint_header {
+    char magic[8];
+    uint64_t key;               // options, patterns and listed paths
+    uint64_t nfiles;
+    uint64_t npatterns;
+    uint64_t ndirs;
+    uint64_t ntop;
+};
+
+// A search's progress, as written or as read back
+struct checkpoint {
+    uint64_t key;
+    size_t nfiles;
+    uint64_t *done;
+    uint64_t *lines;
+    size_t npatterns;
+    uint64_t *dir_lines;
+    size_t ndirs;
+    struct topk_entry *top;     // in any order
+    size_t ntop;
+};
+
+/**
+ * @return 0 on success, -1 after printing the reason to stderr
+ */
+int checkpoint_write(const char *file, const struct checkpoint *c);
+
+/**
+ * @param c receives the progress, to be released with checkpoint_free()
+ * @return 1 if the file was read, 0 if there is none, -1 after printing
+ *   the reason to stderr
+ */
+int checkpoint_read(const char *file, struct checkpoint *c);
+
+// Release what checkpoint_read() allocated
+void checkpoint_free(struct checkpoint *c);
+
+#endif
@@ -0,0 +1,87 @@
+#include "dirtree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int dirtree_init(struct dirtree *t, unsigned max_depth)
+{
+    memset(t, 0, sizeof(*t));
+    t->max_depth = max_depth;
+    t->stack = calloc((size_t)max_depth + 1, sizeof(uint32_t));
+    return t->stack ? 0 : -1;
+}
+
+// Levels below the root: the '/' characters after the root's own path
+static unsigned depth_of(const struct dirtree *t, const char *path)
+{
+    unsigned depth = 0;
+    for (const char *p = path + t->rootlen; (p = strchr(p, '/')); p++)
+        depth++;
+    return depth;
+}
+
+int dirtree_enter(struct dirtree *t, const char *path)
+{
+    if (t->n == 0) {
+        // walk_tree() joins names onto "/" without doubling the slash
+        t->rootlen = strcmp(path, "/") == 0 ? 0 : strlen(path);
+    }
+    unsigned depth = t->n ? depth_of(t, path) : 0;
+    if (depth > t->max_depth)
+        return 0;
+
+    if (t->n == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 64;
+        struct dirtree_node *nodes = realloc(t->nodes, cap * sizeof(*nodes));
+        if (!nodes)
+            return -1;
+        t->nodes = nodes;
+        t->cap = cap;
+    }
+    struct dirtree_node *node = &t->nodes[t->n];
+    if (!(node->path = strdup(path)))
+        return -1;
+    node->parent = depth ? t->stack[depth - 1] : (uint32_t)t->n;
+    node->depth = depth;
+    node->files = 0;
+    node->lines = 0;
+    t->stack[depth] = (uint32_t)t->n++;
+    return 0;
+}
+
+uint32_t dirtree_node(const struct dirtree *t, const char *path)
+{
+    unsigned depth = depth_of(t, path) - 1;
+    return t->stack[depth < t->max_depth ? depth : t->max_depth];
+}
+
+struct finder_dir *dirtree_take(struct dirtree *t, size_t *n)
+{
+    for (size_t i = t->n; i-- > 1;) {
+        struct dirtree_node *parent = &t->nodes[t->nodes[i].parent];
+        parent->files += t->nodes[i].files;
+        parent->lines += t->nodes[i].lines;
+    }
+
+    struct finder_dir *dirs = calloc(t->n ? t->n : 1, sizeof(*dirs));
+    if (!dirs)
+        return NULL;
+    for (size_t i = 0; i < t->n; i++) {
+        dirs[i].path = t->nodes[i].path;
+        dirs[i].depth = t->nodes[i].depth;
+        dirs[i].files = t->nodes[i].files;
+        dirs[i].lines = t->nodes[i].lines;
+    }
+    *n = t->n;
+    t->n = 0;
+    return dirs;
+}
+
+void dirtree_free(struct dirtree *t)
+{
+    for (size_t i = 0; i < t->n; i++)
+        free(t->nodes[i].path);
+    free(t->nodes);
+    free(t->stack);
+    memset(t, 0, sizeof(*t));
+}
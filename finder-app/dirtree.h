@@ -0,0 +1,60 @@
+#ifndef DIRTREE_H
+#define DIRTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "finder.h"
+
+/*
+ * Files and matching lines per directory down to a fixed depth, like du
+ * for matches.
+ *
+ * Directories are added in the preorder a depth-first walk visits them,
+ * so every directory comes after its parent: counts are added to the
+ * directory holding each file as its results arrive, and one pass from the
+ * last directory back to the root then rolls them up into every ancestor,
+ * touching each directory once whatever the number of files. Directories
+ * below the depth limit count towards their ancestor at the limit.
+ */
+struct dirtree_node {
+    char *path;
+    uint32_t parent;        // index of the parent, the root's is its own
+    unsigned depth;         // 0 for the root
+    uint64_t files;
+    uint64_t lines;         // matching lines summed over the patterns
+};
+
+struct dirtree {
+    struct dirtree_node *nodes;
+    size_t n, cap;
+    uint32_t *stack;        // the node entered last at each depth
+    unsigned max_depth;
+    size_t rootlen;         // a path's '/' after this many bytes start levels
+};
+
+// @return 0 on success, -1 if memory ran out
+int dirtree_init(struct dirtree *t, unsigned max_depth);
+
+/**
+ * Add a directory as a walk enters it, the root first.
+ * @return 0 on success, -1 if memory ran out
+ */
+int dirtree_enter(struct dirtree *t, const char *path);
+
+/**
+ * The node that counts a file the walk has just found, which is the
+ * file's directory or its ancestor at the depth limit.
+ */
+uint32_t dirtree_node(const struct dirtree *t, const char *path);
+
+/**
+ * Roll the counts up into the ancestors and hand the nodes over as
+ * finder_dir entries in preorder, leaving t empty.
+ * @return the entries, or NULL if memory ran out
+ */
+struct finder_dir *dirtree_take(struct dirtree *t, size_t *n);
+
+void dirtree_free(struct dirtree *t);
+
+#endif
@@ -0,0 +1,407 @@
+#include "finder.h"
+#include "ignore.h"
+#include "matcher.h"
+#include "scan.h"
+#include "zscan.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Each probe is a random descent from the root, as in Knuth's estimate of
+ * the size of a search tree. At every directory on the way it counts the
+ * files, reads one of them chosen uniformly, and moves into one of the
+ * subdirectories chosen uniformly, until it reaches a directory without
+ * any. A directory reached through subdirectory choices among n1, n2, ...
+ * entries is visited with probability 1/(n1 n2 ...), so weighting what is
+ * found there by n1 n2 ... makes every probe an unbiased estimate of the
+ * totals: files as the directory's file count times the weight, and lines
+ * as that times the lines in the file read. Probes are independent, so
+ * their mean has a normal 95% confidence interval of 1.96 standard errors.
+ * When a few deep directories or large files hold most of the matches the
+ * probes rarely find them, and short runs then tend to underestimate with
+ * intervals that are too narrow.
+ */
+#define Z95 1.96
+
+// Directory listings kept between probes, which mostly revisit the top
+#define ESTIMATE_CACHE_DIRS (64 * 1024)
+
+// One directory's files and subdirectories, after the ignore rules
+struct listing {
+    char *path;             // relative to the root, "" for the root itself
+    char **names;           // nfiles files, then ndirs directories
+    size_t nfiles, ndirs;
+};
+
+// Running mean and variance of one estimated total (Welford)
+struct moments {
+    double mean, m2;
+};
+
+struct estimator {
+    const struct finder_opts *opts;
+    struct ignore *ignore;
+    struct match_ctx *ctx;
+    char *buf;
+    int rootfd;
+    uint64_t rng;
+    struct listing **cache; // open addressing on the path, ncache used
+    size_t ncache, capcache;
+    uint64_t files_read;
+    struct moments files;
+    struct moments *lines;
+    double *probe_lines;    // the current probe's line estimates
+};
+
+static uint64_t next_rand(struct estimator *e)
+{
+    // splitmix64
+    uint64_t z = (e->rng += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t hash_path(const char *p)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (; *p; p++)
+        h = (h ^ (uint8_t)*p) * 1099511628211ull;
+    return h;
+}
+
+static void listing_free(struct listing *l)
+{
+    if (!l)
+        return;
+    for (size_t i = 0; i < l->nfiles + l->ndirs; i++)
+        free(l->names[i]);
+    free(l->names);
+    free(l->path);
+    free(l);
+}
+
+static int listing_add(struct listing *l, size_t *cap, const char *name, bool dir)
+{
+    size_t n = l->nfiles + l->ndirs;
+    if (n == *cap) {
+        size_t c = *cap ? *cap * 2 : 16;
+        char **names = realloc(l->names, c * sizeof(char *));
+        if (!names)
+            return -1;
+        l->names = names;
+        *cap = c;
+    }
+    char *copy = strdup(name);
+    if (!copy)
+        return -1;
+    // Files stay in front of the directories
+    if (dir) {
+        l->names[n] = copy;
+        l->ndirs++;
+    } else {
+        l->names[n] = l->names[l->nfiles];
+        l->names[l->nfiles++] = copy;
+    }
+    return 0;
+}
+
+/**
+ * Read one directory below the root, applying the ignore rules as
+ * walk_tree() does. A directory that cannot be read is reported and
+ * listed as empty.
+ * @return the listing, or NULL if memory ran out
+ */
+static struct listing *list_dir(struct estimator *e, const char *path)
+{
+    struct listing *l = calloc(1, sizeof(*l));
+    if (!l || !(l->path = strdup(path))) {
+        free(l);
+        return NULL;
+    }
+    int fd = openat(e->rootfd, path[0] ? path : ".",
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!d) {
+        fprintf(stderr, "finder: %s/%s: %s\n", e->opts->dir, path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return l;
+    }
+
+    size_t cap = 0;
+    char rel[PATH_MAX];
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        const char *name = de->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        unsigned char type = de->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(d), name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                continue;
+            type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+        }
+        if (type != DT_REG && type != DT_DIR)
+            continue;
+        int len = snprintf(rel, sizeof(rel), path[0] ? "%s/%s" : "%s%s", path, name);
+        if (len < 0 || (size_t)len >= sizeof(rel))
+            continue;
+        if (e->ignore && ignore_match(e->ignore, rel, rel + len - strlen(name), type == DT_DIR))
+            continue;
+        if (listing_add(l, &cap, name, type == DT_DIR) != 0) {
+            closedir(d);
+            listing_free(l);
+            return NULL;
+        }
+    }
+    closedir(d);
+    return l;
+}
+
+/**
+ * The listing of path, from the cache if a probe went there before.
+ * @param owned set if the cache is full and the caller must free it
+ */
+static struct listing *get_listing(struct estimator *e, const char *path, bool *owned)
+{
+    *owned = false;
+    size_t mask = e->capcache - 1;
+    size_t i = hash_path(path) & mask;
+    for (; e->cache[i]; i = (i + 1) & mask) {
+        if (strcmp(e->cache[i]->path, path) == 0)
+            return e->cache[i];
+    }
+    struct listing *l = list_dir(e, path);
+    if (l && e->ncache < ESTIMATE_CACHE_DIRS) {
+        e->cache[i] = l;
+        e->ncache++;
+    } else {
+        *owned = true;
+    }
+    return l;
+}
+
+static bool name_matches(const char *const *globs, size_t n, const char *name)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (fnmatch(globs[i], name, 0) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Match one file as finder_run() would, leaving its counts in e->ctx.
+ * Files the options filter out, and those that cannot be read, have none.
+ */
+static void sample_file(struct estimator *e, const char *dir, const char *name)
+{
+    const struct finder_opts *opts = e->opts;
+    match_begin(e->ctx);
+    if ((opts->ninclude && !name_matches(opts->include, opts->ninclude, name)) ||
+        name_matches(opts->exclude, opts->nexclude, name)) {
+        match_end(e->ctx);
+        return;
+    }
+
+    char rel[PATH_MAX];
+    snprintf(rel, sizeof(rel), dir[0] ? "%s/%s" : "%s%s", dir, name);
+    e->files_read++;
+    int fd = openat(e->rootfd, rel, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        (opts->max_size && (uint64_t)st.st_size > opts->max_size)) {
+        if (fd < 0)
+            fprintf(stderr, "finder: %s/%s: %s\n", opts->dir, rel, strerror(errno));
+        else
+            close(fd);
+        match_end(e->ctx);
+        return;
+    }
+
+    struct scan_stats stats = { 0 };
+    ssize_t n;
+    while ((n = read(fd, e->buf, SCAN_BUFSZ)) < 0 && errno == EINTR)
+        ;
+    enum zscan_format zf = ZSCAN_NONE;
+    int rc = n < 0 ? -1 : 0;
+    if (n > 0) {
+        if (opts->decompress)
+            zf = zscan_detect(e->buf, (size_t)n);
+        if (zf) {
+            rc = zscan_fd(fd, zf, e->buf, (size_t)n, e->ctx, e->buf, SCAN_BUFSZ,
+                          false, &stats, NULL);
+        } else if (!opts->skip_binary || !memchr(e->buf, '\0', (size_t)n)) {
+            match_feed(e->ctx, e->buf, (size_t)n);
+            rc = scan_fd(fd, (uint64_t)n, e->ctx, e->buf, SCAN_BUFSZ, &stats, NULL, NULL);
+        }
+    }
+    if (rc != 0)
+        fprintf(stderr, "finder: %s/%s: %s\n", opts->dir, rel, strerror(errno));
+    match_end(e->ctx);
+    close(fd);
+}
+
+static void moments_add(struct moments *m, uint64_t n, double x)
+{
+    double d = x - m->mean;
+    m->mean += d / (double)n;
+    m->m2 += d * (x - m->mean);
+}
+
+static void interval(const struct moments *m, uint64_t n, struct finder_interval *out)
+{
+    out->value = m->mean;
+    if (n < 2) {
+        out->low = 0;
+        out->high = INFINITY;
+        return;
+    }
+    double half = Z95 * sqrt(m->m2 / (double)(n - 1) / (double)n);
+    out->low = m->mean > half ? m->mean - half : 0;
+    out->high = m->mean + half;
+}
+
+/**
+ * Descend once from the root, adding the probe's estimates as probe n.
+ * @return 0 on success, -1 if memory ran out
+ */
+static int probe(struct estimator *e, uint64_t n)
+{
+    size_t npatterns = e->opts->npatterns;
+    char path[PATH_MAX] = "";
+    double weight = 1, files = 0;
+    memset(e->probe_lines, 0, npatterns * sizeof(double));
+
+    for (bool more = true; more;) {
+        bool owned;
+        struct listing *l = get_listing(e, path, &owned);
+        if (!l)
+            return -1;
+        if (l->nfiles) {
+            double w = weight * (double)l->nfiles;
+            files += w;
+            sample_file(e, path, l->names[next_rand(e) % l->nfiles]);
+            const uint64_t *counts = match_counts(e->ctx);
+            for (size_t i = 0; i < npatterns; i++)
+                e->probe_lines[i] += w * (double)counts[i];
+        }
+        more = false;
+        if (l->ndirs) {
+            const char *sub = l->names[l->nfiles + next_rand(e) % l->ndirs];
+            size_t len = strlen(path);
+            if (len + 1 + strlen(sub) < sizeof(path)) {
+                snprintf(path + len, sizeof(path) - len, len ? "/%s" : "%s", sub);
+                weight *= (double)l->ndirs;
+                more = true;
+            }
+        }
+        if (owned)
+            listing_free(l);
+    }
+
+    moments_add(&e->files, n, files);
+    for (size_t i = 0; i < npatterns; i++)
+        moments_add(&e->lines[i], n, e->probe_lines[i]);
+    return 0;
+}
+
+int finder_estimate(const struct finder_opts *opts, uint64_t budget_ns,
+                    struct finder_estimate *est)
+{
+    memset(est, 0, sizeof(*est));
+    est->lines = calloc(opts->npatterns ? opts->npatterns : 1, sizeof(*est->lines));
+    if (!est->lines) {
+        fprintf(stderr, "finder: out of memory\n");
+        return -1;
+    }
+    est->npatterns = opts->npatterns;
+
+    uint64_t start = now_ns();
+    struct matcher *m = matcher_new(opts->patterns, opts->npatterns, opts->fixed_strings,
+                                    opts->fuzzy ? (int)opts->max_errors : -1);
+    if (!m)
+        return -1;
+
+    struct estimator e = {
+        .opts = opts,
+        .rootfd = -1,
+        .rng = start ^ ((uint64_t)getpid() << 32),
+        .capcache = 2 * ESTIMATE_CACHE_DIRS,
+    };
+    int rc = -1;
+    if (opts->nignore_files &&
+        !(e.ignore = ignore_load(opts->ignore_files, opts->nignore_files)))
+        goto out;
+    e.ctx = match_ctx_new(m);
+    e.buf = malloc(SCAN_BUFSZ);
+    e.cache = calloc(e.capcache, sizeof(*e.cache));
+    e.lines = calloc(opts->npatterns ? opts->npatterns : 1, sizeof(*e.lines));
+    e.probe_lines = calloc(opts->npatterns ? opts->npatterns : 1, sizeof(double));
+    if (!e.ctx || !e.buf || !e.cache || !e.lines || !e.probe_lines) {
+        fprintf(stderr, "finder: out of memory\n");
+        goto out;
+    }
+    e.rootfd = open(opts->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (e.rootfd < 0) {
+        fprintf(stderr, "finder: %s: %s\n", opts->dir, strerror(errno));
+        goto out;
+    }
+
+    // The probe under way when the budget runs out is finished, so there
+    // is always at least one
+    uint64_t n = 0;
+    do {
+        if (probe(&e, ++n) != 0) {
+            fprintf(stderr, "finder: out of memory\n");
+            goto out;
+        }
+    } while (now_ns() - start < budget_ns);
+
+    est->probes = n;
+    est->files_read = e.files_read;
+    interval(&e.files, n, &est->files);
+    for (size_t i = 0; i < opts->npatterns; i++)
+        interval(&e.lines[i], n, &est->lines[i]);
+    rc = 0;
+
+out:
+    if (e.rootfd >= 0)
+        close(e.rootfd);
+    for (size_t i = 0; e.cache && i < e.capcache; i++)
+        listing_free(e.cache[i]);
+    free(e.cache);
+    free(e.lines);
+    free(e.probe_lines);
+    free(e.buf);
+    match_ctx_free(e.ctx);
+    ignore_free(e.ignore);
+    matcher_free(m);
+    return rc;
+}
+
+void finder_estimate_free(struct finder_estimate *est)
+{
+    free(est->lines);
+    est->lines = NULL;
+}
@@ -0,0 +1,234 @@
+#include "filelist.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t hash_bytes(const char *s, size_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t)s[i]) * 1099511628211ull;
+    return h;
+}
+
+static uint64_t hash_dir(uint32_t parent, uint32_t name)
+{
+    uint64_t h = ((uint64_t)parent << 32 | name) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+static bool same_name(const struct file_list *l, uint32_t off, const char *s, size_t len)
+{
+    return memcmp(l->names + off, s, len) == 0 && l->names[off + len] == '\0';
+}
+
+static int grow_name_set(struct file_list *l)
+{
+    size_t cap = l->name_cap ? l->name_cap * 2 : 1024;
+    uint32_t *set = calloc(cap, sizeof(*set));
+    if (!set)
+        return -1;
+    for (size_t i = 0; i < l->name_cap; i++) {
+        uint32_t v = l->name_set[i];
+        if (!v)
+            continue;
+        const char *s = l->names + v - 1;
+        size_t j = hash_bytes(s, strlen(s)) & (cap - 1);
+        while (set[j])
+            j = (j + 1) & (cap - 1);
+        set[j] = v;
+    }
+    free(l->name_set);
+    l->name_set = set;
+    l->name_cap = cap;
+    return 0;
+}
+
+// The offset of name s in the arena, adding it if it is new
+static int intern(struct file_list *l, const char *s, size_t len, uint32_t *off)
+{
+    if (l->nnames * 2 >= l->name_cap && grow_name_set(l) != 0)
+        return -1;
+    size_t mask = l->name_cap - 1;
+    size_t i = hash_bytes(s, len) & mask;
+    for (; l->name_set[i]; i = (i + 1) & mask) {
+        if (same_name(l, l->name_set[i] - 1, s, len)) {
+            *off = l->name_set[i] - 1;
+            return 0;
+        }
+    }
+
+    // Offsets are stored plus one in 32 bits
+    if (l->len + len + 1 >= UINT32_MAX)
+        return -1;
+    if (l->len + len + 1 > l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 64 * 1024;
+        while (cap < l->len + len + 1)
+            cap *= 2;
+        char *names = realloc(l->names, cap);
+        if (!names)
+            return -1;
+        l->names = names;
+        l->cap = cap;
+    }
+    memcpy(l->names + l->len, s, len);
+    l->names[l->len + len] = '\0';
+    *off = (uint32_t)l->len;
+    l->name_set[i] = *off + 1;
+    l->nnames++;
+    l->len += len + 1;
+    return 0;
+}
+
+static int grow_dir_set(struct file_list *l)
+{
+    size_t cap = l->dir_set_cap ? l->dir_set_cap * 2 : 1024;
+    uint32_t *set = calloc(cap, sizeof(*set));
+    if (!set)
+        return -1;
+    for (size_t i = 0; i < l->dir_set_cap; i++) {
+        uint32_t id = l->dir_set[i];
+        if (!id)
+            continue;
+        size_t j = hash_dir(l->dirs[id].parent, l->dirs[id].name) & (cap - 1);
+        while (set[j])
+            j = (j + 1) & (cap - 1);
+        set[j] = id;
+    }
+    free(l->dir_set);
+    l->dir_set = set;
+    l->dir_set_cap = cap;
+    return 0;
+}
+
+// The index of directory name below parent, adding it if it is new
+static int find_dir(struct file_list *l, uint32_t parent, uint32_t name, uint32_t *id)
+{
+    if (l->ndirs * 2 >= l->dir_set_cap && grow_dir_set(l) != 0)
+        return -1;
+    size_t mask = l->dir_set_cap - 1;
+    size_t i = hash_dir(parent, name) & mask;
+    for (; l->dir_set[i]; i = (i + 1) & mask) {
+        const struct file_list_dir *d = &l->dirs[l->dir_set[i]];
+        if (d->parent == parent && d->name == name) {
+            *id = l->dir_set[i];
+            return 0;
+        }
+    }
+
+    if (l->ndirs == l->dir_cap) {
+        size_t cap = l->dir_cap * 2;
+        struct file_list_dir *dirs = realloc(l->dirs, cap * sizeof(*dirs));
+        if (!dirs)
+            return -1;
+        l->dirs = dirs;
+        l->dir_cap = cap;
+    }
+    *id = (uint32_t)l->ndirs;
+    l->dirs[l->ndirs++] = (struct file_list_dir){ .parent = parent, .name = name };
+    l->dir_set[i] = *id;
+    return 0;
+}
+
+// Resolve the directory part of a path, "" or ending in '/', to its index
+static int resolve_dir(struct file_list *l, const char *dir, size_t len, uint32_t *id)
+{
+    if (len == 0) {
+        *id = 0;
+        return 0;
+    }
+    if (len == l->last_len && memcmp(dir, l->last, len) == 0) {
+        *id = l->last_dir;
+        return 0;
+    }
+
+    uint32_t cur = 0;
+    for (const char *p = dir, *end = dir + len; p < end;) {
+        const char *slash = memchr(p, '/', (size_t)(end - p));
+        uint32_t name;
+        if (intern(l, p, (size_t)(slash - p), &name) != 0 ||
+            find_dir(l, cur, name, &cur) != 0)
+            return -1;
+        p = slash + 1;
+    }
+
+    if (len + 1 > l->last_cap) {
+        size_t cap = l->last_cap ? l->last_cap : 256;
+        while (cap < len + 1)
+            cap *= 2;
+        char *last = realloc(l->last, cap);
+        if (!last)
+            return -1;
+        l->last = last;
+        l->last_cap = cap;
+    }
+    memcpy(l->last, dir, len);
+    l->last_len = len;
+    l->last_dir = cur;
+    *id = cur;
+    return 0;
+}
+
+int file_list_add(struct file_list *l, const char *path)
+{
+    if (!l->dirs) {
+        l->dirs = calloc(64, sizeof(*l->dirs));
+        if (!l->dirs)
+            return -1;
+        l->dir_cap = 64;
+        l->ndirs = 1;
+    }
+    if (l->n == l->ncap) {
+        size_t cap = l->ncap ? l->ncap * 2 : 1024;
+        struct file_list_entry *files = realloc(l->files, cap * sizeof(*files));
+        if (!files)
+            return -1;
+        l->files = files;
+        l->ncap = cap;
+    }
+
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    struct file_list_entry *e = &l->files[l->n];
+    if (resolve_dir(l, path, (size_t)(name - path), &e->dir) != 0 ||
+        intern(l, name, strlen(name), &e->name) != 0)
+        return -1;
+    l->n++;
+    return 0;
+}
+
+char *file_list_path(const struct file_list *l, size_t i, char *buf, size_t size)
+{
+    // Written back to front, from the file's name up through its parents
+    const struct file_list_entry *e = &l->files[i];
+    size_t total = strlen(l->names + e->name);
+    for (uint32_t d = e->dir; d; d = l->dirs[d].parent)
+        total += strlen(l->names + l->dirs[d].name) + 1;
+    if (total >= size) {
+        buf[0] = '\0';
+        return buf;
+    }
+
+    char *p = buf + total;
+    *p = '\0';
+    size_t len = strlen(l->names + e->name);
+    memcpy(p -= len, l->names + e->name, len);
+    for (uint32_t d = e->dir; d; d = l->dirs[d].parent) {
+        *--p = '/';
+        len = strlen(l->names + l->dirs[d].name);
+        memcpy(p -= len, l->names + l->dirs[d].name, len);
+    }
+    return buf;
+}
+
+void file_list_free(struct file_list *l)
+{
+    free(l->names);
+    free(l->name_set);
+    free(l->dirs);
+    free(l->dir_set);
+    free(l->files);
+    free(l->last);
+    memset(l, 0, sizeof(*l));
+}
@@ -0,0 +1,63 @@
+#ifndef FILELIST_H
+#define FILELIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Paths queued for scanning, relative to a directory descriptor, stored as
+ * a tree rather than as strings.
+ *
+ * A file is its directory's index and the offset of its name, eight bytes
+ * in all. A directory is likewise its parent's index and its name, and
+ * names are interned, so a deep tree's long shared prefixes and the names
+ * that recur in every directory (Makefile, index.js, README) are stored
+ * once. Paths are put back together only when a file is opened or
+ * reported, by walking up the parents.
+ *
+ * Adding a file costs one compare with the previous file's directory in
+ * the usual case of files added directory by directory, and hash lookups
+ * of its directories' names otherwise. A zeroed file_list is empty.
+ */
+struct file_list_dir {
+    uint32_t parent;
+    uint32_t name;          // offset in names
+};
+
+struct file_list_entry {
+    uint32_t dir;
+    uint32_t name;
+};
+
+struct file_list {
+    char *names;            // interned names, each NUL-terminated
+    size_t len, cap;
+    uint32_t *name_set;     // open addressing, offset + 1 of each name
+    size_t nnames, name_cap;
+    struct file_list_dir *dirs;     // 0 is the empty prefix of relative paths
+    size_t ndirs, dir_cap;
+    uint32_t *dir_set;      // open addressing, index of each other directory
+    size_t dir_set_cap;
+    struct file_list_entry *files;
+    size_t n, ncap;
+    char *last;             // directory part of the last path, with its '/'
+    size_t last_len, last_cap;
+    uint32_t last_dir;
+};
+
+/**
+ * @param path a path shorter than PATH_MAX
+ * @return 0 on success, -1 if memory ran out
+ */
+int file_list_add(struct file_list *l, const char *path);
+
+/**
+ * Put file i's path together in buf.
+ * @param size the size of buf, PATH_MAX for any path that was added
+ * @return buf
+ */
+char *file_list_path(const struct file_list *l, size_t i, char *buf, size_t size);
+
+void file_list_free(struct file_list *l);
+
+#endif
@@ -0,0 +1,566 @@
+// includes
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "finder.h"
+#include "fuzzy.h"
+#include "index.h"
+#include "output.h"
+#include "serve.h"
+#include "watch.h"
+#include "zscan.h"
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: finder [-FILsUz] [-j threads] [-k count] [-m size] [-o format] [-f patternfile]\n"
+            "              [-i indexfile] [-c cachefile] [--max-count=n | --any]\n"
+            "              [--max-size=size] [--include=glob] [--exclude=glob]\n"
+            "              [--ignore-file=file] [--max-errors=n] [--estimate=seconds]\n"
+            "              [--aggregate=depth] [--dedup] [--low-impact]\n"
+            "              [--readahead=size] [--checkpoint=file [--resume]\n"
+            "              [--checkpoint-interval=seconds]]\n"
+            "              <directory> [pattern...]\n"
+            "       finder index <directory> <indexfile>\n"
+            "       finder watch [-F] <directory> [indexfile]\n"
+            "       finder serve [-j threads] <directory> <socket> [indexfile]\n"
+            "  Counts the files below <directory> and, for each pattern, the\n"
+            "  number of lines matching it, reading every file once.\n"
+            "  -F              treat patterns as fixed strings, not basic regexes\n"
+            "  -I              skip binary files, those with a NUL byte in the first block\n"
+            "  -L              follow symbolic links; each directory is read once\n"
+            "                  and links back into the path being read are reported\n"
+            "  -z              match the contents of gzip and zstd files, as built\n"
+            "  -f patternfile  read additional patterns from a file, one per line\n"
+            "  -i indexfile    read only the files a trigram index built by\n"
+            "                  'finder index' says may match, or walk the\n"
+            "                  directory if it has changed since\n"
+            "  -c cachefile    reuse per-file counts of unchanged files from the\n"
+            "                  cache and add the files that had to be read\n"
+            "  -j threads      match with this many threads, default one per CPU\n"
+            "  -k count        also list the count files with the most matching lines\n"
+            "  -m size         buffer at most size bytes, with an optional K, M or G\n"
+            "                  suffix; the default is 256M or less under a cgroup limit\n"
+            "  -o format       write each file's counts, bytes and scan time as it\n"
+            "                  is scanned, then the totals, as json lines or binary\n"
+            "  -U              read files with plain system calls, not io_uring\n"
+            "  --max-count=n   stop reading files once n lines match, all patterns\n"
+            "                  together; the counts are then at least n\n"
+            "  --any           stop at the first matching line, as --max-count=1\n"
+            "  --max-size=size skip files larger than size, with K, M or G as for -m\n"
+            "  --include=glob  read only files whose name matches a glob, repeatable\n"
+            "  --exclude=glob  do not read files whose name matches, repeatable;\n"
+            "                  skipped files are still counted\n"
+            "  --ignore-file=file  leave out the paths that .gitignore rules in file\n"
+            "                  match, relative to <directory>, repeatable; ignored\n"
+            "                  directories are not read and their files not counted\n"
+            "  --max-errors=n  count lines holding each pattern, taken literally,\n"
+            "                  with at most n bytes inserted, deleted or changed;\n"
+            "                  patterns are limited to 64 bytes\n"
+            "  --estimate=seconds  estimate the counts with 95%% confidence intervals\n"
+            "                  from random descents of the tree made for about\n"
+            "                  this long, reading one file per directory passed\n"
+            "  --aggregate=depth  also list the files and matching lines below each\n"
+            "                  directory down to depth levels under <directory>\n"
+            "  --dedup         count and read a file with several names, hard or\n"
+            "                  symbolic links, under the first name found only\n"
+            "  --low-impact    leave the page cache to other programs: drop each\n"
+            "                  file's pages once they are matched\n"
+            "  --readahead=size  keep size bytes, with K, M or G as for -m,\n"
+            "                  requested from storage ahead of each file's reads\n"
+            "  --checkpoint=file  save which files are matched and their counts to\n"
+            "                  file every 10 seconds; it is removed once done\n"
+            "  --checkpoint-interval=seconds  save it this often instead, 0 for\n"
+            "                  after every file\n"
+            "  --resume        go on from the checkpoint an interrupted run saved,\n"
+            "                  if the tree and options are unchanged; with -o only\n"
+            "                  the files not matched before are listed\n"
+            "  -s              report the system calls made on standard error\n"
+            "  watch keeps an index of <directory> current as files change and\n"
+            "  answers one query per pattern read from standard input\n"
+            "  serve does the same for clients of a Unix socket, one request per\n"
+            "  line: count <pattern>, fixed <string> or files\n");
+}
+
+/**
+ * Parse a byte count such as 512K or 64M.
+ * @return the count, or 0 if size is not a count of at least min
+ */
+static size_t parse_size(const char *size, size_t min)
+{
+    char *end;
+    unsigned long long n = strtoull(size, &end, 10);
+    unsigned shift = 0;
+    switch (*end) {
+    case 'K': case 'k': shift = 10; end++; break;
+    case 'M': case 'm': shift = 20; end++; break;
+    case 'G': case 'g': shift = 30; end++; break;
+    }
+    if (*end || end == size || n > (SIZE_MAX >> shift) || (n << shift) < min)
+        return 0;
+    return (size_t)(n << shift);
+}
+
+// Pattern list grown as patterns are collected from the command line and -f
+struct patterns {
+    char **list;
+    size_t n;
+    size_t cap;
+};
+
+static int patterns_add(struct patterns *p, char *pattern)
+{
+    if (p->n == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 16;
+        char **list = realloc(p->list, cap * sizeof(char *));
+        if (!list)
+            return -1;
+        p->list = list;
+        p->cap = cap;
+    }
+    p->list[p->n++] = pattern;
+    return 0;
+}
+
+static int patterns_read(struct patterns *p, const char *file)
+{
+    FILE *fp = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+    if (!fp) {
+        perror(file);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int rc = 0;
+    while ((len = getline(&line, &cap, fp)) >= 0) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        char *copy = strdup(line);
+        if (!copy || patterns_add(p, copy) != 0) {
+            free(copy);
+            fprintf(stderr, "Error: out of memory reading %s\n", file);
+            rc = -1;
+            break;
+        }
+    }
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+    return rc;
+}
+
+// finder index <directory> <indexfile>
+static int cmd_index(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Error: Two arguments required - (1) a directory and (2) an index file.\n");
+        usage();
+        return 1;
+    }
+    return index_build(argv[1], argv[2]) == 0 ? 0 : 1;
+}
+
+// finder watch [-F] <directory> [indexfile]
+static int cmd_watch(int argc, char *argv[])
+{
+    bool fixed = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "F")) != -1) {
+        if (opt != 'F') {
+            usage();
+            return 1;
+        }
+        fixed = true;
+    }
+    if (argc - optind < 1 || argc - optind > 2) {
+        fprintf(stderr, "Error: a directory and an optional index file are required.\n");
+        usage();
+        return 1;
+    }
+    const char *indexfile = argc - optind == 2 ? argv[optind + 1] : NULL;
+    return watch_run(argv[optind], indexfile, fixed) == 0 ? 0 : 1;
+}
+
+// finder serve [-j threads] <directory> <socket> [indexfile]
+static int cmd_serve(int argc, char *argv[])
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = cpus > 0 ? (unsigned)cpus : 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:")) != -1) {
+        if (opt != 'j') {
+            usage();
+            return 1;
+        }
+        char *end;
+        unsigned long n = strtoul(optarg, &end, 10);
+        if (*end || n == 0 || n > 1024) {
+            fprintf(stderr, "Error: invalid thread count %s\n", optarg);
+            return 1;
+        }
+        threads = (unsigned)n;
+    }
+    if (argc - optind < 2 || argc - optind > 3) {
+        fprintf(stderr, "Error: a directory, a socket and an optional index file are required.\n");
+        usage();
+        return 1;
+    }
+    const char *indexfile = argc - optind == 3 ? argv[optind + 2] : NULL;
+    return serve_run(argv[optind], argv[optind + 1], indexfile, threads) == 0 ? 0 : 1;
+}
+
+// Print estimated counts, in finder.sh's words as far as they go
+static int print_estimate(const struct finder_opts *opts, uint64_t budget_ns)
+{
+    struct finder_estimate est;
+    if (finder_estimate(opts, budget_ns, &est) != 0) {
+        finder_estimate_free(&est);
+        return 1;
+    }
+    printf("Estimated from %" PRIu64 " random descents reading %" PRIu64
+           " files, with 95%% confidence intervals:\n", est.probes, est.files_read);
+    printf("The number of files are about %.0f (%.0f to %.0f)\n",
+           est.files.value, est.files.low, est.files.high);
+    for (size_t i = 0; i < est.npatterns; i++)
+        printf("The number of matching lines for \"%s\" are about %.0f (%.0f to %.0f)\n",
+               opts->patterns[i], est.lines[i].value, est.lines[i].low, est.lines[i].high);
+    finder_estimate_free(&est);
+    return 0;
+}
+
+// Main Function
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "index") == 0)
+        return cmd_index(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "watch") == 0)
+        return cmd_watch(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "serve") == 0)
+        return cmd_serve(argc - 1, argv + 1);
+
+    struct finder_opts opts = { 0 };
+    struct patterns pats = { 0 };
+    size_t owned = 0;   // leading entries of pats.list that were allocated
+    bool stats = false;
+    uint64_t estimate_ns = 0;
+    struct output_sink out = { .fp = stdout, .fmt = OUTPUT_TEXT };
+    int opt;
+    int rc = 1;
+
+    struct patterns include = { 0 }, exclude = { 0 }, ignore = { 0 };
+    enum { OPT_MAX_COUNT = 256, OPT_ANY, OPT_MAX_SIZE, OPT_INCLUDE, OPT_EXCLUDE, OPT_IGNORE,
+           OPT_MAX_ERRORS, OPT_ESTIMATE, OPT_AGGREGATE, OPT_DEDUP,
+           OPT_LOW_IMPACT, OPT_READAHEAD, OPT_CHECKPOINT, OPT_RESUME,
+           OPT_CHECKPOINT_INTERVAL };
+    static const struct option longopts[] = {
+        { "max-count", required_argument, NULL, OPT_MAX_COUNT },
+        { "any", no_argument, NULL, OPT_ANY },
+        { "max-size", required_argument, NULL, OPT_MAX_SIZE },
+        { "include", required_argument, NULL, OPT_INCLUDE },
+        { "exclude", required_argument, NULL, OPT_EXCLUDE },
+        { "ignore-file", required_argument, NULL, OPT_IGNORE },
+        { "max-errors", required_argument, NULL, OPT_MAX_ERRORS },
+        { "estimate", required_argument, NULL, OPT_ESTIMATE },
+        { "aggregate", required_argument, NULL, OPT_AGGREGATE },
+        { "dedup", no_argument, NULL, OPT_DEDUP },
+        { "low-impact", no_argument, NULL, OPT_LOW_IMPACT },
+        { "readahead", required_argument, NULL, OPT_READAHEAD },
+        { "checkpoint", required_argument, NULL, OPT_CHECKPOINT },
+        { "resume", no_argument, NULL, OPT_RESUME },
+        { "checkpoint-interval", required_argument, NULL, OPT_CHECKPOINT_INTERVAL },
+        { NULL, 0, NULL, 0 },
+    };
+    while ((opt = getopt_long(argc, argv, "FILf:i:c:j:k:m:o:sUzh", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'F':
+            opts.fixed_strings = true;
+            break;
+        case 'I':
+            opts.skip_binary = true;
+            break;
+        case 'L':
+            opts.follow_links = true;
+            break;
+        case 'z':
+            if (!zscan_supported()) {
+                fprintf(stderr, "Error: finder was built without zlib and libzstd\n");
+                goto out;
+            }
+            opts.decompress = true;
+            break;
+        case 'f':
+            if (patterns_read(&pats, optarg) != 0)
+                goto out;
+            owned = pats.n;
+            break;
+        case 'i':
+            opts.index = optarg;
+            break;
+        case 'c':
+            opts.cache = optarg;
+            break;
+        case 'j': {
+            char *end;
+            unsigned long n = strtoul(optarg, &end, 10);
+            if (*end || n == 0 || n > 1024) {
+                fprintf(stderr, "Error: invalid thread count %s\n", optarg);
+                goto out;
+            }
+            opts.threads = (unsigned)n;
+            break;
+        }
+        case 'k': {
+            char *end;
+            unsigned long n = strtoul(optarg, &end, 10);
+            if (*end || n == 0 || n > 1000000) {
+                fprintf(stderr, "Error: invalid file count %s\n", optarg);
+                goto out;
+            }
+            opts.top_k = n;
+            break;
+        }
+        case 'm':
+            if ((opts.mem_limit = parse_size(optarg, 1u << 20)) == 0) {
+                fprintf(stderr, "Error: invalid memory size %s, at least 1M\n", optarg);
+                goto out;
+            }
+            break;
+        case 'o':
+            if ((out.fmt = output_parse(optarg)) == OUTPUT_TEXT) {
+                fprintf(stderr, "Error: unknown output format %s, not json or binary\n", optarg);
+                goto out;
+            }
+            break;
+        case OPT_MAX_COUNT: {
+            char *end;
+            errno = 0;
+            unsigned long long n = strtoull(optarg, &end, 10);
+            if (*end || end == optarg || n == 0 || errno) {
+                fprintf(stderr, "Error: invalid line count %s\n", optarg);
+                goto out;
+            }
+            opts.max_count = n;
+            break;
+        }
+        case OPT_ANY:
+            opts.max_count = 1;
+            break;
+        case OPT_MAX_SIZE:
+            if ((opts.max_size = parse_size(optarg, 1)) == 0) {
+                fprintf(stderr, "Error: invalid file size %s\n", optarg);
+                goto out;
+            }
+            break;
+        case OPT_MAX_ERRORS: {
+            char *end;
+            unsigned long n = strtoul(optarg, &end, 10);
+            if (*end || end == optarg || n > FUZZY_MAX_LEN) {
+                fprintf(stderr, "Error: invalid error count %s\n", optarg);
+                goto out;
+            }
+            opts.fuzzy = true;
+            opts.max_errors = (unsigned)n;
+            break;
+        }
+        case OPT_ESTIMATE: {
+            char *end;
+            double secs = strtod(optarg, &end);
+            if (*end || end == optarg || !(secs > 0 && secs <= 86400)) {
+                fprintf(stderr, "Error: invalid time budget %s\n", optarg);
+                goto out;
+            }
+            estimate_ns = (uint64_t)(secs * 1e9);
+            break;
+        }
+        case OPT_AGGREGATE: {
+            char *end;
+            unsigned long n = strtoul(optarg, &end, 10);
+            if (*end || end == optarg || n > 4096) {
+                fprintf(stderr, "Error: invalid depth %s\n", optarg);
+                goto out;
+            }
+            opts.aggregate = true;
+            opts.aggregate_depth = (unsigned)n;
+            break;
+        }
+        case OPT_DEDUP:
+            opts.dedup = true;
+            break;
+        case OPT_LOW_IMPACT:
+            opts.low_impact = true;
+            break;
+        case OPT_CHECKPOINT:
+            opts.checkpoint = optarg;
+            break;
+        case OPT_RESUME:
+            opts.resume = true;
+            break;
+        case OPT_CHECKPOINT_INTERVAL: {
+            char *end;
+            double secs = strtod(optarg, &end);
+            if (*end || end == optarg || !(secs >= 0 && secs <= 86400)) {
+                fprintf(stderr, "Error: invalid checkpoint interval %s\n", optarg);
+                goto out;
+            }
+            // 0 saves after every file; 1 ns does that, as a checkpoint_ns
+            // of 0 means the default interval
+            opts.checkpoint_ns = secs > 0 ? (uint64_t)(secs * 1e9) : 1;
+            break;
+        }
+        case OPT_READAHEAD:
+            if ((opts.readahead = parse_size(optarg, 4096)) == 0) {
+                fprintf(stderr, "Error: invalid readahead size %s, at least 4K\n", optarg);
+                goto out;
+            }
+            break;
+        case OPT_INCLUDE:
+        case OPT_EXCLUDE:
+        case OPT_IGNORE:
+            if (patterns_add(opt == OPT_INCLUDE ? &include :
+                             opt == OPT_EXCLUDE ? &exclude : &ignore, optarg) != 0) {
+                fprintf(stderr, "Error: out of memory\n");
+                goto out;
+            }
+            break;
+        case 'U':
+            opts.sync_io = true;
+            break;
+        case 's':
+            stats = true;
+            break;
+        case 'h':
+            usage();
+            rc = 0;
+            goto out;
+        default:
+            usage();
+            goto out;
+        }
+    }
+
+    // Check that a directory and at least one pattern were given
+    if (argc - optind < 1 || (argc - optind < 2 && pats.n == 0)) {
+        fprintf(stderr, "Error: a directory and at least one search string are required.\n");
+        usage();
+        goto out;
+    }
+    opts.dir = argv[optind++];
+    for (; optind < argc; optind++) {
+        if (patterns_add(&pats, argv[optind]) != 0) {
+            fprintf(stderr, "Error: out of memory\n");
+            goto out;
+        }
+    }
+
+    // Check if argument 1 is a valid directory
+    struct stat st;
+    if (stat(opts.dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        printf("Error: %s is not a valid directory.\n", opts.dir);
+        goto out;
+    }
+
+    opts.patterns = (const char *const *)pats.list;
+    opts.npatterns = pats.n;
+    opts.include = (const char *const *)include.list;
+    opts.ninclude = include.n;
+    opts.exclude = (const char *const *)exclude.list;
+    opts.nexclude = exclude.n;
+    opts.ignore_files = (const char *const *)ignore.list;
+    opts.nignore_files = ignore.n;
+
+    if (opts.resume && !opts.checkpoint) {
+        fprintf(stderr, "Error: --resume needs the --checkpoint file to resume from\n");
+        goto out;
+    }
+    if (estimate_ns) {
+        if (out.fmt != OUTPUT_TEXT || opts.top_k || opts.index || opts.cache || opts.max_count ||
+            opts.aggregate || opts.follow_links || opts.dedup || opts.checkpoint) {
+            fprintf(stderr, "Error: --estimate cannot be combined with -o, -k, -i, -c, -L, "
+                    "--max-count, --aggregate, --dedup or --checkpoint\n");
+            goto out;
+        }
+        rc = print_estimate(&opts, estimate_ns);
+        goto out;
+    }
+
+    if (out.fmt != OUTPUT_TEXT) {
+        opts.on_file = output_file;
+        opts.on_file_arg = &out;
+        output_begin(&out, opts.patterns, opts.npatterns);
+    }
+
+    struct finder_result res;
+    if (finder_run(&opts, &res) != 0) {
+        finder_result_free(&res);
+        goto out;
+    }
+
+    // Print result, in finder.sh's words when there is a single pattern
+    if (out.fmt != OUTPUT_TEXT) {
+        output_end(&out, &res);
+    } else if (res.npatterns == 1) {
+        printf("The number of files are %" PRIu64 " and the number of matching lines are %" PRIu64 "\n",
+               res.files, res.lines[0]);
+    } else {
+        printf("The number of files are %" PRIu64 "\n", res.files);
+        for (size_t i = 0; i < res.npatterns; i++)
+            printf("The number of matching lines for \"%s\" are %" PRIu64 "\n",
+                   opts.patterns[i], res.lines[i]);
+    }
+    if (out.fmt == OUTPUT_TEXT) {
+        for (size_t i = 0; i < res.ntop; i++)
+            printf("%" PRIu64 " %s\n", res.top[i].lines, res.top[i].path);
+        for (size_t i = 0; i < res.ndirs; i++)
+            printf("%" PRIu64 "\t%" PRIu64 "\t%s\n", res.dirs[i].lines, res.dirs[i].files,
+                   res.dirs[i].path);
+        if (res.stopped)
+            printf("The search stopped early, having found at least %" PRIu64 " matching lines\n",
+                   opts.max_count);
+    }
+    if (stats) {
+        const struct finder_stats *fs = &res.stats;
+        fprintf(stderr, "finder: %" PRIu64 " directories, %" PRIu64 " getdents64, %" PRIu64
+                " fstatat, %" PRIu64 " openat, %" PRIu64 " read, %" PRIu64
+                " io_uring_enter, %" PRIu64 " bytes, %" PRIu64 " bytes buffered at most\n",
+                fs->dirs, fs->getdents, fs->stats, fs->opens, fs->reads,
+                fs->enters, fs->bytes, fs->mem_peak);
+        fprintf(stderr, "finder: %" PRIu64 " bytes scanned, %" PRIu64 " bytes in %" PRIu64
+                " filtered files skipped, %" PRIu64 " paths ignored\n",
+                fs->bytes, fs->skipped_bytes, fs->skipped, fs->ignored);
+        if (opts.follow_links || opts.dedup)
+            fprintf(stderr, "finder: %" PRIu64 " duplicate file names skipped, %" PRIu64
+                    " file system loops not followed\n", fs->duplicates, fs->loops);
+        if (opts.resume)
+            fprintf(stderr, "finder: %" PRIu64 " files matched before resuming\n", fs->resumed);
+        uint64_t cached = fs->bytes > fs->disk_bytes ? fs->bytes - fs->disk_bytes : 0;
+        fprintf(stderr, "finder: %" PRIu64 " bytes read from disk, %" PRIu64
+                " from the page cache, %" PRIu64 " major page faults\n",
+                fs->disk_bytes, cached, fs->major_faults);
+        // Threads busy for about as long as the scan took are balanced
+        fprintf(stderr, "finder: %" PRIu64 " ms scanning, threads busy for", fs->scan_ns / 1000000);
+        for (size_t i = 0; i < res.nthreads; i++)
+            fprintf(stderr, "%s %" PRIu64, i ? "," : "", res.busy_ns[i] / 1000000);
+        fprintf(stderr, " ms\n");
+    }
+    finder_result_free(&res);
+    rc = 0;
+
+out:
+    for (size_t i = 0; i < owned; i++)
+        free(pats.list[i]);
+    free(pats.list);
+    free(include.list);
+    free(exclude.list);
+    free(ignore.list);
+    return rc;
+}
@@ -0,0 +1,169 @@
+#ifndef FINDER_H
+#define FINDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// One file's results, passed to finder_opts.on_file
+struct finder_file {
+    const char *path;               // below dir, or relative to it with an index
+    const uint64_t *lines;          // matching lines per pattern
+    size_t npatterns;
+    uint64_t bytes;                 // bytes read, 0 if the counts were cached
+    uint64_t ns;                    // time spent matching it
+    bool cached;                    // counts came from the cache unread
+    bool skipped;                   // binary or too large, counts are zero
+};
+
+/**
+ * Called with each file's results as soon as they are known, in no
+ * particular order. Calls are serialized but may come from any thread.
+ */
+typedef void (*finder_file_fn)(void *arg, const struct finder_file *f);
+
+// Options for one search over a directory tree
+struct finder_opts {
+    const char *dir;                // root directory to search
+    const char *const *patterns;    // grep-style patterns, one per entry
+    size_t npatterns;
+    bool fixed_strings;             // treat every pattern as a literal (-F)
+    bool fuzzy;                     // match literals approximately (--max-errors)
+    unsigned max_errors;            // edit distance allowed when fuzzy
+    const char *index;              // trigram index of dir to narrow the scan
+    const char *cache;              // per-file result cache to consult and update
+    unsigned threads;               // matcher threads, 0 for one per CPU
+    bool sync_io;                   // read with plain system calls, not io_uring
+    size_t mem_limit;               // bytes for buffers, 0 for the default
+    finder_file_fn on_file;         // per-file results, or NULL
+    void *on_file_arg;
+    size_t top_k;                   // files with the most matches to keep
+    uint64_t max_count;             // stop once this many lines match, 0 for no limit
+    const bool *cancel;             // if not NULL, stop as at max_count once
+                                    // on_file or another thread sets it: the
+                                    // walk at its next file, and the files
+                                    // being read within a buffer
+    bool skip_binary;               // skip files with a NUL byte in the first block
+    uint64_t max_size;              // skip files larger than this, 0 for no limit
+    bool decompress;                // match gzip and zstd files decompressed (-z)
+    const char *const *include;     // if any, only read files whose name matches one
+    size_t ninclude;
+    const char *const *exclude;     // never read files whose name matches one
+    size_t nexclude;
+    const char *const *ignore_files;    // .gitignore syntax, relative to dir
+    size_t nignore_files;
+    bool aggregate;                 // total each directory, not with an index
+    unsigned aggregate_depth;       // directories this far below dir, 0 for dir alone
+    bool follow_links;              // follow symbolic links, not with an index (-L)
+    bool dedup;                     // count and read each inode once, not with an index
+    bool low_impact;                // drop files from the page cache once read
+    size_t readahead;               // bytes to request ahead of reads, 0 for the kernel's
+    const char *checkpoint;         // file to save progress to now and then, or NULL;
+                                    // removed once the search is over
+    bool resume;                    // start from the checkpoint, if it was saved
+                                    // for the same files and options
+    uint64_t checkpoint_ns;         // how often to save progress, 0 for every 10 s
+};
+
+// System calls made by finder_run()
+struct finder_stats {
+    uint64_t dirs;                  // directories read
+    uint64_t getdents;              // getdents64 calls
+    uint64_t stats;                 // fstatat calls
+    uint64_t opens;                 // openat calls and io_uring opens
+    uint64_t reads;                 // read calls and io_uring reads
+    uint64_t bytes;                 // bytes read from files
+    uint64_t enters;                // io_uring_enter calls
+    uint64_t mem_peak;              // most buffer memory in use at once
+    uint64_t skipped;               // files not read, or not to the end, by the filters
+    uint64_t skipped_bytes;         // bytes of them not read
+    uint64_t ignored;               // files and directories left out by ignore rules
+    uint64_t duplicates;            // further names of files already found, with dedup
+    uint64_t loops;                 // links back to a directory being read, with follow_links
+    uint64_t scan_ns;               // wall time spent reading and matching files
+    uint64_t disk_bytes;            // of bytes, those read from storage, not the
+                                    // page cache, readahead included
+    uint64_t major_faults;          // page faults that waited for storage
+    uint64_t resumed;               // files matched before, taken from the checkpoint
+};
+
+// A file among those with the most matching lines
+struct finder_hit {
+    char *path;
+    uint64_t lines;                 // matching lines, summed over the patterns
+};
+
+// A directory's totals, everything below it included
+struct finder_dir {
+    char *path;                     // starting with dir as given
+    unsigned depth;                 // levels below dir
+    uint64_t files;
+    uint64_t lines;                 // matching lines, summed over the patterns
+};
+
+// Totals produced by finder_run()
+struct finder_result {
+    uint64_t files;                 // regular files found, as find -type f
+    uint64_t *lines;                // matching lines per pattern, npatterns entries
+    size_t npatterns;
+    struct finder_hit *top;         // up to top_k files, most lines first
+    size_t ntop;
+    struct finder_dir *dirs;        // with aggregate, in depth-first preorder
+    size_t ndirs;
+    bool stopped;                   // max_count was reached or the run was
+                                    // cancelled, counts are partial
+    struct finder_stats stats;
+    uint64_t *busy_ns;              // time each matcher thread spent on files,
+                                    // 0 for one not started, of stats.scan_ns
+    size_t nthreads;
+};
+
+/**
+ * @param opts the directory and patterns to search for
+ * @param res receives the file count and per-pattern matching line counts,
+ *   must be released with finder_result_free()
+ * @return 0 on success, -1 if the patterns could not be compiled or the
+ *   directory could not be opened. Unreadable files below the root are
+ *   reported on stderr and still counted, like find | wc -l does. A run
+ *   that stops at max_count or is cancelled succeeds with res->stopped
+ *   set; files read after a cancel are not passed to on_file. Files and
+ *   directories the ignore files match are not counted or read at all.
+ */
+int finder_run(const struct finder_opts *opts, struct finder_result *res);
+
+void finder_result_free(struct finder_result *res);
+
+// An estimated total and its 95% confidence interval
+struct finder_interval {
+    double value;
+    double low;
+    double high;                    // infinite after a single probe
+};
+
+// Totals estimated by finder_estimate()
+struct finder_estimate {
+    uint64_t probes;                // random descents from the root averaged
+    uint64_t files_read;            // files sampled and read
+    struct finder_interval files;
+    struct finder_interval *lines;  // per pattern, npatterns entries
+    size_t npatterns;
+};
+
+/**
+ * Estimate what finder_run() would count from random descents of the tree,
+ * each reading one file per directory it passes through, for trees too
+ * large to read in full. Probes are made until budget_ns has passed, plus
+ * the one under way then; more probes narrow the intervals. Only the
+ * options that decide what is counted and matched are used, not those for
+ * indexes, caches, threads, buffers, per-file results or stopping early.
+ * @param est receives the estimates, must be released with
+ *   finder_estimate_free()
+ * @return 0 on success, -1 if the patterns could not be compiled or the
+ *   directory could not be opened
+ */
+int finder_estimate(const struct finder_opts *opts, uint64_t budget_ns,
+                    struct finder_estimate *est);
+
+void finder_estimate_free(struct finder_estimate *est);
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef FINDER_HPP
+#define FINDER_HPP
+
+// C++ interface to libfinder. Header-only: it needs nothing beyond
+// libfinder.h and the library itself.
+
+#include "libfinder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace finder {
+
+// A run that failed; the reason was printed to stderr
+class error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// One file's counts, passed to the callback given to query::run()
+struct file {
+    const char *path;
+    const std::uint64_t *lines;     // per pattern, npatterns entries
+    std::size_t npatterns;
+
+    std::uint64_t operator[](std::size_t i) const { return lines[i]; }
+};
+
+// A file among those with the most matching lines
+struct hit {
+    std::string path;
+    std::uint64_t lines;            // summed over the patterns
+};
+
+// Option flags, as for finder_query_set_flags()
+enum flags : unsigned {
+    fixed_strings = FINDER_FIXED_STRINGS,
+    skip_binary = FINDER_SKIP_BINARY,
+    decompress = FINDER_DECOMPRESS,
+    follow_links = FINDER_FOLLOW_LINKS,
+    dedup = FINDER_DEDUP,
+    low_impact = FINDER_LOW_IMPACT,
+    sync_io = FINDER_SYNC_IO,
+};
+
+/**
+ * A search of one directory, freed with the object. Setters return the
+ * query so options can be chained; those copying a string throw
+ * std::bad_alloc if memory runs out.
+ */
+class query {
+public:
+    explicit query(const std::string &dir) : q_(finder_query_new(dir.c_str()))
+    {
+        if (!q_)
+            throw std::bad_alloc();
+    }
+
+    query &pattern(const std::string &p) { return check(finder_query_add_pattern(get(), p.c_str())); }
+    query &flags(unsigned f) { finder_query_set_flags(get(), f); return *this; }
+    query &threads(unsigned n) { finder_query_set_threads(get(), n); return *this; }
+    query &max_errors(unsigned n) { finder_query_set_max_errors(get(), n); return *this; }
+    query &max_count(std::uint64_t n) { finder_query_set_max_count(get(), n); return *this; }
+    query &max_size(std::uint64_t n) { finder_query_set_max_size(get(), n); return *this; }
+    query &top_k(std::size_t n) { finder_query_set_top_k(get(), n); return *this; }
+    query &index(const std::string &f) { return check(finder_query_set_index(get(), f.c_str())); }
+    query &cache(const std::string &f) { return check(finder_query_set_cache(get(), f.c_str())); }
+    query &include(const std::string &g) { return check(finder_query_add_include(get(), g.c_str())); }
+    query &exclude(const std::string &g) { return check(finder_query_add_exclude(get(), g.c_str())); }
+    query &ignore_file(const std::string &f) { return check(finder_query_add_ignore_file(get(), f.c_str())); }
+
+    // Search the tree; throws finder::error if it could not be searched
+    void run()
+    {
+        finder_query_on_file(get(), nullptr, nullptr);
+        if (finder_query_run(get()) != 0)
+            throw error("finder: search failed");
+    }
+
+    /**
+     * Search the tree, calling on_file(const finder::file &) with each
+     * file's counts. Calls are serialized but may come from any thread.
+     * The callback's type is a template parameter, so the call is made
+     * directly and can be inlined. An exception it throws cancels the
+     * run and is rethrown once it has stopped.
+     */
+    template <class F>
+    void run(F &&on_file)
+    {
+        struct call {
+            F &fn;
+            finder_query *q;
+            std::exception_ptr err;
+
+            static void each(void *arg, const char *path, const std::uint64_t *lines,
+                             std::size_t n)
+            {
+                call *c = static_cast<call *>(arg);
+                if (c->err)
+                    return;
+                try {
+                    c->fn(file{ path, lines, n });
+                } catch (...) {
+                    c->err = std::current_exception();
+                    finder_query_cancel(c->q);
+                }
+            }
+        } c{ on_file, get(), nullptr };
+
+        finder_query_on_file(get(), &call::each, &c);
+        int rc = finder_query_run(get());
+        finder_query_on_file(get(), nullptr, nullptr);
+        if (c.err)
+            std::rethrow_exception(c.err);
+        if (rc != 0)
+            throw error("finder: search failed");
+    }
+
+    // Counts of the last run
+    std::uint64_t files() const { return finder_query_files(get()); }
+    std::size_t npatterns() const { return finder_query_npatterns(get()); }
+    std::uint64_t lines(std::size_t i) const { return finder_query_lines(get(), i); }
+    bool stopped() const { return finder_query_stopped(get()) != 0; }
+
+    // Files with the most matching lines, with top_k, most first
+    std::vector<hit> top() const
+    {
+        std::vector<hit> v;
+        std::size_t n = finder_query_ntop(get());
+        v.reserve(n);
+        for (std::size_t i = 0; i < n; i++) {
+            std::uint64_t lines;
+            const char *path = finder_query_top(get(), i, &lines);
+            v.push_back(hit{ path, lines });
+        }
+        return v;
+    }
+
+    finder_query *get() const { return q_.get(); }
+
+private:
+    struct deleter {
+        void operator()(finder_query *q) const { finder_query_free(q); }
+    };
+
+    query &check(int rc)
+    {
+        if (rc != 0)
+            throw std::bad_alloc();
+        return *this;
+    }
+
+    std::unique_ptr<finder_query, deleter> q_;
+};
+
+} // namespace finder
+
+#endif
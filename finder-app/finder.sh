@@ -1,11 +1,17 @@
 #!/bin/sh
 
-# Check if the number of arguments is not equal to 2
-if [ "$#" -ne 2 ]; then
+# Check if fewer than 2 arguments were given
+if [ "$#" -lt 2 ]; then
     echo "Error: Two arguments required - (1) a directory and (2) a search string."
     exit 1
 fi
 
+# Several search strings are counted by the native finder in a single pass.
+# Options end before the directory, so search strings may start with '-'.
+if [ "$#" -gt 2 ]; then
+    exec "$(dirname "$0")/finder" -- "$@"
+fi
+
 # Assign arguments to variables
 filesdir=$1
 searchstr=$2
@@ -20,7 +26,7 @@ fi
 num_files=$(find "$filesdir" -type f | wc -l)
 
 # Count the tot number of lines that contain the search string in all the files
-num_matching_lines=$(grep -r "$searchstr" "$filesdir" 2>/dev/null | wc -l)
+num_matching_lines=$(grep -r -- "$searchstr" "$filesdir" 2>/dev/null | wc -l)
 
 # Print result
 echo "The number of files are $num_files and the number of matching lines are $num_matching_lines"
\ No newline at end of file
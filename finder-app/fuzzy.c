@@ -0,0 +1,230 @@
+#include "fuzzy.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// One bit-vector word for each of FUZZY_LANES patterns
+typedef uint64_t lanes __attribute__((vector_size(FUZZY_LANES * sizeof(uint64_t))));
+
+/*
+ * Each pattern sits in the top bits of its word, so its last row is always
+ * bit 63 and a lane's distance changes by the top bits of the horizontal
+ * deltas, which shifts extract without per-lane masks. The bits below stay
+ * a zero-cost prefix: with no byte matching them, Pv stays all ones, Mv
+ * zero, and the horizontal deltas they shift up are zero, as the search
+ * algorithm needs for the top row.
+ *
+ * Distances are kept with max_errors + 1 taken off, so a lane is within
+ * the limit when its sign bit is set and needs no compare, which SSE2
+ * lacks for 64-bit lanes.
+ */
+struct fuzzy {
+    size_t n;               // patterns
+    size_t nvec;            // vectors of lanes, the last padded
+    uint32_t *ids;
+    lanes *peq;             // per byte value, the pattern positions holding it
+    lanes *slack0;          // each pattern's length less max_errors + 1
+    bool done0;             // every pattern matches the empty line
+};
+
+// A vertical column of the distance matrix per pattern, for the current line
+struct fuzzy_scan {
+    lanes *pv, *mv;         // positive and negative vertical deltas
+    lanes *slack;           // distance of the whole pattern ending here, offset
+    lanes *hit;             // sign bit set once the pattern has matched the line
+    bool done;              // every pattern has matched the line
+    bool started;           // the line has at least one byte
+};
+
+static lanes *lanes_new(size_t n)
+{
+    lanes *v = aligned_alloc(sizeof(lanes), n * sizeof(lanes));
+    if (v)
+        memset(v, 0, n * sizeof(lanes));
+    return v;
+}
+
+static bool all_set(lanes v)
+{
+    for (unsigned i = 0; i < FUZZY_LANES; i++) {
+        if (!(v[i] >> 63))
+            return false;
+    }
+    return true;
+}
+
+struct fuzzy *fuzzy_new(const char *const *pats, const uint32_t *ids, size_t n,
+                        unsigned max_errors)
+{
+    struct fuzzy *fz = calloc(1, sizeof(*fz));
+    if (!fz)
+        return NULL;
+    fz->n = n;
+    fz->nvec = (n + FUZZY_LANES - 1) / FUZZY_LANES;
+    size_t nvec = fz->nvec ? fz->nvec : 1;
+    fz->ids = malloc((n ? n : 1) * sizeof(uint32_t));
+    fz->peq = lanes_new(256 * nvec);
+    fz->slack0 = lanes_new(nvec);
+    if (!fz->ids || !fz->peq || !fz->slack0) {
+        fuzzy_free(fz);
+        return NULL;
+    }
+    memcpy(fz->ids, ids, n * sizeof(uint32_t));
+
+    // Padding lanes are empty patterns, which match from the start of a
+    // line and so never hold it open
+    fz->done0 = true;
+    for (size_t j = 0; j < fz->nvec * FUZZY_LANES; j++) {
+        size_t v = j / FUZZY_LANES, lane = j % FUZZY_LANES;
+        size_t len = j < n ? strlen(pats[j]) : 0;
+        for (size_t i = 0; i < len; i++)
+            fz->peq[(size_t)(unsigned char)pats[j][i] * nvec + v][lane] |= 1ull << (64 - len + i);
+        fz->slack0[v][lane] = len - max_errors - 1;
+        if (len > max_errors)
+            fz->done0 = false;
+    }
+    return fz;
+}
+
+void fuzzy_free(struct fuzzy *fz)
+{
+    if (!fz)
+        return;
+    free(fz->ids);
+    free(fz->peq);
+    free(fz->slack0);
+    free(fz);
+}
+
+struct fuzzy_scan *fuzzy_scan_new(const struct fuzzy *fz)
+{
+    struct fuzzy_scan *s = calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+    size_t nvec = fz->nvec ? fz->nvec : 1;
+    s->pv = lanes_new(nvec);
+    s->mv = lanes_new(nvec);
+    s->slack = lanes_new(nvec);
+    s->hit = lanes_new(nvec);
+    if (!s->pv || !s->mv || !s->slack || !s->hit) {
+        fuzzy_scan_free(s);
+        return NULL;
+    }
+    fuzzy_begin(fz, s);
+    return s;
+}
+
+void fuzzy_scan_free(struct fuzzy_scan *s)
+{
+    if (!s)
+        return;
+    free(s->pv);
+    free(s->mv);
+    free(s->slack);
+    free(s->hit);
+    free(s);
+}
+
+static void line_begin(const struct fuzzy *fz, struct fuzzy_scan *s)
+{
+    for (size_t v = 0; v < fz->nvec; v++) {
+        s->pv[v] = ~(lanes){ 0 };
+        s->mv[v] = (lanes){ 0 };
+    }
+    memcpy(s->slack, fz->slack0, fz->nvec * sizeof(lanes));
+    memcpy(s->hit, fz->slack0, fz->nvec * sizeof(lanes));
+    s->done = fz->done0;
+    s->started = false;
+}
+
+void fuzzy_begin(const struct fuzzy *fz, struct fuzzy_scan *s)
+{
+    line_begin(fz, s);
+}
+
+static void line_end(const struct fuzzy *fz, struct fuzzy_scan *s, uint64_t *counts)
+{
+    for (size_t j = 0; j < fz->n; j++) {
+        if (s->hit[j / FUZZY_LANES][j % FUZZY_LANES] >> 63)
+            counts[fz->ids[j]]++;
+    }
+    line_begin(fz, s);
+}
+
+// Advance one vector of patterns over a byte whose positions are eq, as in
+// Myers' search algorithm
+static inline void advance(lanes eq, lanes *pv, lanes *mv, lanes *slack, lanes *hit)
+{
+    lanes xv = eq | *mv;
+    lanes xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+    lanes ph = *mv | ~(xh | *pv);
+    lanes mh = *pv & xh;
+    *slack += (ph >> 63) - (mh >> 63);
+    ph <<= 1;
+    mh <<= 1;
+    *pv = mh | ~(xv | ph);
+    *mv = ph & xv;
+    *hit |= *slack;
+}
+
+/**
+ * Advance every pattern over bytes of one line.
+ * @return true once every pattern has matched the line
+ */
+static bool step(const struct fuzzy *fz, struct fuzzy_scan *s,
+                 const unsigned char *p, const unsigned char *end)
+{
+    size_t nvec = fz->nvec;
+    if (nvec == 1) {
+        // The common case, kept in registers
+        lanes pv = s->pv[0], mv = s->mv[0], slack = s->slack[0], hit = s->hit[0];
+        // Checking for an early exit every few bytes keeps the lane
+        // extraction off the critical path
+        while (p < end && !all_set(hit)) {
+            const unsigned char *stop = end - p > 8 ? p + 8 : end;
+            for (; p < stop; p++)
+                advance(fz->peq[*p], &pv, &mv, &slack, &hit);
+        }
+        s->pv[0] = pv;
+        s->mv[0] = mv;
+        s->slack[0] = slack;
+        s->hit[0] = hit;
+        return all_set(hit);
+    }
+    for (; p < end; p++) {
+        const lanes *peq = fz->peq + (size_t)*p * nvec;
+        lanes all = ~(lanes){ 0 };
+        for (size_t v = 0; v < nvec; v++) {
+            advance(peq[v], &s->pv[v], &s->mv[v], &s->slack[v], &s->hit[v]);
+            all &= s->hit[v];
+        }
+        if (all_set(all))
+            return true;
+    }
+    return false;
+}
+
+void fuzzy_feed(const struct fuzzy *fz, struct fuzzy_scan *s,
+                const char *buf, size_t len, uint64_t *counts)
+{
+    const unsigned char *p = (const unsigned char *)buf, *end = p + len;
+    while (p < end) {
+        const unsigned char *nl = memchr(p, '\n', (size_t)(end - p));
+        const unsigned char *stop = nl ? nl : end;
+        if (p < stop) {
+            s->started = true;
+            if (!s->done)
+                s->done = step(fz, s, p, stop);
+        }
+        if (!nl)
+            return;
+        line_end(fz, s, counts);
+        p = nl + 1;
+    }
+}
+
+void fuzzy_end(const struct fuzzy *fz, struct fuzzy_scan *s, uint64_t *counts)
+{
+    if (s->started)
+        line_end(fz, s, counts);
+}
@@ -0,0 +1,61 @@
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Approximate matching of literal patterns: a line matches a pattern when
+ * some part of it is within a given number of insertions, deletions and
+ * substitutions of the pattern.
+ *
+ * Each pattern is one column of Myers' bit-parallel edit distance matrix,
+ * held in a 64-bit word, so patterns are limited to FUZZY_MAX_LEN bytes
+ * and a byte costs the same handful of word operations whatever the
+ * distance allowed. Patterns are packed FUZZY_LANES to a vector and
+ * stepped together with GCC vector extensions, which compile to SIMD
+ * where the target has it. A line is left as soon as every pattern has
+ * matched it.
+ */
+#define FUZZY_MAX_LEN 64
+#ifdef __AVX2__
+#define FUZZY_LANES 4
+#else
+#define FUZZY_LANES 2
+#endif
+
+struct fuzzy;
+struct fuzzy_scan;
+
+/**
+ * @param pats the patterns, none longer than FUZZY_MAX_LEN or containing '\n'
+ * @param ids the id reported for each pattern, used to index counts
+ * @param n the number of patterns
+ * @param max_errors the edit distance within which a line matches
+ * @return the compiled set, or NULL if memory could not be allocated
+ */
+struct fuzzy *fuzzy_new(const char *const *pats, const uint32_t *ids, size_t n,
+                        unsigned max_errors);
+
+void fuzzy_free(struct fuzzy *fz);
+
+// Per-thread scan state for one pattern set
+struct fuzzy_scan *fuzzy_scan_new(const struct fuzzy *fz);
+
+void fuzzy_scan_free(struct fuzzy_scan *s);
+
+// Start a new file
+void fuzzy_begin(const struct fuzzy *fz, struct fuzzy_scan *s);
+
+/**
+ * Feed the next len bytes of the stream. Each line that matches pattern
+ * ids[i] increments counts[ids[i]] once.
+ */
+void fuzzy_feed(const struct fuzzy *fz, struct fuzzy_scan *s,
+                const char *buf, size_t len, uint64_t *counts);
+
+// End the file, counting a final line that lacks a newline
+void fuzzy_end(const struct fuzzy *fz, struct fuzzy_scan *s, uint64_t *counts);
+
+#endif
@@ -0,0 +1,458 @@
+#define _GNU_SOURCE
+#include "ignore.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    TOK_BYTE,           // one literal byte
+    TOK_ANY,            // ?: any byte but '/'
+    TOK_CLASS,          // [...]: a byte of a class, never '/'
+    TOK_STAR,           // *: any run of bytes without '/'
+    TOK_GLOBSTAR,       // trailing **: everything that is left
+    TOK_DIRS,           // **/: zero or more whole directories
+};
+
+struct tok {
+    uint8_t op;
+    uint8_t c;          // the byte of TOK_BYTE
+    uint32_t cls;       // the class of TOK_CLASS
+};
+
+struct rule {
+    bool negate;        // !rule re-includes what earlier rules ignored
+    bool dir_only;      // rule/ matches directories only
+    bool anchored;      // matched against the path rather than the name
+    uint32_t tok, ntok; // glob rules only
+};
+
+// The last rule, plus one, with each key; 0 if there is none
+struct entry {
+    char *key;
+    size_t len;
+    uint32_t any;       // among all rules
+    uint32_t files;     // among rules that also match files
+};
+
+struct set {
+    struct entry *slots;
+    size_t cap, n;      // cap is zero or a power of two
+};
+
+struct suffixes {
+    size_t len;
+    struct set set;
+};
+
+struct ignore {
+    struct rule *rules;
+    size_t nrules, rcap;
+    struct set names, paths;
+    struct suffixes *suffix;
+    size_t nsuffix;
+    uint32_t *globs;    // glob rules in ascending order
+    size_t nglobs;
+    struct tok *toks;
+    size_t ntoks, tcap;
+    uint8_t (*classes)[32];
+    size_t nclasses;
+};
+
+static uint64_t hash_bytes(const char *s, size_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t)s[i]) * 1099511628211ull;
+    return h;
+}
+
+static const struct entry *set_find(const struct set *set, const char *key, size_t len)
+{
+    if (!set->n)
+        return NULL;
+    for (size_t i = hash_bytes(key, len) & (set->cap - 1);; i = (i + 1) & (set->cap - 1)) {
+        const struct entry *e = &set->slots[i];
+        if (!e->key)
+            return NULL;
+        if (e->len == len && memcmp(e->key, key, len) == 0)
+            return e;
+    }
+}
+
+static struct entry *set_slot(struct entry *slots, size_t cap, const char *key, size_t len)
+{
+    size_t i = hash_bytes(key, len) & (cap - 1);
+    while (slots[i].key && (slots[i].len != len || memcmp(slots[i].key, key, len) != 0))
+        i = (i + 1) & (cap - 1);
+    return &slots[i];
+}
+
+// Record rule id, later than any before it, under key
+static int set_add(struct set *set, const char *key, size_t len, uint32_t id, bool dir_only)
+{
+    if (2 * (set->n + 1) > set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 64;
+        struct entry *slots = calloc(cap, sizeof(*slots));
+        if (!slots)
+            return -1;
+        for (size_t i = 0; i < set->cap; i++) {
+            if (set->slots[i].key)
+                *set_slot(slots, cap, set->slots[i].key, set->slots[i].len) = set->slots[i];
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->cap = cap;
+    }
+    struct entry *e = set_slot(set->slots, set->cap, key, len);
+    if (!e->key) {
+        if (!(e->key = strndup(key, len)))
+            return -1;
+        e->len = len;
+        set->n++;
+    }
+    e->any = id + 1;
+    if (!dir_only)
+        e->files = id + 1;
+    return 0;
+}
+
+static void set_free(struct set *set)
+{
+    for (size_t i = 0; i < set->cap; i++)
+        free(set->slots[i].key);
+    free(set->slots);
+}
+
+static struct set *suffix_set(struct ignore *ig, size_t len)
+{
+    for (size_t i = 0; i < ig->nsuffix; i++) {
+        if (ig->suffix[i].len == len)
+            return &ig->suffix[i].set;
+    }
+    struct suffixes *s = realloc(ig->suffix, (ig->nsuffix + 1) * sizeof(*s));
+    if (!s)
+        return NULL;
+    ig->suffix = s;
+    s[ig->nsuffix] = (struct suffixes){ .len = len };
+    return &s[ig->nsuffix++].set;
+}
+
+static int add_tok(struct ignore *ig, uint8_t op, uint8_t c, uint32_t cls)
+{
+    if (ig->ntoks == ig->tcap) {
+        size_t cap = ig->tcap ? ig->tcap * 2 : 64;
+        struct tok *t = realloc(ig->toks, cap * sizeof(*t));
+        if (!t)
+            return -1;
+        ig->toks = t;
+        ig->tcap = cap;
+    }
+    ig->toks[ig->ntoks++] = (struct tok){ op, c, cls };
+    return 0;
+}
+
+// Compile the class at p, just past '['; returns the end or NULL if unclosed
+static const char *add_class(const char *p, uint8_t bits[32])
+{
+    bool negate = *p == '!' || *p == '^';
+    if (negate)
+        p++;
+    memset(bits, 0, 32);
+    for (bool first = true; first || *p != ']'; first = false) {
+        if (!*p)
+            return NULL;
+        uint8_t lo = (uint8_t)(*p == '\\' && p[1] ? *++p : *p);
+        uint8_t hi = lo;
+        p++;
+        if (p[0] == '-' && p[1] && p[1] != ']') {
+            p++;
+            hi = (uint8_t)(*p == '\\' && p[1] ? *++p : *p);
+            p++;
+        }
+        for (unsigned c = lo; c <= hi; c++)
+            bits[c / 8] |= (uint8_t)(1u << (c % 8));
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++)
+            bits[i] = (uint8_t)~bits[i];
+    }
+    return p + 1;
+}
+
+static int compile_glob(struct ignore *ig, struct rule *r, const char *p)
+{
+    const char *start = p;
+    r->tok = (uint32_t)ig->ntoks;
+    while (*p) {
+        int rc;
+        if (p[0] == '*' && p[1] == '*' && r->anchored &&
+            (p == start || p[-1] == '/') && (p[2] == '/' || !p[2])) {
+            rc = add_tok(ig, p[2] ? TOK_DIRS : TOK_GLOBSTAR, 0, 0);
+            p += p[2] ? 3 : 2;
+        } else if (*p == '*') {
+            rc = add_tok(ig, TOK_STAR, 0, 0);
+            while (*p == '*')
+                p++;
+        } else if (*p == '?') {
+            rc = add_tok(ig, TOK_ANY, 0, 0);
+            p++;
+        } else if (*p == '[') {
+            uint8_t bits[32];
+            const char *end = add_class(p + 1, bits);
+            if (end) {
+                uint8_t (*cls)[32] = realloc(ig->classes, (ig->nclasses + 1) * sizeof(*cls));
+                if (!cls)
+                    return -1;
+                ig->classes = cls;
+                memcpy(cls[ig->nclasses], bits, 32);
+                rc = add_tok(ig, TOK_CLASS, 0, (uint32_t)ig->nclasses++);
+                p = end;
+            } else {
+                rc = add_tok(ig, TOK_BYTE, '[', 0);
+                p++;
+            }
+        } else {
+            if (*p == '\\' && p[1])
+                p++;
+            rc = add_tok(ig, TOK_BYTE, (uint8_t)*p, 0);
+            p++;
+        }
+        if (rc != 0)
+            return -1;
+    }
+    r->ntok = (uint32_t)(ig->ntoks - r->tok);
+    return 0;
+}
+
+// Remove backslash escapes in place; false if a glob character is left
+static bool unescape_literal(char *s)
+{
+    char *d = s;
+    for (; *s; s++) {
+        if (*s == '*' || *s == '?' || *s == '[')
+            return false;
+        if (*s == '\\' && s[1])
+            s++;
+        *d++ = *s;
+    }
+    *d = '\0';
+    return true;
+}
+
+static int add_rule(struct ignore *ig, char *line)
+{
+    size_t len = strlen(line);
+    while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+        len--;
+    // Trailing spaces do not count unless escaped
+    while (len && line[len - 1] == ' ' && !(len > 1 && line[len - 2] == '\\'))
+        len--;
+    line[len] = '\0';
+    if (!len || line[0] == '#')
+        return 0;
+
+    struct rule r = { 0 };
+    char *p = line;
+    if (*p == '!') {
+        r.negate = true;
+        p++;
+    }
+    len = strlen(p);
+    if (len && p[len - 1] == '/') {
+        r.dir_only = true;
+        p[--len] = '\0';
+    }
+    if (*p == '/') {
+        r.anchored = true;
+        p++;
+    }
+    if (!*p)
+        return 0;
+    if (strchr(p, '/'))
+        r.anchored = true;
+
+    if (ig->nrules == ig->rcap) {
+        size_t cap = ig->rcap ? ig->rcap * 2 : 64;
+        struct rule *rules = realloc(ig->rules, cap * sizeof(*rules));
+        if (!rules)
+            return -1;
+        ig->rules = rules;
+        ig->rcap = cap;
+    }
+    uint32_t id = (uint32_t)ig->nrules;
+
+    char *lit = strdup(p);
+    if (!lit)
+        return -1;
+    int rc = 0;
+    bool literal = unescape_literal(lit), suffix = false;
+    if (!literal && !r.anchored && p[0] == '*' && p[1]) {
+        strcpy(lit, p + 1);
+        suffix = unescape_literal(lit);
+    }
+    if (literal) {
+        rc = set_add(r.anchored ? &ig->paths : &ig->names, lit, strlen(lit), id, r.dir_only);
+    } else if (suffix) {
+        struct set *set = suffix_set(ig, strlen(lit));
+        rc = set ? set_add(set, lit, strlen(lit), id, r.dir_only) : -1;
+    } else {
+        uint32_t *globs = realloc(ig->globs, (ig->nglobs + 1) * sizeof(*globs));
+        rc = globs ? compile_glob(ig, &r, p) : -1;
+        if (globs) {
+            ig->globs = globs;
+            if (rc == 0)
+                globs[ig->nglobs++] = id;
+        }
+    }
+    free(lit);
+    if (rc == 0)
+        ig->rules[ig->nrules++] = r;
+    return rc;
+}
+
+struct ignore *ignore_load(const char *const *files, size_t n)
+{
+    struct ignore *ig = calloc(1, sizeof(*ig));
+    if (!ig) {
+        fprintf(stderr, "finder: out of memory\n");
+        return NULL;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    for (size_t i = 0; i < n; i++) {
+        FILE *fp = fopen(files[i], "r");
+        if (!fp) {
+            fprintf(stderr, "finder: %s: %s\n", files[i], strerror(errno));
+            goto fail;
+        }
+        while (getline(&line, &cap, fp) >= 0) {
+            if (add_rule(ig, line) != 0) {
+                fprintf(stderr, "finder: out of memory\n");
+                fclose(fp);
+                goto fail;
+            }
+        }
+        fclose(fp);
+    }
+    free(line);
+    return ig;
+
+fail:
+    free(line);
+    ignore_free(ig);
+    return NULL;
+}
+
+void ignore_free(struct ignore *ig)
+{
+    if (!ig)
+        return;
+    set_free(&ig->names);
+    set_free(&ig->paths);
+    for (size_t i = 0; i < ig->nsuffix; i++)
+        set_free(&ig->suffix[i].set);
+    free(ig->suffix);
+    free(ig->globs);
+    free(ig->toks);
+    free(ig->classes);
+    free(ig->rules);
+    free(ig);
+}
+
+static bool glob_match(const struct ignore *ig, const struct tok *t,
+                       const struct tok *end, const char *s)
+{
+    for (; t < end; t++) {
+        uint8_t c = (uint8_t)*s;
+        switch (t->op) {
+        case TOK_BYTE:
+            if (c != t->c)
+                return false;
+            break;
+        case TOK_ANY:
+            if (!c || c == '/')
+                return false;
+            break;
+        case TOK_CLASS:
+            if (!c || c == '/' || !(ig->classes[t->cls][c / 8] & (1u << (c % 8))))
+                return false;
+            break;
+        case TOK_STAR:
+            for (;; s++) {
+                if (glob_match(ig, t + 1, end, s))
+                    return true;
+                if (!*s || *s == '/')
+                    return false;
+            }
+        case TOK_GLOBSTAR:
+            return true;
+        case TOK_DIRS:
+            for (;;) {
+                if (glob_match(ig, t + 1, end, s))
+                    return true;
+                const char *slash = strchr(s, '/');
+                if (!slash)
+                    return false;
+                s = slash + 1;
+            }
+        }
+        s++;
+    }
+    return *s == '\0';
+}
+
+// The later of best and what e holds for an entry of this kind
+static uint32_t later(uint32_t best, const struct entry *e, bool dir)
+{
+    if (!e)
+        return best;
+    uint32_t id = dir ? e->any : e->files;
+    return id > best ? id : best;
+}
+
+bool ignore_match(const struct ignore *ig, const char *path, const char *name, bool dir)
+{
+    size_t len = strlen(name);
+    uint32_t best = later(0, set_find(&ig->names, name, len), dir);
+    for (size_t i = 0; i < ig->nsuffix; i++) {
+        size_t n = ig->suffix[i].len;
+        if (n <= len)
+            best = later(best, set_find(&ig->suffix[i].set, name + len - n, n), dir);
+    }
+    if (ig->paths.n)
+        best = later(best, set_find(&ig->paths, path, strlen(path)), dir);
+
+    for (size_t i = ig->nglobs; i > 0 && ig->globs[i - 1] + 1 > best; i--) {
+        const struct rule *r = &ig->rules[ig->globs[i - 1]];
+        if (r->dir_only && !dir)
+            continue;
+        const struct tok *t = ig->toks + r->tok;
+        if (glob_match(ig, t, t + r->ntok, r->anchored ? path : name)) {
+            best = ig->globs[i - 1] + 1;
+            break;
+        }
+    }
+    return best && !ig->rules[best - 1].negate;
+}
+
+bool ignore_path(const struct ignore *ig, const char *path)
+{
+    char buf[PATH_MAX];
+    size_t len = strlen(path);
+    if (len >= sizeof(buf))
+        return false;
+    memcpy(buf, path, len + 1);
+    const char *name = buf;
+    for (char *slash = buf; (slash = strchr(slash, '/')) != NULL; name = ++slash) {
+        *slash = '\0';
+        bool hit = ignore_match(ig, buf, name, true);
+        *slash = '/';
+        if (hit)
+            return true;
+    }
+    return ignore_match(ig, buf, name, false);
+}
@@ -0,0 +1,50 @@
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Paths to leave out of a walk, given as rule files in .gitignore syntax
+ * relative to the root of the walk.
+ *
+ * Rules are compiled by shape so most of them cost a hash lookup rather
+ * than a glob match per directory entry:
+ *
+ *   node_modules, .git      the whole name, in a hash set of names
+ *   *.o, *~                 a literal suffix, in a hash set per length
+ *   /build, docs/tmp        a whole path from the root, in a hash set
+ *   anything else           a glob compiled to tokens with byte classes
+ *
+ * As in git the last rule that matches decides, so globs are tried from
+ * the last rule back and only while they could still beat the rule a hash
+ * set found.
+ */
+struct ignore;
+
+/**
+ * @param files rule files, read in order as if concatenated
+ * @return the compiled rules, or NULL after printing the reason to stderr
+ */
+struct ignore *ignore_load(const char *const *files, size_t n);
+
+void ignore_free(struct ignore *ig);
+
+/**
+ * Decide one directory entry, its parent directories having been let
+ * through already.
+ * @param path the entry's path relative to the root, without a leading '/'
+ * @param name the entry's last component, within path
+ * @param dir whether the entry is a directory
+ * @return true if the entry and, for a directory, everything below it is
+ *   ignored
+ */
+bool ignore_match(const struct ignore *ig, const char *path, const char *name, bool dir);
+
+/**
+ * Decide a file by its path relative to the root, checking each of its
+ * parent directories first.
+ */
+bool ignore_path(const struct ignore *ig, const char *path);
+
+#endif
@@ -0,0 +1,637 @@
+#include "index.h"
+#include "scan.h"
+#include "trigram.h"
+#include "walk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define EMPTY UINT32_MAX
+
+// Posting list being built, one hash table slot per distinct trigram
+struct posting {
+    uint32_t trigram;
+    uint32_t last;          // last file id appended
+    uint32_t count;
+    uint32_t len;
+    uint32_t cap;
+    uint8_t *buf;
+};
+
+struct builder {
+    size_t rootlen;
+    struct trigram_set set;
+    char *buf;
+    struct index_file *files;
+    size_t nfiles;
+    size_t fcap;
+    struct index_dir *dirs;
+    size_t ndirs;
+    size_t dcap;
+    char *names;
+    size_t nlen;
+    size_t ncap;
+    struct posting *slots;
+    size_t nslots;          // power of two
+    size_t nused;
+};
+
+struct index {
+    const uint8_t *map;
+    size_t size;
+    const struct index_header *hdr;
+    const struct index_file *files;
+    const struct index_dir *dirs;
+    const char *names;
+    const struct index_trigram *trigrams;
+    const uint8_t *postings;
+};
+
+static size_t align8(size_t off)
+{
+    return (off + 7) & ~(size_t)7;
+}
+
+static size_t slot_of(const struct builder *b, uint32_t t)
+{
+    return (size_t)(((uint64_t)t * 0x9E3779B97F4A7C15ull) >> 32) & (b->nslots - 1);
+}
+
+static int postings_grow(struct builder *b)
+{
+    size_t nslots = b->nslots ? b->nslots * 2 : 1u << 16;
+    struct posting *slots = calloc(nslots, sizeof(*slots));
+    if (!slots)
+        return -1;
+    for (size_t i = 0; i < nslots; i++)
+        slots[i].trigram = EMPTY;
+
+    struct posting *old = b->slots;
+    size_t nold = b->nslots;
+    b->slots = slots;
+    b->nslots = nslots;
+    for (size_t i = 0; i < nold; i++) {
+        if (old[i].trigram == EMPTY)
+            continue;
+        size_t s = slot_of(b, old[i].trigram);
+        while (slots[s].trigram != EMPTY)
+            s = (s + 1) & (nslots - 1);
+        slots[s] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static int posting_add(struct builder *b, uint32_t t, uint32_t id)
+{
+    if ((b->nused + 1) * 4 > b->nslots * 3 && postings_grow(b) != 0)
+        return -1;
+
+    size_t s = slot_of(b, t);
+    while (b->slots[s].trigram != EMPTY && b->slots[s].trigram != t)
+        s = (s + 1) & (b->nslots - 1);
+    struct posting *p = &b->slots[s];
+    uint32_t delta = id;
+    if (p->trigram == EMPTY) {
+        p->trigram = t;
+        b->nused++;
+    } else {
+        delta = id - p->last;
+    }
+
+    if (p->len + 5 > p->cap) {
+        uint32_t cap = p->cap ? p->cap * 2 : 8;
+        uint8_t *buf = realloc(p->buf, cap);
+        if (!buf)
+            return -1;
+        p->buf = buf;
+        p->cap = cap;
+    }
+    while (delta >= 0x80) {
+        p->buf[p->len++] = (uint8_t)(delta | 0x80);
+        delta >>= 7;
+    }
+    p->buf[p->len++] = (uint8_t)delta;
+    p->last = id;
+    p->count++;
+    return 0;
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// Add a path relative to the root to the pool, returning its offset
+static int add_name(struct builder *b, const char *rel, uint64_t *off)
+{
+    size_t rlen = strlen(rel) + 1;
+    if (b->nlen + rlen > b->ncap) {
+        size_t cap = b->ncap ? b->ncap : 64 * 1024;
+        while (cap < b->nlen + rlen)
+            cap *= 2;
+        char *names = realloc(b->names, cap);
+        if (!names)
+            return -1;
+        b->names = names;
+        b->ncap = cap;
+    }
+    *off = b->nlen;
+    memcpy(b->names + b->nlen, rel, rlen);
+    b->nlen += rlen;
+    return 0;
+}
+
+static int on_index_dir(void *arg, const char *path)
+{
+    struct builder *b = arg;
+    const char *rel = strlen(path) > b->rootlen + 1 ? path + b->rootlen + 1 : "";
+
+    // Taken before the directory is read, so an entry added meanwhile
+    // leaves the index stale rather than missing it unnoticed
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    if (b->ndirs >= UINT32_MAX) {
+        fprintf(stderr, "finder: too many directories to index\n");
+        return -1;
+    }
+    if (b->ndirs == b->dcap) {
+        size_t cap = b->dcap ? b->dcap * 2 : 256;
+        struct index_dir *dirs = realloc(b->dirs, cap * sizeof(*dirs));
+        if (!dirs)
+            goto oom;
+        b->dirs = dirs;
+        b->dcap = cap;
+    }
+    struct index_dir *d = &b->dirs[b->ndirs];
+    d->mtime_ns = mtime_ns(&st);
+    if (add_name(b, rel, &d->name_off) != 0)
+        goto oom;
+    b->ndirs++;
+    return 0;
+
+oom:
+    fprintf(stderr, "finder: out of memory indexing %s\n", path);
+    return -1;
+}
+
+static int on_index_file(void *arg, int dirfd, const char *name,
+                         const char *path, const struct stat *st)
+{
+    struct builder *b = arg;
+    const char *rel = path + b->rootlen + 1;
+
+    // The index records each file's identity, which the walk may not know
+    struct stat sb;
+    if (!st) {
+        if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+            fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+            return 0;
+        }
+        st = &sb;
+    }
+
+    if (b->nfiles >= UINT32_MAX) {
+        fprintf(stderr, "finder: too many files to index\n");
+        return -1;
+    }
+    if (b->nfiles == b->fcap) {
+        size_t cap = b->fcap ? b->fcap * 2 : 1024;
+        struct index_file *files = realloc(b->files, cap * sizeof(*files));
+        if (!files)
+            goto oom;
+        b->files = files;
+        b->fcap = cap;
+    }
+
+    uint32_t id = (uint32_t)b->nfiles;
+    struct index_file *f = &b->files[id];
+    f->dev = st->st_dev;
+    f->ino = st->st_ino;
+    f->size = (uint64_t)st->st_size;
+    f->mtime_ns = mtime_ns(st);
+    if (add_name(b, rel, &f->name_off) != 0)
+        goto oom;
+    b->nfiles++;
+
+    if (trigram_file(&b->set, dirfd, name, b->buf, SCAN_BUFSZ, NULL) != 0) {
+        if (errno == ENOMEM)
+            goto oom;
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    for (size_t i = 0; i < b->set.n; i++) {
+        if (posting_add(b, b->set.list[i], id) != 0)
+            goto oom;
+    }
+    return 0;
+
+oom:
+    fprintf(stderr, "finder: out of memory indexing %s\n", path);
+    return -1;
+}
+
+static int cmp_posting(const void *a, const void *b)
+{
+    uint32_t x = (*(struct posting *const *)a)->trigram;
+    uint32_t y = (*(struct posting *const *)b)->trigram;
+    return x < y ? -1 : x > y;
+}
+
+static int write_pad(FILE *fp, size_t off)
+{
+    static const char zero[8];
+    size_t pad = align8(off) - off;
+    return fwrite(zero, 1, pad, fp) == pad ? 0 : -1;
+}
+
+static int index_write(const struct builder *b, const char *root, const char *file)
+{
+    struct posting **sorted = malloc((b->nused ? b->nused : 1) * sizeof(*sorted));
+    if (!sorted) {
+        fprintf(stderr, "finder: out of memory writing %s\n", file);
+        return -1;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < b->nslots; i++) {
+        if (b->slots[i].trigram != EMPTY)
+            sorted[k++] = &b->slots[i];
+    }
+    qsort(sorted, k, sizeof(*sorted), cmp_posting);
+
+    struct index_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.nfiles = (uint32_t)b->nfiles;
+    h.ntrigrams = (uint32_t)k;
+    h.ndirs = (uint32_t)b->ndirs;
+    size_t rootlen = strlen(root) + 1;
+    size_t off = sizeof(h);
+    h.root_off = off;
+    off = align8(off + rootlen);
+    h.files_off = off;
+    off += b->nfiles * sizeof(struct index_file);
+    h.dirs_off = off;
+    off += b->ndirs * sizeof(struct index_dir);
+    h.names_off = off;
+    off = align8(off + b->nlen);
+    h.trigrams_off = off;
+    off += k * sizeof(struct index_trigram);
+    h.postings_off = off;
+    for (size_t i = 0; i < k; i++)
+        off += sorted[i]->len;
+    h.size = off;
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", file, (int)getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        perror(tmp);
+        free(sorted);
+        return -1;
+    }
+
+    int rc = 0;
+    if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+        fwrite(root, 1, rootlen, fp) != rootlen ||
+        write_pad(fp, sizeof(h) + rootlen) != 0 ||
+        fwrite(b->files, sizeof(struct index_file), b->nfiles, fp) != b->nfiles ||
+        fwrite(b->dirs, sizeof(struct index_dir), b->ndirs, fp) != b->ndirs ||
+        fwrite(b->names, 1, b->nlen, fp) != b->nlen ||
+        write_pad(fp, h.names_off + b->nlen) != 0)
+        rc = -1;
+    uint64_t poff = 0;
+    for (size_t i = 0; rc == 0 && i < k; i++) {
+        struct index_trigram t = { sorted[i]->trigram, sorted[i]->count, poff };
+        if (fwrite(&t, sizeof(t), 1, fp) != 1)
+            rc = -1;
+        poff += sorted[i]->len;
+    }
+    for (size_t i = 0; rc == 0 && i < k; i++) {
+        if (fwrite(sorted[i]->buf, 1, sorted[i]->len, fp) != sorted[i]->len)
+            rc = -1;
+    }
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+        rc = -1;
+    if (rc != 0)
+        fprintf(stderr, "finder: %s: %s\n", tmp, strerror(errno));
+    fclose(fp);
+    free(sorted);
+
+    if (rc == 0 && rename(tmp, file) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", file, strerror(errno));
+        rc = -1;
+    }
+    if (rc != 0)
+        unlink(tmp);
+    return rc;
+}
+
+int index_build(const char *dir, const char *file)
+{
+    char root[PATH_MAX];
+    if (!realpath(dir, root)) {
+        fprintf(stderr, "finder: %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    struct builder b;
+    memset(&b, 0, sizeof(b));
+    b.rootlen = strlen(root);
+    if (b.rootlen == 1)
+        b.rootlen = 0;
+    b.buf = malloc(SCAN_BUFSZ);
+    int rc = -1;
+    if (!b.buf || trigram_set_init(&b.set) != 0 || postings_grow(&b) != 0)
+        fprintf(stderr, "finder: out of memory\n");
+    else if (walk_tree(root, on_index_file, on_index_dir, &b, NULL, 0, NULL) == 0)
+        rc = index_write(&b, root, file);
+
+    for (size_t i = 0; i < b.nslots; i++)
+        free(b.slots[i].buf);
+    free(b.slots);
+    free(b.files);
+    free(b.dirs);
+    free(b.names);
+    free(b.buf);
+    trigram_set_free(&b.set);
+    return rc;
+}
+
+struct index *index_open(const char *file)
+{
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "finder: %s: %s\n", file, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", file, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size < sizeof(struct index_header)) {
+        fprintf(stderr, "finder: %s: not a finder index\n", file);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "finder: %s: %s\n", file, strerror(errno));
+        return NULL;
+    }
+
+    struct index *idx = calloc(1, sizeof(*idx));
+    if (!idx) {
+        munmap(map, size);
+        return NULL;
+    }
+    idx->map = map;
+    idx->size = size;
+    idx->hdr = map;
+
+    // Check the layout once so lookups need no bounds checks
+    const struct index_header *h = idx->hdr;
+    if (memcmp(h->magic, INDEX_MAGIC_PREFIX, strlen(INDEX_MAGIC_PREFIX)) == 0 &&
+        memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0) {
+        fprintf(stderr, "finder: %s: built by another version of finder, build it again\n",
+                file);
+        index_close(idx);
+        return NULL;
+    }
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0 || h->size != size ||
+        h->root_off >= h->files_off ||
+        h->files_off + (uint64_t)h->nfiles * sizeof(struct index_file) > h->dirs_off ||
+        h->dirs_off + (uint64_t)h->ndirs * sizeof(struct index_dir) > h->names_off ||
+        h->names_off > h->trigrams_off ||
+        h->trigrams_off + (uint64_t)h->ntrigrams * sizeof(struct index_trigram) > h->postings_off ||
+        h->postings_off > size || idx->map[h->files_off - 1] != '\0' ||
+        (h->trigrams_off > h->names_off && idx->map[h->trigrams_off - 1] != '\0')) {
+        fprintf(stderr, "finder: %s: not a finder index or corrupt\n", file);
+        index_close(idx);
+        return NULL;
+    }
+    idx->files = (const struct index_file *)(idx->map + h->files_off);
+    idx->dirs = (const struct index_dir *)(idx->map + h->dirs_off);
+    idx->names = (const char *)(idx->map + h->names_off);
+    idx->trigrams = (const struct index_trigram *)(idx->map + h->trigrams_off);
+    idx->postings = idx->map + h->postings_off;
+    return idx;
+}
+
+void index_close(struct index *idx)
+{
+    if (!idx)
+        return;
+    munmap((void *)idx->map, idx->size);
+    free(idx);
+}
+
+const char *index_root(const struct index *idx)
+{
+    return (const char *)idx->map + idx->hdr->root_off;
+}
+
+uint32_t index_nfiles(const struct index *idx)
+{
+    return idx->hdr->nfiles;
+}
+
+const struct index_file *index_file(const struct index *idx, uint32_t id)
+{
+    return &idx->files[id];
+}
+
+const char *index_name(const struct index *idx, uint32_t id)
+{
+    return idx->names + idx->files[id].name_off;
+}
+
+const char *index_stale(const struct index *idx, int rootfd)
+{
+    struct stat st;
+    for (uint32_t i = 0; i < idx->hdr->ndirs; i++) {
+        const char *name = idx->names + idx->dirs[i].name_off;
+        if (!name[0])
+            name = ".";
+        if (fstatat(rootfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISDIR(st.st_mode) ||
+            mtime_ns(&st) != idx->dirs[i].mtime_ns)
+            return name;
+    }
+    for (uint32_t i = 0; i < idx->hdr->nfiles; i++) {
+        const struct index_file *f = &idx->files[i];
+        const char *name = idx->names + f->name_off;
+        if (fstatat(rootfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+            (uint64_t)st.st_size != f->size || mtime_ns(&st) != f->mtime_ns)
+            return name;
+    }
+    return NULL;
+}
+
+static const struct index_trigram *lookup(const struct index *idx, uint32_t t)
+{
+    size_t lo = 0, hi = idx->hdr->ntrigrams;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->trigrams[mid].trigram < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < idx->hdr->ntrigrams && idx->trigrams[lo].trigram == t)
+        return &idx->trigrams[lo];
+    return NULL;
+}
+
+uint32_t index_ntrigrams(const struct index *idx)
+{
+    return idx->hdr->ntrigrams;
+}
+
+const struct index_trigram *index_trigram_at(const struct index *idx, uint32_t k)
+{
+    return &idx->trigrams[k];
+}
+
+size_t index_decode(const struct index *idx, const struct index_trigram *t,
+                    uint32_t *ids)
+{
+    const uint8_t *p = idx->postings + t->off;
+    const uint8_t *end = idx->map + idx->size;
+    uint32_t id = 0;
+    size_t n = 0;
+    for (; n < t->count && p < end; n++) {
+        uint32_t delta = 0;
+        int shift = 0;
+        while (p < end && (*p & 0x80) && shift < 28) {
+            delta |= (uint32_t)(*p++ & 0x7f) << shift;
+            shift += 7;
+        }
+        if (p < end)
+            delta |= (uint32_t)*p++ << shift;
+        id = n == 0 ? delta : id + delta;
+        ids[n] = id;
+    }
+    return n;
+}
+
+static int cmp_count(const void *a, const void *b)
+{
+    uint32_t x = (*(const struct index_trigram *const *)a)->count;
+    uint32_t y = (*(const struct index_trigram *const *)b)->count;
+    return x < y ? -1 : x > y;
+}
+
+// Mark the files holding every trigram in tris, rarest trigram first
+static int mark_pattern(const struct index *idx, const uint32_t *tris, size_t n,
+                        uint8_t *mark)
+{
+    const struct index_trigram **lists = malloc(n * sizeof(*lists));
+    if (!lists)
+        return -1;
+    for (size_t i = 0; i < n; i++) {
+        lists[i] = lookup(idx, tris[i]);
+        if (!lists[i]) {
+            free(lists);
+            return 0;
+        }
+    }
+    qsort(lists, n, sizeof(*lists), cmp_count);
+
+    uint32_t *cand = malloc(lists[0]->count * sizeof(uint32_t));
+    uint32_t *other = malloc(lists[0]->count * sizeof(uint32_t));
+    uint32_t *next = n > 1 ? malloc(lists[n - 1]->count * sizeof(uint32_t)) : NULL;
+    if (!cand || !other || (n > 1 && !next)) {
+        free(cand);
+        free(other);
+        free(next);
+        free(lists);
+        return -1;
+    }
+
+    size_t nc = index_decode(idx, lists[0], cand);
+    for (size_t i = 1; i < n && nc; i++) {
+        if (lists[i] == lists[i - 1])
+            continue;
+        size_t nn = index_decode(idx, lists[i], next), a = 0, b = 0, k = 0;
+        while (a < nc && b < nn) {
+            if (cand[a] < next[b])
+                a++;
+            else if (cand[a] > next[b])
+                b++;
+            else {
+                other[k++] = cand[a];
+                a++;
+                b++;
+            }
+        }
+        uint32_t *swap = cand;
+        cand = other;
+        other = swap;
+        nc = k;
+    }
+    for (size_t i = 0; i < nc; i++) {
+        if (cand[i] < idx->hdr->nfiles)
+            mark[cand[i]] = 1;
+    }
+
+    free(cand);
+    free(other);
+    free(next);
+    free(lists);
+    return 0;
+}
+
+int index_candidates(const struct index *idx, const char *const *patterns,
+                     size_t n, bool fixed, uint32_t **ids, size_t *nids)
+{
+    uint32_t nfiles = idx->hdr->nfiles;
+    uint8_t *mark = calloc(nfiles ? nfiles : 1, 1);
+    if (!mark)
+        return -1;
+
+    bool all = false;
+    for (size_t i = 0; i < n && !all; i++) {
+        uint32_t *tris;
+        size_t ntris;
+        if (trigram_query(patterns[i], fixed, &tris, &ntris) != 0) {
+            free(mark);
+            return -1;
+        }
+        if (ntris == 0)
+            all = true;
+        else if (mark_pattern(idx, tris, ntris, mark) != 0) {
+            free(tris);
+            free(mark);
+            return -1;
+        }
+        free(tris);
+    }
+
+    *ids = malloc((nfiles ? nfiles : 1) * sizeof(uint32_t));
+    if (!*ids) {
+        free(mark);
+        return -1;
+    }
+    size_t k = 0;
+    for (uint32_t id = 0; id < nfiles; id++) {
+        if (all || mark[id])
+            (*ids)[k++] = id;
+    }
+    *nids = k;
+    free(mark);
+    return 0;
+}
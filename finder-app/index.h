@@ -0,0 +1,124 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Persistent trigram index of a directory tree.
+ *
+ * The file is written in host byte order and memory-mapped read-only when
+ * queried, so opening it costs one mmap() regardless of its size:
+ *
+ *   struct index_header
+ *   root directory, NUL-terminated
+ *   struct index_file[nfiles]        in traversal order
+ *   struct index_dir[ndirs]          in traversal order, the root first
+ *   path pool                        NUL-terminated, relative to the root
+ *   struct index_trigram[ntrigrams]  sorted by trigram
+ *   posting lists                    ascending file ids as LEB128 deltas
+ *
+ * The index is a snapshot. Files and directories keep the size and
+ * modification time they had when it was built, so index_stale() can
+ * tell when a file was added, removed or renamed, which changes its
+ * directory's time, or when any file was written to.
+ */
+#define INDEX_MAGIC "FNDRIDX2"
+// Indexes of other versions start the same way
+#define INDEX_MAGIC_PREFIX "FNDRIDX"
+
+struct index_header {
+    char magic[8];
+    uint32_t nfiles;
+    uint32_t ntrigrams;
+    uint32_t ndirs;
+    uint32_t reserved;
+    uint64_t root_off;
+    uint64_t files_off;
+    uint64_t dirs_off;
+    uint64_t names_off;
+    uint64_t trigrams_off;
+    uint64_t postings_off;
+    uint64_t size;              // total file size
+};
+
+struct index_file {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t name_off;          // offset into the path pool
+};
+
+struct index_dir {
+    int64_t mtime_ns;
+    uint64_t name_off;          // offset into the path pool, "" for the root
+};
+
+struct index_trigram {
+    uint32_t trigram;
+    uint32_t count;             // number of files containing it
+    uint64_t off;               // offset into the posting lists
+};
+
+struct index;
+
+/**
+ * Index every regular file below dir and write the result to file. The
+ * index is written to a temporary name and renamed into place, so readers
+ * holding the previous index mapped are unaffected.
+ * @return 0 on success, -1 after printing the reason to stderr
+ */
+int index_build(const char *dir, const char *file);
+
+/**
+ * @return the mapped index, or NULL after printing the reason to stderr
+ */
+struct index *index_open(const char *file);
+
+void index_close(struct index *idx);
+
+// Canonical path of the directory the index was built from
+const char *index_root(const struct index *idx);
+
+uint32_t index_nfiles(const struct index *idx);
+
+const struct index_file *index_file(const struct index *idx, uint32_t id);
+
+// Path of a file relative to the index root
+const char *index_name(const struct index *idx, uint32_t id);
+
+/**
+ * Check the tree against the index: every directory's modification time,
+ * and every file's size and modification time. Only files that may match
+ * are read, but any file written to since may now match.
+ * @param rootfd the indexed directory
+ * @return the path of the first file or directory that changed, relative
+ *   to the root and "." for the root itself, or NULL if none did
+ */
+const char *index_stale(const struct index *idx, int rootfd);
+
+uint32_t index_ntrigrams(const struct index *idx);
+
+// The k-th trigram in ascending order
+const struct index_trigram *index_trigram_at(const struct index *idx, uint32_t k);
+
+/**
+ * Decode the posting list of t.
+ * @param ids receives the ascending file ids, must hold t->count entries
+ * @return the number of ids decoded
+ */
+size_t index_decode(const struct index *idx, const struct index_trigram *t,
+                    uint32_t *ids);
+
+/**
+ * Find the files that may hold a line matching any of the patterns.
+ * @param ids receives a malloc'd ascending array of file ids
+ * @param nids receives the number of ids
+ * @return 0 on success, -1 if memory could not be allocated
+ */
+int index_candidates(const struct index *idx, const char *const *patterns,
+                     size_t n, bool fixed, uint32_t **ids, size_t *nids);
+
+#endif
@@ -0,0 +1,246 @@
+#include "libfinder.h"
+#include "finder.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Strings the query owns, grown as they are added
+struct strlist {
+    char **v;
+    size_t n;
+    size_t cap;
+};
+
+struct finder_query {
+    char *dir;
+    struct strlist patterns;
+    struct strlist include;
+    struct strlist exclude;
+    struct strlist ignore;
+    char *index;
+    char *cache;
+    unsigned flags;
+    unsigned threads;
+    unsigned max_errors;
+    uint64_t max_count;
+    uint64_t max_size;
+    size_t top_k;
+    finder_query_file_fn on_file;
+    void *on_file_arg;
+    bool cancel;                    // set to stop the run in progress
+    struct finder_result res;       // of the last run, zeroed if it failed
+};
+
+static int strlist_add(struct strlist *l, const char *s)
+{
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 8;
+        char **v = realloc(l->v, cap * sizeof(char *));
+        if (!v)
+            return -1;
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->n] = strdup(s);
+    return l->v[l->n++] ? 0 : -1;
+}
+
+static void strlist_free(struct strlist *l)
+{
+    for (size_t i = 0; i < l->n; i++)
+        free(l->v[i]);
+    free(l->v);
+}
+
+// Replace an optional path with a copy of path
+static int set_path(char **dst, const char *path)
+{
+    char *copy = NULL;
+    if (path && !(copy = strdup(path)))
+        return -1;
+    free(*dst);
+    *dst = copy;
+    return 0;
+}
+
+struct finder_query *finder_query_new(const char *dir)
+{
+    struct finder_query *q = calloc(1, sizeof(*q));
+    if (!q)
+        return NULL;
+    if (!(q->dir = strdup(dir))) {
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+void finder_query_free(struct finder_query *q)
+{
+    if (!q)
+        return;
+    finder_result_free(&q->res);
+    strlist_free(&q->patterns);
+    strlist_free(&q->include);
+    strlist_free(&q->exclude);
+    strlist_free(&q->ignore);
+    free(q->index);
+    free(q->cache);
+    free(q->dir);
+    free(q);
+}
+
+int finder_query_add_pattern(struct finder_query *q, const char *pattern)
+{
+    return strlist_add(&q->patterns, pattern);
+}
+
+void finder_query_set_flags(struct finder_query *q, unsigned flags)
+{
+    q->flags = flags;
+}
+
+void finder_query_set_threads(struct finder_query *q, unsigned threads)
+{
+    q->threads = threads;
+}
+
+void finder_query_set_max_errors(struct finder_query *q, unsigned max_errors)
+{
+    q->max_errors = max_errors;
+}
+
+void finder_query_set_max_count(struct finder_query *q, uint64_t max_count)
+{
+    q->max_count = max_count;
+}
+
+void finder_query_set_max_size(struct finder_query *q, uint64_t max_size)
+{
+    q->max_size = max_size;
+}
+
+void finder_query_set_top_k(struct finder_query *q, size_t top_k)
+{
+    q->top_k = top_k;
+}
+
+int finder_query_set_index(struct finder_query *q, const char *indexfile)
+{
+    return set_path(&q->index, indexfile);
+}
+
+int finder_query_set_cache(struct finder_query *q, const char *cachefile)
+{
+    return set_path(&q->cache, cachefile);
+}
+
+int finder_query_add_include(struct finder_query *q, const char *glob)
+{
+    return strlist_add(&q->include, glob);
+}
+
+int finder_query_add_exclude(struct finder_query *q, const char *glob)
+{
+    return strlist_add(&q->exclude, glob);
+}
+
+int finder_query_add_ignore_file(struct finder_query *q, const char *file)
+{
+    return strlist_add(&q->ignore, file);
+}
+
+void finder_query_on_file(struct finder_query *q, finder_query_file_fn fn, void *arg)
+{
+    q->on_file = fn;
+    q->on_file_arg = arg;
+}
+
+// Pass the engine's per-file results on without the fields callers do not see
+static void forward_file(void *arg, const struct finder_file *f)
+{
+    const struct finder_query *q = arg;
+    q->on_file(q->on_file_arg, f->path, f->lines, f->npatterns);
+}
+
+void finder_query_cancel(struct finder_query *q)
+{
+    __atomic_store_n(&q->cancel, true, __ATOMIC_RELAXED);
+}
+
+int finder_query_run(struct finder_query *q)
+{
+    finder_result_free(&q->res);
+    __atomic_store_n(&q->cancel, false, __ATOMIC_RELAXED);
+
+    struct finder_opts opts = {
+        .dir = q->dir,
+        .patterns = (const char *const *)q->patterns.v,
+        .npatterns = q->patterns.n,
+        .fixed_strings = q->flags & FINDER_FIXED_STRINGS,
+        .fuzzy = q->max_errors > 0,
+        .max_errors = q->max_errors,
+        .index = q->index,
+        .cache = q->cache,
+        .threads = q->threads,
+        .sync_io = q->flags & FINDER_SYNC_IO,
+        .on_file = q->on_file ? forward_file : NULL,
+        .on_file_arg = q,
+        .top_k = q->top_k,
+        .max_count = q->max_count,
+        .cancel = &q->cancel,
+        .skip_binary = q->flags & FINDER_SKIP_BINARY,
+        .max_size = q->max_size,
+        .decompress = q->flags & FINDER_DECOMPRESS,
+        .include = (const char *const *)q->include.v,
+        .ninclude = q->include.n,
+        .exclude = (const char *const *)q->exclude.v,
+        .nexclude = q->exclude.n,
+        .ignore_files = (const char *const *)q->ignore.v,
+        .nignore_files = q->ignore.n,
+        .follow_links = q->flags & FINDER_FOLLOW_LINKS,
+        .dedup = q->flags & FINDER_DEDUP,
+        .low_impact = q->flags & FINDER_LOW_IMPACT,
+    };
+    if (finder_run(&opts, &q->res) != 0) {
+        finder_result_free(&q->res);
+        memset(&q->res, 0, sizeof(q->res));
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t finder_query_files(const struct finder_query *q)
+{
+    return q->res.files;
+}
+
+size_t finder_query_npatterns(const struct finder_query *q)
+{
+    return q->patterns.n;
+}
+
+uint64_t finder_query_lines(const struct finder_query *q, size_t i)
+{
+    return i < q->res.npatterns ? q->res.lines[i] : 0;
+}
+
+int finder_query_stopped(const struct finder_query *q)
+{
+    return q->res.stopped;
+}
+
+size_t finder_query_ntop(const struct finder_query *q)
+{
+    return q->res.ntop;
+}
+
+const char *finder_query_top(const struct finder_query *q, size_t i, uint64_t *lines)
+{
+    if (i >= q->res.ntop)
+        return NULL;
+    if (lines)
+        *lines = q->res.top[i].lines;
+    return q->res.top[i].path;
+}
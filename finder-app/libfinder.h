@@ -0,0 +1,136 @@
+#ifndef LIBFINDER_H
+#define LIBFINDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The finder engine for programs that link it in, rather than running
+ * finder and reading its output.
+ *
+ * A query is opened on a directory, given its patterns and options, and
+ * run as often as wanted; each run reads the tree as it is then and
+ * replaces the previous run's counts. The query owns copies of every
+ * string it is given. A query is used by one thread at a time; separate
+ * queries may run at once.
+ *
+ * Functions returning int return 0 on success and -1 on failure. The
+ * reason for a failed run, such as an invalid pattern or a missing
+ * directory, is printed to stderr as finder does.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FINDER_API __attribute__((visibility("default")))
+
+struct finder_query;
+
+// Flags for finder_query_set_flags(), as finder's options of the same effect
+#define FINDER_FIXED_STRINGS    0x01    // patterns are literals (-F)
+#define FINDER_SKIP_BINARY      0x02    // skip files with a NUL in the first block (-I)
+#define FINDER_DECOMPRESS       0x04    // match gzip and zstd files decompressed (-z)
+#define FINDER_FOLLOW_LINKS     0x08    // follow symbolic links (-L)
+#define FINDER_DEDUP            0x10    // read each inode once (--dedup)
+#define FINDER_LOW_IMPACT       0x20    // leave the page cache as found (--low-impact)
+#define FINDER_SYNC_IO          0x40    // plain reads instead of io_uring (-U)
+
+/**
+ * Called with each file's counts as soon as they are known, in no
+ * particular order. Calls are serialized but may come from any thread.
+ * @param lines matching lines per pattern, npatterns entries
+ */
+typedef void (*finder_query_file_fn)(void *arg, const char *path,
+                                     const uint64_t *lines, size_t npatterns);
+
+/**
+ * @param dir the directory to search
+ * @return a query with no patterns, NULL if memory ran out
+ */
+FINDER_API struct finder_query *finder_query_new(const char *dir);
+
+FINDER_API void finder_query_free(struct finder_query *q);
+
+// Add a basic regex, or a literal with FINDER_FIXED_STRINGS
+FINDER_API int finder_query_add_pattern(struct finder_query *q, const char *pattern);
+
+// Replace the flags, an or of FINDER_ values
+FINDER_API void finder_query_set_flags(struct finder_query *q, unsigned flags);
+
+// Matcher threads, 0 for one per CPU
+FINDER_API void finder_query_set_threads(struct finder_query *q, unsigned threads);
+
+// Match patterns literally with up to max_errors bytes edited (--max-errors),
+// 0 to match them as usual
+FINDER_API void finder_query_set_max_errors(struct finder_query *q, unsigned max_errors);
+
+// Stop once this many lines match, 0 for no limit (--max-count)
+FINDER_API void finder_query_set_max_count(struct finder_query *q, uint64_t max_count);
+
+// Skip files larger than this, 0 for no limit (--max-size)
+FINDER_API void finder_query_set_max_size(struct finder_query *q, uint64_t max_size);
+
+// Keep this many files with the most matching lines (-k)
+FINDER_API void finder_query_set_top_k(struct finder_query *q, size_t top_k);
+
+// A trigram index of the directory to narrow the scan (-i), NULL for none
+FINDER_API int finder_query_set_index(struct finder_query *q, const char *indexfile);
+
+// A per-file result cache to consult and update (-c), NULL for none
+FINDER_API int finder_query_set_cache(struct finder_query *q, const char *cachefile);
+
+// Only read files whose name matches one of the globs added (--include)
+FINDER_API int finder_query_add_include(struct finder_query *q, const char *glob);
+
+// Never read files whose name matches a glob added (--exclude)
+FINDER_API int finder_query_add_exclude(struct finder_query *q, const char *glob);
+
+// Leave out what a .gitignore-style file, relative to dir, lists (--ignore-file)
+FINDER_API int finder_query_add_ignore_file(struct finder_query *q, const char *file);
+
+// Receive each file's counts during runs, NULL for none
+FINDER_API void finder_query_on_file(struct finder_query *q, finder_query_file_fn fn, void *arg);
+
+/**
+ * Search the tree. Counts of a failed run read as zero.
+ * @return 0 on success, also when max_count or finder_query_cancel()
+ *   stopped the run early, -1 if the patterns could not be compiled or the
+ *   directory could not be opened
+ */
+FINDER_API int finder_query_run(struct finder_query *q);
+
+/**
+ * Stop the run in progress, as max_count does, from the on_file callback
+ * or another thread. The walk stops at its next file and the files being
+ * read within a buffer, and the callback is not called again.
+ */
+FINDER_API void finder_query_cancel(struct finder_query *q);
+
+// Regular files found by the last run
+FINDER_API uint64_t finder_query_files(const struct finder_query *q);
+
+FINDER_API size_t finder_query_npatterns(const struct finder_query *q);
+
+// Lines the last run found matching pattern i, in the order added
+FINDER_API uint64_t finder_query_lines(const struct finder_query *q, size_t i);
+
+// Whether the last run stopped at max_count or was cancelled, so its counts
+// are partial
+FINDER_API int finder_query_stopped(const struct finder_query *q);
+
+// Files kept by the last run with top_k, at most top_k
+FINDER_API size_t finder_query_ntop(const struct finder_query *q);
+
+/**
+ * @param i 0 for the file with the most matching lines
+ * @param lines receives its matching lines, summed over the patterns
+ * @return its path, valid until the next run or free
+ */
+FINDER_API const char *finder_query_top(const struct finder_query *q, size_t i, uint64_t *lines);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,690 @@
+#include "live.h"
+#include "matcher.h"
+#include "scan.h"
+#include "trigram.h"
+#include "walk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EMPTY UINT32_MAX
+#define TOMB (UINT32_MAX - 1)
+#define MEMO_SLOTS (1u << 16)
+
+struct live_file {
+    char *path;             // relative to the root, NULL for a free slot
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t gen;           // bumped whenever the file is re-indexed or dropped
+    uint32_t seen;          // reconcile epoch that last found the file
+    uint32_t *tris;         // sorted trigram set
+    uint32_t ntris;
+};
+
+struct ref {
+    uint32_t id;
+    uint32_t gen;
+};
+
+struct posting {
+    uint32_t trigram;       // EMPTY for an unused slot
+    uint32_t n;
+    uint32_t cap;
+    struct ref *refs;
+};
+
+// Direct-mapped cache of one file's matching line count for one query
+struct memo {
+    uint64_t qhash;         // 0 for an unused slot
+    uint32_t id;
+    uint32_t gen;
+    uint64_t lines;
+};
+
+struct live {
+    char *root;
+    int rootfd;
+    struct live_file *files;
+    uint32_t nfiles;        // slots in use or free-listed
+    uint32_t fcap;
+    uint32_t nlive;
+    uint32_t *freeids;
+    uint32_t nfree;
+    uint32_t *paths;        // path hash table of file ids
+    size_t npaths;
+    size_t pused;           // ids plus tombstones
+    struct posting *post;
+    size_t npost;
+    size_t postused;
+    uint64_t refs;          // postings entries, live and stale
+    uint64_t stale;
+    struct memo *memo;
+    pthread_mutex_t memo_lock;      // counts may run on several threads
+    uint32_t epoch;
+    struct trigram_set set;
+    char *buf;              // for indexing
+};
+
+struct live_query {
+    struct matcher *m;
+    uint32_t *tris;         // trigrams every matching file holds
+    size_t n;
+    uint64_t qhash;
+};
+
+static uint64_t hash_str(const char *s)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (; *s; s++)
+        h = (h ^ (uint8_t)*s) * 1099511628211ull;
+    return h;
+}
+
+static size_t hash_tri(uint32_t t, size_t n)
+{
+    return (size_t)(((uint64_t)t * 0x9E3779B97F4A7C15ull) >> 32) & (n - 1);
+}
+
+struct live *live_new(const char *root)
+{
+    struct live *lv = calloc(1, sizeof(*lv));
+    if (!lv)
+        goto oom;
+    lv->rootfd = -1;
+    pthread_mutex_init(&lv->memo_lock, NULL);
+    lv->root = strdup(root);
+    lv->npaths = 1024;
+    lv->paths = malloc(lv->npaths * sizeof(uint32_t));
+    lv->npost = 1u << 16;
+    lv->post = calloc(lv->npost, sizeof(struct posting));
+    lv->memo = calloc(MEMO_SLOTS, sizeof(struct memo));
+    lv->buf = malloc(SCAN_BUFSZ);
+    if (!lv->root || !lv->paths || !lv->post || !lv->memo || !lv->buf ||
+        trigram_set_init(&lv->set) != 0)
+        goto oom;
+    memset(lv->paths, 0xff, lv->npaths * sizeof(uint32_t));
+    for (size_t i = 0; i < lv->npost; i++)
+        lv->post[i].trigram = EMPTY;
+
+    lv->rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (lv->rootfd < 0) {
+        fprintf(stderr, "finder: %s: %s\n", root, strerror(errno));
+        live_free(lv);
+        return NULL;
+    }
+    return lv;
+
+oom:
+    fprintf(stderr, "finder: out of memory\n");
+    live_free(lv);
+    return NULL;
+}
+
+void live_free(struct live *lv)
+{
+    if (!lv)
+        return;
+    for (uint32_t i = 0; i < lv->nfiles; i++) {
+        free(lv->files[i].path);
+        free(lv->files[i].tris);
+    }
+    for (size_t i = 0; lv->post && i < lv->npost; i++)
+        free(lv->post[i].refs);
+    if (lv->rootfd >= 0)
+        close(lv->rootfd);
+    free(lv->files);
+    free(lv->freeids);
+    free(lv->paths);
+    free(lv->post);
+    free(lv->memo);
+    pthread_mutex_destroy(&lv->memo_lock);
+    free(lv->buf);
+    free(lv->root);
+    trigram_set_free(&lv->set);
+    free(lv);
+}
+
+const char *live_root(const struct live *lv)
+{
+    return lv->root;
+}
+
+uint32_t live_nfiles(const struct live *lv)
+{
+    return lv->nlive;
+}
+
+// Slot holding rel, or the slot to insert it into when *found is false
+static size_t path_slot(const struct live *lv, const char *rel, bool *found)
+{
+    size_t mask = lv->npaths - 1, s = hash_str(rel) & mask, tomb = SIZE_MAX;
+    for (;; s = (s + 1) & mask) {
+        uint32_t id = lv->paths[s];
+        if (id == EMPTY) {
+            *found = false;
+            return tomb != SIZE_MAX ? tomb : s;
+        }
+        if (id == TOMB) {
+            if (tomb == SIZE_MAX)
+                tomb = s;
+        } else if (strcmp(lv->files[id].path, rel) == 0) {
+            *found = true;
+            return s;
+        }
+    }
+}
+
+static int paths_grow(struct live *lv)
+{
+    size_t n = lv->npaths;
+    while ((size_t)(lv->nlive + 1) * 2 > n)
+        n *= 2;
+    uint32_t *paths = malloc(n * sizeof(uint32_t));
+    if (!paths)
+        return -1;
+    memset(paths, 0xff, n * sizeof(uint32_t));
+    free(lv->paths);
+    lv->paths = paths;
+    lv->npaths = n;
+    lv->pused = 0;
+    for (uint32_t id = 0; id < lv->nfiles; id++) {
+        if (!lv->files[id].path)
+            continue;
+        bool found;
+        lv->paths[path_slot(lv, lv->files[id].path, &found)] = id;
+        lv->pused++;
+    }
+    return 0;
+}
+
+static struct posting *posting_get(struct live *lv, uint32_t t, bool create)
+{
+    if (create && (lv->postused + 1) * 4 > lv->npost * 3) {
+        size_t n = lv->npost * 2;
+        struct posting *post = calloc(n, sizeof(*post));
+        if (!post)
+            return NULL;
+        for (size_t i = 0; i < n; i++)
+            post[i].trigram = EMPTY;
+        for (size_t i = 0; i < lv->npost; i++) {
+            if (lv->post[i].trigram == EMPTY)
+                continue;
+            size_t s = hash_tri(lv->post[i].trigram, n);
+            while (post[s].trigram != EMPTY)
+                s = (s + 1) & (n - 1);
+            post[s] = lv->post[i];
+        }
+        free(lv->post);
+        lv->post = post;
+        lv->npost = n;
+    }
+
+    size_t s = hash_tri(t, lv->npost);
+    while (lv->post[s].trigram != EMPTY && lv->post[s].trigram != t)
+        s = (s + 1) & (lv->npost - 1);
+    if (lv->post[s].trigram == EMPTY) {
+        if (!create)
+            return NULL;
+        lv->post[s].trigram = t;
+        lv->postused++;
+    }
+    return &lv->post[s];
+}
+
+static int posting_add(struct live *lv, uint32_t t, uint32_t id, uint32_t gen)
+{
+    struct posting *p = posting_get(lv, t, true);
+    if (!p)
+        return -1;
+    if (p->n == p->cap) {
+        uint32_t cap = p->cap ? p->cap * 2 : 4;
+        struct ref *refs = realloc(p->refs, cap * sizeof(*refs));
+        if (!refs)
+            return -1;
+        p->refs = refs;
+        p->cap = cap;
+    }
+    p->refs[p->n].id = id;
+    p->refs[p->n].gen = gen;
+    p->n++;
+    lv->refs++;
+    return 0;
+}
+
+// Drop postings entries whose file has since been re-indexed or removed
+static void compact(struct live *lv)
+{
+    lv->refs = 0;
+    for (size_t i = 0; i < lv->npost; i++) {
+        struct posting *p = &lv->post[i];
+        uint32_t k = 0;
+        for (uint32_t j = 0; j < p->n; j++) {
+            const struct live_file *f = &lv->files[p->refs[j].id];
+            if (f->path && f->gen == p->refs[j].gen)
+                p->refs[k++] = p->refs[j];
+        }
+        p->n = k;
+        lv->refs += k;
+    }
+    lv->stale = 0;
+}
+
+static void unindex(struct live *lv, struct live_file *f)
+{
+    lv->stale += f->ntris;
+    free(f->tris);
+    f->tris = NULL;
+    f->ntris = 0;
+    f->gen++;
+}
+
+static int index_tris(struct live *lv, uint32_t id)
+{
+    struct live_file *f = &lv->files[id];
+    for (uint32_t i = 0; i < f->ntris; i++) {
+        if (posting_add(lv, f->tris[i], id, f->gen) != 0)
+            return -1;
+    }
+    if (lv->stale * 2 > lv->refs)
+        compact(lv);
+    return 0;
+}
+
+static void remove_file(struct live *lv, size_t slot)
+{
+    uint32_t id = lv->paths[slot];
+    struct live_file *f = &lv->files[id];
+    unindex(lv, f);
+    free(f->path);
+    f->path = NULL;
+    lv->paths[slot] = TOMB;
+    lv->freeids[lv->nfree++] = id;
+    lv->nlive--;
+}
+
+// Add rel with no trigrams yet, returning its id
+static int add_file(struct live *lv, const char *rel, uint32_t *idp)
+{
+    if ((lv->pused + 1) * 4 > lv->npaths * 3 && paths_grow(lv) != 0)
+        return -1;
+    if (lv->nfiles == lv->fcap) {
+        uint32_t cap = lv->fcap ? lv->fcap * 2 : 1024;
+        struct live_file *files = realloc(lv->files, cap * sizeof(*files));
+        uint32_t *freeids = realloc(lv->freeids, cap * sizeof(uint32_t));
+        if (files)
+            lv->files = files;
+        if (freeids)
+            lv->freeids = freeids;
+        if (!files || !freeids)
+            return -1;
+        lv->fcap = cap;
+    }
+    char *path = strdup(rel);
+    if (!path)
+        return -1;
+
+    uint32_t id;
+    if (lv->nfree) {
+        id = lv->freeids[--lv->nfree];
+    } else {
+        id = lv->nfiles++;
+        memset(&lv->files[id], 0, sizeof(lv->files[id]));
+    }
+    lv->files[id].path = path;
+    bool found;
+    size_t slot = path_slot(lv, rel, &found);
+    if (lv->paths[slot] == EMPTY)
+        lv->pused++;
+    lv->paths[slot] = id;
+    lv->nlive++;
+    *idp = id;
+    return 0;
+}
+
+int live_update(struct live *lv, const char *rel, const struct stat *st)
+{
+    struct stat sb;
+    bool found;
+    size_t slot = path_slot(lv, rel, &found);
+
+    if (!st) {
+        if (fstatat(lv->rootfd, rel, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+            if (errno != ENOENT && errno != ENOTDIR)
+                fprintf(stderr, "finder: %s: %s\n", rel, strerror(errno));
+            if (found)
+                remove_file(lv, slot);
+            return 0;
+        }
+        st = &sb;
+    }
+    if (!S_ISREG(st->st_mode)) {
+        if (found)
+            remove_file(lv, slot);
+        return 0;
+    }
+
+    int64_t mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    uint32_t id;
+    if (found) {
+        id = lv->paths[slot];
+        struct live_file *f = &lv->files[id];
+        f->seen = lv->epoch;
+        if (f->dev == (uint64_t)st->st_dev && f->ino == (uint64_t)st->st_ino &&
+            f->size == (uint64_t)st->st_size && f->mtime_ns == mtime_ns)
+            return 0;
+        unindex(lv, f);
+    } else if (add_file(lv, rel, &id) != 0) {
+        fprintf(stderr, "finder: out of memory indexing %s\n", rel);
+        return -1;
+    }
+
+    struct live_file *f = &lv->files[id];
+    f->dev = st->st_dev;
+    f->ino = st->st_ino;
+    f->size = (uint64_t)st->st_size;
+    f->mtime_ns = mtime_ns;
+    f->seen = lv->epoch;
+
+    if (trigram_file(&lv->set, lv->rootfd, rel, lv->buf, SCAN_BUFSZ, NULL) != 0) {
+        if (errno == ENOENT) {
+            remove_file(lv, path_slot(lv, rel, &found));
+            return 0;
+        }
+        fprintf(stderr, "finder: %s: %s\n", rel, strerror(errno));
+        return errno == ENOMEM ? -1 : 0;
+    }
+    f->tris = malloc((lv->set.n ? lv->set.n : 1) * sizeof(uint32_t));
+    if (!f->tris) {
+        fprintf(stderr, "finder: out of memory indexing %s\n", rel);
+        return -1;
+    }
+    memcpy(f->tris, lv->set.list, lv->set.n * sizeof(uint32_t));
+    f->ntris = (uint32_t)lv->set.n;
+    if (index_tris(lv, id) != 0) {
+        fprintf(stderr, "finder: out of memory indexing %s\n", rel);
+        return -1;
+    }
+    return 0;
+}
+
+void live_remove_tree(struct live *lv, const char *rel)
+{
+    size_t len = strlen(rel);
+    for (uint32_t id = 0; id < lv->nfiles; id++) {
+        const char *path = lv->files[id].path;
+        if (!path || (len && (strncmp(path, rel, len) != 0 || path[len] != '/')))
+            continue;
+        bool found;
+        size_t slot = path_slot(lv, path, &found);
+        if (found)
+            remove_file(lv, slot);
+    }
+}
+
+int live_load(struct live *lv, const struct index *idx)
+{
+    uint32_t n = index_nfiles(idx);
+    uint32_t *ids = malloc((n ? n : 1) * sizeof(uint32_t));
+    uint32_t *base = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (!ids || !base)
+        goto oom;
+
+    for (uint32_t k = 0; k < n; k++) {
+        const struct index_file *xf = index_file(idx, k);
+        uint32_t id;
+        bool found;
+        path_slot(lv, index_name(idx, k), &found);
+        if (found || add_file(lv, index_name(idx, k), &id) != 0) {
+            base[k] = EMPTY;
+            if (!found)
+                goto oom;
+            continue;
+        }
+        struct live_file *f = &lv->files[id];
+        f->dev = xf->dev;
+        f->ino = xf->ino;
+        f->size = xf->size;
+        f->mtime_ns = xf->mtime_ns;
+        base[k] = id;
+    }
+
+    // Trigrams come out of the index in ascending order, so one pass to
+    // size each file's set and one to fill it leaves every set sorted
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t t = 0; t < index_ntrigrams(idx); t++) {
+            const struct index_trigram *xt = index_trigram_at(idx, t);
+            size_t m = index_decode(idx, xt, ids);
+            for (size_t j = 0; j < m; j++) {
+                if (ids[j] >= n || base[ids[j]] == EMPTY)
+                    continue;
+                struct live_file *f = &lv->files[base[ids[j]]];
+                if (pass == 0) {
+                    f->ntris++;
+                    continue;
+                }
+                f->tris[f->ntris++] = xt->trigram;
+                if (posting_add(lv, xt->trigram, base[ids[j]], f->gen) != 0)
+                    goto oom;
+            }
+        }
+        for (uint32_t k = 0; pass == 0 && k < n; k++) {
+            if (base[k] == EMPTY)
+                continue;
+            struct live_file *f = &lv->files[base[k]];
+            f->tris = malloc((f->ntris ? f->ntris : 1) * sizeof(uint32_t));
+            if (!f->tris)
+                goto oom;
+            f->ntris = 0;
+        }
+    }
+
+    free(ids);
+    free(base);
+    return 0;
+
+oom:
+    fprintf(stderr, "finder: out of memory loading index\n");
+    free(ids);
+    free(base);
+    return -1;
+}
+
+struct reconcile {
+    struct live *lv;
+    size_t rootlen;
+    int (*dir_fn)(void *arg, const char *rel);
+    void *arg;
+};
+
+static const char *rel_of(const struct reconcile *r, const char *path)
+{
+    size_t len = strlen(path);
+    return len <= r->rootlen ? "" : path + r->rootlen + 1;
+}
+
+static int reconcile_file(void *arg, int dirfd, const char *name,
+                          const char *path, const struct stat *st)
+{
+    struct reconcile *r = arg;
+    (void)dirfd;
+    (void)name;
+    return live_update(r->lv, rel_of(r, path), st);
+}
+
+static int reconcile_dir(void *arg, const char *path)
+{
+    struct reconcile *r = arg;
+    return r->dir_fn ? r->dir_fn(r->arg, rel_of(r, path)) : 0;
+}
+
+int live_scan_dir(struct live *lv, const char *rel,
+                  int (*dir_fn)(void *arg, const char *rel), void *arg)
+{
+    struct reconcile r = { lv, strlen(lv->root), dir_fn, arg };
+    if (r.rootlen == 1)
+        r.rootlen = 0;
+
+    char path[PATH_MAX];
+    if (rel[0])
+        snprintf(path, sizeof(path), "%s/%s", r.rootlen ? lv->root : "", rel);
+    else
+        snprintf(path, sizeof(path), "%s", lv->root);
+    return walk_tree(path, reconcile_file, reconcile_dir, &r, NULL, 0, NULL);
+}
+
+int live_reconcile(struct live *lv, int (*dir_fn)(void *arg, const char *rel),
+                   void *arg)
+{
+    lv->epoch++;
+    if (live_scan_dir(lv, "", dir_fn, arg) != 0)
+        return -1;
+    for (uint32_t id = 0; id < lv->nfiles; id++) {
+        if (!lv->files[id].path || lv->files[id].seen == lv->epoch)
+            continue;
+        bool found;
+        size_t slot = path_slot(lv, lv->files[id].path, &found);
+        if (found)
+            remove_file(lv, slot);
+    }
+    return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static bool has_all(const struct live_file *f, const uint32_t *tris, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (!bsearch(&tris[i], f->tris, f->ntris, sizeof(uint32_t), cmp_u32))
+            return false;
+    }
+    return true;
+}
+
+static void count_file(struct live *lv, uint32_t id, const struct live_query *q,
+                       struct match_ctx *ctx, char *buf, uint64_t *lines)
+{
+    const struct live_file *f = &lv->files[id];
+    struct memo *m = &lv->memo[(q->qhash ^ ((uint64_t)id * 0x9E3779B97F4A7C15ull)) & (MEMO_SLOTS - 1)];
+    pthread_mutex_lock(&lv->memo_lock);
+    bool hit = m->qhash == q->qhash && m->id == id && m->gen == f->gen;
+    uint64_t memo_lines = m->lines;
+    pthread_mutex_unlock(&lv->memo_lock);
+    if (hit) {
+        *lines += memo_lines;
+        return;
+    }
+
+    if (scan_file(lv->rootfd, f->path, ctx, buf, SCAN_BUFSZ, NULL) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", f->path, strerror(errno));
+        return;
+    }
+    pthread_mutex_lock(&lv->memo_lock);
+    m->qhash = q->qhash;
+    m->id = id;
+    m->gen = f->gen;
+    m->lines = match_counts(ctx)[0];
+    pthread_mutex_unlock(&lv->memo_lock);
+    *lines += match_counts(ctx)[0];
+}
+
+struct live_query *live_query_new(const char *pattern, bool fixed)
+{
+    struct live_query *q = calloc(1, sizeof(*q));
+    if (!q) {
+        fprintf(stderr, "finder: out of memory\n");
+        return NULL;
+    }
+    if (!(q->m = matcher_new(&pattern, 1, fixed, -1))) {
+        free(q);
+        return NULL;
+    }
+    if (trigram_query(pattern, fixed, &q->tris, &q->n) != 0) {
+        fprintf(stderr, "finder: out of memory\n");
+        live_query_free(q);
+        return NULL;
+    }
+    if (q->n)
+        qsort(q->tris, q->n, sizeof(uint32_t), cmp_u32);
+    // Bit 0 only marks the slot used, so fixed goes in the top bit: the
+    // same text as a regex and as a fixed string must not share counts
+    q->qhash = (hash_str(pattern) ^ ((uint64_t)fixed << 63)) | 1;
+    return q;
+}
+
+void live_query_free(struct live_query *q)
+{
+    if (!q)
+        return;
+    matcher_free(q->m);
+    free(q->tris);
+    free(q);
+}
+
+int live_query_count(struct live *lv, const struct live_query *q, uint64_t *lines)
+{
+    *lines = 0;
+    struct match_ctx *ctx = match_ctx_new(q->m);
+    char *buf = malloc(SCAN_BUFSZ);
+    int rc = -1;
+    if (!ctx || !buf) {
+        fprintf(stderr, "finder: out of memory\n");
+        goto out;
+    }
+
+    if (q->n == 0) {
+        for (uint32_t id = 0; id < lv->nfiles; id++) {
+            if (lv->files[id].path)
+                count_file(lv, id, q, ctx, buf, lines);
+        }
+        rc = 0;
+        goto out;
+    }
+
+    // Walk the rarest trigram's files and check the rest against each
+    // file's own set
+    const struct posting *best = NULL;
+    for (size_t i = 0; i < q->n; i++) {
+        const struct posting *p = posting_get(lv, q->tris[i], false);
+        if (!p || p->n == 0) {
+            rc = 0;
+            goto out;
+        }
+        if (!best || p->n < best->n)
+            best = p;
+    }
+    for (uint32_t j = 0; j < best->n; j++) {
+        struct ref r = best->refs[j];
+        const struct live_file *f = &lv->files[r.id];
+        if (f->path && f->gen == r.gen && has_all(f, q->tris, q->n))
+            count_file(lv, r.id, q, ctx, buf, lines);
+    }
+    rc = 0;
+
+out:
+    free(buf);
+    match_ctx_free(ctx);
+    return rc;
+}
+
+int live_count(struct live *lv, const char *pattern, bool fixed, uint64_t *lines)
+{
+    *lines = 0;
+    struct live_query *q = live_query_new(pattern, fixed);
+    if (!q)
+        return -1;
+    int rc = live_query_count(lv, q, lines);
+    live_query_free(q);
+    return rc;
+}
@@ -0,0 +1,93 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "index.h"
+
+/*
+ * In-memory trigram index of a directory tree that is kept current one
+ * file at a time. Each file keeps its sorted trigram set; postings map a
+ * trigram to (file, generation) pairs so removing or re-indexing a file
+ * only bumps its generation, and stale pairs are dropped in bulk once
+ * they outnumber the live ones. Per-file query results are memoized by
+ * generation, so repeated queries over unchanged files read nothing.
+ */
+struct live;
+
+/**
+ * @param root the canonical path of the directory to index
+ * @return an empty index, or NULL after printing the reason to stderr
+ */
+struct live *live_new(const char *root);
+
+void live_free(struct live *lv);
+
+const char *live_root(const struct live *lv);
+
+/**
+ * Seed the index from an on-disk index of the same root. Files keep the
+ * trigrams recorded there; live_reconcile() then re-reads only the ones
+ * whose inode, size or mtime no longer match.
+ */
+int live_load(struct live *lv, const struct index *idx);
+
+/**
+ * Bring one file up to date: re-index it if it changed, add it if it is
+ * new, drop it if it no longer exists or is not a regular file.
+ * @param rel the path of the file relative to the root
+ * @param st the file's lstat() information, or NULL to stat it here
+ * @return 0 on success, -1 if memory ran out
+ */
+int live_update(struct live *lv, const char *rel, const struct stat *st);
+
+// Drop every file at or below the directory rel
+void live_remove_tree(struct live *lv, const char *rel);
+
+/**
+ * Walk the directory rel, adding and updating the files below it.
+ * @param dir_fn if not NULL, called with each directory's path relative to
+ *   the root ("" for the root itself)
+ * @return 0 on success, -1 on error
+ */
+int live_scan_dir(struct live *lv, const char *rel,
+                  int (*dir_fn)(void *arg, const char *rel), void *arg);
+
+/**
+ * Walk the whole tree, updating changed files and dropping missing ones,
+ * to recover after change notifications were lost.
+ * @return 0 on success, -1 on error
+ */
+int live_reconcile(struct live *lv, int (*dir_fn)(void *arg, const char *rel),
+                   void *arg);
+
+uint32_t live_nfiles(const struct live *lv);
+
+/**
+ * Count the lines matching pattern in the indexed files.
+ * @return 0 on success, -1 if the pattern is invalid or memory ran out
+ */
+int live_count(struct live *lv, const char *pattern, bool fixed, uint64_t *lines);
+
+// A pattern compiled once for any number of counts
+struct live_query;
+
+/**
+ * @return the compiled pattern, or NULL after printing the reason to
+ *   stderr if it is invalid or memory ran out
+ */
+struct live_query *live_query_new(const char *pattern, bool fixed);
+
+void live_query_free(struct live_query *q);
+
+/**
+ * Count the lines matching a compiled pattern in the indexed files. Counts
+ * may run on several threads at once, sharing q, but not alongside any
+ * call that changes the index.
+ * @return 0 on success, -1 if memory ran out
+ */
+int live_query_count(struct live *lv, const struct live_query *q, uint64_t *lines);
+
+#endif
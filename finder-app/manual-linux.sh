@@ -115,7 +115,8 @@ sudo mknod -m 622 "${OUTDIR}/rootfs/dev/console" c 5 1
 # TODO: Clean and build the writer utility
 cd "${FINDER_APP_DIR}"
 make clean
-make CROSS_COMPILE="${CROSS_COMPILE}"
+# finder.sh hands more than one search string to the native finder
+make CROSS_COMPILE="${CROSS_COMPILE}" writer finder
 
 # TODO: Copy the finder related scripts and executables to the /home directory
 # on the target rootfs
@@ -123,6 +124,7 @@ mkdir -p "${OUTDIR}/rootfs/home"
 mkdir -p "${OUTDIR}/rootfs/home/conf"
 cp "${FINDER_APP_DIR}/autorun-qemu.sh" "${OUTDIR}/rootfs/home/"
 cp "${FINDER_APP_DIR}/writer" "${OUTDIR}/rootfs/home/"
+cp "${FINDER_APP_DIR}/finder" "${OUTDIR}/rootfs/home/"
 cp "${FINDER_APP_DIR}/finder.sh" "${OUTDIR}/rootfs/home/"
 cp "${FINDER_APP_DIR}/finder-test.sh" "${OUTDIR}/rootfs/home/"
 cp "${FINDER_APP_DIR}/conf/username.txt" "${OUTDIR}/rootfs/home/conf"
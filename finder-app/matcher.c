@@ -0,0 +1,385 @@
+#include "matcher.h"
+#include "ac.h"
+#include "budget.h"
+#include "fuzzy.h"
+#include "rx.h"
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct matcher {
+    size_t npatterns;
+    struct ac *ac;          // literal patterns, NULL if there are none
+    struct fuzzy *fz;       // all patterns when matching approximately
+    struct rx **rx;         // regular expressions
+    uint32_t *rx_ids;
+    size_t nrx;
+    regex_t *re;            // expressions rx cannot handle, matched per line
+    uint32_t *re_ids;
+    size_t nre;
+};
+
+struct match_ctx {
+    const struct matcher *m;
+    struct ac_state ac;
+    struct fuzzy_scan *fz;
+    struct rx_scan **rx;
+    uint64_t *seen;
+    uint64_t *counts;
+    char *line;             // start of a line split across two chunks
+    size_t linelen;
+    size_t linecap;
+    bool truncated;         // line outgrew the budget, reported once
+    struct budget *budget;  // limits line, NULL for no limit
+    struct match_limit *limit;      // NULL for none
+    uint64_t limited;       // of the file's lines, those added to limit
+};
+
+// True if pattern means the same thing as a basic regex and a literal
+static bool is_literal(const char *p)
+{
+    return strpbrk(p, ".[]*^$\\") == NULL;
+}
+
+struct matcher *matcher_new(const char *const *patterns, size_t n, bool fixed,
+                            int max_errors)
+{
+    struct matcher *m = calloc(1, sizeof(*m));
+    const char **lits = malloc((n ? n : 1) * sizeof(char *));
+    size_t *lens = malloc((n ? n : 1) * sizeof(size_t));
+    uint32_t *ids = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (!m || !lits || !lens || !ids) {
+        fprintf(stderr, "finder: out of memory\n");
+        goto fail;
+    }
+    m->npatterns = n;
+
+    size_t nlit = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (strchr(patterns[i], '\n')) {
+            fprintf(stderr, "finder: pattern %zu contains a newline\n", i + 1);
+            goto fail;
+        }
+        if (max_errors >= 0) {
+            if (strlen(patterns[i]) > FUZZY_MAX_LEN) {
+                fprintf(stderr, "finder: pattern '%s' is longer than %d bytes, "
+                        "the most that can be matched approximately\n",
+                        patterns[i], FUZZY_MAX_LEN);
+                goto fail;
+            }
+            lits[nlit] = patterns[i];
+            ids[nlit++] = (uint32_t)i;
+            continue;
+        }
+        // The empty pattern matches every line, which rx handles
+        if (patterns[i][0] && (fixed || is_literal(patterns[i]))) {
+            lits[nlit] = patterns[i];
+            lens[nlit] = strlen(patterns[i]);
+            ids[nlit] = (uint32_t)i;
+            nlit++;
+            continue;
+        }
+
+        char msg[256];
+        bool unsupported;
+        struct rx *rx = rx_compile(patterns[i], msg, sizeof(msg), &unsupported);
+        if (rx) {
+            if (!m->rx) {
+                m->rx = calloc(n, sizeof(struct rx *));
+                m->rx_ids = calloc(n, sizeof(uint32_t));
+                if (!m->rx || !m->rx_ids) {
+                    rx_free(rx);
+                    fprintf(stderr, "finder: out of memory\n");
+                    goto fail;
+                }
+            }
+            m->rx[m->nrx] = rx;
+            m->rx_ids[m->nrx++] = (uint32_t)i;
+            continue;
+        }
+        if (!unsupported) {
+            fprintf(stderr, "finder: invalid pattern '%s': %s\n", patterns[i], msg);
+            goto fail;
+        }
+
+        if (!m->re) {
+            m->re = calloc(n, sizeof(regex_t));
+            m->re_ids = calloc(n, sizeof(uint32_t));
+            if (!m->re || !m->re_ids) {
+                fprintf(stderr, "finder: out of memory\n");
+                goto fail;
+            }
+        }
+        int rc = regcomp(&m->re[m->nre], patterns[i], REG_NOSUB);
+        if (rc != 0) {
+            regerror(rc, &m->re[m->nre], msg, sizeof(msg));
+            fprintf(stderr, "finder: invalid pattern '%s': %s\n", patterns[i], msg);
+            goto fail;
+        }
+        m->re_ids[m->nre++] = (uint32_t)i;
+    }
+
+    if (max_errors >= 0) {
+        m->fz = fuzzy_new(lits, ids, nlit, (unsigned)max_errors);
+        if (!m->fz) {
+            fprintf(stderr, "finder: out of memory\n");
+            goto fail;
+        }
+    } else if (nlit) {
+        m->ac = ac_build(lits, lens, ids, nlit);
+        if (!m->ac) {
+            fprintf(stderr, "finder: out of memory building pattern automaton\n");
+            goto fail;
+        }
+    }
+
+    free(lits);
+    free(lens);
+    free(ids);
+    return m;
+
+fail:
+    free(lits);
+    free(lens);
+    free(ids);
+    matcher_free(m);
+    return NULL;
+}
+
+void matcher_free(struct matcher *m)
+{
+    if (!m)
+        return;
+    ac_free(m->ac);
+    fuzzy_free(m->fz);
+    for (size_t i = 0; i < m->nrx; i++)
+        rx_free(m->rx[i]);
+    free(m->rx);
+    free(m->rx_ids);
+    for (size_t i = 0; i < m->nre; i++)
+        regfree(&m->re[i]);
+    free(m->re);
+    free(m->re_ids);
+    free(m);
+}
+
+size_t matcher_npatterns(const struct matcher *m)
+{
+    return m->npatterns;
+}
+
+size_t matcher_mem(const struct matcher *m)
+{
+    size_t n = m->ac ? ac_mem(m->ac) : 0;
+    for (size_t i = 0; i < m->nrx; i++)
+        n += rx_mem(m->rx[i]);
+    return n;
+}
+
+size_t match_ctx_mem(const struct matcher *m)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < m->nrx; i++)
+        n += rx_scan_mem(m->rx[i]);
+    return n;
+}
+
+struct match_ctx *match_ctx_new(const struct matcher *m)
+{
+    struct match_ctx *ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+        return NULL;
+    ctx->m = m;
+    ctx->seen = calloc(m->npatterns ? m->npatterns : 1, sizeof(uint64_t));
+    ctx->counts = calloc(m->npatterns ? m->npatterns : 1, sizeof(uint64_t));
+    ctx->rx = calloc(m->nrx ? m->nrx : 1, sizeof(struct rx_scan *));
+    if (!ctx->seen || !ctx->counts || !ctx->rx) {
+        match_ctx_free(ctx);
+        return NULL;
+    }
+    if (m->fz && !(ctx->fz = fuzzy_scan_new(m->fz))) {
+        match_ctx_free(ctx);
+        return NULL;
+    }
+    for (size_t i = 0; i < m->nrx; i++) {
+        if (!(ctx->rx[i] = rx_scan_new(m->rx[i]))) {
+            match_ctx_free(ctx);
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+void match_ctx_free(struct match_ctx *ctx)
+{
+    if (!ctx)
+        return;
+    for (size_t i = 0; ctx->rx && i < ctx->m->nrx; i++)
+        rx_scan_free(ctx->rx[i]);
+    free(ctx->rx);
+    fuzzy_scan_free(ctx->fz);
+    free(ctx->seen);
+    free(ctx->counts);
+    free(ctx->line);
+    if (ctx->budget)
+        budget_release(ctx->budget, ctx->linecap);
+    free(ctx);
+}
+
+void match_begin(struct match_ctx *ctx)
+{
+    memset(ctx->counts, 0, ctx->m->npatterns * sizeof(uint64_t));
+    ac_reset(&ctx->ac);
+    if (ctx->fz)
+        fuzzy_begin(ctx->m->fz, ctx->fz);
+    for (size_t i = 0; i < ctx->m->nrx; i++)
+        rx_begin(ctx->rx[i]);
+    ctx->linelen = 0;
+    ctx->truncated = false;
+    ctx->limited = 0;
+}
+
+static void match_line(struct match_ctx *ctx, const char *line, size_t len)
+{
+    const struct matcher *m = ctx->m;
+    regmatch_t pm[1];
+
+    for (size_t i = 0; i < m->nre; i++) {
+        pm[0].rm_so = 0;
+        pm[0].rm_eo = (regoff_t)len;
+        if (regexec(&m->re[i], line, 1, pm, REG_STARTEND) == 0)
+            ctx->counts[m->re_ids[i]]++;
+    }
+}
+
+static void line_append(struct match_ctx *ctx, const char *p, size_t len)
+{
+    if (ctx->truncated)
+        return;
+    if (ctx->linelen + len > ctx->linecap) {
+        size_t cap = ctx->linecap ? ctx->linecap : 256;
+        while (cap < ctx->linelen + len)
+            cap *= 2;
+        // Lines are never waited for: the memory may be held by readers
+        // that wait on this thread
+        char *line = NULL;
+        if (!ctx->budget || budget_try(ctx->budget, cap - ctx->linecap)) {
+            if (!(line = realloc(ctx->line, cap)) && ctx->budget)
+                budget_release(ctx->budget, cap - ctx->linecap);
+        }
+        if (!line) {
+            fprintf(stderr, "finder: line longer than the memory available, truncated\n");
+            ctx->truncated = true;
+            return;
+        }
+        ctx->line = line;
+        ctx->linecap = cap;
+    }
+    memcpy(ctx->line + ctx->linelen, p, len);
+    ctx->linelen += len;
+}
+
+// Give back a line buffer grown for an unusually long line
+static void line_trim(struct match_ctx *ctx)
+{
+    ctx->linelen = 0;
+    ctx->truncated = false;
+    if (ctx->linecap > MATCH_LINE_KEEP) {
+        free(ctx->line);
+        if (ctx->budget)
+            budget_release(ctx->budget, ctx->linecap);
+        ctx->line = NULL;
+        ctx->linecap = 0;
+    }
+}
+
+// Pass the lines matched since the last call on to the shared limit
+static void limit_update(struct match_ctx *ctx)
+{
+    struct match_limit *l = ctx->limit;
+    if (!l)
+        return;
+    if (l->cancel && __atomic_load_n(l->cancel, __ATOMIC_RELAXED))
+        __atomic_store_n(l->stop, true, __ATOMIC_RELAXED);
+    if (!l->max)
+        return;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < ctx->m->npatterns; i++)
+        sum += ctx->counts[i];
+    if (sum == ctx->limited)
+        return;
+    uint64_t lines = __atomic_add_fetch(&l->lines, sum - ctx->limited, __ATOMIC_RELAXED);
+    ctx->limited = sum;
+    if (lines >= l->max)
+        __atomic_store_n(l->stop, true, __ATOMIC_RELAXED);
+}
+
+static void feed(struct match_ctx *ctx, const char *buf, size_t len)
+{
+    const struct matcher *m = ctx->m;
+
+    if (m->ac)
+        ac_feed(m->ac, &ctx->ac, (const unsigned char *)buf, len,
+                ctx->seen, ctx->counts);
+    if (m->fz)
+        fuzzy_feed(m->fz, ctx->fz, buf, len, ctx->counts);
+    for (size_t i = 0; i < m->nrx; i++)
+        ctx->counts[m->rx_ids[i]] += rx_feed(ctx->rx[i], buf, len);
+    if (!m->nre)
+        return;
+
+    // Whole lines are matched in place; only a line split between chunks
+    // is copied so regexec sees it in one piece.
+    const char *p = buf, *end = buf + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl) {
+            line_append(ctx, p, (size_t)(end - p));
+            return;
+        }
+        if (ctx->linelen || ctx->truncated) {
+            line_append(ctx, p, (size_t)(nl - p));
+            match_line(ctx, ctx->line ? ctx->line : "", ctx->linelen);
+            ctx->linelen = 0;
+            ctx->truncated = false;
+        } else {
+            match_line(ctx, p, (size_t)(nl - p));
+        }
+        p = nl + 1;
+    }
+}
+
+void match_feed(struct match_ctx *ctx, const char *buf, size_t len)
+{
+    feed(ctx, buf, len);
+    limit_update(ctx);
+}
+
+void match_end(struct match_ctx *ctx)
+{
+    if (ctx->fz)
+        fuzzy_end(ctx->m->fz, ctx->fz, ctx->counts);
+    for (size_t i = 0; i < ctx->m->nrx; i++)
+        ctx->counts[ctx->m->rx_ids[i]] += rx_end(ctx->rx[i]);
+    if (ctx->linelen)
+        match_line(ctx, ctx->line, ctx->linelen);
+    line_trim(ctx);
+    limit_update(ctx);
+}
+
+void match_set_budget(struct match_ctx *ctx, struct budget *b)
+{
+    ctx->budget = b;
+}
+
+void match_set_limit(struct match_ctx *ctx, struct match_limit *l)
+{
+    ctx->limit = l;
+}
+
+const uint64_t *match_counts(const struct match_ctx *ctx)
+{
+    return ctx->counts;
+}
@@ -0,0 +1,84 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A compiled set of grep-style patterns. Patterns without basic regular
+ * expression metacharacters (and all patterns when fixed is set) share one
+ * Aho-Corasick automaton; the rest go through the lazy DFA in rx.h, or
+ * line by line through regexec() when they use back-references or word
+ * boundaries. When matching approximately every pattern is a literal
+ * matched as fuzzy.h describes.
+ * Input is streamed in arbitrary chunks and each pattern counts the lines
+ * it matches, as grep -c would.
+ */
+struct matcher;
+struct match_ctx;
+struct budget;
+
+// Line buffers grown past this are freed when a file ends
+#define MATCH_LINE_KEEP (64 * 1024)
+
+/**
+ * @param patterns the patterns to compile
+ * @param n the number of patterns
+ * @param fixed true to treat every pattern as a literal string
+ * @param max_errors match every pattern as a literal within this edit
+ *   distance, or -1 to match exactly
+ * @return the compiled set, or NULL after printing the reason to stderr
+ */
+struct matcher *matcher_new(const char *const *patterns, size_t n, bool fixed,
+                            int max_errors);
+
+void matcher_free(struct matcher *m);
+
+size_t matcher_npatterns(const struct matcher *m);
+
+// Bytes the compiled automata hold, shared by every context
+size_t matcher_mem(const struct matcher *m);
+
+// Bytes each context of m holds for its DFA caches
+size_t match_ctx_mem(const struct matcher *m);
+
+// Per-thread scan state for one matcher
+struct match_ctx *match_ctx_new(const struct matcher *m);
+
+void match_ctx_free(struct match_ctx *ctx);
+
+/**
+ * Draw the buffer that holds a line split between chunks from b. Lines are
+ * only buffered for patterns matched with regexec(); one that would exceed
+ * the budget is matched truncated, with a warning.
+ */
+void match_set_budget(struct match_ctx *ctx, struct budget *b);
+
+// Matching lines counted across the contexts that share it
+struct match_limit {
+    uint64_t lines;         // all patterns', read and updated atomically
+    uint64_t max;           // lines at which *stop is set, 0 for no limit
+    const bool *cancel;     // if not NULL, *stop is also set once this is
+    bool *stop;
+};
+
+/**
+ * Add the lines ctx matches to l after every match_feed() and match_end(),
+ * so a reader that checks *l->stop between feeds stops within one buffer
+ * of the line that reached l->max, or of l->cancel being set.
+ */
+void match_set_limit(struct match_ctx *ctx, struct match_limit *l);
+
+// Start a new file, zeroing the per-pattern counts
+void match_begin(struct match_ctx *ctx);
+
+void match_feed(struct match_ctx *ctx, const char *buf, size_t len);
+
+// End the current file, counting a final line that lacks a newline
+void match_end(struct match_ctx *ctx);
+
+// Per-pattern matching line counts for the current file
+const uint64_t *match_counts(const struct match_ctx *ctx);
+
+#endif
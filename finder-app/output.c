@@ -0,0 +1,141 @@
+#include "output.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+enum output_format output_parse(const char *name)
+{
+    if (strcmp(name, "json") == 0)
+        return OUTPUT_JSON;
+    if (strcmp(name, "binary") == 0)
+        return OUTPUT_BINARY;
+    return OUTPUT_TEXT;
+}
+
+static void json_string(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            putc(c, fp);
+    }
+    putc('"', fp);
+}
+
+static void json_counts(FILE *fp, const uint64_t *n, size_t len)
+{
+    putc('[', fp);
+    for (size_t i = 0; i < len; i++)
+        fprintf(fp, i ? ",%" PRIu64 : "%" PRIu64, n[i]);
+    putc(']', fp);
+}
+
+static void put_varint(FILE *fp, uint64_t v)
+{
+    while (v >= 0x80) {
+        putc((int)(v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+    putc((int)v, fp);
+}
+
+static void put_string(FILE *fp, const char *s)
+{
+    size_t len = strlen(s);
+    put_varint(fp, len);
+    fwrite(s, 1, len, fp);
+}
+
+void output_begin(const struct output_sink *o, const char *const *patterns,
+                  size_t npatterns)
+{
+    if (o->fmt == OUTPUT_JSON) {
+        fputs("{\"type\":\"begin\",\"patterns\":[", o->fp);
+        for (size_t i = 0; i < npatterns; i++) {
+            if (i)
+                putc(',', o->fp);
+            json_string(o->fp, patterns[i]);
+        }
+        fputs("]}\n", o->fp);
+    } else if (o->fmt == OUTPUT_BINARY) {
+        fwrite(OUTPUT_MAGIC, 1, strlen(OUTPUT_MAGIC), o->fp);
+        put_varint(o->fp, npatterns);
+        for (size_t i = 0; i < npatterns; i++)
+            put_string(o->fp, patterns[i]);
+    }
+}
+
+void output_file(void *arg, const struct finder_file *f)
+{
+    const struct output_sink *o = arg;
+    if (o->fmt == OUTPUT_JSON) {
+        fputs("{\"type\":\"file\",\"path\":", o->fp);
+        json_string(o->fp, f->path);
+        fputs(",\"lines\":", o->fp);
+        json_counts(o->fp, f->lines, f->npatterns);
+        fprintf(o->fp, ",\"bytes\":%" PRIu64 ",\"ns\":%" PRIu64 ",\"cached\":%s,\"skipped\":%s}\n",
+                f->bytes, f->ns, f->cached ? "true" : "false", f->skipped ? "true" : "false");
+    } else if (o->fmt == OUTPUT_BINARY) {
+        putc('F', o->fp);
+        put_string(o->fp, f->path);
+        putc((f->cached ? 1 : 0) | (f->skipped ? 2 : 0), o->fp);
+        for (size_t i = 0; i < f->npatterns; i++)
+            put_varint(o->fp, f->lines[i]);
+        put_varint(o->fp, f->bytes);
+        put_varint(o->fp, f->ns);
+    }
+}
+
+void output_end(const struct output_sink *o, const struct finder_result *res)
+{
+    if (o->fmt == OUTPUT_JSON) {
+        fprintf(o->fp, "{\"type\":\"end\",\"stopped\":%s,\"files\":%" PRIu64 ",\"lines\":",
+                res->stopped ? "true" : "false", res->files);
+        json_counts(o->fp, res->lines, res->npatterns);
+        if (res->ntop) {
+            fputs(",\"top\":[", o->fp);
+            for (size_t i = 0; i < res->ntop; i++) {
+                fputs(i ? ",{\"path\":" : "{\"path\":", o->fp);
+                json_string(o->fp, res->top[i].path);
+                fprintf(o->fp, ",\"lines\":%" PRIu64 "}", res->top[i].lines);
+            }
+            putc(']', o->fp);
+        }
+        if (res->ndirs) {
+            fputs(",\"dirs\":[", o->fp);
+            for (size_t i = 0; i < res->ndirs; i++) {
+                const struct finder_dir *d = &res->dirs[i];
+                fputs(i ? ",{\"path\":" : "{\"path\":", o->fp);
+                json_string(o->fp, d->path);
+                fprintf(o->fp, ",\"depth\":%u,\"files\":%" PRIu64 ",\"lines\":%" PRIu64 "}",
+                        d->depth, d->files, d->lines);
+            }
+            putc(']', o->fp);
+        }
+        fputs("}\n", o->fp);
+    } else if (o->fmt == OUTPUT_BINARY) {
+        putc('E', o->fp);
+        putc(res->stopped ? 1 : 0, o->fp);
+        put_varint(o->fp, res->files);
+        for (size_t i = 0; i < res->npatterns; i++)
+            put_varint(o->fp, res->lines[i]);
+        put_varint(o->fp, res->ntop);
+        for (size_t i = 0; i < res->ntop; i++) {
+            put_string(o->fp, res->top[i].path);
+            put_varint(o->fp, res->top[i].lines);
+        }
+        put_varint(o->fp, res->ndirs);
+        for (size_t i = 0; i < res->ndirs; i++) {
+            put_string(o->fp, res->dirs[i].path);
+            put_varint(o->fp, res->dirs[i].depth);
+            put_varint(o->fp, res->dirs[i].files);
+            put_varint(o->fp, res->dirs[i].lines);
+        }
+    }
+    fflush(o->fp);
+}
@@ -0,0 +1,58 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+
+#include "finder.h"
+
+/*
+ * Machine-readable results, written as files finish scanning so a reader
+ * can start on them before the scan is over.
+ *
+ * OUTPUT_JSON writes one JSON object per line:
+ *
+ *   {"type":"begin","patterns":["p1",...]}
+ *   {"type":"file","path":"...","lines":[n1,...],"bytes":n,"ns":n,"cached":false,"skipped":false}
+ *   {"type":"end","stopped":false,"files":n,"lines":[n1,...],"top":[{"path":"...","lines":n},...],
+ *    "dirs":[{"path":"...","depth":n,"files":n,"lines":n},...]}
+ *
+ * "top" is there only when finder_opts.top_k asked for it, and "dirs"
+ * only when finder_opts.aggregate did. Strings are
+ * the path and pattern bytes with '"', '\' and control bytes escaped;
+ * other bytes are copied as they are, so a name that is not UTF-8 gives a
+ * line that is not strictly JSON.
+ *
+ * OUTPUT_BINARY writes the same records with integers as unsigned LEB128
+ * varints and strings as a varint length followed by the bytes:
+ *
+ *   "FNDROUT1" npatterns pattern...
+ *   'F' path flags lines... bytes ns        flags bit 0: cached, 1: skipped
+ *   'E' flags files lines... ntop (path lines)... ndirs (path depth files lines)...
+ *                                           flags bit 0: stopped
+ */
+#define OUTPUT_MAGIC "FNDROUT1"
+
+enum output_format { OUTPUT_TEXT, OUTPUT_JSON, OUTPUT_BINARY };
+
+/**
+ * @param name "json" or "binary"
+ * @return the format, or OUTPUT_TEXT if name is neither
+ */
+enum output_format output_parse(const char *name);
+
+struct output_sink {
+    FILE *fp;
+    enum output_format fmt;
+};
+
+// Write the header naming the patterns
+void output_begin(const struct output_sink *o, const char *const *patterns,
+                  size_t npatterns);
+
+// A finder_file_fn; arg is the output_sink
+void output_file(void *arg, const struct finder_file *f);
+
+// Write the totals and flush
+void output_end(const struct output_sink *o, const struct finder_result *res);
+
+#endif
@@ -0,0 +1,754 @@
+#include "pipeline.h"
+#include "budget.h"
+#include "uring.h"
+#include "zscan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+enum { OP_OPEN, OP_READ, OP_CLOSE };
+
+struct slot {
+    size_t file;
+    int fd;                 // -1 until opened and once closed
+    int op;                 // the operation last prepared for it
+    int len;                // bytes read into buf so far
+    char *buf;
+    char path[PATH_MAX];    // the file's path until its open is submitted
+};
+
+// A file large enough to be matched in chunks by several threads
+struct split {
+    size_t file;
+    int fd;
+    uint64_t size;
+    unsigned nchunks;
+    unsigned next;          // next chunk to hand out
+    unsigned left;          // chunks not yet matched
+    int err;
+    int slot;               // the io_uring slot holding fd, or -1
+    uint64_t *sums;         // per-pattern counts over the finished chunks
+    uint64_t bytes, ns;     // likewise
+    struct split *link;     // next split with chunks to hand out
+};
+
+struct pipe {
+    const struct pipeline_opts *po;
+    pipeline_done_fn done;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // a slot or chunk is ready, or the run is over
+    pthread_cond_t idle;    // a slot was matched
+    struct budget budget;   // read and line buffers
+    unsigned nthreads;
+    struct slot *slots;
+    unsigned nslots;
+    unsigned ready[PIPE_DEPTH];     // read, waiting for a matcher thread
+    unsigned nready;
+    unsigned matched[PIPE_DEPTH];   // matched, waiting to be closed
+    unsigned nmatched;
+    struct split *splits;   // splits with chunks to hand out
+    size_t next;            // next file to open without io_uring
+    unsigned opening;       // threads reading a file's first block
+    bool uring;
+    bool stop;
+    bool cancel;            // stop reading, read without the lock
+    bool finished;          // done asked to stop
+    struct match_limit limit;       // sets cancel at max_lines or po->cancel
+};
+
+struct worker {
+    struct pipe *p;
+    pthread_t tid;
+    struct match_ctx *ctx;
+    char *buf;              // for files larger than a slot's buffer
+    struct scan_stats stats;
+    uint64_t busy_ns;       // time not spent waiting for work
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static bool cancelled(const struct pipe *p)
+{
+    return __atomic_load_n(&p->cancel, __ATOMIC_RELAXED) ||
+           (p->po->cancel && __atomic_load_n(p->po->cancel, __ATOMIC_RELAXED));
+}
+
+// Pass a file's results on, called with the lock held
+static void finish(struct pipe *p, size_t file, const struct file_scan *fs)
+{
+    // Once done has cancelled the run nothing more is reported; a run
+    // cancelled at max_lines still counts the files it cut short
+    if (!p->finished && p->done(p->arg, file, fs)) {
+        p->finished = true;
+        __atomic_store_n(&p->cancel, true, __ATOMIC_RELAXED);
+    }
+}
+
+static void report(struct pipe *p, size_t file, int err)
+{
+    char path[PATH_MAX];
+    fprintf(stderr, "finder: %s: %s\n",
+            file_list_path(p->po->files, file, path, sizeof(path)), strerror(err));
+}
+
+// Hand a file out in chunks if it is large and there are threads to share
+// it. Called with the first block read; true if the file was split.
+static bool split_file(struct worker *w, size_t file, int fd, int slot, uint64_t size)
+{
+    struct pipe *p = w->p;
+    if (p->nthreads < 2 || size < PIPE_SPLIT_MIN)
+        return false;
+
+    struct split *sp = calloc(1, sizeof(*sp));
+    uint64_t *sums = calloc(matcher_npatterns(p->po->m) ? matcher_npatterns(p->po->m) : 1,
+                            sizeof(uint64_t));
+    if (!sp || !sums) {
+        free(sp);
+        free(sums);
+        return false;
+    }
+    sp->file = file;
+    sp->fd = fd;
+    sp->size = size;
+    sp->nchunks = (unsigned)((sp->size + PIPE_CHUNK - 1) / PIPE_CHUNK);
+    sp->left = sp->nchunks;
+    sp->slot = slot;
+    sp->sums = sums;
+
+    pthread_mutex_lock(&p->lock);
+    sp->link = p->splits;
+    p->splits = sp;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    return true;
+}
+
+/**
+ * Match the lines that start in chunk i of a split file. A line that runs
+ * past the chunk's end is finished here, and the partial line at its start
+ * belongs to the chunk before, so every line is counted exactly once.
+ */
+static int match_chunk(struct worker *w, const struct split *sp, unsigned i)
+{
+    uint64_t start = (uint64_t)i * PIPE_CHUNK;
+    uint64_t end = start + PIPE_CHUNK < sp->size ? start + PIPE_CHUNK : sp->size;
+    // Reading from start - 1 shows whether a line begins at start
+    uint64_t pos = start ? start - 1 : 0;
+    bool feeding = start == 0;
+
+    match_begin(w->ctx);
+    while (!cancelled(w->p)) {
+        ssize_t n = pread(sp->fd, w->buf, SCAN_BUFSZ, (off_t)pos);
+        w->stats.reads++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        w->stats.bytes += (uint64_t)n;
+        const char *p = w->buf, *e = w->buf + n;
+
+        if (!feeding) {
+            const char *nl = memchr(p, '\n', (size_t)n);
+            if (!nl || pos + (uint64_t)(nl - w->buf) + 1 >= end) {
+                // No line starts inside the chunk so far
+                pos += (uint64_t)n;
+                if (nl || pos >= end)
+                    break;
+                continue;
+            }
+            feeding = true;
+            p = nl + 1;
+        }
+
+        if (pos + (uint64_t)n >= end) {
+            // Finish the line that is open at the end of the chunk
+            uint64_t from = pos + (uint64_t)(p - w->buf);
+            if (from < end - 1)
+                from = end - 1;
+            const char *q = w->buf + (from - pos);
+            const char *nl = memchr(q, '\n', (size_t)(e - q));
+            if (nl) {
+                match_feed(w->ctx, p, (size_t)(nl + 1 - p));
+                break;
+            }
+        }
+        match_feed(w->ctx, p, (size_t)(e - p));
+        pos += (uint64_t)n;
+    }
+    match_end(w->ctx);
+    scan_release(sp->fd, start, end - start, &w->p->po->cache);
+    return 0;
+}
+
+// Called with the lock held once every chunk of sp is matched
+static void split_done(struct pipe *p, struct split *sp)
+{
+    // Readahead for one chunk may have brought back pages another dropped
+    scan_release(sp->fd, 0, 0, &p->po->cache);
+    if (sp->err)
+        report(p, sp->file, sp->err);
+    else
+        finish(p, sp->file, &(struct file_scan){ .counts = sp->sums, .bytes = sp->bytes,
+                                                 .ns = sp->ns, .partial = cancelled(p) });
+    if (sp->slot >= 0) {
+        p->matched[p->nmatched++] = (unsigned)sp->slot;
+        pthread_cond_signal(&p->idle);
+    } else {
+        close(sp->fd);
+    }
+    free(sp->sums);
+    free(sp);
+}
+
+// Files to scan
+static size_t nfiles(const struct pipe *p)
+{
+    return p->po->order ? p->po->norder : p->po->files->n;
+}
+
+// File number pos in the scanning order
+static size_t file_at(const struct pipe *p, size_t pos)
+{
+    return p->po->order ? p->po->order[pos] : pos;
+}
+
+/**
+ * Take a read slot off the ready list, preferring one whose file filled
+ * the buffer: it is the one with more left to read. Called with the lock
+ * held.
+ */
+static unsigned take_ready(struct pipe *p)
+{
+    unsigned k = p->nready - 1;
+    for (unsigned j = p->nready; j > 0; j--) {
+        if (p->slots[p->ready[j - 1]].len == PIPE_BUFSZ) {
+            k = j - 1;
+            break;
+        }
+    }
+    unsigned id = p->ready[k];
+    p->ready[k] = p->ready[--p->nready];
+    return id;
+}
+
+// Take the next chunk, called and returning with the lock held
+static void take_chunk(struct worker *w)
+{
+    struct pipe *p = w->p;
+    struct split *sp = p->splits;
+    unsigned i = sp->next++;
+    if (sp->next == sp->nchunks)
+        p->splits = sp->link;
+    pthread_mutex_unlock(&p->lock);
+
+    uint64_t t0 = now_ns(), b0 = w->stats.bytes;
+    int rc = match_chunk(w, sp, i);
+    int err = errno;
+    uint64_t t1 = now_ns();
+
+    pthread_mutex_lock(&p->lock);
+    w->busy_ns += t1 - t0;
+    sp->bytes += w->stats.bytes - b0;
+    sp->ns += t1 - t0;
+    if (rc != 0 && !sp->err)
+        sp->err = err;
+    const uint64_t *counts = match_counts(w->ctx);
+    for (size_t k = 0; k < matcher_npatterns(p->po->m); k++)
+        sp->sums[k] += counts[k];
+    if (--sp->left == 0)
+        split_done(p, sp);
+}
+
+/**
+ * Match a file whose first len bytes are in first, reading on if they
+ * filled a buffer of bufsz, or split it for several threads to share.
+ * @param t0 when this thread started on the file
+ * @return true if the file was split, which then owns fd
+ */
+static bool match_file(struct worker *w, size_t file, int fd, int slot,
+                       const char *first, size_t len, size_t bufsz, uint64_t t0)
+{
+    struct pipe *p = w->p;
+    if (cancelled(p))
+        return false;
+    // Files read without io_uring were advised as they were opened
+    if (slot >= 0)
+        scan_advise(fd, &p->po->cache);
+
+    enum zscan_format zf = p->po->decompress ? zscan_detect(first, len) : ZSCAN_NONE;
+
+    // Only a file that filled the buffer can be large enough to matter
+    uint64_t size = len;
+    struct stat st;
+    if (len == bufsz && (p->po->max_size || p->nthreads >= 2 || zf) && fstat(fd, &st) == 0)
+        size = (uint64_t)st.st_size;
+    if ((p->po->max_size && size > p->po->max_size) ||
+        (!zf && p->po->skip_binary && memchr(first, '\0', len))) {
+        w->stats.skipped++;
+        w->stats.skipped_bytes += size > len ? size - len : 0;
+        scan_release(fd, 0, 0, &p->po->cache);
+        match_begin(w->ctx);
+        match_end(w->ctx);
+        struct file_scan fs = {
+            .counts = match_counts(w->ctx),
+            .bytes = len,
+            .ns = now_ns() - t0,
+            .skipped = true,
+        };
+        pthread_mutex_lock(&p->lock);
+        finish(p, file, &fs);
+        pthread_mutex_unlock(&p->lock);
+        return false;
+    }
+    if (!zf && len == bufsz && split_file(w, file, fd, slot, size))
+        return true;
+
+    uint64_t b0 = w->stats.bytes;
+    int rc = 0;
+    match_begin(w->ctx);
+    if (zf) {
+        bool threaded = size >= ZSCAN_THREAD_MIN && budget_try(&p->budget, ZSCAN_THREAD_MEM);
+        rc = zscan_fd(fd, zf, first, len, w->ctx, w->buf, SCAN_BUFSZ, threaded,
+                      &w->stats, &p->cancel);
+        int err = errno;
+        if (threaded)
+            budget_release(&p->budget, ZSCAN_THREAD_MEM);
+        errno = err;
+    } else {
+        match_feed(w->ctx, first, len);
+        if (len == bufsz)
+            rc = scan_fd(fd, len, w->ctx, w->buf, SCAN_BUFSZ, &w->stats, &p->cancel,
+                         &p->po->cache);
+    }
+    match_end(w->ctx);
+    scan_release(fd, 0, 0, &p->po->cache);
+    struct file_scan fs = {
+        .counts = match_counts(w->ctx),
+        .bytes = len + (w->stats.bytes - b0),
+        .ns = now_ns() - t0,
+        // Reading on may have stopped short; a first block is whole
+        .partial = (zf || len == bufsz) && cancelled(p),
+    };
+
+    pthread_mutex_lock(&p->lock);
+    if (rc != 0)
+        report(p, file, errno);
+    else
+        finish(p, file, &fs);
+    pthread_mutex_unlock(&p->lock);
+    return false;
+}
+
+// Open and match file i without io_uring
+static void open_file(struct worker *w, size_t i)
+{
+    struct pipe *p = w->p;
+    uint64_t t0 = now_ns();
+    char path[PATH_MAX];
+    w->stats.opens++;
+    int fd = openat(p->po->dirfd, file_list_path(p->po->files, i, path, sizeof(path)),
+                    O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        report(p, i, errno);
+        return;
+    }
+    scan_advise(fd, &p->po->cache);
+    // As with io_uring, the first block is read until full or at the end
+    size_t len = 0;
+    while (len < SCAN_BUFSZ) {
+        ssize_t n = pread(fd, w->buf + len, SCAN_BUFSZ - len, (off_t)len);
+        w->stats.reads++;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            report(p, i, errno);
+            close(fd);
+            return;
+        }
+        if (n == 0)
+            break;
+        len += (size_t)n;
+        w->stats.bytes += (uint64_t)n;
+    }
+    if (!match_file(w, i, fd, -1, w->buf, len, SCAN_BUFSZ, t0))
+        close(fd);
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct pipe *p = w->p;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        // Chunks come first so a split file is not left to one thread
+        if (p->splits) {
+            take_chunk(w);
+            continue;
+        }
+
+        if (p->uring) {
+            if (!p->nready) {
+                if (p->stop)
+                    break;
+                pthread_cond_wait(&p->work, &p->lock);
+                continue;
+            }
+            unsigned id = take_ready(p);
+            pthread_mutex_unlock(&p->lock);
+            struct slot *s = &p->slots[id];
+            uint64_t t0 = now_ns();
+            bool split = match_file(w, s->file, s->fd, (int)id, s->buf,
+                                    (size_t)s->len, PIPE_BUFSZ, t0);
+            w->busy_ns += now_ns() - t0;
+            pthread_mutex_lock(&p->lock);
+            // A split file's slot is closed once its last chunk is matched
+            if (!split) {
+                p->matched[p->nmatched++] = id;
+                pthread_cond_signal(&p->idle);
+            }
+            continue;
+        }
+
+        if (p->next == nfiles(p) || cancelled(p)) {
+            // Another thread may still split the file it is reading
+            if (!p->opening)
+                break;
+            pthread_cond_wait(&p->work, &p->lock);
+            continue;
+        }
+        size_t i = file_at(p, p->next++);
+        p->opening++;
+        pthread_mutex_unlock(&p->lock);
+        uint64_t t0 = now_ns();
+        open_file(w, i);
+        w->busy_ns += now_ns() - t0;
+        pthread_mutex_lock(&p->lock);
+        p->opening--;
+        pthread_cond_broadcast(&p->work);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static void prep(struct uring *r, int op, unsigned id, struct slot *s,
+                 const struct pipe *p, bool fixed)
+{
+    // The ring never holds more than one operation per slot
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    sqe->user_data = (uint64_t)id << 2 | (uint64_t)op;
+    s->op = op;
+    switch (op) {
+    case OP_OPEN:
+        s->fd = -1;
+        s->len = 0;
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = p->po->dirfd;
+        sqe->addr = (uint64_t)(uintptr_t)file_list_path(p->po->files, s->file,
+                                                         s->path, sizeof(s->path));
+        sqe->open_flags = O_RDONLY | O_NOCTTY | O_CLOEXEC;
+        break;
+    case OP_READ:
+        sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = s->fd;
+        // A read that came back short is continued where it stopped
+        sqe->addr = (uint64_t)(uintptr_t)(s->buf + s->len);
+        sqe->len = PIPE_BUFSZ - (unsigned)s->len;
+        sqe->off = (uint64_t)s->len;
+        sqe->buf_index = (uint16_t)id;
+        break;
+    case OP_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = s->fd;
+        break;
+    }
+}
+
+/**
+ * Close the files of the busy slots once the ring has failed. Operations
+ * the kernel never took are taken back and done here, and slots with the
+ * matchers are waited for; a close already in the kernel is left to it,
+ * and an open still there is lost with the ring.
+ * @param inflight operations in the ring, taken or not
+ * @param busy slots holding a file
+ */
+static void ring_abort(struct pipe *p, struct uring *r, unsigned inflight, unsigned busy)
+{
+    // Every busy slot has one operation in the ring or is with a matcher
+    unsigned held = busy - inflight;
+    __atomic_store_n(&p->cancel, true, __ATOMIC_RELAXED);
+
+    struct io_uring_sqe *sqe;
+    while ((sqe = uring_unsubmitted(r)) != NULL) {
+        struct slot *s = &p->slots[sqe->user_data >> 2];
+        if (s->fd >= 0)
+            close(s->fd);
+        s->fd = -1;
+    }
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(r)) != NULL) {
+        struct slot *s = &p->slots[cqe->user_data >> 2];
+        int op = (int)(cqe->user_data & 3);
+        if (op == OP_OPEN && cqe->res >= 0)
+            close(cqe->res);
+        else if (op == OP_READ)
+            close(s->fd);
+        s->fd = -1;
+        uring_cqe_seen(r);
+    }
+
+    // Cancelled, the matchers hand their slots back without matching
+    pthread_mutex_lock(&p->lock);
+    while (p->nmatched < held)
+        pthread_cond_wait(&p->idle, &p->lock);
+    p->nmatched = 0;
+    pthread_mutex_unlock(&p->lock);
+
+    // What is left is a read still in the kernel, which holds its own
+    // reference to the file, or a slot back from the matchers
+    for (unsigned i = 0; i < p->nslots; i++) {
+        if (p->slots[i].fd >= 0 && p->slots[i].op != OP_CLOSE)
+            close(p->slots[i].fd);
+        p->slots[i].fd = -1;
+    }
+}
+
+// Drive the files through the ring until all are matched and closed
+static int run_ring(struct pipe *p, struct uring *r, bool fixed, struct scan_stats *stats)
+{
+    unsigned free_ids[PIPE_DEPTH], nfree = 0;
+    for (unsigned i = p->nslots; i > 0; i--)
+        free_ids[nfree++] = i - 1;
+    unsigned inflight = 0, busy = 0;
+    size_t next = 0;
+
+    // Only a busy file's results can cancel the run
+    while (busy || (next < nfiles(p) && !cancelled(p))) {
+        while (nfree && next < nfiles(p) && !cancelled(p)) {
+            // A slot's buffer counts against the budget only while in use,
+            // so opening stops while long lines hold the memory. With no
+            // file in flight nothing here can free it, so wait for matchers.
+            if (busy && !budget_try(&p->budget, PIPE_BUFSZ))
+                break;
+            if (!busy)
+                budget_acquire(&p->budget, PIPE_BUFSZ);
+            unsigned id = free_ids[--nfree];
+            p->slots[id].file = file_at(p, next++);
+            prep(r, OP_OPEN, id, &p->slots[id], p, fixed);
+            stats->opens++;
+            inflight++;
+            busy++;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        // With nothing in the ring, every busy slot is with a matcher
+        while (!inflight && !p->nmatched)
+            pthread_cond_wait(&p->idle, &p->lock);
+        while (p->nmatched) {
+            unsigned id = p->matched[--p->nmatched];
+            prep(r, OP_CLOSE, id, &p->slots[id], p, fixed);
+            inflight++;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        if (uring_submit(r, 1) != 0) {
+            fprintf(stderr, "finder: io_uring: %s\n", strerror(errno));
+            ring_abort(p, r, inflight, busy);
+            return -1;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(r)) != NULL) {
+            unsigned id = (unsigned)(cqe->user_data >> 2);
+            int op = (int)(cqe->user_data & 3);
+            int res = cqe->res;
+            uring_cqe_seen(r);
+            struct slot *s = &p->slots[id];
+
+            if (op == OP_OPEN) {
+                if (res < 0) {
+                    report(p, s->file, -res);
+                    inflight--;
+                    busy--;
+                    free_ids[nfree++] = id;
+                    budget_release(&p->budget, PIPE_BUFSZ);
+                } else if (cancelled(p)) {
+                    s->fd = res;
+                    prep(r, OP_CLOSE, id, s, p, fixed);
+                } else {
+                    s->fd = res;
+                    stats->reads++;
+                    prep(r, OP_READ, id, s, p, fixed);
+                }
+            } else if (op == OP_READ) {
+                if (res < 0 || cancelled(p)) {
+                    if (res < 0)
+                        report(p, s->file, -res);
+                    prep(r, OP_CLOSE, id, s, p, fixed);
+                } else if (res > 0 && s->len + res < PIPE_BUFSZ) {
+                    // Reads may stop short of the end, on NFS, FUSE or
+                    // procfs say, so only a read of nothing ends the file
+                    s->len += res;
+                    stats->bytes += (uint64_t)res;
+                    stats->reads++;
+                    prep(r, OP_READ, id, s, p, fixed);
+                } else {
+                    s->len += res;
+                    stats->bytes += (uint64_t)res;
+                    inflight--;
+                    pthread_mutex_lock(&p->lock);
+                    p->ready[p->nready++] = id;
+                    pthread_cond_signal(&p->work);
+                    pthread_mutex_unlock(&p->lock);
+                }
+            } else {
+                s->fd = -1;
+                inflight--;
+                busy--;
+                free_ids[nfree++] = id;
+                budget_release(&p->budget, PIPE_BUFSZ);
+            }
+        }
+    }
+    return 0;
+}
+
+int pipeline_run(const struct pipeline_opts *po, pipeline_done_fn done,
+                 void *arg, struct scan_stats *stats)
+{
+    struct pipe p = { .po = po, .done = done, .arg = arg };
+    struct uring r;
+    bool fixed = false;
+    char *bufs = MAP_FAILED;
+    int rc = -1;
+
+    // The automata and each thread's DFA caches are taken first
+    size_t shared = matcher_mem(po->m), ctx_mem = match_ctx_mem(po->m);
+    size_t per_thread = SCAN_BUFSZ + MATCH_LINE_KEEP + ctx_mem;
+    if (po->mem_limit < shared + per_thread + PIPE_BUFSZ) {
+        fprintf(stderr, "finder: a memory budget of %zu bytes is too small\n", po->mem_limit);
+        return -1;
+    }
+    size_t mem_limit = po->mem_limit - shared;
+    budget_init(&p.budget, po->mem_limit);
+    p.limit = (struct match_limit){ .max = po->max_lines, .cancel = po->cancel,
+                                    .stop = &p.cancel };
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.work, NULL);
+    pthread_cond_init(&p.idle, NULL);
+
+    // Each thread keeps a read buffer and its DFA caches, and may keep a
+    // short line buffer;
+    // what the budget leaves beyond those bounds the files io_uring has in
+    // flight. At least one file always fits, so opening never waits on
+    // memory no file will give back.
+    unsigned n = po->threads ? po->threads : 1;
+    if ((size_t)n * per_thread + PIPE_BUFSZ > mem_limit)
+        n = (unsigned)((mem_limit - PIPE_BUFSZ) / per_thread);
+    size_t nslots = (mem_limit - (size_t)n * per_thread) / PIPE_BUFSZ;
+    p.nslots = nslots < PIPE_DEPTH ? (unsigned)nslots : PIPE_DEPTH;
+
+    // Fall back to plain reads in the matcher threads if the kernel lacks
+    // io_uring or it is disabled
+    if (!po->sync_io && nfiles(&p) > 1 && uring_init(&r, PIPE_DEPTH) == 0) {
+        p.slots = calloc(p.nslots, sizeof(*p.slots));
+        bufs = mmap(NULL, (size_t)p.nslots * PIPE_BUFSZ, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (!p.slots || bufs == MAP_FAILED) {
+            fprintf(stderr, "finder: out of memory\n");
+            uring_exit(&r);
+            goto out;
+        }
+        struct iovec iov[PIPE_DEPTH];
+        for (unsigned i = 0; i < p.nslots; i++) {
+            p.slots[i].buf = bufs + (size_t)i * PIPE_BUFSZ;
+            p.slots[i].fd = -1;
+            iov[i].iov_base = p.slots[i].buf;
+            iov[i].iov_len = PIPE_BUFSZ;
+        }
+        // Registration can fail on locked-memory limits; plain reads work
+        fixed = uring_register_buffers(&r, iov, p.nslots) == 0;
+        p.uring = true;
+    }
+
+    struct worker *w = calloc(n, sizeof(*w));
+    unsigned started = 0;
+    if (!w) {
+        fprintf(stderr, "finder: out of memory\n");
+    } else {
+        p.nthreads = n;
+        budget_acquire(&p.budget, shared + (size_t)n * (SCAN_BUFSZ + ctx_mem));
+        for (; started < n; started++) {
+            w[started].p = &p;
+            w[started].ctx = match_ctx_new(po->m);
+            w[started].buf = malloc(SCAN_BUFSZ);
+            if (!w[started].ctx || !w[started].buf) {
+                fprintf(stderr, "finder: out of memory\n");
+                break;
+            }
+            match_set_budget(w[started].ctx, &p.budget);
+            if (po->max_lines || po->cancel)
+                match_set_limit(w[started].ctx, &p.limit);
+            int err = pthread_create(&w[started].tid, NULL, worker_main, &w[started]);
+            if (err != 0) {
+                fprintf(stderr, "finder: cannot start thread: %s\n", strerror(err));
+                break;
+            }
+        }
+    }
+
+    if (started > 0) {
+        rc = p.uring ? run_ring(&p, &r, fixed, stats) : 0;
+        pthread_mutex_lock(&p.lock);
+        p.stop = true;
+        pthread_cond_broadcast(&p.work);
+        pthread_mutex_unlock(&p.lock);
+        for (unsigned i = 0; i < started; i++)
+            pthread_join(w[i].tid, NULL);
+    }
+    for (unsigned i = 0; w && i < n; i++) {
+        stats->opens += w[i].stats.opens;
+        stats->reads += w[i].stats.reads;
+        stats->bytes += w[i].stats.bytes;
+        stats->skipped += w[i].stats.skipped;
+        stats->skipped_bytes += w[i].stats.skipped_bytes;
+        if (po->busy_ns)
+            po->busy_ns[i] = w[i].busy_ns;
+        match_ctx_free(w[i].ctx);
+        free(w[i].buf);
+    }
+    free(w);
+    if (p.uring) {
+        stats->enters += r.enters;
+        uring_exit(&r);
+    }
+    stats->mem_peak = p.budget.peak;
+
+out:
+    if (bufs != MAP_FAILED)
+        munmap(bufs, (size_t)p.nslots * PIPE_BUFSZ);
+    free(p.slots);
+    pthread_cond_destroy(&p.idle);
+    pthread_cond_destroy(&p.work);
+    pthread_mutex_destroy(&p.lock);
+    budget_destroy(&p.budget);
+    return rc;
+}
@@ -0,0 +1,118 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "filelist.h"
+#include "matcher.h"
+#include "scan.h"
+
+/*
+ * Scanning of a list of files by a pool of matcher threads.
+ *
+ * With io_uring the calling thread keeps up to PIPE_DEPTH files in flight,
+ * submitting their OPENAT, first READs into a registered buffer and CLOSE
+ * in batches, and hands each filled buffer to a matcher thread. A read may
+ * stop short of the file's end, so the buffer is read into until it is
+ * full or a read returns nothing. Files that fill the buffer are read to
+ * the end by that thread. Without io_uring the matcher threads open and
+ * read the files themselves.
+ *
+ * Files of PIPE_SPLIT_MIN bytes or more are cut into PIPE_CHUNK byte
+ * chunks that any thread may match. Each chunk counts the lines that start
+ * in it, finishing its last line past the chunk's end, and the file's
+ * counts are the sum over its chunks.
+ *
+ * Files are handed out in the order given, so that when traversal knew
+ * their sizes the largest can go first and a large file found late does
+ * not leave one thread matching it after the others are done. The order
+ * may also leave files out, such as those a checkpoint has counted. Among
+ * files read and waiting for a thread, those that filled the first block,
+ * and so are at least that large, are taken first.
+ *
+ * Files are never mapped or read whole. Every thread streams through a
+ * SCAN_BUFSZ window and the matchers carry their state across windows, so
+ * only lines split between windows that a regexec() pattern must see
+ * whole are buffered. Those buffers, the thread windows, the in-flight
+ * io_uring buffers, the matcher's automata and each thread's DFA caches
+ * all come from one budget of mem_limit bytes: fewer threads are started
+ * if their windows and caches would not fit, no new file is opened while
+ * the budget is spent, and a line that cannot fit is matched truncated.
+ *
+ * Files are sniffed in the block read first: with skip_binary a NUL byte
+ * in it, and with max_size the size fstat() reports for a file that fills
+ * it, skip the rest of the file. Skipped files are passed to done with
+ * zero counts. With decompress a compressed file is recognized there too
+ * and matched through zscan_fd() instead; it is never split, and while
+ * the budget allows a large one is decompressed and matched on two
+ * threads.
+ */
+#define PIPE_DEPTH 128
+#define PIPE_BUFSZ (64 * 1024)
+#define PIPE_SPLIT_MIN (64ull << 20)
+#define PIPE_CHUNK (16u << 20)
+
+// What scanning one file found
+struct file_scan {
+    const uint64_t *counts;     // matching lines per pattern
+    uint64_t bytes;             // bytes read from the file
+    uint64_t ns;                // time matcher threads spent on it, summed
+                                // over the chunks of a split file
+    bool skipped;               // binary or too large, counts are zero
+    bool partial;               // cut short once max_lines was reached,
+                                // counts are of the lines read
+};
+
+/**
+ * Called with each file's results once it is scanned. Calls are
+ * serialized but come from any thread and in any order.
+ * @param i the file's position in the list
+ * @return true to cancel the run: files not yet scanned are skipped, those
+ *   being read are abandoned and closed, and this is not called again.
+ *   Files being read when max_lines is reached or cancel is set are passed
+ *   on partial until it returns true.
+ */
+typedef bool (*pipeline_done_fn)(void *arg, size_t i, const struct file_scan *fs);
+
+struct pipeline_opts {
+    const struct matcher *m;
+    int dirfd;                  // files are opened relative to this
+    const struct file_list *files;
+    unsigned threads;           // matcher threads, at least 1
+    bool sync_io;               // do not use io_uring
+    size_t mem_limit;           // bytes for read and line buffers
+    bool skip_binary;           // skip files with a NUL in the first block
+    uint64_t max_size;          // skip larger files, 0 for no limit
+    uint64_t max_lines;         // stop reading once the files being read
+                                // and those scanned have this many matching
+                                // lines between them, all patterns; 0 for
+                                // no limit
+    const bool *cancel;         // if not NULL, stop reading as at max_lines
+                                // once another thread sets it, within a
+                                // buffer of each file being read
+    bool decompress;            // match compressed files decompressed
+    struct scan_cache cache;    // page cache policy; chunks of split files
+                                // are dropped as matched but get no
+                                // readahead requests, several threads
+                                // already reading each
+    const uint32_t *order;      // indexes of the files to scan in the order
+                                // to scan them, NULL for all in list order
+    size_t norder;
+    uint64_t *busy_ns;          // if not NULL, receives each thread's time
+                                // spent opening and matching files, threads
+                                // entries, 0 for any not started
+};
+
+/**
+ * Scan every file in the list. Files that cannot be read are reported on
+ * stderr and skipped.
+ * @param stats receives the I/O done, including io_uring_enter calls
+ * @return 0 on success, including a run cancelled by done, -1 if threads
+ *   or memory could not be had
+ */
+int pipeline_run(const struct pipeline_opts *po, pipeline_done_fn done,
+                 void *arg, struct scan_stats *stats);
+
+#endif
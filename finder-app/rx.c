@@ -0,0 +1,1132 @@
+#define _GNU_SOURCE
+#include "rx.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define RX_MAX_LIT 64
+
+enum ast_type { A_EMPTY, A_SET, A_CAT, A_ALT, A_REP, A_BOL, A_EOL };
+
+struct ast {
+    enum ast_type type;
+    int set;                // A_SET: index into rx->sets
+    int min, max;           // A_REP: max -1 for no limit
+    int a, b;               // children
+};
+
+enum nfa_op { N_EPS, N_SPLIT, N_SET, N_BOL, N_EOL, N_MATCH };
+
+struct nstate {
+    uint8_t op;
+    int set;
+    int out, out1;
+};
+
+struct rx {
+    uint8_t (*sets)[32];    // byte sets, one bit per byte
+    int nsets;
+    struct nstate *nfa;
+    int nnfa;
+    int start;
+    uint8_t cls[256];       // byte to equivalence class
+    int nclasses;
+    char lit[RX_MAX_LIT];   // required literal, nlit 0 if none
+    size_t nlit;
+};
+
+struct parser {
+    const char *p;
+    struct rx *rx;
+    struct ast *nodes;
+    int n, cap;
+    const char *err;
+    bool unsupported;
+};
+
+// Set of NFA states
+struct nset {
+    uint32_t *s;
+    uint32_t n;
+};
+
+#define D_MATCH 1           // a match ends inside the line
+#define D_EOLMATCH 2        // a match ends if the line ends here
+
+struct dstate {
+    uint32_t off, n;        // NFA states in sc->pool
+    uint32_t hash;
+    uint8_t flags;
+};
+
+struct rx_scan {
+    const struct rx *rx;
+    uint32_t *mark;         // per NFA state, gen when added to a set
+    uint32_t gen;
+    uint32_t *stack;
+    struct nset tmp, aux, cur, next;
+    bool hit;               // the last set built holds N_MATCH
+    // lazy DFA
+    struct dstate *st;
+    uint32_t nst;
+    int32_t *trans;         // nst * nclasses, -1 if not built yet
+    int32_t *table;         // hash of state sets, -1 if empty
+    uint32_t *pool;
+    size_t npool, poolcap;
+    uint64_t bytes;         // scanned since the last flush
+    int32_t d;              // current state in DFA mode
+    bool nfa;               // simulating the NFA for the rest of the file
+    // the line in progress
+    bool in_line;
+    bool matched;
+};
+
+/* Parsing */
+
+static int node(struct parser *ps, enum ast_type type, int a, int b)
+{
+    if (ps->n == ps->cap) {
+        int cap = ps->cap ? ps->cap * 2 : 64;
+        struct ast *nodes = realloc(ps->nodes, (size_t)cap * sizeof(*nodes));
+        if (!nodes) {
+            ps->err = "out of memory";
+            return -1;
+        }
+        ps->nodes = nodes;
+        ps->cap = cap;
+    }
+    struct ast *x = &ps->nodes[ps->n];
+    memset(x, 0, sizeof(*x));
+    x->type = type;
+    x->a = a;
+    x->b = b;
+    return ps->n++;
+}
+
+// Add a byte set, sharing an existing one with the same bytes
+static int set_node(struct parser *ps, const uint8_t bits[32])
+{
+    struct rx *rx = ps->rx;
+    int i;
+    for (i = 0; i < rx->nsets; i++) {
+        if (memcmp(rx->sets[i], bits, 32) == 0)
+            break;
+    }
+    if (i == rx->nsets) {
+        uint8_t (*sets)[32] = realloc(rx->sets, (size_t)(i + 1) * 32);
+        if (!sets) {
+            ps->err = "out of memory";
+            return -1;
+        }
+        rx->sets = sets;
+        memcpy(rx->sets[i], bits, 32);
+        rx->nsets++;
+    }
+    int n = node(ps, A_SET, -1, -1);
+    if (n >= 0)
+        ps->nodes[n].set = i;
+    return n;
+}
+
+static void bit_set(uint8_t bits[32], unsigned c)
+{
+    bits[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+static bool bit_test(const uint8_t bits[32], unsigned c)
+{
+    return bits[c >> 3] & (1u << (c & 7));
+}
+
+static int char_node(struct parser *ps, unsigned char c)
+{
+    uint8_t bits[32] = {0};
+    bit_set(bits, c);
+    return set_node(ps, bits);
+}
+
+// Add the bytes of a character class, returning false for an unknown name
+static bool class_bits(uint8_t bits[32], const char *name, size_t len)
+{
+    static const struct {
+        const char *name;
+        int (*fn)(int);
+    } classes[] = {
+        {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum},
+        {"upper", isupper}, {"lower", islower}, {"space", isspace},
+        {"blank", isblank}, {"punct", ispunct}, {"print", isprint},
+        {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit},
+    };
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) == len && memcmp(classes[i].name, name, len) == 0) {
+            for (unsigned c = 0; c < 256; c++) {
+                if (classes[i].fn((int)c))
+                    bit_set(bits, c);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parse [. .] or [= =] holding a single byte; p points past the '['
+static int collating(struct parser *ps)
+{
+    char delim = *ps->p++;
+    if (ps->p[0] && ps->p[1] == delim && ps->p[2] == ']') {
+        int c = (unsigned char)ps->p[0];
+        ps->p += 3;
+        return c;
+    }
+    ps->err = "Invalid collation character";
+    return -1;
+}
+
+static int bracket(struct parser *ps)
+{
+    uint8_t bits[32] = {0};
+    bool neg = false;
+    ps->p++;
+    if (*ps->p == '^') {
+        neg = true;
+        ps->p++;
+    }
+    for (bool first = true; first || *ps->p != ']'; first = false) {
+        if (!*ps->p) {
+            ps->err = "Unmatched [, [^, [:, [., or [=";
+            return -1;
+        }
+        if (ps->p[0] == '[' && ps->p[1] == ':') {
+            const char *name = ps->p + 2;
+            const char *close = strstr(name, ":]");
+            if (!close) {
+                ps->err = "Unmatched [, [^, [:, [., or [=";
+                return -1;
+            }
+            if (!class_bits(bits, name, (size_t)(close - name))) {
+                ps->err = "Invalid character class name";
+                return -1;
+            }
+            ps->p = close + 2;
+            continue;
+        }
+        int lo;
+        if (ps->p[0] == '[' && (ps->p[1] == '.' || ps->p[1] == '=')) {
+            ps->p++;
+            if ((lo = collating(ps)) < 0)
+                return -1;
+        } else {
+            lo = (unsigned char)*ps->p++;
+        }
+        int hi = lo;
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            ps->p++;
+            if (ps->p[0] == '[' && ps->p[1] == '.') {
+                ps->p++;
+                if ((hi = collating(ps)) < 0)
+                    return -1;
+            } else {
+                hi = (unsigned char)*ps->p++;
+            }
+            if (hi < lo) {
+                ps->err = "Invalid range end";
+                return -1;
+            }
+        }
+        for (int c = lo; c <= hi; c++)
+            bit_set(bits, (unsigned)c);
+    }
+    ps->p++;
+    if (neg) {
+        for (int i = 0; i < 32; i++)
+            bits[i] = (uint8_t)~bits[i];
+    }
+    bits['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+    return set_node(ps, bits);
+}
+
+// \w \W \s \S
+static int escape_class(struct parser *ps, char e)
+{
+    uint8_t bits[32] = {0};
+    for (unsigned c = 0; c < 256; c++) {
+        bool in = (e == 'w' || e == 'W') ? (isalnum((int)c) || c == '_') : isspace((int)c);
+        if (in == (e == 'w' || e == 's') && c != '\n')
+            bit_set(bits, c);
+    }
+    return set_node(ps, bits);
+}
+
+static bool at_branch_end(const char *q)
+{
+    return !*q || (q[0] == '\\' && (q[1] == '|' || q[1] == ')'));
+}
+
+static int alternation(struct parser *ps, int depth);
+
+static int atom(struct parser *ps, int depth)
+{
+    char c = *ps->p;
+    if (c == '.') {
+        uint8_t bits[32];
+        memset(bits, 0xff, sizeof(bits));
+        bits['\n' >> 3] &= (uint8_t)~(1u << ('\n' & 7));
+        ps->p++;
+        return set_node(ps, bits);
+    }
+    if (c == '[')
+        return bracket(ps);
+    if (c != '\\') {
+        ps->p++;
+        return char_node(ps, (unsigned char)c);
+    }
+
+    char e = ps->p[1];
+    if (!e) {
+        ps->err = "Trailing backslash";
+        return -1;
+    }
+    ps->p += 2;
+    if (e == '(') {
+        int n = alternation(ps, depth + 1);
+        if (n < 0)
+            return -1;
+        if (ps->p[0] != '\\' || ps->p[1] != ')') {
+            ps->err = "Unmatched ( or \\(";
+            return -1;
+        }
+        ps->p += 2;
+        return n;
+    }
+    if (strchr("123456789<>bB`'", e)) {
+        ps->unsupported = true;
+        return -1;
+    }
+    if (strchr("wWsS", e))
+        return escape_class(ps, e);
+    return char_node(ps, (unsigned char)e);
+}
+
+// Parse the bounds after "\{"; errors are worded as grep's
+static int interval(struct parser *ps, int *min, int *max)
+{
+    if (!strstr(ps->p, "\\}")) {
+        ps->err = "Unmatched \\{";
+        return -1;
+    }
+    char *end;
+    *min = 0;
+    if (isdigit((unsigned char)*ps->p)) {
+        long v = strtol(ps->p, &end, 10);
+        if (v > 32767)
+            goto big;
+        *min = (int)v;
+        ps->p = end;
+    } else if (*ps->p != ',') {
+        goto bad;
+    }
+    *max = *min;
+    if (*ps->p == ',') {
+        ps->p++;
+        *max = -1;
+        if (isdigit((unsigned char)*ps->p)) {
+            long v = strtol(ps->p, &end, 10);
+            if (v > 32767)
+                goto big;
+            *max = (int)v;
+            ps->p = end;
+        }
+    }
+    if (ps->p[0] != '\\' || ps->p[1] != '}')
+        goto bad;
+    ps->p += 2;
+    if (*max >= 0 && *max < *min)
+        goto bad;
+    return 0;
+bad:
+    ps->err = "Invalid content of \\{\\}";
+    return -1;
+big:
+    ps->err = "Regular expression too big";
+    return -1;
+}
+
+static int branch(struct parser *ps, int depth)
+{
+    int seq = -1;
+    bool start = true;      // nothing to repeat yet: '*' and "\{" are literal
+    bool bol = true;        // '^' anchors only first, "^^" matches a '^'
+    while (!at_branch_end(ps->p)) {
+        int n;
+        if (*ps->p == '^' && bol) {
+            ps->p++;
+            bol = false;
+            n = node(ps, A_BOL, -1, -1);
+        } else if (*ps->p == '$' && at_branch_end(ps->p + 1)) {
+            ps->p++;
+            n = node(ps, A_EOL, -1, -1);
+            start = false;
+        } else {
+            if (*ps->p == '*' && start) {
+                ps->p++;
+                n = char_node(ps, '*');
+            } else if (ps->p[0] == '\\' && ps->p[1] == '{' && start) {
+                // As grep does; "\{1\}" alone matches "{1}"
+                ps->p += 2;
+                n = char_node(ps, '{');
+            } else {
+                n = atom(ps, depth);
+            }
+            start = bol = false;
+            while (n >= 0) {
+                int min, max;
+                if (*ps->p == '*') {
+                    ps->p++;
+                    min = 0, max = -1;
+                } else if (ps->p[0] == '\\' && ps->p[1] == '+') {
+                    ps->p += 2;
+                    min = 1, max = -1;
+                } else if (ps->p[0] == '\\' && ps->p[1] == '?') {
+                    ps->p += 2;
+                    min = 0, max = 1;
+                } else if (ps->p[0] == '\\' && ps->p[1] == '{') {
+                    ps->p += 2;
+                    if (interval(ps, &min, &max) != 0)
+                        return -1;
+                } else {
+                    break;
+                }
+                int r = node(ps, A_REP, n, -1);
+                if (r >= 0) {
+                    ps->nodes[r].min = min;
+                    ps->nodes[r].max = max;
+                }
+                n = r;
+            }
+        }
+        if (n < 0)
+            return -1;
+        seq = seq < 0 ? n : node(ps, A_CAT, seq, n);
+        if (seq < 0)
+            return -1;
+    }
+    return seq < 0 ? node(ps, A_EMPTY, -1, -1) : seq;
+}
+
+static int alternation(struct parser *ps, int depth)
+{
+    int n = branch(ps, depth);
+    while (n >= 0 && ps->p[0] == '\\' && ps->p[1] == '|') {
+        ps->p += 2;
+        int m = branch(ps, depth);
+        n = m < 0 ? -1 : node(ps, A_ALT, n, m);
+    }
+    return n;
+}
+
+/* Required literal */
+
+struct litbuf {
+    char s[RX_MAX_LIT];
+    size_t n;
+};
+
+static void consider(struct rx *rx, const struct litbuf *run)
+{
+    if (run->n > rx->nlit) {
+        memcpy(rx->lit, run->s, run->n);
+        rx->nlit = run->n;
+    }
+}
+
+// The byte a set holds if it holds exactly one, else -1
+static int single_byte(const uint8_t bits[32])
+{
+    int c = -1;
+    for (int i = 0; i < 256; i++) {
+        if (bit_test(bits, (unsigned)i)) {
+            if (c >= 0)
+                return -1;
+            c = i;
+        }
+    }
+    return c;
+}
+
+// Keep in rx->lit the longest run of bytes every match of node n contains.
+// Runs are extended across concatenations; alternations contribute none.
+static void required(struct parser *ps, int n, struct litbuf *run)
+{
+    const struct ast *x = &ps->nodes[n];
+    struct rx *rx = ps->rx;
+    int c;
+    switch (x->type) {
+    case A_CAT:
+        required(ps, x->a, run);
+        required(ps, x->b, run);
+        return;
+    case A_SET:
+        c = single_byte(rx->sets[x->set]);
+        if (c >= 0) {
+            if (run->n == RX_MAX_LIT) {
+                consider(rx, run);
+                run->n = 0;
+            }
+            run->s[run->n++] = (char)c;
+            return;
+        }
+        break;
+    case A_REP:
+        consider(rx, run);
+        run->n = 0;
+        if (x->min >= 1) {
+            struct litbuf inner = {.n = 0};
+            required(ps, x->a, &inner);
+            consider(rx, &inner);
+        }
+        return;
+    case A_EMPTY:
+        return;
+    default:
+        break;
+    }
+    consider(rx, run);
+    run->n = 0;
+}
+
+/* NFA construction */
+
+static int nfa_add(struct rx *rx, enum nfa_op op, int set, int out, int out1)
+{
+    if (rx->nnfa == RX_MAX_NFA)
+        return -1;
+    struct nstate *s = &rx->nfa[rx->nnfa];
+    s->op = (uint8_t)op;
+    s->set = set;
+    s->out = out;
+    s->out1 = out1;
+    return rx->nnfa++;
+}
+
+// Build node n, returning its entry state and in *end an N_EPS state
+// whose out is left for the caller to connect
+static int compile(struct rx *rx, const struct ast *nodes, int n, int *end)
+{
+    const struct ast *x = &nodes[n];
+    int e = nfa_add(rx, N_EPS, -1, -1, -1);
+    if (e < 0)
+        return -1;
+    *end = e;
+
+    int s, ae, be;
+    switch (x->type) {
+    case A_EMPTY:
+        return e;
+    case A_SET:
+        return nfa_add(rx, N_SET, x->set, e, -1);
+    case A_BOL:
+        return nfa_add(rx, N_BOL, -1, e, -1);
+    case A_EOL:
+        return nfa_add(rx, N_EOL, -1, e, -1);
+    case A_CAT:
+        if ((s = compile(rx, nodes, x->a, &ae)) < 0)
+            return -1;
+        if ((rx->nfa[ae].out = compile(rx, nodes, x->b, &be)) < 0)
+            return -1;
+        rx->nfa[be].out = e;
+        return s;
+    case A_ALT: {
+        int a = compile(rx, nodes, x->a, &ae);
+        int b = a < 0 ? -1 : compile(rx, nodes, x->b, &be);
+        if (b < 0)
+            return -1;
+        rx->nfa[ae].out = e;
+        rx->nfa[be].out = e;
+        return nfa_add(rx, N_SPLIT, -1, a, b);
+    }
+    case A_REP: {
+        // min copies, then a loop or max - min nested optional copies
+        int head = e, tail = -1;
+        for (int i = 0; i < x->min; i++) {
+            int cs = compile(rx, nodes, x->a, &ae);
+            if (cs < 0)
+                return -1;
+            if (tail < 0)
+                head = cs;
+            else
+                rx->nfa[tail].out = cs;
+            tail = ae;
+        }
+        int link = e;
+        if (x->max < 0) {
+            int cs = compile(rx, nodes, x->a, &ae);
+            int split = cs < 0 ? -1 : nfa_add(rx, N_SPLIT, -1, cs, e);
+            if (split < 0)
+                return -1;
+            rx->nfa[ae].out = split;
+            link = split;
+        } else {
+            for (int i = x->min; i < x->max; i++) {
+                int cs = compile(rx, nodes, x->a, &ae);
+                int split = cs < 0 ? -1 : nfa_add(rx, N_SPLIT, -1, cs, e);
+                if (split < 0)
+                    return -1;
+                rx->nfa[ae].out = link;
+                link = split;
+            }
+        }
+        if (tail < 0)
+            return link;
+        rx->nfa[tail].out = link;
+        return head;
+    }
+    }
+    return -1;
+}
+
+// Split bytes into classes no byte set tells apart
+static void byte_classes(struct rx *rx)
+{
+    int cls[256] = {0};
+    int n = 1;
+    for (int i = 0; i < rx->nsets; i++) {
+        // Bytes in the set move to a new class, one per class they leave
+        int remap[256];
+        for (int k = 0; k < n; k++)
+            remap[k] = -1;
+        for (unsigned c = 0; c < 256; c++) {
+            if (bit_test(rx->sets[i], c)) {
+                if (remap[cls[c]] < 0)
+                    remap[cls[c]] = n++;
+                cls[c] = remap[cls[c]];
+            }
+        }
+        // Renumber densely; classes the set covered whole are left empty
+        int dense[512];
+        for (int k = 0; k < n; k++)
+            dense[k] = -1;
+        n = 0;
+        for (unsigned c = 0; c < 256; c++) {
+            if (dense[cls[c]] < 0)
+                dense[cls[c]] = n++;
+            cls[c] = dense[cls[c]];
+        }
+    }
+    rx->nclasses = n;
+    for (int c = 0; c < 256; c++)
+        rx->cls[c] = (uint8_t)cls[c];
+}
+
+struct rx *rx_compile(const char *pattern, char *err, size_t errlen,
+                      bool *unsupported)
+{
+    struct parser ps = {.p = pattern};
+    *unsupported = false;
+    struct rx *rx = ps.rx = calloc(1, sizeof(*rx));
+    if (!rx) {
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+
+    int root = alternation(&ps, 0);
+    if (root >= 0 && *ps.p) {
+        ps.err = "Unmatched ) or \\)";
+        root = -1;
+    }
+    if (root < 0)
+        goto fail;
+
+    struct litbuf run = {.n = 0};
+    required(&ps, root, &run);
+    consider(rx, &run);
+
+    rx->nfa = malloc(RX_MAX_NFA * sizeof(*rx->nfa));
+    if (!rx->nfa) {
+        ps.err = "out of memory";
+        goto fail;
+    }
+    int end;
+    rx->start = compile(rx, ps.nodes, root, &end);
+    if (rx->start < 0 || (rx->nfa[end].out = nfa_add(rx, N_MATCH, -1, -1, -1)) < 0) {
+        // Too large for the automaton; regexec copes with big repeats
+        ps.unsupported = true;
+        goto fail;
+    }
+    byte_classes(rx);
+    // Give back what the NFA left of its RX_MAX_NFA states
+    struct nstate *nfa = realloc(rx->nfa, (size_t)rx->nnfa * sizeof(*rx->nfa));
+    if (nfa)
+        rx->nfa = nfa;
+    free(ps.nodes);
+    return rx;
+
+fail:
+    if (ps.unsupported)
+        *unsupported = true;
+    else
+        snprintf(err, errlen, "%s", ps.err ? ps.err : "invalid pattern");
+    free(ps.nodes);
+    rx_free(rx);
+    return NULL;
+}
+
+void rx_free(struct rx *rx)
+{
+    if (!rx)
+        return;
+    free(rx->sets);
+    free(rx->nfa);
+    free(rx);
+}
+
+size_t rx_mem(const struct rx *rx)
+{
+    return sizeof(*rx) + (size_t)rx->nnfa * sizeof(*rx->nfa) + (size_t)rx->nsets * 32;
+}
+
+/* State sets */
+
+// Add s and the states reachable from it without reading a byte
+static void closure(struct rx_scan *sc, struct nset *set, int s, bool bol)
+{
+    const struct nstate *nfa = sc->rx->nfa;
+    uint32_t sp = 0;
+    sc->stack[sp++] = (uint32_t)s;
+    while (sp) {
+        uint32_t i = sc->stack[--sp];
+        if (sc->mark[i] == sc->gen)
+            continue;
+        sc->mark[i] = sc->gen;
+        switch (nfa[i].op) {
+        case N_EPS:
+            sc->stack[sp++] = (uint32_t)nfa[i].out;
+            break;
+        case N_SPLIT:
+            sc->stack[sp++] = (uint32_t)nfa[i].out1;
+            sc->stack[sp++] = (uint32_t)nfa[i].out;
+            break;
+        case N_BOL:
+            if (bol)
+                sc->stack[sp++] = (uint32_t)nfa[i].out;
+            break;
+        case N_MATCH:
+            sc->hit = true;
+            set->s[set->n++] = i;
+            break;
+        default:
+            set->s[set->n++] = i;
+            break;
+        }
+    }
+}
+
+static void next_gen(struct rx_scan *sc)
+{
+    if (++sc->gen == 0) {
+        memset(sc->mark, 0, (size_t)sc->rx->nnfa * sizeof(uint32_t));
+        sc->gen = 1;
+    }
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// The states at the start of a line
+static void start_set(struct rx_scan *sc, struct nset *out)
+{
+    next_gen(sc);
+    out->n = 0;
+    sc->hit = false;
+    closure(sc, out, sc->rx->start, true);
+}
+
+// The states after reading byte c from the states in in. A match may start
+// anywhere, so the start state is always added again.
+static void step(struct rx_scan *sc, const uint32_t *in, uint32_t n,
+                 unsigned c, struct nset *out)
+{
+    const struct rx *rx = sc->rx;
+    next_gen(sc);
+    out->n = 0;
+    sc->hit = false;
+    for (uint32_t i = 0; i < n; i++) {
+        const struct nstate *s = &rx->nfa[in[i]];
+        if (s->op == N_SET && bit_test(rx->sets[s->set], c))
+            closure(sc, out, s->out, false);
+    }
+    closure(sc, out, rx->start, false);
+}
+
+static uint8_t set_flags(struct rx_scan *sc, const uint32_t *s, uint32_t n)
+{
+    const struct nstate *nfa = sc->rx->nfa;
+    uint8_t flags = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (nfa[s[i]].op == N_MATCH)
+            return D_MATCH;
+    }
+    next_gen(sc);
+    sc->aux.n = 0;
+    sc->hit = false;
+    for (uint32_t i = 0; i < n && !sc->hit; i++) {
+        if (nfa[s[i]].op == N_EOL)
+            closure(sc, &sc->aux, nfa[s[i]].out, false);
+    }
+    if (sc->hit)
+        flags |= D_EOLMATCH;
+    return flags;
+}
+
+/* Lazy DFA */
+
+static uint32_t hash_set(const uint32_t *s, uint32_t n)
+{
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < n; i++)
+        h = (h ^ s[i]) * 16777619u;
+    return h;
+}
+
+#define TABLE_SIZE (RX_DFA_STATES * 2)
+#define POOL_START 4096
+
+static int32_t dfa_find(const struct rx_scan *sc, const struct nset *set, uint32_t h)
+{
+    for (uint32_t i = h & (TABLE_SIZE - 1);; i = (i + 1) & (TABLE_SIZE - 1)) {
+        int32_t id = sc->table[i];
+        if (id < 0)
+            return -1;
+        const struct dstate *d = &sc->st[id];
+        if (d->hash == h && d->n == set->n &&
+            memcmp(sc->pool + d->off, set->s, set->n * sizeof(uint32_t)) == 0)
+            return id;
+    }
+}
+
+// Add a state for set, which must be sorted; -1 if memory ran out
+static int32_t dfa_add(struct rx_scan *sc, const struct nset *set, uint32_t h)
+{
+    if (sc->npool + set->n > sc->poolcap) {
+        size_t cap = sc->poolcap * 2;
+        while (cap < sc->npool + set->n)
+            cap *= 2;
+        uint32_t *pool = realloc(sc->pool, cap * sizeof(uint32_t));
+        if (!pool)
+            return -1;
+        sc->pool = pool;
+        sc->poolcap = cap;
+    }
+    int32_t id = (int32_t)sc->nst++;
+    struct dstate *d = &sc->st[id];
+    d->off = (uint32_t)sc->npool;
+    d->n = set->n;
+    d->hash = h;
+    memcpy(sc->pool + sc->npool, set->s, set->n * sizeof(uint32_t));
+    sc->npool += set->n;
+    d->flags = set_flags(sc, set->s, set->n);
+    for (int c = 0; c < sc->rx->nclasses; c++)
+        sc->trans[(size_t)id * (size_t)sc->rx->nclasses + (size_t)c] = -1;
+    uint32_t i = h & (TABLE_SIZE - 1);
+    while (sc->table[i] >= 0)
+        i = (i + 1) & (TABLE_SIZE - 1);
+    sc->table[i] = id;
+    return id;
+}
+
+// Empty the cache, leaving the line start as state 0
+static int dfa_flush(struct rx_scan *sc)
+{
+    sc->nst = 0;
+    sc->npool = 0;
+    sc->bytes = 0;
+    for (uint32_t i = 0; i < TABLE_SIZE; i++)
+        sc->table[i] = -1;
+    start_set(sc, &sc->tmp);
+    qsort(sc->tmp.s, sc->tmp.n, sizeof(uint32_t), cmp_u32);
+    return dfa_add(sc, &sc->tmp, hash_set(sc->tmp.s, sc->tmp.n)) < 0 ? -1 : 0;
+}
+
+// Switch to simulating the NFA from the states in s
+static void to_nfa(struct rx_scan *sc, const uint32_t *s, uint32_t n)
+{
+    memmove(sc->cur.s, s, n * sizeof(uint32_t));
+    sc->cur.n = n;
+    sc->nfa = true;
+    sc->hit = false;
+    for (uint32_t i = 0; i < n; i++) {
+        if (sc->rx->nfa[s[i]].op == N_MATCH)
+            sc->hit = true;
+    }
+}
+
+// Build the transition from state d on byte c. Returns the target, or -1
+// after switching to NFA simulation at the target.
+static int32_t dfa_step(struct rx_scan *sc, int32_t d, unsigned c)
+{
+    const struct dstate *from = &sc->st[d];
+    step(sc, sc->pool + from->off, from->n, c, &sc->tmp);
+    qsort(sc->tmp.s, sc->tmp.n, sizeof(uint32_t), cmp_u32);
+    uint32_t h = hash_set(sc->tmp.s, sc->tmp.n);
+    int32_t t = dfa_find(sc, &sc->tmp, h);
+    if (t >= 0) {
+        sc->trans[(size_t)d * (size_t)sc->rx->nclasses + sc->rx->cls[c]] = t;
+        return t;
+    }
+    if (sc->nst == RX_DFA_STATES) {
+        if (sc->bytes < (uint64_t)RX_THRASH_BYTES * RX_DFA_STATES) {
+            to_nfa(sc, sc->tmp.s, sc->tmp.n);
+            return -1;
+        }
+        // tmp survives the flush in next, which only the NFA uses
+        memcpy(sc->next.s, sc->tmp.s, sc->tmp.n * sizeof(uint32_t));
+        uint32_t n = sc->tmp.n;
+        if (dfa_flush(sc) != 0) {
+            to_nfa(sc, sc->next.s, n);
+            return -1;
+        }
+        memcpy(sc->tmp.s, sc->next.s, n * sizeof(uint32_t));
+        sc->tmp.n = n;
+        if ((t = dfa_find(sc, &sc->tmp, h)) >= 0)
+            return t;
+        d = -1;
+    }
+    if ((t = dfa_add(sc, &sc->tmp, h)) < 0) {
+        to_nfa(sc, sc->tmp.s, sc->tmp.n);
+        return -1;
+    }
+    if (d >= 0)
+        sc->trans[(size_t)d * (size_t)sc->rx->nclasses + sc->rx->cls[c]] = t;
+    return t;
+}
+
+/* Scanning */
+
+struct rx_scan *rx_scan_new(const struct rx *rx)
+{
+    struct rx_scan *sc = calloc(1, sizeof(*sc));
+    if (!sc)
+        return NULL;
+    size_t n = (size_t)rx->nnfa;
+    sc->rx = rx;
+    sc->gen = 1;
+    sc->mark = calloc(n, sizeof(uint32_t));
+    sc->stack = malloc((2 * n + 1) * sizeof(uint32_t));
+    sc->tmp.s = malloc(n * sizeof(uint32_t));
+    sc->aux.s = malloc(n * sizeof(uint32_t));
+    sc->cur.s = malloc(n * sizeof(uint32_t));
+    sc->next.s = malloc(n * sizeof(uint32_t));
+    sc->st = malloc(RX_DFA_STATES * sizeof(*sc->st));
+    sc->trans = malloc((size_t)RX_DFA_STATES * (size_t)rx->nclasses * sizeof(int32_t));
+    sc->table = malloc(TABLE_SIZE * sizeof(int32_t));
+    sc->poolcap = POOL_START;
+    sc->pool = malloc(sc->poolcap * sizeof(uint32_t));
+    if (!sc->mark || !sc->stack || !sc->tmp.s || !sc->aux.s || !sc->cur.s ||
+        !sc->next.s || !sc->st || !sc->trans || !sc->table || !sc->pool ||
+        dfa_flush(sc) != 0) {
+        rx_scan_free(sc);
+        return NULL;
+    }
+    return sc;
+}
+
+void rx_scan_free(struct rx_scan *sc)
+{
+    if (!sc)
+        return;
+    free(sc->mark);
+    free(sc->stack);
+    free(sc->tmp.s);
+    free(sc->aux.s);
+    free(sc->cur.s);
+    free(sc->next.s);
+    free(sc->st);
+    free(sc->trans);
+    free(sc->table);
+    free(sc->pool);
+    free(sc);
+}
+
+size_t rx_scan_mem(const struct rx *rx)
+{
+    // Marks, stack and four sets per NFA state, then the DFA cache
+    size_t n = (size_t)rx->nnfa;
+    return sizeof(struct rx_scan) + (7 * n + 1) * sizeof(uint32_t) +
+           RX_DFA_STATES * (sizeof(struct dstate) + (size_t)rx->nclasses * sizeof(int32_t)) +
+           (TABLE_SIZE + POOL_START) * sizeof(uint32_t);
+}
+
+void rx_begin(struct rx_scan *sc)
+{
+    sc->nfa = false;
+    sc->in_line = false;
+    sc->matched = false;
+}
+
+static void line_begin(struct rx_scan *sc)
+{
+    if (sc->nfa)
+        start_set(sc, &sc->cur);
+    else
+        sc->d = 0;
+}
+
+// Advance the line in progress over [p, e); true once the line matches
+static bool advance(struct rx_scan *sc, const unsigned char *p, const unsigned char *e)
+{
+    if (!sc->nfa) {
+        const uint8_t *cls = sc->rx->cls;
+        size_t nc = (size_t)sc->rx->nclasses;
+        int32_t d = sc->d;
+        sc->bytes += (uint64_t)(e - p);
+        if (sc->st[d].flags & D_MATCH)
+            return true;
+        while (p < e) {
+            int32_t t = sc->trans[(size_t)d * nc + cls[*p]];
+            if (t < 0 && (t = dfa_step(sc, d, *p)) < 0) {
+                p++;
+                if (sc->hit)
+                    return true;
+                goto nfa;
+            }
+            d = t;
+            p++;
+            if (sc->st[d].flags & D_MATCH) {
+                sc->d = d;
+                return true;
+            }
+        }
+        sc->d = d;
+        return false;
+    }
+
+nfa:
+    for (; p < e; p++) {
+        step(sc, sc->cur.s, sc->cur.n, *p, &sc->next);
+        if (sc->hit)
+            return true;
+        struct nset t = sc->cur;
+        sc->cur = sc->next;
+        sc->next = t;
+    }
+    return false;
+}
+
+static bool line_end_matches(struct rx_scan *sc)
+{
+    if (sc->nfa)
+        return set_flags(sc, sc->cur.s, sc->cur.n) != 0;
+    return sc->st[sc->d].flags != 0;
+}
+
+static bool match_line(struct rx_scan *sc, const char *p, const char *e)
+{
+    line_begin(sc);
+    return advance(sc, (const unsigned char *)p, (const unsigned char *)e) ||
+           line_end_matches(sc);
+}
+
+// Find the required literal in [p, p + n)
+static const char *lit_find(const struct rx *rx, const char *p, size_t n)
+{
+    size_t k = rx->nlit;
+    if (k == 1)
+        return memchr(p, rx->lit[0], n);
+    if (n < k)
+        return NULL;
+#if defined(__SSE2__)
+    // Compare the first and last bytes of the literal 16 positions at a
+    // time and check the full literal only where both agree
+    const __m128i first = _mm_set1_epi8(rx->lit[0]);
+    const __m128i last = _mm_set1_epi8(rx->lit[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + i + k - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(p + i + bit + 1, rx->lit + 1, k - 2) == 0)
+                return p + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return memmem(p + i, n - i, rx->lit, k);
+#else
+    return memmem(p, n, rx->lit, k);
+#endif
+}
+
+// Count the matching lines in [p, e), which ends with a newline
+static uint64_t scan_lines(struct rx_scan *sc, const char *p, const char *e)
+{
+    uint64_t count = 0;
+    if (sc->rx->nlit) {
+        // Only lines holding the literal can match
+        const char *hit;
+        while (p < e && (hit = lit_find(sc->rx, p, (size_t)(e - p)))) {
+            const char *ls = memrchr(p, '\n', (size_t)(hit - p));
+            const char *le = memchr(hit, '\n', (size_t)(e - hit));
+            count += match_line(sc, ls ? ls + 1 : p, le);
+            p = le + 1;
+        }
+        return count;
+    }
+    while (p < e) {
+        const char *le = memchr(p, '\n', (size_t)(e - p));
+        count += match_line(sc, p, le);
+        p = le + 1;
+    }
+    return count;
+}
+
+uint64_t rx_feed(struct rx_scan *sc, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len;
+    uint64_t count = 0;
+
+    // Finish the line the previous chunk ended in
+    if (sc->in_line) {
+        const char *nl = memchr(p, '\n', len);
+        if (!sc->matched)
+            sc->matched = advance(sc, (const unsigned char *)p,
+                                  (const unsigned char *)(nl ? nl : end));
+        if (!nl)
+            return 0;
+        count += sc->matched || line_end_matches(sc);
+        sc->in_line = false;
+        p = nl + 1;
+    }
+
+    const char *last = memrchr(p, '\n', (size_t)(end - p));
+    if (last) {
+        count += scan_lines(sc, p, last + 1);
+        p = last + 1;
+    }
+
+    // A literal may continue into the next chunk, so the unfinished line
+    // always goes through the automaton
+    if (p < end) {
+        sc->in_line = true;
+        line_begin(sc);
+        sc->matched = advance(sc, (const unsigned char *)p, (const unsigned char *)end);
+    }
+    return count;
+}
+
+uint64_t rx_end(struct rx_scan *sc)
+{
+    if (!sc->in_line)
+        return 0;
+    sc->in_line = false;
+    return sc->matched || line_end_matches(sc);
+}
@@ -0,0 +1,73 @@
+#ifndef RX_H
+#define RX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Basic regular expressions, as grep uses them, matched line by line with
+ * a lazily built DFA.
+ *
+ * Patterns are compiled to a Thompson NFA. DFA states are built from NFA
+ * state sets on first use and kept in a per-scan cache of at most
+ * RX_DFA_STATES states; when the cache fills it is flushed, and if that
+ * happens again before RX_THRASH_BYTES bytes per cached state were
+ * scanned, the rest of the file is matched by simulating the NFA directly,
+ * which needs no cache and never backtracks.
+ *
+ * The longest literal every match must contain is searched for first
+ * (with SSE2 where available), so only lines holding it reach the DFA.
+ *
+ * Matching is byte-wise, as grep does in the C locale. GNU extensions
+ * \+ \? \| \{,n\} \w \W \s \S are supported; back-references and word
+ * boundary assertions are not, and rx_compile() reports them as
+ * unsupported so the caller can fall back to regexec().
+ *
+ * Where POSIX leaves a pattern undefined, GNU grep is followed: a '^'
+ * after the leading one and a '*' or "\{" with nothing to repeat are
+ * literals, and an interval missing its "\}" is an error, as
+ * "Unmatched \{".
+ */
+#define RX_MAX_NFA 20000
+#define RX_DFA_STATES 1024
+#define RX_THRASH_BYTES 16
+
+struct rx;
+struct rx_scan;
+
+/**
+ * @param pattern the basic regular expression
+ * @param err receives a message when the pattern is invalid
+ * @param unsupported set to true when the pattern is valid but needs
+ *   features this engine lacks
+ * @return the compiled pattern, or NULL if it is invalid or unsupported
+ */
+struct rx *rx_compile(const char *pattern, char *err, size_t errlen,
+                      bool *unsupported);
+
+void rx_free(struct rx *rx);
+
+// Bytes the compiled pattern holds
+size_t rx_mem(const struct rx *rx);
+
+// Per-thread scan state, including the DFA cache
+struct rx_scan *rx_scan_new(const struct rx *rx);
+
+void rx_scan_free(struct rx_scan *sc);
+
+// Bytes an rx_scan of rx holds, with its pool of DFA state sets at the
+// size it starts at; the pool grows only for states of many NFA states
+size_t rx_scan_mem(const struct rx *rx);
+
+// Start a new file
+void rx_begin(struct rx_scan *sc);
+
+// Feed the next len bytes, returning the number of lines completed in
+// them that match
+uint64_t rx_feed(struct rx_scan *sc, const char *buf, size_t len);
+
+// End the file, returning 1 if a final line without a newline matches
+uint64_t rx_end(struct rx_scan *sc);
+
+#endif
@@ -0,0 +1,74 @@
+#include "scan.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+void scan_advise(int fd, const struct scan_cache *c)
+{
+    if (c && c->drop)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (c && c->readahead)
+        posix_fadvise(fd, 0, (off_t)c->readahead, POSIX_FADV_WILLNEED);
+}
+
+void scan_release(int fd, uint64_t off, uint64_t len, const struct scan_cache *c)
+{
+    if (c && c->drop)
+        posix_fadvise(fd, (off_t)off, (off_t)len, POSIX_FADV_DONTNEED);
+}
+
+int scan_fd(int fd, uint64_t off, struct match_ctx *ctx, char *buf,
+            size_t bufsz, struct scan_stats *stats, const bool *cancel,
+            const struct scan_cache *c)
+{
+    uint64_t dropped = off;         // pages before this are given back
+    uint64_t ahead = c && c->readahead ? c->readahead : UINT64_MAX;
+    for (;;) {
+        if (cancel && __atomic_load_n(cancel, __ATOMIC_RELAXED))
+            return 0;
+        if (ahead != UINT64_MAX && off + bufsz > ahead) {
+            // Keep readahead bytes requested past the read about to be made
+            posix_fadvise(fd, (off_t)ahead, (off_t)(off + c->readahead - ahead),
+                          POSIX_FADV_WILLNEED);
+            ahead = off + c->readahead;
+        }
+        ssize_t n = pread(fd, buf, bufsz, (off_t)off);
+        stats->reads++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return 0;
+        match_feed(ctx, buf, (size_t)n);
+        stats->bytes += (uint64_t)n;
+        off += (uint64_t)n;
+        if (off - dropped >= SCAN_DROP_WINDOW) {
+            scan_release(fd, dropped, off - dropped, c);
+            dropped = off;
+        }
+    }
+}
+
+int scan_file(int dirfd, const char *name, struct match_ctx *ctx,
+              char *buf, size_t bufsz, struct scan_stats *stats)
+{
+    struct scan_stats unused = {0};
+    if (!stats)
+        stats = &unused;
+    stats->opens++;
+    int fd = openat(dirfd, name, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    match_begin(ctx);
+    int rc = scan_fd(fd, 0, ctx, buf, bufsz, stats, NULL, NULL);
+    int err = errno;
+    match_end(ctx);
+
+    close(fd);
+    errno = err;
+    return rc;
+}
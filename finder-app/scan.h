@@ -0,0 +1,77 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "matcher.h"
+
+// Size of the read buffer each scanning thread streams files through
+#define SCAN_BUFSZ (128 * 1024)
+
+// I/O done by scan_file(), accumulated across calls
+struct scan_stats {
+    uint64_t opens;
+    uint64_t reads;
+    uint64_t bytes;
+    uint64_t enters;        // io_uring_enter calls, see pipeline.h
+    uint64_t mem_peak;      // most budgeted memory in use, see pipeline.h
+    uint64_t skipped;       // files skipped as binary or too large
+    uint64_t skipped_bytes; // bytes of them left unread
+};
+
+/*
+ * How scanning treats the page cache. By default files are read like any
+ * other, and what they bring into the cache stays there. A scan that
+ * drops instead tells the kernel it reads sequentially and gives up each
+ * file's pages as soon as they are matched, every SCAN_DROP_WINDOW bytes
+ * for large files, so a scan of a large tree does not push out the pages
+ * other programs are using. Pages that were cached before are dropped too
+ * unless another process has them mapped.
+ */
+struct scan_cache {
+    bool drop;              // POSIX_FADV_SEQUENTIAL, then POSIX_FADV_DONTNEED
+    size_t readahead;       // bytes to keep requested ahead of the reads,
+                            // 0 to leave readahead to the kernel
+};
+
+#define SCAN_DROP_WINDOW (8u << 20)
+
+/**
+ * Give the kernel a freshly opened file's readahead advice.
+ * @param c the policy, NULL for the default
+ */
+void scan_advise(int fd, const struct scan_cache *c);
+
+/**
+ * Drop a file's pages from the cache once it is matched, if c says to.
+ * @param off where the pages to drop start
+ * @param len bytes to drop, 0 for all to the end of the file
+ */
+void scan_release(int fd, uint64_t off, uint64_t len, const struct scan_cache *c);
+
+/**
+ * Stream the file name in dirfd through the matcher, leaving the file's
+ * per-pattern counts in ctx.
+ * @param buf a scratch buffer of bufsz bytes
+ * @param stats if not NULL, receives the calls made and bytes read
+ * @return 0 on success, -1 with errno set if the file could not be read
+ */
+int scan_file(int dirfd, const char *name, struct match_ctx *ctx,
+              char *buf, size_t bufsz, struct scan_stats *stats);
+
+/**
+ * Feed the rest of an open file through the matcher, from offset off to
+ * the end, without starting or ending the file in ctx.
+ * @param stats receives the calls made and bytes read
+ * @param cancel if not NULL, reading stops early once another thread sets it
+ * @param c the page cache policy, NULL for the default; the pages read
+ *   are dropped as reading goes, though not those before off
+ * @return 0 on success, -1 with errno set on a read error
+ */
+int scan_fd(int fd, uint64_t off, struct match_ctx *ctx, char *buf,
+            size_t bufsz, struct scan_stats *stats, const bool *cancel,
+            const struct scan_cache *c);
+
+#endif
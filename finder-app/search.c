@@ -0,0 +1,885 @@
+#include "finder.h"
+#include "budget.h"
+#include "cache.h"
+#include "checkpoint.h"
+#include "dirtree.h"
+#include "ignore.h"
+#include "index.h"
+#include "matcher.h"
+#include "pipeline.h"
+#include "scan.h"
+#include "topk.h"
+#include "walk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// A listed file whose size traversal learned
+struct sized {
+    uint32_t file;
+    uint64_t size;
+};
+
+/*
+ * Checkpoints are written by a thread of their own. Files are reported
+ * under the pipeline's lock, so a write and fsync there would hold up
+ * every matcher; only a copy of the progress is taken there.
+ */
+struct saver {
+    const char *file;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct checkpoint c;            // the copy, the thread's own while full
+    bool full;                      // c is waiting to be written or being written
+    bool stop;
+    bool started;
+};
+
+struct search {
+    const struct finder_opts *opts;
+    struct finder_result *res;
+    struct file_list files;         // files that have to be read
+    struct walk_stats walk;
+    struct scan_stats scan;
+    struct cache *cache;
+    struct ignore *ignore;
+    struct cache_entry *keys;       // identity of each listed file, with a cache
+    size_t nkeys;
+    uint64_t *qhash;                // cache key of each pattern
+    uint64_t *cached;
+    int64_t racy_ns;                // files modified after this may change unseen
+    struct topk top;
+    struct dirtree dirs;            // per-directory totals, if asked for
+    uint32_t dir;                   // node of the file being added
+    uint32_t *dir_of;               // node of each listed file, with dirs
+    size_t ndir_of;
+    struct sized *big;              // listed files known to fill a first read
+    size_t nbig;
+    uint64_t key;                   // hash of the listed paths, for a checkpoint
+    uint64_t *done;                 // bit per listed file matched, with a checkpoint
+    uint64_t *scanned;              // per pattern, lines in the files matched
+    uint64_t *dir_base;             // each directory's lines once the walk was over
+    struct topk top_scanned;        // the best of the files matched, with a checkpoint
+    struct saver saver;
+    uint64_t saved_ns;              // when progress was last handed to the saver
+    char path[PATH_MAX];            // of the file being reported
+    bool nomem;                     // top could not keep a file
+    uint64_t total;                 // matching lines so far, over all patterns
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Bytes this process has had read from storage, as /proc/self/io counts
+ * them, 0 if the kernel does not keep the count. io_uring's workers are
+ * threads of the process, so their reads are included.
+ */
+static uint64_t disk_read_bytes(void)
+{
+    FILE *fp = fopen("/proc/self/io", "r");
+    if (!fp)
+        return 0;
+    char line[128];
+    unsigned long long n = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "read_bytes: %llu", &n) == 1)
+            break;
+    }
+    fclose(fp);
+    return n;
+}
+
+static uint64_t major_faults(void)
+{
+    struct rusage ru;
+    return getrusage(RUSAGE_SELF, &ru) == 0 ? (uint64_t)ru.ru_majflt : 0;
+}
+
+// Hash of everything that decides a pattern's per-file count
+static uint64_t pattern_hash(const struct finder_opts *opts, const char *pattern)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (const char *p = pattern; *p; p++)
+        h = (h ^ (uint8_t)*p) * 1099511628211ull;
+    h = (h ^ (uint64_t)opts->fixed_strings) * 1099511628211ull;
+    h = (h ^ (opts->fuzzy ? opts->max_errors + 1ull : 0)) * 1099511628211ull;
+    h = (h ^ (uint64_t)opts->skip_binary) * 1099511628211ull;
+    h = (h ^ opts->max_size) * 1099511628211ull;
+    h = (h ^ (uint64_t)opts->decompress) * 1099511628211ull;
+    return h | 1;
+}
+
+static void key_of(struct cache_entry *key, const struct stat *st)
+{
+    memset(key, 0, sizeof(*key));
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->size = (uint64_t)st->st_size;
+    key->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// True once the caller has asked the run to stop
+static bool search_cancelled(const struct search *s)
+{
+    return s->opts->cancel && __atomic_load_n(s->opts->cancel, __ATOMIC_RELAXED);
+}
+
+// Rank one file and pass its results on to the caller if it asked for them
+static void emit(struct search *s, const char *path, const uint64_t *lines,
+                 uint64_t bytes, uint64_t ns, bool cached, bool skipped)
+{
+    if (s->opts->top_k) {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < s->res->npatterns; i++)
+            sum += lines[i];
+        // A checkpoint keeps matched files apart from those the walk finds
+        // again on resuming
+        struct topk *t = s->opts->checkpoint && !cached ? &s->top_scanned : &s->top;
+        if (sum && topk_push(t, sum, path) != 0)
+            s->nomem = true;
+    }
+    if (!s->opts->on_file || search_cancelled(s))
+        return;
+    struct finder_file f = {
+        .path = path,
+        .lines = lines,
+        .npatterns = s->res->npatterns,
+        .bytes = bytes,
+        .ns = ns,
+        .cached = cached,
+        .skipped = skipped,
+    };
+    s->opts->on_file(s->opts->on_file_arg, &f);
+}
+
+// Count a file's matching lines towards its directory
+static void dir_add(struct search *s, uint32_t dir, const uint64_t *lines)
+{
+    for (size_t i = 0; i < s->res->npatterns; i++)
+        s->dirs.nodes[dir].lines += lines[i];
+}
+
+// Use the cached counts if every pattern has one for this version of key
+static bool search_cached(struct search *s, struct cache_entry *key, const char *path)
+{
+    size_t n = s->res->npatterns;
+    for (size_t i = 0; i < n; i++) {
+        key->qhash = s->qhash[i];
+        if (!cache_lookup(s->cache, key, &s->cached[i]))
+            return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        key->qhash = s->qhash[i];
+        key->lines = s->cached[i];
+        cache_touch(s->cache, key);
+        s->res->lines[i] += s->cached[i];
+        s->total += s->cached[i];
+    }
+    if (s->opts->aggregate)
+        dir_add(s, s->dir, s->cached);
+    emit(s, path, s->cached, 0, 0, true, false);
+    return true;
+}
+
+static void cache_store(struct search *s, const struct cache_entry *key,
+                        const uint64_t *counts)
+{
+    // A file written within the timestamp granularity of the scan could
+    // change again without its size or mtime changing
+    if (key->mtime_ns >= s->racy_ns)
+        return;
+    struct cache_entry e = *key;
+    for (size_t i = 0; i < s->res->npatterns; i++) {
+        e.qhash = s->qhash[i];
+        e.lines = counts[i];
+        cache_put(s->cache, &e);
+    }
+}
+
+static bool name_matches(const char *const *globs, size_t n, const char *name)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (fnmatch(globs[i], name, 0) == 0)
+            return true;
+    }
+    return false;
+}
+
+// True if the include and exclude globs let the file's name through
+static bool search_wanted(const struct search *s, const char *path)
+{
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    if (s->opts->ninclude && !name_matches(s->opts->include, s->opts->ninclude, name))
+        return false;
+    return !name_matches(s->opts->exclude, s->opts->nexclude, name);
+}
+
+/**
+ * Queue a file to be read unless the cache has its counts or its name is
+ * filtered out.
+ * @param st the file's stat information, or NULL if it is not known yet
+ * @param size the file's size if st is NULL, as last seen, 0 if unknown
+ * @return 0 on success, -1 if memory ran out
+ */
+static int search_add(struct search *s, int dirfd, const char *name,
+                      const char *path, const struct stat *st, uint64_t size)
+{
+    struct stat sb;
+    struct cache_entry key;
+
+    if (!search_wanted(s, path)) {
+        s->scan.skipped++;
+        return 0;
+    }
+    if (s->cache) {
+        if (!st) {
+            s->walk.stats++;
+            if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0) {
+                fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+                return 0;
+            }
+            st = &sb;
+        }
+        key_of(&key, st);
+        if (search_cached(s, &key, path))
+            return 0;
+        if (s->nkeys % 1024 == 0) {
+            struct cache_entry *keys = realloc(s->keys, (s->nkeys + 1024) * sizeof(*keys));
+            if (!keys)
+                return -1;
+            s->keys = keys;
+        }
+        s->keys[s->nkeys++] = key;
+    }
+    if (s->opts->aggregate) {
+        if (s->ndir_of % 1024 == 0) {
+            uint32_t *dir_of = realloc(s->dir_of, (s->ndir_of + 1024) * sizeof(*dir_of));
+            if (!dir_of)
+                return -1;
+            s->dir_of = dir_of;
+        }
+        s->dir_of[s->ndir_of++] = s->dir;
+    }
+    if (st)
+        size = (uint64_t)st->st_size;
+    // Only files more than a first read are worth scheduling
+    if (size > PIPE_BUFSZ) {
+        if (s->nbig % 1024 == 0) {
+            struct sized *big = realloc(s->big, (s->nbig + 1024) * sizeof(*big));
+            if (!big)
+                return -1;
+            s->big = big;
+        }
+        s->big[s->nbig++] = (struct sized){ (uint32_t)s->files.n, size };
+    }
+    for (const char *p = path; ; p++) {
+        s->key = (s->key ^ (uint8_t)*p) * 1099511628211ull;
+        if (!*p)
+            break;
+    }
+    return file_list_add(&s->files, path);
+}
+
+static int on_file(void *arg, int dirfd, const char *name, const char *path,
+                   const struct stat *st)
+{
+    struct search *s = arg;
+
+    // The walk stops, and nothing is read, once the caller cancels
+    if (search_cancelled(s))
+        return 1;
+    s->res->files++;
+    if (s->opts->aggregate)
+        s->dirs.nodes[s->dir = dirtree_node(&s->dirs, path)].files++;
+    if (search_add(s, dirfd, name, path, st, 0) != 0) {
+        fprintf(stderr, "finder: out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int on_dir(void *arg, const char *path)
+{
+    struct search *s = arg;
+
+    if (dirtree_enter(&s->dirs, path) != 0) {
+        fprintf(stderr, "finder: out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+// True once max_count matching lines have been found or the run cancelled
+static bool search_done(struct search *s)
+{
+    if (!search_cancelled(s) && (!s->opts->max_count || s->total < s->opts->max_count))
+        return false;
+    s->res->stopped = true;
+    return true;
+}
+
+/**
+ * Copy the files matched so far and what they counted into c, which
+ * saver_start() sized.
+ * @return 0 on success, -1 if memory for the ranked paths ran out
+ */
+static int search_snapshot(const struct search *s, struct checkpoint *c)
+{
+    c->key = s->key;
+    memcpy(c->done, s->done, (c->nfiles + 63) / 64 * sizeof(uint64_t));
+    memcpy(c->lines, s->scanned, c->npatterns * sizeof(uint64_t));
+    for (size_t i = 0; i < c->ndirs; i++)
+        c->dir_lines[i] = s->dirs.nodes[i].lines - s->dir_base[i];
+    for (size_t i = 0; i < c->ntop; i++)
+        free(c->top[i].path);
+    c->ntop = 0;
+    for (size_t i = 0; i < s->top_scanned.n; i++) {
+        const struct topk_entry *e = &s->top_scanned.heap[i];
+        if (!(c->top[i].path = strdup(e->path))) {
+            fprintf(stderr, "finder: out of memory\n");
+            return -1;
+        }
+        c->top[i].lines = e->lines;
+        c->ntop++;
+    }
+    return 0;
+}
+
+static void *saver_main(void *arg)
+{
+    struct saver *sv = arg;
+    pthread_mutex_lock(&sv->lock);
+    for (;;) {
+        while (!sv->full && !sv->stop)
+            pthread_cond_wait(&sv->wake, &sv->lock);
+        if (!sv->full)
+            break;
+        pthread_mutex_unlock(&sv->lock);
+        // A failure is reported and the search goes on; the previous
+        // checkpoint stays
+        checkpoint_write(sv->file, &sv->c);
+        pthread_mutex_lock(&sv->lock);
+        sv->full = false;
+    }
+    pthread_mutex_unlock(&sv->lock);
+    return NULL;
+}
+
+/**
+ * Start the thread that writes checkpoints, with room for a copy of the
+ * progress search_resume() set up.
+ * @return 0 on success, -1 after printing the reason to stderr
+ */
+static int saver_start(struct search *s)
+{
+    struct saver *sv = &s->saver;
+    struct checkpoint *c = &sv->c;
+    size_t ntop = s->opts->top_k;
+    c->nfiles = s->files.n;
+    c->npatterns = s->res->npatterns;
+    c->ndirs = s->opts->aggregate ? s->dirs.n : 0;
+    c->done = calloc((c->nfiles + 63) / 64 + 1, sizeof(uint64_t));
+    c->lines = calloc(c->npatterns ? c->npatterns : 1, sizeof(uint64_t));
+    c->dir_lines = calloc(c->ndirs ? c->ndirs : 1, sizeof(uint64_t));
+    c->top = calloc(ntop ? ntop : 1, sizeof(*c->top));
+    if (!c->done || !c->lines || !c->dir_lines || !c->top) {
+        fprintf(stderr, "finder: out of memory\n");
+        return -1;
+    }
+    sv->file = s->opts->checkpoint;
+    pthread_mutex_init(&sv->lock, NULL);
+    pthread_cond_init(&sv->wake, NULL);
+    int err = pthread_create(&sv->tid, NULL, saver_main, sv);
+    if (err != 0) {
+        fprintf(stderr, "finder: cannot start thread: %s\n", strerror(err));
+        pthread_cond_destroy(&sv->wake);
+        pthread_mutex_destroy(&sv->lock);
+        return -1;
+    }
+    sv->started = true;
+    return 0;
+}
+
+// Wait for the checkpoint being written, if any, and end the thread
+static void saver_stop(struct saver *sv)
+{
+    if (!sv->started)
+        return;
+    pthread_mutex_lock(&sv->lock);
+    sv->stop = true;
+    pthread_cond_signal(&sv->wake);
+    pthread_mutex_unlock(&sv->lock);
+    pthread_join(sv->tid, NULL);
+    pthread_cond_destroy(&sv->wake);
+    pthread_mutex_destroy(&sv->lock);
+    sv->started = false;
+}
+
+/**
+ * Hand the progress to the saver. While it is still writing the last
+ * copy nothing is taken, and the next file tries again.
+ */
+static void search_save(struct search *s)
+{
+    struct saver *sv = &s->saver;
+    pthread_mutex_lock(&sv->lock);
+    if (!sv->full && search_snapshot(s, &sv->c) == 0) {
+        sv->full = true;
+        pthread_cond_signal(&sv->wake);
+        s->saved_ns = now_ns();
+    }
+    pthread_mutex_unlock(&sv->lock);
+}
+
+static bool on_scanned(void *arg, size_t i, const struct file_scan *fs)
+{
+    struct search *s = arg;
+
+    for (size_t k = 0; k < s->res->npatterns; k++) {
+        s->res->lines[k] += fs->counts[k];
+        s->total += fs->counts[k];
+    }
+    if (s->opts->aggregate)
+        dir_add(s, s->dir_of[i], fs->counts);
+    // A file cut short at max_count adds to the totals alone: it is not
+    // done, cached or ranked on lines it was not read for
+    if (fs->partial)
+        return search_done(s);
+    if (s->done) {
+        s->done[i / 64] |= 1ull << (i % 64);
+        for (size_t k = 0; k < s->res->npatterns; k++)
+            s->scanned[k] += fs->counts[k];
+    }
+    if (s->cache)
+        cache_store(s, &s->keys[i], fs->counts);
+    emit(s, file_list_path(&s->files, i, s->path, sizeof(s->path)), fs->counts,
+         fs->bytes, fs->ns, false, fs->skipped);
+    uint64_t interval = s->opts->checkpoint_ns ? s->opts->checkpoint_ns : CHECKPOINT_INTERVAL_NS;
+    if (s->done && now_ns() - s->saved_ns >= interval)
+        search_save(s);
+    return search_done(s);
+}
+
+/**
+ * Set up checkpoints once the walk is over and, when resuming, take back
+ * the progress saved by an earlier run over the same files.
+ * @return 0 on success, -1 if memory ran out or the checkpoint could not
+ *   be read
+ */
+static int search_resume(struct search *s)
+{
+    const struct finder_opts *opts = s->opts;
+    size_t n = s->res->npatterns, ndirs = opts->aggregate ? s->dirs.n : 0;
+    s->done = calloc((s->files.n + 63) / 64 + 1, sizeof(uint64_t));
+    s->scanned = calloc(n ? n : 1, sizeof(uint64_t));
+    s->dir_base = calloc(ndirs ? ndirs : 1, sizeof(uint64_t));
+    if (!s->done || !s->scanned || !s->dir_base || topk_init(&s->top_scanned, opts->top_k) != 0) {
+        fprintf(stderr, "finder: out of memory\n");
+        return -1;
+    }
+    for (size_t i = 0; i < ndirs; i++)
+        s->dir_base[i] = s->dirs.nodes[i].lines;
+    // Whatever decides which files are listed and what is kept of them
+    uint64_t h = s->key;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ pattern_hash(opts, opts->patterns[i])) * 1099511628211ull;
+    h = (h ^ opts->top_k) * 1099511628211ull;
+    h = (h ^ (opts->aggregate ? opts->aggregate_depth + 1ull : 0)) * 1099511628211ull;
+    s->key = h;
+    s->saved_ns = now_ns();
+    if (!opts->resume)
+        return 0;
+
+    struct checkpoint c;
+    int rc = checkpoint_read(opts->checkpoint, &c);
+    if (rc <= 0)
+        return rc;
+    if (c.key != s->key || c.nfiles != s->files.n || c.npatterns != n || c.ndirs != ndirs) {
+        fprintf(stderr, "finder: %s: saved for other files or options, starting over\n",
+                opts->checkpoint);
+        checkpoint_free(&c);
+        return 0;
+    }
+    memcpy(s->done, c.done, (c.nfiles + 63) / 64 * sizeof(uint64_t));
+    for (size_t k = 0; k < n; k++) {
+        s->scanned[k] = c.lines[k];
+        s->res->lines[k] += c.lines[k];
+        s->total += c.lines[k];
+    }
+    for (size_t i = 0; i < ndirs; i++)
+        s->dirs.nodes[i].lines += c.dir_lines[i];
+    for (size_t i = 0; i < c.ntop && rc == 1; i++) {
+        if (topk_push(&s->top_scanned, c.top[i].lines, c.top[i].path) != 0) {
+            fprintf(stderr, "finder: out of memory\n");
+            rc = -1;
+        }
+    }
+    for (size_t i = 0; i < c.nfiles; i++)
+        s->res->stats.resumed += (c.done[i / 64] >> (i % 64)) & 1;
+    checkpoint_free(&c);
+    return rc < 0 ? -1 : 0;
+}
+
+static int by_size(const void *a, const void *b)
+{
+    const struct sized *x = a, *y = b;
+    if (x->size != y->size)
+        return x->size < y->size ? 1 : -1;
+    return x->file < y->file ? -1 : x->file > y->file;
+}
+
+static bool search_matched(const struct search *s, size_t i)
+{
+    return s->done && (s->done[i / 64] >> (i % 64)) & 1;
+}
+
+/**
+ * Order the listed files for scanning, leaving out those a resumed run
+ * has matched: those of known size largest first, so no thread is left
+ * with a large file once the rest are done, then the others as they were
+ * listed.
+ * @param order receives the order, NULL for all files in list order
+ * @param norder receives the number of files in it
+ * @return 0 on success, -1 if memory ran out while resuming; otherwise
+ *   running out only loses the sizes' order
+ */
+static int search_order(struct search *s, uint32_t **order, size_t *norder)
+{
+    size_t n = s->files.n;
+    bool resumed = s->res->stats.resumed;
+    *order = NULL;
+    *norder = 0;
+    uint32_t *o = s->nbig || resumed ? malloc((n ? n : 1) * sizeof(*o)) : NULL;
+    if (!o) {
+        if (!resumed)
+            return 0;
+        fprintf(stderr, "finder: out of memory\n");
+        return -1;
+    }
+    // big is in list order until it is sorted
+    size_t nbig = 0;
+    for (size_t j = 0; j < s->nbig; j++)
+        nbig += !search_matched(s, s->big[j].file);
+    size_t k = nbig;
+    for (size_t i = 0, j = 0; i < n; i++) {
+        if (j < s->nbig && s->big[j].file == i)
+            j++;
+        else if (!search_matched(s, i))
+            o[k++] = (uint32_t)i;
+    }
+    qsort(s->big, s->nbig, sizeof(*s->big), by_size);
+    for (size_t i = 0, j = 0; i < s->nbig; i++) {
+        if (!search_matched(s, s->big[i].file))
+            o[j++] = s->big[i].file;
+    }
+    *order = o;
+    *norder = k;
+    return 0;
+}
+
+/**
+ * List only the files the index says may match; the file count is the
+ * index's own.
+ * @param stale set, with -1 returned and nothing listed, if the tree has
+ *   changed since the index was built
+ * @return a descriptor for the root the names are relative to, or -1
+ */
+static int search_index(struct search *s, const struct finder_opts *opts, bool *stale)
+{
+    struct index *idx = index_open(opts->index);
+    if (!idx)
+        return -1;
+
+    char root[PATH_MAX];
+    if (!realpath(opts->dir, root)) {
+        fprintf(stderr, "finder: %s: %s\n", opts->dir, strerror(errno));
+        index_close(idx);
+        return -1;
+    }
+    if (strcmp(root, index_root(idx)) != 0) {
+        fprintf(stderr, "finder: %s indexes %s, not %s\n",
+                opts->index, index_root(idx), root);
+        index_close(idx);
+        return -1;
+    }
+
+    // An approximate match need not contain any of a pattern's trigrams,
+    // so every file is a candidate, as for the empty pattern
+    static const char *const any[] = { "" };
+    uint32_t *ids;
+    size_t nids;
+    if (index_candidates(idx, opts->fuzzy ? any : opts->patterns,
+                         opts->fuzzy ? 1 : opts->npatterns,
+                         opts->fixed_strings, &ids, &nids) != 0) {
+        fprintf(stderr, "finder: out of memory\n");
+        index_close(idx);
+        return -1;
+    }
+
+    int rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootfd < 0) {
+        fprintf(stderr, "finder: %s: %s\n", root, strerror(errno));
+        free(ids);
+        index_close(idx);
+        return -1;
+    }
+
+    const char *changed = index_stale(idx, rootfd);
+    if (changed) {
+        fprintf(stderr, "finder: %s is out of date, %s changed; searching without it\n",
+                opts->index, changed);
+        *stale = true;
+        close(rootfd);
+        free(ids);
+        index_close(idx);
+        return -1;
+    }
+
+    s->res->files = index_nfiles(idx);
+    for (size_t i = 0; i < nids; i++) {
+        const char *name = index_name(idx, ids[i]);
+        if (s->ignore && ignore_path(s->ignore, name)) {
+            s->walk.ignored++;
+            continue;
+        }
+        if (search_add(s, rootfd, name, name, NULL, index_file(idx, ids[i])->size) != 0) {
+            fprintf(stderr, "finder: out of memory\n");
+            close(rootfd);
+            rootfd = -1;
+            break;
+        }
+    }
+
+    free(ids);
+    index_close(idx);
+    return rootfd;
+}
+
+int finder_run(const struct finder_opts *opts, struct finder_result *res)
+{
+    memset(res, 0, sizeof(*res));
+    res->lines = calloc(opts->npatterns ? opts->npatterns : 1, sizeof(uint64_t));
+    if (!res->lines) {
+        fprintf(stderr, "finder: out of memory\n");
+        return -1;
+    }
+    res->npatterns = opts->npatterns;
+
+    struct matcher *m = matcher_new(opts->patterns, opts->npatterns,
+                                    opts->fixed_strings,
+                                    opts->fuzzy ? (int)opts->max_errors : -1);
+    if (!m)
+        return -1;
+
+    struct search s = { .opts = opts, .res = res };
+    int dirfd = AT_FDCWD;
+    uint32_t *order = NULL;
+    int rc = -1;
+    if (topk_init(&s.top, opts->top_k) != 0) {
+        fprintf(stderr, "finder: out of memory\n");
+        goto out;
+    }
+    if (opts->cache) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        s.racy_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec - 1000000000;
+        s.cache = cache_open(opts->cache);
+        s.qhash = calloc(opts->npatterns ? opts->npatterns : 1, sizeof(uint64_t));
+        s.cached = calloc(opts->npatterns ? opts->npatterns : 1, sizeof(uint64_t));
+        if (!s.cache || !s.qhash || !s.cached)
+            goto out;
+        for (size_t i = 0; i < opts->npatterns; i++)
+            s.qhash[i] = pattern_hash(opts, opts->patterns[i]);
+    }
+
+    if (opts->nignore_files &&
+        !(s.ignore = ignore_load(opts->ignore_files, opts->nignore_files)))
+        goto out;
+    if (opts->index && (opts->follow_links || opts->dedup)) {
+        fprintf(stderr, "finder: following links and skipping duplicates need a walk, "
+                "not an index\n");
+        goto out;
+    }
+    if (opts->aggregate) {
+        if (opts->index) {
+            fprintf(stderr, "finder: directory totals need a walk, not an index\n");
+            goto out;
+        }
+        if (dirtree_init(&s.dirs, opts->aggregate_depth) != 0) {
+            fprintf(stderr, "finder: out of memory\n");
+            goto out;
+        }
+    }
+
+    // Find the files to read, then read them all in one pipeline. A tree
+    // that has moved on from its index is walked instead.
+    bool stale = false;
+    if (opts->index && (dirfd = search_index(&s, opts, &stale)) < 0) {
+        if (!stale)
+            goto out;
+        dirfd = AT_FDCWD;
+    }
+    if ((!opts->index || stale) &&
+        walk_tree(opts->dir, on_file, opts->aggregate ? on_dir : NULL, &s, s.ignore,
+                  (opts->follow_links ? WALK_FOLLOW : 0) | (opts->dedup ? WALK_DEDUP : 0),
+                  &s.walk) != 0 && !search_cancelled(&s)) {
+        goto out;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned threads = opts->threads ? opts->threads : cpus > 0 ? (unsigned)cpus : 1;
+    if (!(res->busy_ns = calloc(threads, sizeof(uint64_t)))) {
+        fprintf(stderr, "finder: out of memory\n");
+        goto out;
+    }
+    res->nthreads = threads;
+    if (opts->checkpoint && (search_resume(&s) != 0 || saver_start(&s) != 0))
+        goto out;
+    size_t norder;
+    if (search_order(&s, &order, &norder) != 0)
+        goto out;
+    struct pipeline_opts po = {
+        .m = m,
+        .dirfd = dirfd,
+        .files = &s.files,
+        .threads = threads,
+        .sync_io = opts->sync_io,
+        .mem_limit = opts->mem_limit ? opts->mem_limit : budget_default(),
+        .skip_binary = opts->skip_binary,
+        .max_size = opts->max_size,
+        // Files the cache or a checkpoint counted are part of max_count
+        .max_lines = opts->max_count ? opts->max_count - s.total : 0,
+        .cancel = opts->cancel,
+        .decompress = opts->decompress,
+        .cache = { .drop = opts->low_impact, .readahead = opts->readahead },
+        .order = order,
+        .norder = norder,
+        .busy_ns = res->busy_ns,
+    };
+    // Cached counts alone may have reached the limit
+    uint64_t t0 = now_ns(), disk0 = disk_read_bytes(), faults0 = major_faults();
+    rc = search_done(&s) ? 0 : pipeline_run(&po, on_scanned, &s, &s.scan);
+    res->stats.scan_ns = now_ns() - t0;
+    res->stats.disk_bytes = disk_read_bytes() - disk0;
+    res->stats.major_faults = major_faults() - faults0;
+    if (rc == 0 && s.cache && cache_commit(s.cache) != 0)
+        rc = -1;
+    // A finished search has no progress to keep; one that failed keeps
+    // what it got through. No copy is being written by then.
+    saver_stop(&s.saver);
+    if (rc == 0 && opts->checkpoint && unlink(opts->checkpoint) != 0 && errno != ENOENT)
+        fprintf(stderr, "finder: %s: %s\n", opts->checkpoint, strerror(errno));
+    else if (rc != 0 && s.saver.c.done && search_snapshot(&s, &s.saver.c) == 0)
+        checkpoint_write(opts->checkpoint, &s.saver.c);
+    if (rc == 0 && opts->checkpoint) {
+        // Matched files' rankings join those of the files the walk found
+        size_t n;
+        struct topk_entry *top = topk_take(&s.top_scanned, &n);
+        for (size_t i = 0; i < n; i++) {
+            if (topk_push(&s.top, top[i].lines, top[i].path) != 0)
+                s.nomem = true;
+            free(top[i].path);
+        }
+        free(top);
+    }
+    if (rc == 0 && s.nomem) {
+        fprintf(stderr, "finder: out of memory\n");
+        rc = -1;
+    }
+    if (rc == 0 && opts->top_k) {
+        size_t n;
+        struct topk_entry *top = topk_take(&s.top, &n);
+        res->top = calloc(n ? n : 1, sizeof(*res->top));
+        for (size_t i = 0; i < n; i++) {
+            if (res->top) {
+                res->top[i].path = top[i].path;
+                res->top[i].lines = top[i].lines;
+            } else {
+                free(top[i].path);
+            }
+        }
+        free(top);
+        if (!res->top) {
+            fprintf(stderr, "finder: out of memory\n");
+            rc = -1;
+        } else {
+            res->ntop = n;
+        }
+    }
+    if (rc == 0 && opts->aggregate && !(res->dirs = dirtree_take(&s.dirs, &res->ndirs))) {
+        fprintf(stderr, "finder: out of memory\n");
+        rc = -1;
+    }
+
+    res->stats.dirs = s.walk.dirs;
+    res->stats.getdents = s.walk.getdents;
+    res->stats.stats = s.walk.stats;
+    res->stats.opens = s.walk.opens + s.scan.opens;
+    res->stats.reads = s.scan.reads;
+    res->stats.bytes = s.scan.bytes;
+    res->stats.enters = s.scan.enters;
+    res->stats.mem_peak = s.scan.mem_peak;
+    res->stats.skipped = s.scan.skipped;
+    res->stats.skipped_bytes = s.scan.skipped_bytes;
+    res->stats.ignored = s.walk.ignored;
+    res->stats.duplicates = s.walk.duplicates;
+    res->stats.loops = s.walk.loops;
+
+out:
+    if (dirfd >= 0)
+        close(dirfd);
+    cache_close(s.cache);
+    ignore_free(s.ignore);
+    free(s.keys);
+    free(s.qhash);
+    free(s.cached);
+    file_list_free(&s.files);
+    topk_free(&s.top);
+    dirtree_free(&s.dirs);
+    free(s.dir_of);
+    free(s.big);
+    free(order);
+    free(s.done);
+    free(s.scanned);
+    free(s.dir_base);
+    topk_free(&s.top_scanned);
+    saver_stop(&s.saver);
+    checkpoint_free(&s.saver.c);
+    matcher_free(m);
+    return rc;
+}
+
+void finder_result_free(struct finder_result *res)
+{
+    free(res->lines);
+    res->lines = NULL;
+    for (size_t i = 0; i < res->ntop; i++)
+        free(res->top[i].path);
+    free(res->top);
+    res->top = NULL;
+    res->ntop = 0;
+    for (size_t i = 0; i < res->ndirs; i++)
+        free(res->dirs[i].path);
+    free(res->dirs);
+    res->dirs = NULL;
+    res->ndirs = 0;
+    free(res->busy_ns);
+    res->busy_ns = NULL;
+    res->nthreads = 0;
+}
@@ -0,0 +1,481 @@
+#define _GNU_SOURCE
+#include "serve.h"
+#include "live.h"
+#include "watch.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A compiled pattern shared by the counts using it
+struct cached_query {
+    char *pattern;          // NULL for an unused slot
+    bool fixed;
+    struct live_query *q;
+    unsigned refs;          // counts using q; only an unused one is replaced
+    uint64_t used;          // when it was last asked for
+};
+
+#define REPLY_MAX 64            // longest reply line
+
+struct client {
+    int fd;
+    size_t len;             // bytes of requests read but not answered in buf
+    size_t outlen;          // bytes of replies not yet sent in out
+    bool closing;           // closed once out is sent
+    struct client *prev, *next;
+    char buf[SERVE_LINE_MAX];
+    char out[64 * REPLY_MAX];
+};
+
+struct server {
+    struct watch *w;
+    pthread_rwlock_t lock;  // counts hold it to read, updates to write
+    pthread_mutex_t qlock;  // queries, tick, clients
+    struct cached_query queries[SERVE_QUERIES];
+    uint64_t tick;
+    struct client *clients; // connected, closed on shutdown
+    int ep;
+    int lfd;                // listening socket
+    int stopfd;             // eventfd, readable once the server stops
+};
+
+/**
+ * Find or compile a pattern. Patterns are compiled without the lock, so
+ * other counts go on meanwhile.
+ * @param slot receives the query's slot, or -1 if no slot was free and the
+ *   caller owns it
+ * @return the compiled pattern, NULL if it is invalid or memory ran out
+ */
+static struct live_query *query_get(struct server *sv, const char *pattern, bool fixed,
+                                    int *slot)
+{
+    pthread_mutex_lock(&sv->qlock);
+    for (int i = 0; i < SERVE_QUERIES; i++) {
+        struct cached_query *c = &sv->queries[i];
+        if (c->pattern && c->fixed == fixed && strcmp(c->pattern, pattern) == 0) {
+            c->refs++;
+            c->used = ++sv->tick;
+            pthread_mutex_unlock(&sv->qlock);
+            *slot = i;
+            return c->q;
+        }
+    }
+    pthread_mutex_unlock(&sv->qlock);
+
+    struct live_query *q = live_query_new(pattern, fixed);
+    char *copy = q ? strdup(pattern) : NULL;
+    if (!copy) {
+        live_query_free(q);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&sv->qlock);
+    // The least recently used pattern no count holds gives way
+    int victim = -1;
+    for (int i = 0; i < SERVE_QUERIES; i++) {
+        struct cached_query *c = &sv->queries[i];
+        if (c->pattern && c->fixed == fixed && strcmp(c->pattern, pattern) == 0) {
+            // Compiled meanwhile by another thread
+            c->refs++;
+            c->used = ++sv->tick;
+            pthread_mutex_unlock(&sv->qlock);
+            live_query_free(q);
+            free(copy);
+            *slot = i;
+            return c->q;
+        }
+        if (!c->refs && (victim < 0 || c->used < sv->queries[victim].used))
+            victim = i;
+    }
+    *slot = victim;
+    if (victim >= 0) {
+        struct cached_query *c = &sv->queries[victim];
+        free(c->pattern);
+        live_query_free(c->q);
+        *c = (struct cached_query){ copy, fixed, q, 1, ++sv->tick };
+    } else {
+        free(copy);
+    }
+    pthread_mutex_unlock(&sv->qlock);
+    return q;
+}
+
+static void query_put(struct server *sv, struct live_query *q, int slot)
+{
+    if (slot < 0) {
+        live_query_free(q);
+        return;
+    }
+    pthread_mutex_lock(&sv->qlock);
+    sv->queries[slot].refs--;
+    pthread_mutex_unlock(&sv->qlock);
+}
+
+// Apply the changes inotify has queued, if any
+static void update(struct server *sv)
+{
+    pthread_rwlock_wrlock(&sv->lock);
+    if (watch_drain(sv->w) != 0)
+        fprintf(stderr, "finder: index may be stale\n");
+    pthread_rwlock_unlock(&sv->lock);
+}
+
+/**
+ * Answer one request line.
+ * @return the reply's length in out
+ */
+static int answer(struct server *sv, const char *req, char *out, size_t size)
+{
+    struct live *lv = watch_live(sv->w);
+
+    // A file changed just before the request is counted as it is now
+    struct pollfd pfd = { watch_fd(sv->w), POLLIN, 0 };
+    if (poll(&pfd, 1, 0) > 0)
+        update(sv);
+
+    bool fixed = strncmp(req, "fixed ", 6) == 0;
+    if (strcmp(req, "files") == 0) {
+        pthread_rwlock_rdlock(&sv->lock);
+        uint32_t files = live_nfiles(lv);
+        pthread_rwlock_unlock(&sv->lock);
+        return snprintf(out, size, "ok %" PRIu32 "\n", files);
+    }
+    if (!fixed && strncmp(req, "count ", 6) != 0)
+        return snprintf(out, size, "error unknown request\n");
+
+    int slot;
+    struct live_query *q = query_get(sv, req + 6, fixed, &slot);
+    if (!q)
+        return snprintf(out, size, "error invalid pattern\n");
+    uint64_t lines;
+    pthread_rwlock_rdlock(&sv->lock);
+    int rc = live_query_count(lv, q, &lines);
+    uint32_t files = live_nfiles(lv);
+    pthread_rwlock_unlock(&sv->lock);
+    query_put(sv, q, slot);
+    if (rc != 0)
+        return snprintf(out, size, "error out of memory\n");
+    return snprintf(out, size, "ok %" PRIu32 " %" PRIu64 "\n", files, lines);
+}
+
+/**
+ * Send what the socket takes of a client's replies.
+ * @return 0 unless the connection is gone
+ */
+static int flush(struct client *c)
+{
+    size_t sent = 0;
+    while (sent < c->outlen) {
+        ssize_t n = send(c->fd, c->out + sent, c->outlen - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0)
+            return -1;
+        sent += (size_t)n;
+    }
+    c->outlen -= sent;
+    memmove(c->out, c->out + sent, c->outlen);
+    return 0;
+}
+
+static void client_close(struct server *sv, struct client *c)
+{
+    pthread_mutex_lock(&sv->qlock);
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        sv->clients = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    pthread_mutex_unlock(&sv->qlock);
+    close(c->fd);
+    free(c);
+}
+
+/**
+ * Answer the requests a client has sent so far, then wait for more.
+ * Sockets do not block: replies the client is slow to read wait in out,
+ * and once it is full no more requests are read until they are sent, so
+ * a client that stops reading holds no thread.
+ */
+static void client_serve(struct server *sv, struct client *c)
+{
+    while (!c->closing) {
+        // Answer the whole requests in buf while their replies fit
+        size_t start = 0;
+        bool full = false;
+        for (;;) {
+            if (sizeof(c->out) - c->outlen < REPLY_MAX) {
+                full = true;
+                break;
+            }
+            char *nl = memchr(c->buf + start, '\n', c->len - start);
+            if (!nl)
+                break;
+            *nl = '\0';
+            c->outlen += (size_t)answer(sv, c->buf + start, c->out + c->outlen, REPLY_MAX);
+            start = (size_t)(nl + 1 - c->buf);
+        }
+        c->len -= start;
+        memmove(c->buf, c->buf + start, c->len);
+        if (flush(c) != 0) {
+            client_close(sv, c);
+            return;
+        }
+        if (full) {
+            if (sizeof(c->out) - c->outlen < REPLY_MAX)
+                break;
+            continue;
+        }
+        if (c->len == sizeof(c->buf)) {
+            static const char msg[] = "error request too long\n";
+            memcpy(c->out + c->outlen, msg, sizeof(msg) - 1);
+            c->outlen += sizeof(msg) - 1;
+            c->closing = true;
+            if (flush(c) != 0)
+                c->outlen = 0;
+            break;
+        }
+
+        ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            client_close(sv, c);
+            return;
+        }
+        c->len += (size_t)n;
+    }
+    if (c->closing && !c->outlen) {
+        client_close(sv, c);
+        return;
+    }
+
+    // Wait for the client to read what is left, and for requests while
+    // their replies have room
+    struct epoll_event ev = { .events = EPOLLONESHOT, .data.ptr = c };
+    if (c->outlen)
+        ev.events |= EPOLLOUT;
+    if (!c->closing && sizeof(c->out) - c->outlen >= REPLY_MAX)
+        ev.events |= EPOLLIN;
+    if (epoll_ctl(sv->ep, EPOLL_CTL_MOD, c->fd, &ev) != 0)
+        client_close(sv, c);
+}
+
+static void accept_clients(struct server *sv)
+{
+    for (;;) {
+        int fd = accept4(sv->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("finder: accept");
+            return;
+        }
+        struct client *c = malloc(sizeof(*c));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->len = 0;
+        c->outlen = 0;
+        c->closing = false;
+        c->prev = NULL;
+        pthread_mutex_lock(&sv->qlock);
+        c->next = sv->clients;
+        if (c->next)
+            c->next->prev = c;
+        sv->clients = c;
+        pthread_mutex_unlock(&sv->qlock);
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = c };
+        if (epoll_ctl(sv->ep, EPOLL_CTL_ADD, fd, &ev) != 0)
+            client_close(sv, c);
+    }
+}
+
+// Re-arm a one-shot descriptor of the server's own
+static void rearm(struct server *sv, int fd, void *ptr)
+{
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = ptr };
+    if (epoll_ctl(sv->ep, EPOLL_CTL_MOD, fd, &ev) != 0)
+        perror("finder: epoll_ctl");
+}
+
+static void *serve_thread(void *arg)
+{
+    struct server *sv = arg;
+    for (;;) {
+        struct epoll_event ev;
+        int n = epoll_wait(sv->ep, &ev, 1, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("finder: epoll_wait");
+            break;
+        }
+        if (n == 0)
+            continue;
+        // The stop event is level-triggered and wakes every thread
+        if (ev.data.ptr == &sv->stopfd)
+            break;
+        if (ev.data.ptr == &sv->lfd) {
+            accept_clients(sv);
+            rearm(sv, sv->lfd, &sv->lfd);
+        } else if (ev.data.ptr == sv->w) {
+            update(sv);
+            rearm(sv, watch_fd(sv->w), sv->w);
+        } else {
+            client_serve(sv, ev.data.ptr);
+        }
+    }
+    return NULL;
+}
+
+// Bind the socket, replacing the file of a server that is gone
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "finder: %s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("finder: socket");
+        return -1;
+    }
+    int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (rc != 0 && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool alive = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe >= 0)
+            close(probe);
+        if (alive) {
+            fprintf(stderr, "finder: %s: another server is listening\n", path);
+            close(fd);
+            return -1;
+        }
+        unlink(path);
+        rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    if (rc != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int serve_run(const char *dir, const char *socket, const char *indexfile, unsigned threads)
+{
+    struct server sv = { .ep = -1, .lfd = -1, .stopfd = -1 };
+    pthread_t *tids = calloc(threads, sizeof(*tids));
+    unsigned started = 0;
+    int rc = -1;
+
+    // Signals are taken by sigwait() alone, not by the serving threads
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    // A steady stream of counts must not keep changes out of the index
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&sv.lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    pthread_mutex_init(&sv.qlock, NULL);
+
+    if (!tids) {
+        fprintf(stderr, "finder: out of memory\n");
+        goto out;
+    }
+    // Clients connecting while the tree is indexed wait in the backlog
+    if ((sv.lfd = listen_on(socket)) < 0)
+        goto out;
+    if (!(sv.w = watch_open(dir, indexfile)))
+        goto out;
+    sv.ep = epoll_create1(EPOLL_CLOEXEC);
+    sv.stopfd = eventfd(0, EFD_CLOEXEC);
+    if (sv.ep < 0 || sv.stopfd < 0) {
+        perror("finder: epoll");
+        goto out;
+    }
+    struct epoll_event evs[3] = {
+        { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = &sv.lfd },
+        { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = sv.w },
+        { .events = EPOLLIN, .data.ptr = &sv.stopfd },
+    };
+    if (epoll_ctl(sv.ep, EPOLL_CTL_ADD, sv.lfd, &evs[0]) != 0 ||
+        epoll_ctl(sv.ep, EPOLL_CTL_ADD, watch_fd(sv.w), &evs[1]) != 0 ||
+        epoll_ctl(sv.ep, EPOLL_CTL_ADD, sv.stopfd, &evs[2]) != 0) {
+        perror("finder: epoll_ctl");
+        goto out;
+    }
+
+    for (; started < threads; started++) {
+        int err = pthread_create(&tids[started], NULL, serve_thread, &sv);
+        if (err != 0) {
+            fprintf(stderr, "finder: cannot start thread: %s\n", strerror(err));
+            goto out;
+        }
+    }
+    fprintf(stderr, "finder: serving %s on %s with %u threads\n", dir, socket, threads);
+
+    int sig;
+    while (sigwait(&sigs, &sig) != 0)
+        ;
+    rc = 0;
+
+out:
+    if (started) {
+        uint64_t one = 1;
+        if (write(sv.stopfd, &one, sizeof(one)) != sizeof(one))
+            perror("finder: eventfd");
+        for (unsigned i = 0; i < started; i++)
+            pthread_join(tids[i], NULL);
+    }
+    while (sv.clients)
+        client_close(&sv, sv.clients);
+    if (sv.lfd >= 0) {
+        close(sv.lfd);
+        unlink(socket);
+    }
+    if (sv.stopfd >= 0)
+        close(sv.stopfd);
+    if (sv.ep >= 0)
+        close(sv.ep);
+    for (int i = 0; i < SERVE_QUERIES; i++) {
+        free(sv.queries[i].pattern);
+        live_query_free(sv.queries[i].q);
+    }
+    watch_close(sv.w);
+    pthread_mutex_destroy(&sv.qlock);
+    pthread_rwlock_destroy(&sv.lock);
+    free(tids);
+    pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
+    return rc;
+}
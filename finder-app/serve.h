@@ -0,0 +1,38 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+/*
+ * A long-running finder that answers count queries from any number of
+ * clients over a Unix stream socket.
+ *
+ * The server keeps what a fresh run would have to rebuild: the live index
+ * of the tree, with its file list and per-file counts memoized by query,
+ * and the most recently used compiled patterns. Changes are picked up
+ * with inotify as watch does. A pool of threads waits on one epoll set;
+ * each ready client is served by one thread at a time, counts run on
+ * several threads at once, and index updates wait for the counts under
+ * way and hold new ones back.
+ *
+ * Requests are lines, and each gets one reply line, in order:
+ *
+ *   count <pattern>    ok <files> <lines>    lines matching a basic regex
+ *   fixed <string>     ok <files> <lines>    lines holding a fixed string
+ *   files              ok <files>            files indexed
+ *
+ * Anything that cannot be answered gets "error <reason>". A request longer
+ * than SERVE_LINE_MAX bytes is answered with an error and the connection
+ * closed.
+ */
+#define SERVE_LINE_MAX 8192
+#define SERVE_QUERIES 64        // compiled patterns kept
+
+/**
+ * Index dir, from indexfile if it exists, and serve it on socket until
+ * SIGINT or SIGTERM. A socket file left by a server that is gone is
+ * replaced; one still being served is an error.
+ * @param threads threads serving clients, at least 1
+ * @return 0 once stopped by a signal, -1 after printing an error to stderr
+ */
+int serve_run(const char *dir, const char *socket, const char *indexfile, unsigned threads);
+
+#endif
@@ -0,0 +1,79 @@
+#include "topk.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int topk_init(struct topk *t, size_t k)
+{
+    t->n = 0;
+    t->k = k;
+    t->heap = malloc((k ? k : 1) * sizeof(*t->heap));
+    return t->heap ? 0 : -1;
+}
+
+static void swap(struct topk_entry *a, struct topk_entry *b)
+{
+    struct topk_entry tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void sift_down(struct topk_entry *h, size_t n, size_t i)
+{
+    for (;;) {
+        size_t min = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && h[l].lines < h[min].lines)
+            min = l;
+        if (r < n && h[r].lines < h[min].lines)
+            min = r;
+        if (min == i)
+            return;
+        swap(&h[i], &h[min]);
+        i = min;
+    }
+}
+
+int topk_push(struct topk *t, uint64_t lines, const char *path)
+{
+    if (t->n == t->k && (t->k == 0 || lines <= t->heap[0].lines))
+        return 0;
+    char *copy = strdup(path);
+    if (!copy)
+        return -1;
+    if (t->n < t->k) {
+        size_t i = t->n++;
+        t->heap[i] = (struct topk_entry){ lines, copy };
+        while (i > 0 && t->heap[(i - 1) / 2].lines > t->heap[i].lines) {
+            swap(&t->heap[i], &t->heap[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+    } else {
+        free(t->heap[0].path);
+        t->heap[0] = (struct topk_entry){ lines, copy };
+        sift_down(t->heap, t->n, 0);
+    }
+    return 0;
+}
+
+struct topk_entry *topk_take(struct topk *t, size_t *n)
+{
+    // Popping the minimum to the back leaves the heap sorted descending
+    for (size_t end = t->n; end > 1; end--) {
+        swap(&t->heap[0], &t->heap[end - 1]);
+        sift_down(t->heap, end - 1, 0);
+    }
+    struct topk_entry *h = t->heap;
+    *n = t->n;
+    t->heap = NULL;
+    t->n = 0;
+    return h;
+}
+
+void topk_free(struct topk *t)
+{
+    for (size_t i = 0; i < t->n; i++)
+        free(t->heap[i].path);
+    free(t->heap);
+    t->heap = NULL;
+    t->n = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The k files with the most matching lines, kept in a min-heap of k
+ * entries so the weakest is replaced in O(log k) and a file that does not
+ * make the cut costs one comparison. Only the paths in the heap are copied.
+ */
+struct topk_entry {
+    uint64_t lines;
+    char *path;
+};
+
+struct topk {
+    struct topk_entry *heap;
+    size_t n, k;
+};
+
+// @return 0 on success, -1 if memory ran out
+int topk_init(struct topk *t, size_t k);
+
+/**
+ * Offer a file; ties keep the file offered first.
+ * @return 0 on success, -1 if memory ran out
+ */
+int topk_push(struct topk *t, uint64_t lines, const char *path);
+
+/**
+ * Sort the entries, most lines first, and hand them over; t is left empty.
+ * @param n receives the number of entries, at most k
+ */
+struct topk_entry *topk_take(struct topk *t, size_t *n);
+
+void topk_free(struct topk *t);
+
+#endif
@@ -0,0 +1,238 @@
+#include "trigram.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int trigram_set_init(struct trigram_set *set)
+{
+    memset(set, 0, sizeof(*set));
+    set->bits = calloc(TRIGRAM_SPACE / 64, sizeof(uint64_t));
+    return set->bits ? 0 : -1;
+}
+
+void trigram_set_free(struct trigram_set *set)
+{
+    free(set->bits);
+    free(set->list);
+    memset(set, 0, sizeof(*set));
+}
+
+static int set_add(struct trigram_set *set, uint32_t t)
+{
+    uint64_t bit = 1ull << (t & 63);
+    if (set->bits[t >> 6] & bit)
+        return 0;
+    if (set->n == set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 1024;
+        uint32_t *list = realloc(set->list, cap * sizeof(uint32_t));
+        if (!list)
+            return -1;
+        set->list = list;
+        set->cap = cap;
+    }
+    set->bits[t >> 6] |= bit;
+    set->list[set->n++] = t;
+    return 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int trigram_file(struct trigram_set *set, int dirfd, const char *name,
+                 char *buf, size_t bufsz, uint64_t *bytes)
+{
+    // Only the list's bits are set, so clearing them is proportional to the
+    // previous file rather than to the whole trigram space
+    for (size_t i = 0; i < set->n; i++)
+        set->bits[set->list[i] >> 6] = 0;
+    set->n = 0;
+
+    int fd = openat(dirfd, name, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    uint32_t w = 0;
+    int valid = 0;          // bytes of w that belong to the current line
+    for (;;) {
+        ssize_t n = read(fd, buf, bufsz);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        if (bytes)
+            *bytes += (uint64_t)n;
+        for (ssize_t i = 0; i < n; i++) {
+            uint8_t c = (uint8_t)buf[i];
+            if (c == '\n') {
+                valid = 0;
+                continue;
+            }
+            w = ((w << 8) | c) & (TRIGRAM_SPACE - 1);
+            if (++valid >= 3) {
+                valid = 3;
+                if (set_add(set, w) != 0) {
+                    close(fd);
+                    errno = ENOMEM;
+                    return -1;
+                }
+            }
+        }
+    }
+    close(fd);
+
+    qsort(set->list, set->n, sizeof(uint32_t), cmp_u32);
+    return 0;
+}
+
+struct tri_list {
+    uint32_t *v;
+    size_t n;
+    size_t cap;
+};
+
+// Append the trigrams of a literal run that every match contains
+static int run_flush(struct tri_list *out, const char *run, size_t len)
+{
+    for (size_t i = 0; i + 3 <= len; i++) {
+        if (out->n == out->cap) {
+            size_t cap = out->cap ? out->cap * 2 : 16;
+            uint32_t *v = realloc(out->v, cap * sizeof(uint32_t));
+            if (!v)
+                return -1;
+            out->v = v;
+            out->cap = cap;
+        }
+        out->v[out->n++] = TRIGRAM(run[i], run[i + 1], run[i + 2]);
+    }
+    return 0;
+}
+
+// True if p starts a repetition that makes the preceding atom optional
+static bool optional_next(const char *p)
+{
+    return p[0] == '*' || (p[0] == '\\' && (p[1] == '?' || p[1] == '{'));
+}
+
+// Skip a bracket expression starting at p[0] == '['
+static const char *skip_bracket(const char *p)
+{
+    p++;
+    if (*p == '^')
+        p++;
+    if (*p == ']')
+        p++;
+    while (*p && *p != ']') {
+        if (p[0] == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+            char delim = p[1];
+            p += 2;
+            while (*p && !(p[0] == delim && p[1] == ']'))
+                p++;
+            if (*p)
+                p += 2;
+        } else {
+            p++;
+        }
+    }
+    return *p ? p + 1 : p;
+}
+
+int trigram_query(const char *pattern, bool fixed, uint32_t **tris, size_t *n)
+{
+    struct tri_list out = { 0 };
+    size_t plen = strlen(pattern);
+    *tris = NULL;
+    *n = 0;
+
+    if (fixed) {
+        if (run_flush(&out, pattern, plen) != 0)
+            goto oom;
+        *tris = out.v;
+        *n = out.n;
+        return 0;
+    }
+
+    char *run = malloc(plen + 1);
+    if (!run)
+        return -1;
+    size_t len = 0;
+    int depth = 0;          // literals inside groups may be repeated away
+    const char *p = pattern;
+
+#define FLUSH() do { if (run_flush(&out, run, len) != 0) goto oom_run; len = 0; } while (0)
+
+    while (*p) {
+        char lit;
+        if (p[0] == '\\') {
+            char e = p[1];
+            if (e == '\0') {
+                break;
+            } else if (e == '|') {
+                // Alternation: nothing is required by every branch
+                free(run);
+                free(out.v);
+                return 0;
+            } else if (e == '(' || e == ')') {
+                FLUSH();
+                depth += e == '(' ? 1 : -1;
+                p += 2;
+                continue;
+            } else if (strchr("{}?+wWsSbB<>`'123456789", e)) {
+                FLUSH();
+                p += 2;
+                if (e == '{') {
+                    while (*p && !(p[0] == '\\' && p[1] == '}'))
+                        p++;
+                    if (*p)
+                        p += 2;
+                }
+                continue;
+            }
+            lit = e;
+            p += 2;
+        } else if (p[0] == '[') {
+            FLUSH();
+            p = skip_bracket(p);
+            continue;
+        } else if (strchr(".*^$", p[0])) {
+            FLUSH();
+            p++;
+            continue;
+        } else {
+            lit = *p++;
+        }
+
+        if (depth > 0 || optional_next(p)) {
+            FLUSH();
+            continue;
+        }
+        run[len++] = lit;
+        // x\+ requires x once, but whatever follows need not be adjacent
+        if (p[0] == '\\' && p[1] == '+')
+            FLUSH();
+    }
+    FLUSH();
+#undef FLUSH
+
+    free(run);
+    *tris = out.v;
+    *n = out.n;
+    return 0;
+
+oom_run:
+    free(run);
+oom:
+    free(out.v);
+    return -1;
+}
@@ -0,0 +1,51 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Trigrams are three consecutive bytes of one line packed into 24 bits.
+ * A file can only contain a line matching a pattern if the file holds every
+ * trigram the pattern requires, which is what the search indexes use to
+ * narrow the files that must be read.
+ */
+#define TRIGRAM(a, b, c) \
+    (((uint32_t)(uint8_t)(a) << 16) | ((uint32_t)(uint8_t)(b) << 8) | (uint8_t)(c))
+
+#define TRIGRAM_SPACE (1u << 24)
+
+// The distinct trigrams of one file, in ascending order after trigram_file()
+struct trigram_set {
+    uint64_t *bits;         // TRIGRAM_SPACE bits, set for members of list
+    uint32_t *list;
+    size_t n;
+    size_t cap;
+};
+
+int trigram_set_init(struct trigram_set *set);
+
+void trigram_set_free(struct trigram_set *set);
+
+/**
+ * Replace the contents of set with the trigrams of the file name in dirfd.
+ * @param buf a scratch buffer of bufsz bytes
+ * @param bytes incremented by the number of bytes read, may be NULL
+ * @return 0 on success, -1 with errno set if the file could not be read
+ */
+int trigram_file(struct trigram_set *set, int dirfd, const char *name,
+                 char *buf, size_t bufsz, uint64_t *bytes);
+
+/**
+ * Find trigrams that every line matching pattern must contain. Fixed
+ * strings contribute all of their trigrams; basic regexes contribute the
+ * trigrams of literal runs outside groups, alternations and repetitions.
+ * @param tris receives a malloc'd array, NULL when *n is 0
+ * @param n receives the number of trigrams, 0 if the pattern cannot be
+ *   narrowed and every file is a candidate
+ * @return 0 on success, -1 if memory could not be allocated
+ */
+int trigram_query(const char *pattern, bool fixed, uint32_t **tris, size_t *n);
+
+#endif
@@ -0,0 +1,163 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, const void *arg, unsigned n)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+// Check the kernel supports every operation finder submits
+static int probe(int fd)
+{
+    static const uint8_t ops[] = {
+        IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_READ, IORING_OP_CLOSE,
+    };
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    union {
+        struct io_uring_probe probe;
+        char bytes[sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op)];
+    } u;
+    memset(&u, 0, len);
+    if (sys_register(fd, IORING_REGISTER_PROBE, &u.probe, 256) < 0)
+        return -1;
+    for (size_t i = 0; i < sizeof(ops); i++) {
+        if (ops[i] > u.probe.last_op || !(u.probe.ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            errno = ENOSYS;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int uring_init(struct uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_setup(entries, &p);
+    if (r->fd < 0)
+        return -1;
+    // Rings that need separate mappings predate OPENAT anyway
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || probe(r->fd) != 0) {
+        int err = errno;
+        close(r->fd);
+        errno = err ? err : ENOSYS;
+        return -1;
+    }
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_len > r->sq_len)
+        r->sq_len = r->cq_len;
+    r->cq_len = r->sq_len;
+    r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED)
+        goto fail;
+    r->cq_map = r->sq_map;
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->sq_map, r->sq_len);
+        goto fail;
+    }
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sqe_tail = *r->sq_tail;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:;
+    int err = errno;
+    close(r->fd);
+    errno = err;
+    return -1;
+}
+
+void uring_exit(struct uring *r)
+{
+    munmap(r->sqes, r->sqes_len);
+    munmap(r->sq_map, r->sq_len);
+    close(r->fd);
+}
+
+int uring_register_buffers(struct uring *r, const struct iovec *iov, unsigned n)
+{
+    return sys_register(r->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries)
+        return NULL;
+    unsigned i = r->sqe_tail++ & r->sq_mask;
+    r->sq_array[i] = i;
+    struct io_uring_sqe *sqe = &r->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit(struct uring *r, unsigned wait_nr)
+{
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    for (;;) {
+        unsigned submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (submit == 0 && wait_nr == 0)
+            return 0;
+        r->enters++;
+        int n = sys_enter(r->fd, submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        if (n >= 0) {
+            if ((unsigned)n >= submit)
+                return 0;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return -1;
+        }
+    }
+}
+
+struct io_uring_sqe *uring_unsubmitted(struct uring *r)
+{
+    if (r->sqe_tail == __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE))
+        return NULL;
+    r->sqe_tail--;
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    return &r->sqes[r->sqe_tail & r->sq_mask];
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *r)
+{
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & r->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *r)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,66 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * The few io_uring operations finder needs, on the raw system calls so
+ * there is no dependency on liburing. A ring is used by one thread.
+ */
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_array;
+    unsigned sq_mask, sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;          // next free sqe, published by uring_submit()
+    unsigned *cq_head, *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len, sqes_len;
+    uint64_t enters;            // io_uring_enter calls made
+};
+
+/**
+ * @param entries the submission queue size, a power of two
+ * @return 0 on success, -1 with errno set if io_uring is unavailable or
+ *   lacks an operation finder uses
+ */
+int uring_init(struct uring *r, unsigned entries);
+
+void uring_exit(struct uring *r);
+
+/**
+ * Register buffers for IORING_OP_READ_FIXED.
+ * @return 0 on success, -1 with errno set
+ */
+int uring_register_buffers(struct uring *r, const struct iovec *iov, unsigned n);
+
+// A zeroed sqe to fill in, or NULL if the submission queue is full
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+
+/**
+ * Submit the sqes obtained since the last call and wait for at least
+ * wait_nr completions.
+ * @return 0 on success, -1 with errno set
+ */
+int uring_submit(struct uring *r, unsigned wait_nr);
+
+/**
+ * Take back the newest sqe the kernel has not consumed, as after
+ * uring_submit() failed, so it is never submitted.
+ * @return the sqe, or NULL once every queued sqe was consumed
+ */
+struct io_uring_sqe *uring_unsubmitted(struct uring *r);
+
+// The next completion, or NULL if none is ready
+struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+
+// Release the completion returned by uring_peek_cqe()
+void uring_cqe_seen(struct uring *r);
+
+#endif
@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include "walk.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Directory entries as getdents64 returns them; glibc has no declaration
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// A file's identity, as far as links go
+struct file_id {
+    dev_t dev;
+    ino_t ino;
+};
+
+// Open addressing on file_id; a zero id marks an empty slot
+struct id_set {
+    struct file_id *ids;
+    size_t n, cap;
+};
+
+struct walk {
+    walk_fn fn;
+    walk_dir_fn dir_fn;
+    void *arg;
+    const struct ignore *ig;
+    unsigned flags;
+    struct walk_stats *stats;
+    struct id_set files;    // files found, with WALK_DEDUP
+    struct id_set dirs;     // directories read, with WALK_FOLLOW
+    struct file_id *chain;  // the directory being read at each level
+    size_t nchain;
+    char **bufs;            // one getdents64 buffer per directory level
+    size_t nbufs;
+    size_t rootlen;         // path[rootlen + 1] starts the path below the root
+    char path[PATH_MAX];
+};
+
+static size_t id_hash(struct file_id id)
+{
+    uint64_t h = ((uint64_t)id.dev * 0x9e3779b97f4a7c15ull) ^ (uint64_t)id.ino;
+    h *= 0xbf58476d1ce4e5b9ull;
+    return (size_t)(h ^ (h >> 31));
+}
+
+static bool id_empty(struct file_id id)
+{
+    return id.dev == 0 && id.ino == 0;
+}
+
+/**
+ * @return 1 if id was added, 0 if it was there already, -1 if memory ran
+ *   out
+ */
+static int id_set_add(struct id_set *s, struct file_id id)
+{
+    if (s->n * 2 >= s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        struct file_id *ids = calloc(cap, sizeof(*ids));
+        if (!ids)
+            return -1;
+        for (size_t i = 0; i < s->cap; i++) {
+            if (id_empty(s->ids[i]))
+                continue;
+            size_t j = id_hash(s->ids[i]) & (cap - 1);
+            while (!id_empty(ids[j]))
+                j = (j + 1) & (cap - 1);
+            ids[j] = s->ids[i];
+        }
+        free(s->ids);
+        s->ids = ids;
+        s->cap = cap;
+    }
+    size_t i = id_hash(id) & (s->cap - 1);
+    for (; !id_empty(s->ids[i]); i = (i + 1) & (s->cap - 1)) {
+        if (s->ids[i].dev == id.dev && s->ids[i].ino == id.ino)
+            return 0;
+    }
+    s->ids[i] = id;
+    s->n++;
+    return 1;
+}
+
+static char *level_buf(struct walk *w, size_t depth)
+{
+    if (depth >= w->nbufs) {
+        size_t n = w->nbufs ? w->nbufs * 2 : 16;
+        char **bufs = realloc(w->bufs, n * sizeof(*bufs));
+        if (!bufs)
+            return NULL;
+        memset(bufs + w->nbufs, 0, (n - w->nbufs) * sizeof(*bufs));
+        w->bufs = bufs;
+        w->nbufs = n;
+    }
+    if (!w->bufs[depth])
+        w->bufs[depth] = malloc(WALK_BUFSZ);
+    return w->bufs[depth];
+}
+
+/**
+ * Note the directory about to be read at this depth, for loops and
+ * duplicate inodes.
+ * @return false if it was read before and is to be passed over
+ */
+static bool enter_dir(struct walk *w, int dirfd, size_t pathlen, size_t depth, dev_t *dev)
+{
+    const char *path = pathlen ? w->path : "/";
+    struct stat st;
+    w->stats->stats++;
+    if (fstat(dirfd, &st) != 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    *dev = st.st_dev;
+    if (!(w->flags & WALK_FOLLOW))
+        return true;
+
+    struct file_id id = { st.st_dev, st.st_ino };
+    int added = id_set_add(&w->dirs, id);
+    if (added < 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(ENOMEM));
+        return false;
+    }
+    if (added == 0) {
+        // Reached again through a link, or through a link to itself
+        for (size_t i = 0; i < depth; i++) {
+            if (w->chain[i].dev == id.dev && w->chain[i].ino == id.ino) {
+                w->stats->loops++;
+                fprintf(stderr, "finder: %s: file system loop, not followed\n", path);
+                break;
+            }
+        }
+        return false;
+    }
+    if (depth >= w->nchain) {
+        size_t n = w->nchain ? w->nchain * 2 : 64;
+        struct file_id *chain = realloc(w->chain, n * sizeof(*chain));
+        if (!chain) {
+            fprintf(stderr, "finder: %s: %s\n", path, strerror(ENOMEM));
+            return false;
+        }
+        w->chain = chain;
+        w->nchain = n;
+    }
+    w->chain[depth] = id;
+    return true;
+}
+
+/**
+ * Find out what an entry is when d_type did not say, or where a link leads
+ * when links are followed.
+ * @param link set if the entry is a symbolic link that was followed
+ * @return the entry's type, DT_UNKNOWN for anything to pass over
+ */
+static unsigned char stat_entry(struct walk *w, int dirfd, const char *name,
+                                unsigned char type, struct stat *st, bool *link)
+{
+    *link = false;
+    if (type == DT_UNKNOWN) {
+        w->stats->stats++;
+        if (fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW) != 0) {
+            fprintf(stderr, "finder: %s: %s\n", w->path, strerror(errno));
+            return DT_UNKNOWN;
+        }
+        if (!S_ISLNK(st->st_mode))
+            return S_ISREG(st->st_mode) ? DT_REG : S_ISDIR(st->st_mode) ? DT_DIR : DT_UNKNOWN;
+        if (!(w->flags & WALK_FOLLOW))
+            return DT_UNKNOWN;
+    }
+    w->stats->stats++;
+    if (fstatat(dirfd, name, st, 0) != 0) {
+        // A link to nothing is not a file, as for find -L
+        if (errno != ENOENT)
+            fprintf(stderr, "finder: %s: %s\n", w->path, strerror(errno));
+        return DT_UNKNOWN;
+    }
+    *link = true;
+    return S_ISREG(st->st_mode) ? DT_REG : S_ISDIR(st->st_mode) ? DT_DIR : DT_UNKNOWN;
+}
+
+static int walk_dir(struct walk *w, int dirfd, size_t pathlen, size_t depth)
+{
+    dev_t dev = 0;
+    if (w->flags && !enter_dir(w, dirfd, pathlen, depth, &dev)) {
+        close(dirfd);
+        return 0;
+    }
+    if (w->dir_fn) {
+        int rc = w->dir_fn(w->arg, pathlen ? w->path : "/");
+        if (rc != 0) {
+            close(dirfd);
+            return rc;
+        }
+    }
+
+    char *buf = level_buf(w, depth);
+    if (!buf) {
+        fprintf(stderr, "finder: %s: %s\n", w->path, strerror(ENOMEM));
+        close(dirfd);
+        return 0;
+    }
+    w->stats->dirs++;
+
+    int rc = 0;
+    while (rc == 0) {
+        long n = syscall(SYS_getdents64, dirfd, buf, WALK_BUFSZ);
+        w->stats->getdents++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "finder: %s: %s\n", pathlen ? w->path : "/", strerror(errno));
+            break;
+        }
+        if (n == 0)
+            break;
+
+        for (long off = 0; rc == 0 && off < n;) {
+            const struct linux_dirent64 *de = (const struct linux_dirent64 *)(buf + off);
+            off += de->d_reclen;
+            const char *name = de->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+            unsigned char type = de->d_type;
+            bool follow = type == DT_LNK && (w->flags & WALK_FOLLOW);
+            if (type != DT_REG && type != DT_DIR && type != DT_UNKNOWN && !follow)
+                continue;
+
+            size_t namelen = strlen(name);
+            if (pathlen + 1 + namelen >= sizeof(w->path)) {
+                fprintf(stderr, "finder: %s/%s: %s\n", w->path, name, strerror(ENAMETOOLONG));
+                continue;
+            }
+            w->path[pathlen] = '/';
+            memcpy(w->path + pathlen + 1, name, namelen + 1);
+
+            // Only file systems that do not fill in d_type, and links when
+            // they are followed, cost a stat
+            struct stat st, *stp = NULL;
+            bool link = false;
+            if (type == DT_UNKNOWN || follow) {
+                type = stat_entry(w, dirfd, name, type, &st, &link);
+                if (type == DT_UNKNOWN) {
+                    w->path[pathlen] = '\0';
+                    continue;
+                }
+                stp = &st;
+            }
+
+            if (w->ig &&
+                ignore_match(w->ig, w->path + w->rootlen + 1, w->path + pathlen + 1,
+                             type == DT_DIR)) {
+                w->stats->ignored++;
+            } else if (type == DT_REG) {
+                struct file_id id = stp ? (struct file_id){ stp->st_dev, stp->st_ino }
+                                        : (struct file_id){ dev, (ino_t)de->d_ino };
+                if ((w->flags & WALK_DEDUP) && id_set_add(&w->files, id) == 0)
+                    w->stats->duplicates++;
+                else
+                    rc = w->fn(w->arg, dirfd, name, w->path, stp);
+            } else {
+                w->stats->opens++;
+                int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC |
+                                (link ? 0 : O_NOFOLLOW));
+                if (fd < 0)
+                    fprintf(stderr, "finder: %s: %s\n", w->path, strerror(errno));
+                else
+                    rc = walk_dir(w, fd, pathlen + 1 + namelen, depth + 1);
+            }
+            w->path[pathlen] = '\0';
+        }
+    }
+
+    close(dirfd);
+    return rc;
+}
+
+int walk_tree(const char *root, walk_fn fn, walk_dir_fn dir_fn, void *arg,
+              const struct ignore *ig, unsigned flags, struct walk_stats *stats)
+{
+    struct walk_stats unused = {0};
+    struct walk w = {
+        .fn = fn,
+        .dir_fn = dir_fn,
+        .arg = arg,
+        .ig = ig,
+        .flags = flags,
+        .stats = stats ? stats : &unused,
+    };
+
+    size_t len = strlen(root);
+    if (len >= sizeof(w.path)) {
+        fprintf(stderr, "finder: %s: %s\n", root, strerror(ENAMETOOLONG));
+        return -1;
+    }
+    memcpy(w.path, root, len + 1);
+    // Avoid a doubled slash when joining names onto "dir/"
+    while (len > 1 && w.path[len - 1] == '/')
+        w.path[--len] = '\0';
+    if (len == 1 && w.path[0] == '/')
+        len = 0;
+    w.rootlen = len;
+
+    w.stats->opens++;
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "finder: %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+    int rc = walk_dir(&w, fd, len, 0);
+    for (size_t i = 0; i < w.nbufs; i++)
+        free(w.bufs[i]);
+    free(w.bufs);
+    free(w.files.ids);
+    free(w.dirs.ids);
+    free(w.chain);
+    return rc;
+}
@@ -0,0 +1,73 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "ignore.h"
+
+// Bytes of directory entries read per getdents64 call
+#define WALK_BUFSZ (64 * 1024)
+
+// walk_tree() flags
+#define WALK_FOLLOW 1       // follow symbolic links to files and directories
+#define WALK_DEDUP 2        // pass each file to fn once, whatever its names
+
+// Metadata system calls made by walk_tree(), accumulated across calls
+struct walk_stats {
+    uint64_t dirs;          // directories read
+    uint64_t getdents;      // getdents64 calls
+    uint64_t stats;         // fstatat calls, made only for DT_UNKNOWN entries
+                            // and, with flags, for links and directories
+    uint64_t opens;         // directories opened
+    uint64_t ignored;       // entries left out by ignore rules, subtrees unread
+    uint64_t duplicates;    // further names of files already found, with WALK_DEDUP
+    uint64_t loops;         // links back to a directory above them, not followed
+};
+
+/**
+ * Called for every regular file below the root.
+ * @param arg the pointer passed to walk_tree()
+ * @param dirfd an open descriptor for the directory containing the file
+ * @param name the file name relative to dirfd
+ * @param path the path of the file, starting with the root as given
+ * @param st the lstat() information for the file, or its stat() information
+ *   when it was reached through a symbolic link, or NULL when the
+ *   directory entry alone showed it to be a regular file
+ * @return 0 to continue the walk, non-zero to stop it and have walk_tree()
+ *   return that value
+ */
+typedef int (*walk_fn)(void *arg, int dirfd, const char *name,
+                       const char *path, const struct stat *st);
+
+/**
+ * Called for every directory, the root included, before its entries.
+ * @param path the path of the directory, starting with the root as given
+ * @return 0 to continue the walk, non-zero to stop it
+ */
+typedef int (*walk_dir_fn)(void *arg, const char *path);
+
+/**
+ * Walk the tree below root depth first without following symbolic links,
+ * the way find -type f and grep -r do. Directories are read with
+ * getdents64 and entries classified by d_type, so entries are stat()ed
+ * only on file systems that leave it DT_UNKNOWN.
+ *
+ * With WALK_FOLLOW symbolic links are followed as find -L and grep -R do,
+ * except that every directory is read once: one reached again through
+ * another link is passed over, and one that is its own ancestor is
+ * reported as a loop. With WALK_DEDUP a file is passed to fn under the
+ * first name found for it only, as identified by its device and inode;
+ * directory entries carry the inode, so only each directory is stat()ed.
+ * @param dir_fn may be NULL
+ * @param ig if not NULL, entries it matches are passed over as if absent
+ *   and ignored directories are never opened
+ * @param flags WALK_FOLLOW and WALK_DEDUP, or 0
+ * @param stats if not NULL, receives the system calls made
+ * @return 0 when the whole tree was walked, -1 if root could not be opened,
+ *   or the first non-zero value returned by fn
+ */
+int walk_tree(const char *root, walk_fn fn, walk_dir_fn dir_fn, void *arg,
+              const struct ignore *ig, unsigned flags, struct walk_stats *stats);
+
+#endif
@@ -0,0 +1,327 @@
+#include "watch.h"
+#include "index.h"
+#include "live.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR | \
+                    IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+struct pathlist {
+    char **v;
+    size_t n;
+    size_t cap;
+};
+
+struct watch {
+    struct live *lv;
+    int ifd;
+    char **dirs;            // directory relative to the root, by watch descriptor
+    size_t ndirs;
+    struct pathlist dirty;  // files touched by the current batch of events
+    struct pathlist newdirs;
+    bool overflow;
+};
+
+static void join(char *out, size_t size, const char *dir, const char *name)
+{
+    if (dir[0])
+        snprintf(out, size, "%s/%s", dir, name);
+    else
+        snprintf(out, size, "%s", name);
+}
+
+static int add_watch(void *arg, const char *rel)
+{
+    struct watch *w = arg;
+    char path[PATH_MAX];
+    join(path, sizeof(path), live_root(w->lv), rel);
+
+    int wd = inotify_add_watch(w->ifd, path, WATCH_MASK);
+    if (wd < 0) {
+        // Out of watches: keep indexing, the directory just goes unwatched
+        fprintf(stderr, "finder: watch %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    if ((size_t)wd >= w->ndirs) {
+        size_t n = w->ndirs ? w->ndirs : 64;
+        while (n <= (size_t)wd)
+            n *= 2;
+        char **dirs = realloc(w->dirs, n * sizeof(char *));
+        if (!dirs)
+            return -1;
+        memset(dirs + w->ndirs, 0, (n - w->ndirs) * sizeof(char *));
+        w->dirs = dirs;
+        w->ndirs = n;
+    }
+    free(w->dirs[wd]);
+    w->dirs[wd] = strdup(rel);
+    return w->dirs[wd] ? 0 : -1;
+}
+
+// Stop watching a directory that moved or went away, and everything below it
+static void drop_watches(struct watch *w, const char *rel)
+{
+    size_t len = strlen(rel);
+    for (size_t wd = 0; wd < w->ndirs; wd++) {
+        const char *dir = w->dirs[wd];
+        if (!dir || strncmp(dir, rel, len) != 0 || (dir[len] && dir[len] != '/'))
+            continue;
+        inotify_rm_watch(w->ifd, (int)wd);
+        free(w->dirs[wd]);
+        w->dirs[wd] = NULL;
+    }
+}
+
+static int pathlist_add(struct pathlist *l, const char *rel)
+{
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 64;
+        char **v = realloc(l->v, cap * sizeof(char *));
+        if (!v)
+            return -1;
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->n] = strdup(rel);
+    return l->v[l->n++] ? 0 : -1;
+}
+
+static void pathlist_clear(struct pathlist *l)
+{
+    for (size_t i = 0; i < l->n; i++)
+        free(l->v[i]);
+    l->n = 0;
+}
+
+static void handle_event(struct watch *w, const struct inotify_event *ev)
+{
+    if (ev->mask & IN_Q_OVERFLOW) {
+        w->overflow = true;
+        return;
+    }
+    if ((size_t)ev->wd >= w->ndirs || !w->dirs[ev->wd])
+        return;
+    if (ev->mask & IN_IGNORED) {
+        free(w->dirs[ev->wd]);
+        w->dirs[ev->wd] = NULL;
+        return;
+    }
+    if (!ev->len)
+        return;
+
+    char rel[PATH_MAX];
+    join(rel, sizeof(rel), w->dirs[ev->wd], ev->name);
+    if (ev->mask & IN_ISDIR) {
+        if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            live_remove_tree(w->lv, rel);
+            drop_watches(w, rel);
+        }
+        // Files created before the directory is watched are only found by
+        // walking it
+        if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) &&
+            pathlist_add(&w->newdirs, rel) != 0)
+            w->overflow = true;
+        return;
+    }
+    if (pathlist_add(&w->dirty, rel) != 0)
+        w->overflow = true;
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int watch_drain(struct watch *w)
+{
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    for (;;) {
+        ssize_t n = read(w->ifd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            perror("inotify");
+            return -1;
+        }
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            handle_event(w, ev);
+            p += sizeof(*ev) + ev->len;
+        }
+    }
+
+    int rc = 0;
+    if (w->overflow) {
+        // Events were lost: compare the whole tree against the index
+        w->overflow = false;
+        rc = live_reconcile(w->lv, add_watch, w);
+    } else {
+        // A file written many times in one batch is read only once
+        if (w->dirty.n)
+            qsort(w->dirty.v, w->dirty.n, sizeof(char *), cmp_str);
+        for (size_t i = 0; i < w->dirty.n && rc == 0; i++) {
+            if (i == 0 || strcmp(w->dirty.v[i], w->dirty.v[i - 1]) != 0)
+                rc = live_update(w->lv, w->dirty.v[i], NULL);
+        }
+        for (size_t i = 0; i < w->newdirs.n && rc == 0; i++)
+            rc = live_scan_dir(w->lv, w->newdirs.v[i], add_watch, w);
+    }
+    pathlist_clear(&w->dirty);
+    pathlist_clear(&w->newdirs);
+    return rc;
+}
+
+static void answer(struct watch *w, const char *pattern, bool fixed)
+{
+    if (watch_drain(w) != 0)
+        fprintf(stderr, "finder: index may be stale\n");
+
+    uint64_t lines;
+    if (live_count(w->lv, pattern, fixed, &lines) != 0) {
+        printf("Error: could not count '%s'\n", pattern);
+    } else {
+        printf("The number of files are %" PRIu32 " and the number of matching lines are %" PRIu64 "\n",
+               live_nfiles(w->lv), lines);
+    }
+    fflush(stdout);
+}
+
+struct watch *watch_open(const char *dir, const char *indexfile)
+{
+    char root[PATH_MAX];
+    if (!realpath(dir, root)) {
+        fprintf(stderr, "finder: %s: %s\n", dir, strerror(errno));
+        return NULL;
+    }
+
+    struct watch *w = calloc(1, sizeof(*w));
+    if (!w) {
+        fprintf(stderr, "finder: out of memory\n");
+        return NULL;
+    }
+    w->ifd = -1;
+    w->lv = live_new(root);
+    if (!w->lv)
+        goto fail;
+    w->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->ifd < 0) {
+        perror("inotify_init1");
+        goto fail;
+    }
+
+    if (indexfile && access(indexfile, F_OK) == 0) {
+        struct index *idx = index_open(indexfile);
+        if (!idx)
+            goto fail;
+        if (strcmp(index_root(idx), root) != 0) {
+            fprintf(stderr, "finder: %s indexes %s, not %s\n",
+                    indexfile, index_root(idx), root);
+            index_close(idx);
+            goto fail;
+        }
+        int rc = live_load(w->lv, idx);
+        index_close(idx);
+        if (rc != 0)
+            goto fail;
+    }
+
+    // Watches go in before the walk so nothing changed during it is missed
+    if (live_reconcile(w->lv, add_watch, w) != 0)
+        goto fail;
+    fprintf(stderr, "finder: watching %s, %" PRIu32 " files indexed\n",
+            root, live_nfiles(w->lv));
+    return w;
+
+fail:
+    watch_close(w);
+    return NULL;
+}
+
+int watch_fd(const struct watch *w)
+{
+    return w->ifd;
+}
+
+struct live *watch_live(struct watch *w)
+{
+    return w->lv;
+}
+
+void watch_close(struct watch *w)
+{
+    if (!w)
+        return;
+    for (size_t i = 0; i < w->ndirs; i++)
+        free(w->dirs[i]);
+    free(w->dirs);
+    pathlist_clear(&w->dirty);
+    pathlist_clear(&w->newdirs);
+    free(w->dirty.v);
+    free(w->newdirs.v);
+    if (w->ifd >= 0)
+        close(w->ifd);
+    live_free(w->lv);
+    free(w);
+}
+
+int watch_run(const char *dir, const char *indexfile, bool fixed)
+{
+    struct watch *w = watch_open(dir, indexfile);
+    if (!w)
+        return -1;
+
+    // One pattern per line on stdin, one answer per line on stdout
+    int rc = -1;
+    char line[PATH_MAX + 2];
+    size_t len = 0;
+    struct pollfd fds[2] = { { w->ifd, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            goto out;
+        }
+        if (fds[0].revents & POLLIN)
+            watch_drain(w);
+        if (!(fds[1].revents & (POLLIN | POLLHUP)))
+            continue;
+
+        ssize_t n = read(STDIN_FILENO, line + len, sizeof(line) - 1 - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+        char *start = line, *nl;
+        while ((nl = memchr(start, '\n', len - (size_t)(start - line))) != NULL) {
+            *nl = '\0';
+            answer(w, start, fixed);
+            start = nl + 1;
+        }
+        len -= (size_t)(start - line);
+        memmove(line, start, len);
+        if (len == sizeof(line) - 1) {
+            fprintf(stderr, "finder: query too long\n");
+            len = 0;
+        }
+    }
+    rc = 0;
+
+out:
+    watch_close(w);
+    return rc;
+}
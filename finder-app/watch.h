@@ -0,0 +1,38 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+
+/**
+ * Keep a live trigram index of dir current with inotify and answer count
+ * queries read from stdin, one pattern per line, until stdin is closed.
+ * Only files named in change events are re-indexed; if the event queue
+ * overflows, the tree is reconciled by inode, size and mtime instead.
+ * @param indexfile an index built by 'finder index' to start from, or NULL
+ * @return 0 when stdin is closed, -1 after printing an error to stderr
+ */
+int watch_run(const char *dir, const char *indexfile, bool fixed);
+
+// A live index kept current with inotify, for callers with their own loop
+struct watch;
+
+/**
+ * Index dir, from indexfile if it exists, and start watching it.
+ * @return the watch, or NULL after printing an error to stderr
+ */
+struct watch *watch_open(const char *dir, const char *indexfile);
+
+// The inotify descriptor, readable when there are changes to apply
+int watch_fd(const struct watch *w);
+
+/**
+ * Apply every change queued so far to the index.
+ * @return 0 on success, -1 if the index may be stale
+ */
+int watch_drain(struct watch *w);
+
+struct live *watch_live(struct watch *w);
+
+void watch_close(struct watch *w);
+
+#endif
@@ -0,0 +1,299 @@
+#include "zscan.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Decompressed bytes matched at a time on one thread
+#define ZSCAN_INLINE_BUFSZ (32 * 1024)
+
+// One decompression stream of either format
+struct dec {
+    enum zscan_format fmt;
+    bool ended;         // the last gzip member or zstd frame is complete
+    bool trailing;      // gzip input after the last member, ignored
+#ifdef HAVE_ZLIB
+    z_stream z;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zs;
+#endif
+};
+
+bool zscan_supported(void)
+{
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+    return true;
+#else
+    return false;
+#endif
+}
+
+enum zscan_format zscan_detect(const char *buf, size_t len)
+{
+    const uint8_t *b = (const uint8_t *)buf;
+#ifdef HAVE_ZLIB
+    if (len >= 3 && b[0] == 0x1f && b[1] == 0x8b && b[2] == 8)
+        return ZSCAN_GZIP;
+#endif
+#ifdef HAVE_ZSTD
+    if (len >= 4 && b[0] == 0x28 && b[1] == 0xb5 && b[2] == 0x2f && b[3] == 0xfd)
+        return ZSCAN_ZSTD;
+#endif
+    (void)b;
+    (void)len;
+    return ZSCAN_NONE;
+}
+
+static int dec_init(struct dec *d, enum zscan_format fmt)
+{
+    memset(d, 0, sizeof(*d));
+    d->fmt = fmt;
+#ifdef HAVE_ZLIB
+    if (fmt == ZSCAN_GZIP)
+        return inflateInit2(&d->z, 15 + 16) == Z_OK ? 0 : -1;
+#endif
+#ifdef HAVE_ZSTD
+    if (fmt == ZSCAN_ZSTD)
+        return (d->zs = ZSTD_createDStream()) ? 0 : -1;
+#endif
+    return -1;
+}
+
+static void dec_end(struct dec *d)
+{
+#ifdef HAVE_ZLIB
+    if (d->fmt == ZSCAN_GZIP)
+        inflateEnd(&d->z);
+#endif
+#ifdef HAVE_ZSTD
+    if (d->fmt == ZSCAN_ZSTD)
+        ZSTD_freeDStream(d->zs);
+#endif
+    (void)d;
+}
+
+/**
+ * Decompress from *in onto the end of out until either runs out.
+ * @return 0 to go on, -1 if the data is corrupt
+ */
+static int dec_run(struct dec *d, const char **in, size_t *inlen,
+                   char *out, size_t *outlen, size_t outcap)
+{
+#ifdef HAVE_ZLIB
+    if (d->fmt == ZSCAN_GZIP) {
+        z_stream *z = &d->z;
+        z->next_in = (Bytef *)*in;
+        z->avail_in = (uInt)*inlen;
+        z->next_out = (Bytef *)out + *outlen;
+        z->avail_out = (uInt)(outcap - *outlen);
+        while (z->avail_in && z->avail_out && !d->trailing) {
+            if (d->ended) {
+                // Another member follows, unless the rest is padding or
+                // garbage, which gzip -d also ignores
+                if (z->next_in[0] != 0x1f) {
+                    d->trailing = true;
+                    break;
+                }
+                inflateReset(z);
+                d->ended = false;
+            }
+            int rc = inflate(z, Z_NO_FLUSH);
+            if (rc == Z_STREAM_END)
+                d->ended = true;
+            else if (rc != Z_OK && rc != Z_BUF_ERROR)
+                return -1;
+        }
+        if (d->trailing)
+            z->avail_in = 0;
+        *in = (const char *)z->next_in;
+        *inlen = z->avail_in;
+        *outlen = outcap - z->avail_out;
+        return 0;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (d->fmt == ZSCAN_ZSTD) {
+        ZSTD_inBuffer ib = { *in, *inlen, 0 };
+        ZSTD_outBuffer ob = { out, outcap, *outlen };
+        while (ib.pos < ib.size && ob.pos < ob.size) {
+            size_t rc = ZSTD_decompressStream(d->zs, &ob, &ib);
+            if (ZSTD_isError(rc))
+                return -1;
+            d->ended = rc == 0;
+        }
+        // Output left in the decoder is flushed by a call with no input
+        if (ib.pos == ib.size && ob.pos < ob.size) {
+            size_t rc = ZSTD_decompressStream(d->zs, &ob, &ib);
+            if (ZSTD_isError(rc))
+                return -1;
+            d->ended = rc == 0;
+        }
+        *in += ib.pos;
+        *inlen -= ib.pos;
+        *outlen = ob.pos;
+        return 0;
+    }
+#endif
+    (void)d;
+    (void)in;
+    (void)inlen;
+    (void)out;
+    (void)outlen;
+    (void)outcap;
+    return -1;
+}
+
+// Decompressed buffers handed from the reading thread to the matching one
+struct ring {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char *bufs[ZSCAN_NBUF];
+    size_t lens[ZSCAN_NBUF];
+    unsigned head, tail;    // next buffer to match and to fill
+    bool closed;            // no more buffers will be filled
+    struct match_ctx *ctx;
+};
+
+static void *match_main(void *arg)
+{
+    struct ring *r = arg;
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (r->head == r->tail && !r->closed)
+            pthread_cond_wait(&r->cond, &r->lock);
+        if (r->head == r->tail)
+            break;
+        unsigned i = r->head % ZSCAN_NBUF;
+        pthread_mutex_unlock(&r->lock);
+        match_feed(r->ctx, r->bufs[i], r->lens[i]);
+        pthread_mutex_lock(&r->lock);
+        r->head++;
+        pthread_cond_broadcast(&r->cond);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+// Hand the buffer just filled to the matcher and wait for a free one
+static char *ring_swap(struct ring *r, size_t len)
+{
+    pthread_mutex_lock(&r->lock);
+    r->lens[r->tail % ZSCAN_NBUF] = len;
+    r->tail++;
+    pthread_cond_broadcast(&r->cond);
+    while (r->tail - r->head == ZSCAN_NBUF)
+        pthread_cond_wait(&r->cond, &r->lock);
+    char *buf = r->bufs[r->tail % ZSCAN_NBUF];
+    pthread_mutex_unlock(&r->lock);
+    return buf;
+}
+
+int zscan_fd(int fd, enum zscan_format fmt, const char *first, size_t len,
+             struct match_ctx *ctx, char *buf, size_t bufsz, bool threaded,
+             struct scan_stats *stats, const bool *cancel)
+{
+    struct dec d;
+    if (dec_init(&d, fmt) != 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    char inline_out[ZSCAN_INLINE_BUFSZ];
+    char *out = inline_out;
+    size_t outcap = sizeof(inline_out);
+    struct ring r = { .ctx = ctx };
+    pthread_t tid;
+    char *mem = threaded ? malloc(ZSCAN_THREAD_MEM) : NULL;
+    if (mem) {
+        pthread_mutex_init(&r.lock, NULL);
+        pthread_cond_init(&r.cond, NULL);
+        for (unsigned i = 0; i < ZSCAN_NBUF; i++)
+            r.bufs[i] = mem + (size_t)i * ZSCAN_BUFSZ;
+        if (pthread_create(&tid, NULL, match_main, &r) == 0) {
+            out = r.bufs[0];
+            outcap = ZSCAN_BUFSZ;
+        } else {
+            pthread_cond_destroy(&r.cond);
+            pthread_mutex_destroy(&r.lock);
+            free(mem);
+            mem = NULL;
+        }
+    }
+
+    const char *in = first;
+    size_t inlen = len, outlen = 0;
+    uint64_t off = len;
+    bool eof = false;
+    int rc = 0, err = 0;
+    while (!(cancel && __atomic_load_n(cancel, __ATOMIC_RELAXED))) {
+        if (dec_run(&d, &in, &inlen, out, &outlen, outcap) != 0) {
+            rc = -1;
+            err = EBADMSG;
+            break;
+        }
+        if (outlen == outcap) {
+            if (mem) {
+                out = ring_swap(&r, outlen);
+            } else {
+                match_feed(ctx, out, outlen);
+            }
+            outlen = 0;
+            continue;
+        }
+        // With room left in out, the decoder has nothing more to give
+        // until it has more input
+        if (inlen)
+            continue;
+        if (eof)
+            break;
+        ssize_t n = pread(fd, buf, bufsz, (off_t)off);
+        stats->reads++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            rc = -1;
+            err = errno;
+            break;
+        }
+        stats->bytes += (uint64_t)n;
+        off += (uint64_t)n;
+        in = buf;
+        inlen = (size_t)n;
+        eof = n == 0;
+    }
+    if (rc == 0 && eof && !d.ended) {
+        rc = -1;
+        err = EBADMSG;
+    }
+
+    if (mem) {
+        pthread_mutex_lock(&r.lock);
+        if (outlen) {
+            r.lens[r.tail % ZSCAN_NBUF] = outlen;
+            r.tail++;
+        }
+        r.closed = true;
+        pthread_cond_broadcast(&r.cond);
+        pthread_mutex_unlock(&r.lock);
+        pthread_join(tid, NULL);
+        pthread_cond_destroy(&r.cond);
+        pthread_mutex_destroy(&r.lock);
+        free(mem);
+    } else if (outlen) {
+        match_feed(ctx, out, outlen);
+    }
+    dec_end(&d);
+    errno = err;
+    return rc;
+}
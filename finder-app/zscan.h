@@ -0,0 +1,52 @@
+#ifndef ZSCAN_H
+#define ZSCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "matcher.h"
+#include "scan.h"
+
+/*
+ * Matching inside compressed files, decompressed as they are read and
+ * never written out. gzip needs zlib and zstd needs libzstd at build time
+ * (HAVE_ZLIB, HAVE_ZSTD); a format built without is matched as it is.
+ *
+ * A file of ZSCAN_THREAD_MIN compressed bytes or more can be decompressed
+ * and matched on two threads: the calling thread inflates into a ring of
+ * ZSCAN_NBUF buffers that a second thread matches, so the two overlap.
+ */
+#define ZSCAN_BUFSZ (256 * 1024)
+#define ZSCAN_NBUF 4
+#define ZSCAN_THREAD_MIN (1u << 20)
+
+// Memory a threaded zscan_fd() allocates
+#define ZSCAN_THREAD_MEM ((size_t)ZSCAN_NBUF * ZSCAN_BUFSZ)
+
+enum zscan_format { ZSCAN_NONE, ZSCAN_GZIP, ZSCAN_ZSTD };
+
+// True if at least one format was built in
+bool zscan_supported(void);
+
+/**
+ * Recognize a compressed file by its first bytes.
+ * @return ZSCAN_NONE if it is not in a format that was built in
+ */
+enum zscan_format zscan_detect(const char *buf, size_t len);
+
+/**
+ * Decompress an open file through the matcher, without starting or ending
+ * the file in ctx.
+ * @param first the first len bytes of the file, already read
+ * @param buf a scratch buffer of bufsz bytes for the rest, may be first
+ * @param threaded match on a second thread; falls back to one thread if it
+ *   cannot be started
+ * @param cancel if not NULL, stop early once another thread sets it
+ * @return 0 on success, -1 with errno set on a read error, or EBADMSG if
+ *   the data is corrupt or cut short; the lines before that are matched
+ */
+int zscan_fd(int fd, enum zscan_format fmt, const char *first, size_t len,
+             struct match_ctx *ctx, char *buf, size_t bufsz, bool threaded,
+             struct scan_stats *stats, const bool *cancel);
+
+#endif
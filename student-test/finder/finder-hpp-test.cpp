@@ -0,0 +1,59 @@
+// Print what finder.hpp reports for the tree regress.sh builds.
+// Usage: finder-hpp-test <directory>
+
+#include "finder.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        std::fprintf(stderr, "Usage: finder-hpp-test <directory>\n");
+        return 2;
+    }
+    const std::string dir = argv[1];
+
+    finder::query q(dir);
+    q.pattern("hello").pattern("wor.d").top_k(1);
+    std::uint64_t files = 0, lines = 0;
+    q.run([&](const finder::file &f) {
+        files++;
+        lines += f[1];
+    });
+    std::printf("files %llu hello %llu world %llu\n", (unsigned long long)q.files(),
+                (unsigned long long)q.lines(0), (unsigned long long)q.lines(1));
+    std::printf("callback %llu %llu\n", (unsigned long long)files, (unsigned long long)lines);
+    for (const finder::hit &h : q.top())
+        std::printf("top %llu %s\n", (unsigned long long)h.lines, h.path.c_str());
+
+    q.flags(finder::fixed_strings).run();
+    std::printf("fixed %llu %llu\n", (unsigned long long)q.lines(0),
+                (unsigned long long)q.lines(1));
+
+    // The callback's exception stops the run and comes out of run()
+    unsigned calls = 0;
+    try {
+        q.run([&](const finder::file &) {
+            calls++;
+            throw std::runtime_error("from callback");
+        });
+        std::printf("no exception\n");
+    } catch (const std::runtime_error &e) {
+        std::printf("caught %s after %u calls, stopped %d\n", e.what(), calls, q.stopped());
+    }
+
+    try {
+        finder::query(dir + "/missing").pattern("x").run();
+        std::printf("no error\n");
+    } catch (const finder::error &) {
+        std::printf("error\n");
+    }
+
+    // A query is moved, not copied, and freed once
+    finder::query moved = std::move(q);
+    moved.run();
+    std::printf("moved %llu\n", (unsigned long long)moved.files());
+    return 0;
+}
@@ -0,0 +1,117 @@
+// Print what libfinder's C API reports for the trees regress.sh builds.
+// Usage: libfinder-test <directory> <large file directory>
+
+#include "libfinder.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+// Lines regress.sh writes to the one file of the large file directory
+#define LARGE_LINES 10000000
+
+struct seen {
+    uint64_t files;
+    uint64_t lines;         // of the first pattern
+    struct finder_query *cancel;    // cancelled from the first call if set
+};
+
+static void on_file(void *arg, const char *path, const uint64_t *lines, size_t npatterns)
+{
+    struct seen *s = arg;
+    (void)path;
+    s->files++;
+    if (npatterns)
+        s->lines += lines[0];
+    if (s->cancel)
+        finder_query_cancel(s->cancel);
+}
+
+// Cancel the query once it has had time to start on the large file
+static void *cancel_later(void *arg)
+{
+    nanosleep(&(struct timespec){ 0, 5000000 }, NULL);
+    finder_query_cancel(arg);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: libfinder-test <directory> <large file directory>\n");
+        return 2;
+    }
+
+    struct finder_query *q = finder_query_new(argv[1]);
+    if (!q || finder_query_add_pattern(q, "hello") != 0 ||
+        finder_query_add_pattern(q, "wor.d") != 0)
+        return 1;
+    finder_query_set_top_k(q, 2);
+    struct seen seen = { 0 };
+    finder_query_on_file(q, on_file, &seen);
+
+    // A query runs as often as wanted, each run replacing the counts
+    for (int run = 0; run < 2; run++) {
+        seen = (struct seen){ 0 };
+        printf("run %d\n", finder_query_run(q));
+        printf("files %" PRIu64 "\n", finder_query_files(q));
+        for (size_t i = 0; i < finder_query_npatterns(q); i++)
+            printf("lines %zu %" PRIu64 "\n", i, finder_query_lines(q, i));
+        for (size_t i = 0; i < finder_query_ntop(q); i++) {
+            uint64_t lines;
+            const char *path = finder_query_top(q, i, &lines);
+            printf("top %" PRIu64 " %s\n", lines, path);
+        }
+        printf("callback %" PRIu64 " %" PRIu64 "\n", seen.files, seen.lines);
+    }
+
+    // A run cancelled from its callback stops there
+    seen = (struct seen){ .cancel = q };
+    int rc = finder_query_run(q);
+    printf("cancel %d %" PRIu64 " %d\n", rc, seen.files, finder_query_stopped(q));
+
+    // Options: fixed strings, a leading '-', include globs, max_count
+    finder_query_on_file(q, NULL, NULL);
+    finder_query_set_top_k(q, 0);
+    finder_query_set_flags(q, FINDER_FIXED_STRINGS);
+    finder_query_add_pattern(q, "-x");
+    finder_query_run(q);
+    printf("fixed %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", finder_query_lines(q, 0),
+           finder_query_lines(q, 1), finder_query_lines(q, 2));
+    finder_query_add_include(q, "*.log");
+    finder_query_run(q);
+    printf("include %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", finder_query_files(q),
+           finder_query_lines(q, 0), finder_query_lines(q, 2));
+    finder_query_free(q);
+
+    q = finder_query_new(argv[1]);
+    finder_query_add_pattern(q, "hello");
+    finder_query_set_max_count(q, 1);
+    finder_query_set_threads(q, 1);
+    rc = finder_query_run(q);
+    printf("max_count %d %d\n", rc, finder_query_stopped(q));
+    finder_query_free(q);
+
+    // A cancel from another thread stops the file being read, with no file
+    // finished to notice it at
+    q = finder_query_new(argv[2]);
+    finder_query_add_pattern(q, "hello");
+    finder_query_set_threads(q, 1);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, cancel_later, q) != 0)
+        return 1;
+    rc = finder_query_run(q);
+    pthread_join(tid, NULL);
+    printf("cancel reading %d %d %d\n", rc, finder_query_stopped(q),
+           finder_query_lines(q, 0) < LARGE_LINES);
+    finder_query_free(q);
+
+    // A failed run reports -1 and zero counts
+    q = finder_query_new(argv[1]);
+    finder_query_add_pattern(q, "\\(");
+    rc = finder_query_run(q);
+    printf("invalid %d %" PRIu64 "\n", rc, finder_query_files(q));
+    finder_query_free(q);
+    return 0;
+}
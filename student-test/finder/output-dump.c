@@ -0,0 +1,109 @@
+// Print the records of finder's binary output on standard input as text,
+// one record per line, and fail on anything that is not the format.
+// Usage: output-dump < output
+//
+//   begin npatterns "pattern"...
+//   file "path" flags lines... bytes ns
+//   end flags files lines... top ntop ("path" lines)... dirs ndirs ("path" depth files lines)...
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void truncated(void)
+{
+    fprintf(stderr, "output-dump: truncated record\n");
+    exit(1);
+}
+
+static int get_byte(void)
+{
+    int c = getchar();
+    if (c == EOF)
+        truncated();
+    return c;
+}
+
+static uint64_t get_varint(void)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = get_byte();
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return v;
+    }
+    fprintf(stderr, "output-dump: varint too long\n");
+    exit(1);
+}
+
+static void print_string(void)
+{
+    uint64_t len = get_varint();
+    putchar(' ');
+    putchar('"');
+    for (uint64_t i = 0; i < len; i++)
+        putchar(get_byte());
+    putchar('"');
+}
+
+static void print_varint(void)
+{
+    printf(" %" PRIu64, get_varint());
+}
+
+int main(void)
+{
+    char magic[8];
+    if (fread(magic, 1, sizeof(magic), stdin) != sizeof(magic) ||
+        memcmp(magic, "FNDROUT1", sizeof(magic)) != 0) {
+        fprintf(stderr, "output-dump: not finder output\n");
+        return 1;
+    }
+    uint64_t npatterns = get_varint();
+    printf("begin %" PRIu64, npatterns);
+    for (uint64_t i = 0; i < npatterns; i++)
+        print_string();
+    putchar('\n');
+
+    for (;;) {
+        int type = get_byte();
+        if (type == 'F') {
+            printf("file");
+            print_string();
+            printf(" %d", get_byte());
+            for (uint64_t i = 0; i < npatterns + 2; i++)
+                print_varint();
+            putchar('\n');
+        } else if (type == 'E') {
+            printf("end %d", get_byte());
+            for (uint64_t i = 0; i < npatterns + 1; i++)
+                print_varint();
+            uint64_t ntop = get_varint();
+            printf(" top %" PRIu64, ntop);
+            for (uint64_t i = 0; i < ntop; i++) {
+                print_string();
+                print_varint();
+            }
+            uint64_t ndirs = get_varint();
+            printf(" dirs %" PRIu64, ndirs);
+            for (uint64_t i = 0; i < ndirs; i++) {
+                print_string();
+                for (int j = 0; j < 3; j++)
+                    print_varint();
+            }
+            putchar('\n');
+            break;
+        } else {
+            fprintf(stderr, "output-dump: unknown record type %d\n", type);
+            return 1;
+        }
+    }
+    if (getchar() != EOF) {
+        fprintf(stderr, "output-dump: data after the end record\n");
+        return 1;
+    }
+    return 0;
+}
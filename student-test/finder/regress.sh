@@ -0,0 +1,917 @@
+#!/bin/sh
+# Regression tests for the native finder, finder serve and libfinder.
+# Usage: regress.sh [finder-app directory]
+# Run by 'make check' in finder-app, which passes CC, CXX and FINDER_LIBS.
+
+set -e
+set -u
+
+APP=$(cd "${1:-$(dirname "$0")/../../finder-app}" && pwd)
+TESTS=$(cd "$(dirname "$0")" && pwd)
+FINDER="$APP/finder"
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+FINDER_LIBS=${FINDER_LIBS:--lm}
+export LC_ALL=C
+
+TMP=$(mktemp -d)
+SERVER=
+WATCHER=
+cleanup()
+{
+	if [ -n "$SERVER" ]; then
+		kill "$SERVER" 2>/dev/null || true
+	fi
+	if [ -n "$WATCHER" ]; then
+		kill "$WATCHER" 2>/dev/null || true
+		kill -CONT "$WATCHER" 2>/dev/null || true
+	fi
+	rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+failures=0
+fail()
+{
+	echo "FAIL: $*"
+	failures=$((failures + 1))
+}
+
+# Compare the output of a test with what it should be
+# Usage: expect <name> <expected> <actual>
+expect()
+{
+	if [ "$2" != "$3" ]; then
+		fail "$1"
+		printf 'expected:\n%s\nfound:\n%s\n' "$2" "$3"
+	fi
+}
+
+# Matching lines finder counts for one pattern, or "error"
+# Usage: count [option...] <directory> -- <pattern>
+count()
+{
+	found=$("$FINDER" "$@" 2>/dev/null |
+		sed -n 's/.*the number of matching lines are \([0-9]*\)$/\1/p')
+	echo "${found:-error}"
+}
+
+# Each pattern and its count, one per line, from finder's output
+pattern_counts()
+{
+	sed -n 's/^The number of matching lines for "\(.*\)" are \([0-9]*\)$/\1 \2/p'
+}
+
+# Bytes finder reads and matches for one pattern, or "error"
+# Usage: scanned [option...] <directory> -- <pattern>
+scanned()
+{
+	found=$("$FINDER" -s "$@" 2>&1 >/dev/null |
+		sed -n 's/^finder: \([0-9]*\) bytes scanned.*/\1/p')
+	echo "${found:-error}"
+}
+
+# Matching lines grep counts for one pattern, or "error"
+grep_count()
+{
+	if cat "$1"/* | grep -c -- "$2" 2>/dev/null; then
+		return
+	elif [ $? -ne 1 ]; then
+		echo error
+	fi
+}
+
+echo "== basic regular expressions against grep"
+mkdir "$TMP/bre"
+cat > "$TMP/bre/lines.txt" <<'EOF'
+abab
+abba
+aXa bYb
+]abc
+a]b
+-dash-
+x-y
+foo_bar1 baz
+12 345 6789
+a{1
+{1}
+aaa
+ab*c
+a.b
+a\b
+^caret
+dollar$
+tab	here
+[bracket]
+abcabc
+xyzzy
+
+EOF
+while IFS= read -r pattern; do
+	expected=$(grep_count "$TMP/bre" "$pattern")
+	expect "pattern $pattern" "$expected" "$(count "$TMP/bre" -- "$pattern")"
+done <<'EOF'
+\(ab\)\1
+\(a\)\(b\)\2\1
+\(.\)\1
+^\(.*\)\1$
+\(\(a\)b\)\2
+[]a]
+[^]a]
+[a-c-]
+[\]
+[.]
+[*]
+[[:digit:]]\{2\}
+[[:alpha:]_][[:alnum:]_]*
+[[:space:]]
+[[:punct:]]
+[[:upper:]]
+^$
+a*
+*a
+^*
+^^
+^^*
+a^
+\(^a\)
+$$
+r\$
+\.
+a\\b
+b\*
+x\{2,3\}
+z\{2\}
+a\{,2\}
+\{1\}
+^\{1
+a\{1
+a\{1,2
+a\{2,1\}
+a\{x\}
+n\(1\|2\)0
+a\+
+a\?b
+\<ab
+ab\>
+EOF
+
+echo "== many fixed strings in one pass"
+mkdir "$TMP/ac"
+cat > "$TMP/ac/words.txt" <<'EOF'
+ushers
+she sells sea shells
+his hers
+hershey
+aaaa aa
+shshe
+ahishers
+EOF
+# Overlapping strings, one a suffix or prefix of others, and one absent
+set -- he she his hers sea shells s ell 'sells sea' aaa a x
+expected=
+for pattern; do
+	expected="$expected$(printf '\n%s %s' "$pattern" "$(grep_count "$TMP/ac" "$pattern")")"
+done
+found=$("$FINDER" -F "$TMP/ac" "$@" | pattern_counts)
+expect "fixed strings" "${expected#?}" "$found"
+# Enough strings for the automaton to outgrow its dense table; each line
+# has a string behind the start of another, so matches follow the
+# failure links
+awk 'BEGIN {
+	srand(7)
+	abc = "abcdefghijklmnopqrstuvwxyz"
+	for (i = 0; i < 20000; i++) {
+		w = ""
+		for (j = 0; j < 8; j++)
+			w = w substr(abc, int(rand() * 26) + 1, 1)
+		print w
+	}
+}' | sort -u > "$TMP/ac.pat"
+awk 'NR == FNR { p[NR] = $0; n = NR; next } END {
+	srand(11)
+	for (i = 0; i < 50000; i++) {
+		a = p[int(rand() * n) + 1]
+		b = p[int(rand() * n) + 1]
+		print substr(a, 1, int(rand() * 8)) b " " i " " substr(b, 3)
+	}
+}' "$TMP/ac.pat" "$TMP/ac.pat" > "$TMP/ac/words.txt"
+# Every string is 8 bytes, so looking up each 8 bytes of a line counts
+expected=$(awk 'NR == FNR { order[NR] = $0; want[$0] = 0; n = NR; next } {
+	delete seen
+	for (i = 1; i + 7 <= length($0); i++) {
+		w = substr($0, i, 8)
+		if (w in want && !(w in seen)) {
+			seen[w] = 1
+			want[w]++
+		}
+	}
+} END {
+	for (i = 1; i <= n; i++)
+		print order[i], want[order[i]]
+}' "$TMP/ac.pat" "$TMP/ac/words.txt")
+found=$("$FINDER" -F -f "$TMP/ac.pat" "$TMP/ac" | pattern_counts)
+if [ "$found" != "$expected" ]; then
+	fail "many fixed strings"
+fi
+rm -rf "$TMP/ac" "$TMP/ac.pat"
+
+echo "== json and binary output"
+"$CC" -Wall -Wextra -o "$TMP/output-dump" "$TESTS/output-dump.c"
+mkdir "$TMP/out"
+printf 'hello\nworld\nhello world\n' > "$TMP/out/a.txt"
+printf 'hello\0\n' > "$TMP/out/bin.dat"
+# A quote, a backslash and a tab, escaped in json and copied in binary
+odd=$(printf '%s/q"b\\c\tt.txt' "$TMP/out")
+printf 'hello\n' > "$odd"
+# Files come in the order they are scanned and take their own time
+found=$("$FINDER" -I -k 1 -o json "$TMP/out" hello world |
+	sed 's/"ns":[0-9]*/"ns":0/' | sort)
+expect "json output" "{\"type\":\"begin\",\"patterns\":[\"hello\",\"world\"]}
+{\"type\":\"end\",\"stopped\":false,\"files\":3,\"lines\":[3,2],\"top\":[{\"path\":\"$TMP/out/a.txt\",\"lines\":4}]}
+{\"type\":\"file\",\"path\":\"$TMP/out/a.txt\",\"lines\":[2,2],\"bytes\":24,\"ns\":0,\"cached\":false,\"skipped\":false}
+{\"type\":\"file\",\"path\":\"$TMP/out/bin.dat\",\"lines\":[0,0],\"bytes\":7,\"ns\":0,\"cached\":false,\"skipped\":true}
+{\"type\":\"file\",\"path\":\"$TMP/out/q\\\"b\\\\c\\u0009t.txt\",\"lines\":[1,0],\"bytes\":6,\"ns\":0,\"cached\":false,\"skipped\":false}" "$found"
+found=$("$FINDER" -I -k 1 -o binary "$TMP/out" hello world | "$TMP/output-dump" |
+	sed 's/^\(file .*\) [0-9]*$/\1 0/' | sort)
+expect "binary output" "begin 2 \"hello\" \"world\"
+end 0 3 3 2 top 1 \"$TMP/out/a.txt\" 4 dirs 0
+file \"$TMP/out/a.txt\" 0 2 2 24 0
+file \"$TMP/out/bin.dat\" 2 0 0 7 0
+file \"$odd\" 0 1 0 6 0" "$found"
+# Counts taken from the cache carry no bytes or time
+touch -d '2000-01-01' "$TMP/out/a.txt"
+"$FINDER" -c "$TMP/out.cache" "$TMP/out" hello > /dev/null
+found=$("$FINDER" -c "$TMP/out.cache" -o binary "$TMP/out" hello | "$TMP/output-dump" |
+	grep '/a\.txt')
+expect "binary cached file" "file \"$TMP/out/a.txt\" 1 2 0 0" "$found"
+rm -rf "$TMP/out" "$TMP/out.cache"
+
+echo "== file filters"
+mkdir -p "$TMP/filt/sub"
+printf 'hello\nhello\n' > "$TMP/filt/a.txt"
+printf 'hello\n' > "$TMP/filt/b.log"
+printf 'hello world\n' > "$TMP/filt/sub/c.txt"
+printf 'hello\0hello\n' > "$TMP/filt/sub/bin.dat"
+# Larger than a first read, so a skip leaves most of it unread
+yes hello | head -n 200000 > "$TMP/filt/big.txt"
+# Filtered files are counted but not matched; each case is the lines
+# matched, the files filtered and the options
+set -f
+while read -r expected files flags; do
+	found=$("$FINDER" -s $flags "$TMP/filt" hello 2> "$TMP/filt.err" |
+		sed -n 's/.*the number of matching lines are \([0-9]*\)$/\1/p')
+	skipped=$(sed -n 's/^finder: [0-9]* bytes scanned, [0-9]* bytes in \([0-9]*\) filtered.*/\1/p' \
+		"$TMP/filt.err")
+	expect "filter $flags" "$expected $files" "$found $skipped"
+done <<'EOF'
+200005 0
+200003 2 --include=*.txt
+2 3 --include=*.log --include=*.dat
+2 3 --exclude=*.txt
+3 3 --include=*.txt --exclude=big*
+5 1 --max-size=100K
+5 1 --max-size=1M
+200005 0 --max-size=2M
+200004 1 -I
+200004 1 -I -U
+1 4 --include=*.dat --include=*.log -I
+EOF
+set +f
+# The bytes of a file too large are skipped after its first read
+total=$(find "$TMP/filt" -type f -exec cat {} + | wc -c)
+for flags in '-j 2' '-U -j 1'; do
+	found=$("$FINDER" -s $flags --max-size=100K "$TMP/filt" hello 2>&1 >/dev/null |
+		sed -n 's/^finder: \([0-9]*\) bytes scanned, \([0-9]*\) bytes in.*/\1 \2/p')
+	scanned=${found% *}
+	skipped=${found#* }
+	if [ "$skipped" -lt 1000000 ] || [ $((scanned + skipped)) -ne "$total" ]; then
+		fail "max-size $flags scanned $scanned and skipped $skipped of $total bytes"
+	fi
+done
+rm -rf "$TMP/filt" "$TMP/filt.err"
+
+echo "== ignore files"
+mkdir -p "$TMP/ign/build" "$TMP/ign/docs/tmp" "$TMP/ign/sub/docs/tmp" \
+	"$TMP/ign/sub/node_modules" "$TMP/ign/sub/gen/deep" "$TMP/ign/x"
+for name in a.txt a.o keep.o build/x.txt sub/build top.txt sub/top.txt \
+	docs/tmp/y.txt sub/docs/tmp/z.txt sub/node_modules/m.txt log1.txt \
+	sub/log12.txt sub/gen/g.c sub/gen/deep/d.c important.tmp x/important.tmp \
+	other.tmp 'sp ace ' '#hash' '!bang'; do
+	printf 'hello\n' > "$TMP/ign/$name"
+done
+cat > "$TMP/ign.rules" <<'EOF'
+# A comment, then a blank line
+
+*.o
+!keep.o
+build/
+!build/x.txt
+/top.txt
+docs/tmp
+node_modules
+log[0-9].txt
+sub/**/*.c
+*.tmp
+!/important.tmp
+\#hash
+\!bang
+sp ace\ 
+EOF
+# What git leaves out for the same rules in a .gitignore; a file in an
+# ignored directory is not let back in
+found=$(cd "$TMP/ign" && "$FINDER" -o json --ignore-file="$TMP/ign.rules" . hello |
+	sed -n 's/^{"type":"file","path":"\([^"]*\)".*/\1/p' | sort)
+expect "ignored paths" "./a.txt
+./important.tmp
+./keep.o
+./sub/build
+./sub/docs/tmp/z.txt
+./sub/log12.txt
+./sub/top.txt" "$found"
+# Ignored directories count once and their files not at all
+found=$("$FINDER" -s --ignore-file="$TMP/ign.rules" "$TMP/ign" hello 2> "$TMP/ign.err" |
+	sed -n 's/^The number of files are \([0-9]*\) .*/\1/p')
+ignored=$(sed -n 's/.* \([0-9]*\) paths ignored$/\1/p' "$TMP/ign.err")
+expect "ignored counts" "7 13" "$found $ignored"
+# Later files override earlier ones
+printf '!a.o\n!sub/gen/g.c\n' > "$TMP/ign.more"
+expect "ignore files in order" "9" \
+	"$(count --ignore-file="$TMP/ign.rules" --ignore-file="$TMP/ign.more" "$TMP/ign" -- hello)"
+if "$FINDER" --ignore-file="$TMP/ign.none" "$TMP/ign" hello > /dev/null 2>&1; then
+	fail "missing ignore file"
+fi
+rm -rf "$TMP/ign" "$TMP/ign.rules" "$TMP/ign.more" "$TMP/ign.err"
+
+echo "== compressed files"
+# Only the formats finder was built with, and that can be made here
+formats=
+case " $FINDER_LIBS " in
+*" -lz "*)
+	if command -v gzip > /dev/null; then
+		formats="gzip"
+	fi
+	;;
+esac
+case " $FINDER_LIBS " in
+*" -lzstd "*)
+	if command -v zstd > /dev/null; then
+		formats="$formats zstd"
+	fi
+	;;
+esac
+mkdir "$TMP/z"
+printf 'hello\nworld\nhello world\n' > "$TMP/z/plain.txt"
+# Over ZSCAN_THREAD_MIN compressed, so it is matched on a second thread
+awk 'BEGIN {
+	for (i = 0; i < 200000; i++)
+		printf "line %d %s %x\n", i, i % 3 ? "hello" : "world", i * 2654435761 % 4294967296
+}' > "$TMP/z.big"
+printf 'hello\nhello\nnothing\n' > "$TMP/z.small"
+expected=$(($(grep -c hello "$TMP/z.big") + 4))
+for format in $formats; do
+	"$format" -c "$TMP/z.small" > "$TMP/z/small.$format"
+	"$format" -c "$TMP/z.big" > "$TMP/z/big.$format"
+	for flags in '-j 4' '-U -j 1'; do
+		expect "$format -z $flags" "$expected" "$(count -z $flags "$TMP/z" -- hello)"
+	done
+	# Without -z the compressed bytes are matched as they are
+	expect "$format without -z" "$(grep_count "$TMP/z" hello)" "$(count "$TMP/z" -- hello)"
+	# A file cut short is reported and counts nothing
+	head -c 2000 "$TMP/z/big.$format" > "$TMP/z/cut.$format"
+	if ! "$FINDER" -z "$TMP/z" hello 2>&1 >/dev/null | grep -q "cut\.$format"; then
+		fail "$format cut short not reported"
+	fi
+	expect "$format cut short" "$expected" "$(count -z "$TMP/z" -- hello)"
+	rm "$TMP/z/small.$format" "$TMP/z/big.$format" "$TMP/z/cut.$format"
+done
+if [ -z "$formats" ]; then
+	echo "skipped compressed files, no gzip or zstd support"
+fi
+rm -rf "$TMP/z" "$TMP/z.big" "$TMP/z.small"
+
+echo "== approximate matching"
+mkdir "$TMP/fz"
+# Identifiers with up to three bytes inserted, deleted or changed, behind
+# a few bytes of the same alphabet, and some lines with none
+awk 'BEGIN {
+	srand(5)
+	abc = "abcdefgh_"
+	n = split("session_id request_timeout abcabc " \
+		"user_agent_string_for_the_client_of_the_service_behind_the_proxy", w, " ")
+	for (i = 0; i < 1000; i++) {
+		s = w[int(rand() * n) + 1]
+		for (e = int(rand() * 4); e > 0; e--) {
+			p = int(rand() * (length(s) + 1))
+			c = substr(abc, int(rand() * 9) + 1, 1)
+			r = rand()
+			if (r < 0.33)
+				s = substr(s, 1, p) c substr(s, p + 1)
+			else if (r < 0.66)
+				s = substr(s, 1, p - 1) substr(s, p + 1)
+			else
+				s = substr(s, 1, p - 1) c substr(s, p + 1)
+		}
+		pre = ""
+		for (j = int(rand() * 6); j > 0; j--)
+			pre = pre substr(abc, int(rand() * 9) + 1, 1)
+		print (i % 7 ? pre s " x" : pre)
+	}
+}' > "$TMP/fz/log.txt"
+# More patterns than a vector holds, one of the longest allowed, and one
+# short enough for every line to be within the distance
+printf '%s\n' session_id request_timeout abcabc ab \
+	user_agent_string_for_the_client_of_the_service_behind_the_proxy > "$TMP/fz.pat"
+for k in 0 1 2 3; do
+	# The least edit distance of each pattern to any part of a line, as
+	# Sellers computes it one cell at a time
+	expected=$(awk -v k="$k" 'NR == FNR { pat[++np] = $0; next } {
+		n = length($0)
+		for (q = 1; q <= np; q++) {
+			p = pat[q]
+			m = length(p)
+			for (j = 0; j <= n; j++)
+				prev[j] = 0
+			for (i = 1; i <= m; i++) {
+				cur[0] = i
+				c = substr(p, i, 1)
+				for (j = 1; j <= n; j++) {
+					v = prev[j - 1] + (c != substr($0, j, 1))
+					if (prev[j] + 1 < v)
+						v = prev[j] + 1
+					if (cur[j - 1] + 1 < v)
+						v = cur[j - 1] + 1
+					cur[j] = v
+				}
+				for (j = 0; j <= n; j++)
+					prev[j] = cur[j]
+			}
+			best = prev[0]
+			for (j = 1; j <= n; j++)
+				if (prev[j] < best)
+					best = prev[j]
+			if (best <= k)
+				hits[q]++
+		}
+	} END {
+		for (q = 1; q <= np; q++)
+			print pat[q], hits[q] + 0
+	}' "$TMP/fz.pat" "$TMP/fz/log.txt")
+	for flags in '-j 2' '-U -j 1'; do
+		found=$("$FINDER" $flags --max-errors="$k" -f "$TMP/fz.pat" "$TMP/fz" | pattern_counts)
+		expect "max-errors $k $flags" "$expected" "$found"
+	done
+done
+if "$FINDER" --max-errors=1 "$TMP/fz" "$(printf '%065d' 0)" > /dev/null 2>&1; then
+	fail "max-errors pattern over 64 bytes"
+fi
+rm -rf "$TMP/fz" "$TMP/fz.pat"
+
+echo "== estimates"
+# Every descent through a tree whose directories alike hold alike files
+# finds the totals, so the estimate is exact
+mkdir "$TMP/est"
+for d in . a b c d; do
+	mkdir -p "$TMP/est/u/$d"
+	for f in 1 2 3; do
+		printf 'hello\nhello\nx\n' > "$TMP/est/u/$d/f$f"
+	done
+done
+found=$(timeout 10 "$FINDER" --estimate=0.2 "$TMP/est/u" hello | sed 1d)
+expect "estimate uniform" "The number of files are about 15 (15 to 15)
+The number of matching lines for \"hello\" are about 30 (30 to 30)" "$found"
+# Otherwise descents differ; after the many made in the time asked for
+# the estimate is within 5% of the totals and its interval narrow
+for i in 1 2 3 4 5 6 7 8 9 10 11 12; do
+	mkdir -p "$TMP/est/v/d$i/e"
+	for j in $(seq 1 "$i"); do
+		yes hello | head -n "$j" > "$TMP/est/v/d$i/f$j"
+	done
+	if [ $((i % 3)) -eq 0 ]; then
+		printf 'hello\nhello\n' > "$TMP/est/v/d$i/e/g"
+	fi
+done
+start=$(date +%s)
+"$FINDER" --estimate=0.5 "$TMP/est/v" hello > "$TMP/est.txt"
+elapsed=$(($(date +%s) - start))
+if [ "$elapsed" -gt 3 ]; then
+	fail "estimate took $elapsed seconds for 0.5"
+fi
+total=$(count "$TMP/est/v" -- hello)
+set -- $(sed -n 's/^The number of matching lines for "hello" are about \([0-9]*\) (\([0-9]*\) to \([0-9]*\))$/\1 \2 \3/p' \
+	"$TMP/est.txt") 0 0 0
+mean=$1
+low=$2
+high=$3
+if [ $((mean * 20)) -lt $((total * 19)) ] || [ $((mean * 20)) -gt $((total * 21)) ] ||
+	[ "$low" -gt "$mean" ] || [ "$high" -lt "$mean" ] || [ $((high - low)) -gt $((total / 10)) ]; then
+	fail "estimate $mean ($low to $high) of $total lines"
+fi
+rm -rf "$TMP/est" "$TMP/est.txt"
+
+echo "== directory totals"
+mkdir -p "$TMP/agg/a/b/c/d" "$TMP/agg/e/f" "$TMP/agg/g"
+i=0
+for d in . a a/b a/b/c a/b/c/d e e/f; do
+	for f in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+		i=$((i + 1))
+		yes hello | head -n $((i % 7)) > "$TMP/agg/$d/f$f"
+	done
+done
+touch -d '2000-01-01' $(find "$TMP/agg" -type f)
+# Lines, files and path of each directory down to depth 2, as find and
+# grep count them
+expected=$(cd "$TMP/agg" && find . -mindepth 0 -maxdepth 2 -type d | sort | while read -r d; do
+	printf '%s\t%s\t%s\n' "$(find "$d" -type f -exec cat {} + | grep -c hello)" \
+		"$(find "$d" -type f | wc -l)" "$TMP/agg${d#.}"
+done)
+for flags in '-j 4' '-U -j 1' "-c $TMP/agg.cache" "-c $TMP/agg.cache"; do
+	found=$("$FINDER" $flags --aggregate=2 "$TMP/agg" hello | sed 1d | sort -t "$(printf '\t')" -k 3)
+	expect "aggregate $flags" "$expected" "$found"
+done
+if "$FINDER" --aggregate=1 -i /dev/null "$TMP/agg" hello > /dev/null 2>&1; then
+	fail "aggregate with an index"
+fi
+rm -rf "$TMP/agg" "$TMP/agg.cache"
+
+echo "== links and duplicate names"
+mkdir -p "$TMP/ln/a" "$TMP/ln/b"
+printf 'hello\n' > "$TMP/ln/a/f"
+printf 'hello\nhello\n' > "$TMP/ln/other"
+ln "$TMP/ln/a/f" "$TMP/ln/b/hard"
+ln -s ../a/f "$TMP/ln/b/sym"
+ln -s ../a "$TMP/ln/b/dir"
+ln -s .. "$TMP/ln/a/up"
+ln -s missing "$TMP/ln/b/dangling"
+# Without -L symbolic links are left alone, hard links counted twice
+expect "links not followed" "4" "$(count "$TMP/ln" -- hello)"
+# Each case is the lines, files, duplicate names and loops found; a
+# directory is read once under whichever name comes first
+while read -r lines files duplicates loops flags; do
+	found=$(timeout 10 "$FINDER" -s $flags "$TMP/ln" hello 2> "$TMP/ln.err" |
+		sed -n 's/^The number of files are \([0-9]*\) and the number of matching lines are \([0-9]*\)$/\2 \1/p')
+	found="$found $(sed -n 's/^finder: \([0-9]*\) duplicate file names skipped, \([0-9]*\) file system loops.*/\1 \2/p' \
+		"$TMP/ln.err")"
+	expect "links $flags" "$lines $files $duplicates $loops" "$found"
+done <<'EOF'
+5 4 0 1 -L
+3 2 1 0 --dedup
+3 2 2 1 -L --dedup
+3 2 2 1 -L --dedup -U -j 1
+EOF
+if ! "$FINDER" -L "$TMP/ln" hello 2>&1 >/dev/null | grep -q '/up: file system loop, not followed$'; then
+	fail "loop not reported"
+fi
+rm -rf "$TMP/ln" "$TMP/ln.err"
+
+echo "== page cache"
+mkdir "$TMP/pc"
+# Several drop windows, written back so its pages can be dropped
+yes hello | head -c 40000000 > "$TMP/pc/big.txt"
+printf 'hello\n' > "$TMP/pc/small.txt"
+sync
+# Bytes read from disk and from the page cache; the disk reads are whole
+# pages, so they can come to more than the bytes scanned
+io()
+{
+	"$FINDER" -s "$@" "$TMP/pc" hello 2>&1 >/dev/null | sed -n \
+		's/^finder: \([0-9]*\) bytes read from disk, \([0-9]*\) from the page cache.*/\1 \2/p'
+}
+total=$(cat "$TMP/pc"/* | wc -c)
+if [ -r /proc/self/io ]; then
+	for flags in '-j 2' '-U -j 1'; do
+		# A scan leaves the files in the cache for the next, unless it
+		# drops them; either way the run after reads them from disk or not
+		io $flags > /dev/null
+		set -- $(io $flags --low-impact)
+		if [ $(($1 + $2)) -ne "$total" ] || [ "$1" -gt $((total / 10)) ]; then
+			fail "low-impact $flags after a scan read $1 from disk and $2 cached"
+		fi
+		set -- $(io $flags --low-impact --readahead=1M)
+		if [ "$1" -lt $((total * 9 / 10)) ]; then
+			fail "low-impact $flags after a low-impact scan read $1 from disk"
+		fi
+		set -- $(io $flags)
+		if [ "$1" -lt $((total * 9 / 10)) ]; then
+			fail "$flags after a low-impact scan read $1 from disk"
+		fi
+	done
+else
+	echo "skipped page cache, no /proc/self/io"
+fi
+rm -rf "$TMP/pc"
+
+echo "== lines across the chunks of a split file"
+mkdir "$TMP/split"
+# Lines of every length up to 300 bytes, so the 16M chunk boundaries of
+# this 80M file fall inside lines that only match when seen whole
+awk 'BEGIN {
+	for (i = 0; n < 80 * 1024 * 1024; i++) {
+		len = (i * 7919) % 300
+		line = (i % 5 ? "a" : "b") sprintf("%0" len "d", i) "z"
+		if (i % 11 == 0)
+			line = line " abab needle"
+		print line
+		n += length(line) + 1
+	}
+}' > "$TMP/split/big.txt"
+for pattern in 'needle' '^a[0-9]*z$' '^b.*z' '\(ab\)\1 needle$' '0\{5\}1z'; do
+	expected=$(grep_count "$TMP/split" "$pattern")
+	for threads in 4 2; do
+		found=$(count -j "$threads" "$TMP/split" -- "$pattern")
+		expect "split -j $threads $pattern" "$expected" "$found"
+	done
+	found=$(count -U -j 4 "$TMP/split" -- "$pattern")
+	expect "split -U $pattern" "$expected" "$found"
+done
+# Stopping at a line count stops inside the file, not at its end
+for flags in '-j 4' '-j 1' '-U -j 4'; do
+	scanned=$("$FINDER" -s $flags --max-count=10 "$TMP/split" -- needle 2>&1 >/dev/null |
+		sed -n 's/^finder: \([0-9]*\) bytes scanned.*/\1/p')
+	if [ "${scanned:-0}" -eq 0 ] || [ "$scanned" -ge $((16 * 1024 * 1024)) ]; then
+		fail "max-count $flags read $scanned bytes"
+	fi
+done
+rm -rf "$TMP/split"
+
+echo "== files read short of their end"
+# procfs reads stop at a page, so this file takes several reads to fill
+# the first block; a short first read is not the whole file
+mkdir "$TMP/short"
+sleep 60 &
+sleeper=$!
+if [ -r "/proc/$sleeper/smaps" ]; then
+	ln -s "/proc/$sleeper/smaps" "$TMP/short/smaps"
+	# The mappings settle once sleep has been loaded and is sleeping
+	expected=
+	while [ "$expected" != "$(grep -c '^Rss' "/proc/$sleeper/smaps")" ]; do
+		expected=$(grep -c '^Rss' "/proc/$sleeper/smaps")
+		sleep 0.1
+	done
+	for flags in '-j 2' '-U -j 1'; do
+		expect "short reads $flags" "$expected" "$(count -L $flags "$TMP/short" -- '^Rss')"
+	done
+else
+	echo "skipped short reads, no /proc"
+fi
+kill "$sleeper"
+wait "$sleeper" 2>/dev/null || true
+rm -rf "$TMP/short"
+
+echo "== checkpoint and resume"
+mkdir "$TMP/ckp"
+for i in $(seq 1 3000); do
+	echo "line $i hello" > "$TMP/ckp/f$i"
+done
+# Distinct leaders, so the top files do not depend on the order of ties:
+# 5, 4 and 3 lines against at most 2 in the others
+printf 'hello\nhello\nhello\nhello\n' >> "$TMP/ckp/f20"
+printf 'hello\nhello\n' >> "$TMP/ckp/f1500"
+printf 'hello\nhello\n' >> "$TMP/ckp/f2990"
+"$FINDER" -k 3 "$TMP/ckp" hello 'line 1' | sort > "$TMP/full.txt"
+# Files are listed as they are matched to a reader that never reads, so
+# the run stops part way once the pipe is full, and is killed there
+mkfifo "$TMP/ckp.fifo"
+sleep 60 < "$TMP/ckp.fifo" &
+reader=$!
+"$FINDER" -j 1 -U -k 3 -o json --checkpoint="$TMP/ckp.state" --checkpoint-interval=0 \
+	"$TMP/ckp" hello 'line 1' > "$TMP/ckp.fifo" &
+pid=$!
+while [ ! -s "$TMP/ckp.state" ] && kill -0 "$pid" 2>/dev/null; do
+	sleep 0.01
+done
+kill -9 "$pid" 2>/dev/null || true
+wait "$pid" 2>/dev/null || true
+kill "$reader"
+wait "$reader" 2>/dev/null || true
+"$FINDER" -s -k 3 --checkpoint="$TMP/ckp.state" --resume "$TMP/ckp" hello 'line 1' \
+	2> "$TMP/stats.txt" | sort > "$TMP/resumed.txt"
+expect "resume output" "$(cat "$TMP/full.txt")" "$(cat "$TMP/resumed.txt")"
+resumed=$(sed -n 's/^finder: \([0-9]*\) files matched before resuming$/\1/p' "$TMP/stats.txt")
+if [ "${resumed:-0}" -eq 0 ]; then
+	fail "resume took no files from the checkpoint"
+fi
+if [ -e "$TMP/ckp.state" ]; then
+	fail "checkpoint left after a finished run"
+fi
+
+echo "== index out of date"
+mkdir -p "$TMP/idx/sub"
+printf 'hello\n' > "$TMP/idx/a.txt"
+printf 'nothing\n' > "$TMP/idx/sub/b.txt"
+"$FINDER" index "$TMP/idx" "$TMP/idx.bin"
+expect "index current" "1" "$(count -i "$TMP/idx.bin" "$TMP/idx" -- hello)"
+# A new file changes its directory, a rewritten candidate its own times
+printf 'hello\n' > "$TMP/idx/sub/c.txt"
+expect "index file added" "2" "$(count -i "$TMP/idx.bin" "$TMP/idx" -- hello)"
+if ! "$FINDER" -i "$TMP/idx.bin" "$TMP/idx" hello 2>&1 >/dev/null | grep -q 'out of date'; then
+	fail "no warning for an index out of date"
+fi
+"$FINDER" index "$TMP/idx" "$TMP/idx.bin"
+printf 'hello\nhello\n' > "$TMP/idx/a.txt"
+touch -d '2000-01-01' "$TMP/idx/a.txt"
+expect "index candidate changed" "3" "$(count -i "$TMP/idx.bin" "$TMP/idx" -- hello)"
+rm "$TMP/idx/sub/c.txt"
+expect "index file removed" "2" "$(count -i "$TMP/idx.bin" "$TMP/idx" -- hello)"
+# A file the index ruled out, appended to in place, may match now
+"$FINDER" index "$TMP/idx" "$TMP/idx.bin"
+printf 'hello again\n' >> "$TMP/idx/sub/b.txt"
+expect "index other file appended" "3" "$(count -i "$TMP/idx.bin" "$TMP/idx" -- hello)"
+
+echo "== result cache"
+mkdir "$TMP/cache"
+printf 'hello\nx\n' > "$TMP/cache/a.txt"
+printf 'hello world\nhello\n' > "$TMP/cache/b.txt"
+# Files written within a second of a run are read again the next time,
+# as they could change again without their size or mtime changing
+touch -d '2000-01-01' "$TMP/cache"/*
+expect "cache first run" "3" "$(count -c "$TMP/cache.bin" "$TMP/cache" -- hello)"
+expect "cache hit" "3 0" \
+	"$(count -c "$TMP/cache.bin" "$TMP/cache" -- hello) $(scanned -c "$TMP/cache.bin" "$TMP/cache" -- hello)"
+# Only the file that changed is read again
+printf 'hello\nhello\nhello\n' > "$TMP/cache/b.txt"
+touch -d '2000-01-02' "$TMP/cache/b.txt"
+expect "cache file changed" "18 4" \
+	"$(scanned -c "$TMP/cache.bin" "$TMP/cache" -- hello) $(count -c "$TMP/cache.bin" "$TMP/cache" -- hello)"
+# The same size and contents at another time may be other contents
+printf 'hallo\nhallo\nhallo\n' > "$TMP/cache/b.txt"
+touch -d '2000-01-03' "$TMP/cache/b.txt"
+expect "cache same size changed" "1" "$(count -c "$TMP/cache.bin" "$TMP/cache" -- hello)"
+# Counts are kept for each pattern and the options that change them
+expect "cache other pattern" "3 0" \
+	"$(count -c "$TMP/cache.bin" "$TMP/cache" -- hallo) $(scanned -c "$TMP/cache.bin" "$TMP/cache" -- hello)"
+expect "cache fixed string" "0" "$(count -F -c "$TMP/cache.bin" "$TMP/cache" -- 'x*')"
+expect "cache regex" "5" "$(count -c "$TMP/cache.bin" "$TMP/cache" -- 'x*')"
+printf 'hello\n' > "$TMP/cache/new.txt"
+expect "cache recent file" "2 6" \
+	"$(count -c "$TMP/cache.bin" "$TMP/cache" -- hello) $(scanned -c "$TMP/cache.bin" "$TMP/cache" -- hello)"
+
+echo "== finder watch"
+mkdir -p "$TMP/w/a"
+printf 'hello\nworld\n' > "$TMP/w/a/one.txt"
+printf 'hello\n' > "$TMP/w/two.txt"
+mkfifo "$TMP/w.in"
+"$FINDER" watch "$TMP/w" < "$TMP/w.in" > "$TMP/w.out" 2> "$TMP/w.err" &
+WATCHER=$!
+exec 3> "$TMP/w.in"
+while ! grep -q 'files indexed$' "$TMP/w.err" && kill -0 "$WATCHER"; do
+	sleep 0.01
+done
+# Each answer from the live index is what a search of the tree gives
+asked=0
+watch_expect()
+{
+	asked=$((asked + 1))
+	printf 'hello\n' >&3
+	while [ "$(wc -l < "$TMP/w.out")" -lt "$asked" ] && kill -0 "$WATCHER"; do
+		sleep 0.01
+	done
+	expect "watch $1" "$("$FINDER" "$TMP/w" hello)" "$(sed -n "${asked}p" "$TMP/w.out")"
+}
+watch_expect "start"
+printf 'hello again\n' >> "$TMP/w/a/one.txt"
+mkdir -p "$TMP/w/b/c"
+printf 'hello\n' > "$TMP/w/b/c/three.txt"
+rm "$TMP/w/two.txt"
+watch_expect "changes"
+# With the watcher stopped, more events than the queue holds are followed
+# by changes whose events are lost, so only reconciling finds them
+mkdir "$TMP/w/flood"
+kill -STOP "$WATCHER"
+events=$(cat /proc/sys/fs/inotify/max_queued_events 2>/dev/null || echo 16384)
+(cd "$TMP/w/flood" && seq 1 $((events + 100)) | xargs touch)
+printf 'hello\nhello\n' > "$TMP/w/a/new.txt"
+mv "$TMP/w/b" "$TMP/w/a/moved"
+printf 'nothing\n' > "$TMP/w/a/one.txt"
+kill -CONT "$WATCHER"
+watch_expect "overflow"
+# Directories found by reconciling are watched from then on
+printf 'hello\n' > "$TMP/w/a/moved/c/four.txt"
+watch_expect "after overflow"
+exec 3>&-
+wait "$WATCHER" || fail "watch exit status"
+WATCHER=
+rm -rf "$TMP/w" "$TMP/w.in" "$TMP/w.out" "$TMP/w.err"
+
+echo "== finder serve"
+"$CC" -Wall -Wextra -o "$TMP/serve-client" "$TESTS/serve-client.c"
+mkdir -p "$TMP/srv/a"
+printf 'hello\nworld\nq.r\nqzr\n' > "$TMP/srv/a/one.txt"
+printf 'hello\nqar\nqxr\n' > "$TMP/srv/a/two.txt"
+"$FINDER" serve -j 3 "$TMP/srv" "$TMP/srv.sock" 2> "$TMP/serve.err" &
+SERVER=$!
+# The socket is bound before the tree is indexed; requests sent meanwhile
+# wait for the index
+while [ ! -S "$TMP/srv.sock" ]; do
+	sleep 0.01
+done
+request()
+{
+	printf '%s\n' "$@" | "$TMP/serve-client" "$TMP/srv.sock"
+}
+found=$(request files 'count hello' 'count \(' 'bogus' 'count hello')
+expect "serve replies" "ok 2
+ok 2 2
+error invalid pattern
+error unknown request
+ok 2 2" "$found"
+# The same text as a fixed string and as a regular expression counts apart
+found=$(request 'count q.r' 'fixed q.r' 'count q.r')
+expect "serve fixed and regex" "ok 2 4
+ok 2 1
+ok 2 4" "$found"
+# Clients served at once get the same answers
+clients=
+for i in 1 2 3 4 5 6; do
+	request 'count hello' 'count wor' 'fixed hello' > "$TMP/client$i.txt" &
+	clients="$clients $!"
+done
+wait $clients
+for i in 1 2 3 4 5 6; do
+	expect "serve client $i" "ok 2 2
+ok 2 1
+ok 2 2" "$(cat "$TMP/client$i.txt")"
+done
+# Changes are seen by the next request
+printf 'hello again\n' > "$TMP/srv/a/three.txt"
+mkdir "$TMP/srv/b"
+printf 'hello\n' > "$TMP/srv/b/four.txt"
+sleep 0.2
+expect "serve after changes" "ok 4 4" "$(request 'count hello')"
+found=$(head -c 9000 /dev/zero | tr '\0' x | "$TMP/serve-client" "$TMP/srv.sock")
+expect "serve long request" "error request too long" "$found"
+# Clients that send requests without reading the replies, one for each
+# thread, keep neither other clients nor shutdown waiting
+stalled=
+for i in 1 2 3; do
+	yes files | head -n 200000 | "$TMP/serve-client" "$TMP/srv.sock" > /dev/null 2>&1 &
+	stalled="$stalled $!"
+done
+sleep 0.5
+found=$(printf 'files\n' | timeout 5 "$TMP/serve-client" "$TMP/srv.sock")
+expect "serve beside stalled clients" "ok 4" "$found"
+# A second server on the same socket is refused
+if "$FINDER" serve "$TMP/srv" "$TMP/srv.sock" 2>/dev/null; then
+	fail "second server on a socket in use"
+fi
+kill -TERM "$SERVER"
+wait "$SERVER" || fail "serve exit status"
+SERVER=
+wait $stalled
+if [ -e "$TMP/srv.sock" ]; then
+	fail "socket left after the server stopped"
+fi
+
+echo "== libfinder"
+mkdir -p "$TMP/lib/sub"
+printf 'hello\nworld\nhello world\n' > "$TMP/lib/a.txt"
+printf 'hello\n' > "$TMP/lib/b.txt"
+printf 'nothing\n-x\n' > "$TMP/lib/sub/c.log"
+# One file that takes a thread far longer to match than a cancel takes
+mkdir "$TMP/libbig"
+yes hello | head -n 10000000 > "$TMP/libbig/big.txt"
+"$CC" -Wall -Wextra -Werror -I"$APP" -o "$TMP/libfinder-test" \
+	"$TESTS/libfinder-test.c" "$APP/libfinder.a" -pthread $FINDER_LIBS
+"$CC" -Wall -Wextra -Werror -I"$APP" -o "$TMP/libfinder-test-shared" \
+	"$TESTS/libfinder-test.c" -L"$APP" -lfinder -Wl,-rpath,"$APP" -pthread
+lib_expected="run 0
+files 3
+lines 0 3
+lines 1 2
+top 4 $TMP/lib/a.txt
+top 1 $TMP/lib/b.txt
+callback 3 3
+run 0
+files 3
+lines 0 3
+lines 1 2
+top 4 $TMP/lib/a.txt
+top 1 $TMP/lib/b.txt
+callback 3 3
+cancel 0 1 1
+fixed 3 0 1
+include 3 0 1
+max_count 0 1
+cancel reading 0 1 1
+invalid -1 0"
+expect "libfinder static" "$lib_expected" "$("$TMP/libfinder-test" "$TMP/lib" "$TMP/libbig" 2>/dev/null)"
+expect "libfinder shared" "$lib_expected" "$("$TMP/libfinder-test-shared" "$TMP/lib" "$TMP/libbig" 2>/dev/null)"
+if command -v "$CXX" > /dev/null; then
+	"$CXX" -std=c++11 -Wall -Wextra -Werror -pedantic -I"$APP" -o "$TMP/finder-hpp-test" \
+		"$TESTS/finder-hpp-test.cpp" "$APP/libfinder.a" -pthread $FINDER_LIBS
+	expect "finder.hpp" "files 3 hello 3 world 2
+callback 3 2
+top 4 $TMP/lib/a.txt
+fixed 3 0
+caught from callback after 1 calls, stopped 1
+error
+moved 3" "$("$TMP/finder-hpp-test" "$TMP/lib" 2>/dev/null)"
+else
+	echo "skipped finder.hpp, no C++ compiler"
+fi
+
+if [ "$failures" -ne 0 ]; then
+	echo "$failures failed"
+	exit 1
+fi
+echo "all passed"
@@ -0,0 +1,48 @@
+// Send standard input to a finder serve socket and print the replies.
+// Usage: serve-client <socket>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: serve-client <socket>\n");
+        return 2;
+    }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // A server that closes the connection early, as after a request too
+    // long, still has its replies read
+    char buf[65536];
+    ssize_t n;
+    bool open = true;
+    while (open && (n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        for (ssize_t off = 0; off < n;) {
+            ssize_t w = send(fd, buf + off, (size_t)(n - off), MSG_NOSIGNAL);
+            if (w < 0) {
+                open = false;
+                break;
+            }
+            off += w;
+        }
+    }
+    // The server answers everything sent before closing its end
+    shutdown(fd, SHUT_WR);
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        fwrite(buf, 1, (size_t)n, stdout);
+    close(fd);
+    // Closing with a request unread resets the connection after the replies
+    return n < 0 && errno != ECONNRESET;
+}